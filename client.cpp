@@ -12,11 +12,15 @@
 /* -- Includes ------------------------------------------------------------ */
 #include <signal.h>
 #include <unistd.h>
+#include <sys/stat.h>
 #include <iostream>
+#include <vector>
 #include "slay2.h"
 #include "slay2_linux.h"
 #include "file_xfer.h"
 #include "file_xfer_client.h"
+#include "file_xfer_event.h"
+#include "writebehind.h"
 
 
 /* -- Defines ------------------------------------------------------------- */
@@ -24,9 +28,20 @@ using namespace std;
 
 #define CTRL_CHANNEL    (5)
 #define DATA_CHANNEL    (6)
+#define SLOT_CHANNEL    (7)   //first channel of the transfer slots. each slot uses 2 channels (control + data)
+#define SLOT_COUNT      (2)   //number of additional transfer slots
+#define LIST_BATCH_SIZE (1000) //entries per batch of a listing, delivered in batches ("Ss")
+#define READ_FILE       ((FileXferClientApp::FileHandle_t)1) //handle of the (dummy) file of an upload
 
 /* -- Types --------------------------------------------------------------- */
 
+//downloaded file (its handle). the data is written behind by a writer thread
+typedef struct
+{
+   WriteBehindFile file;
+   size_t size;            //size of the file, when it was opened
+} DownloadFile;
+
 /* -- (Module) Global Variables ------------------------------------------- */
 static int ctrlC;
 
@@ -106,6 +121,24 @@ public:
    }
 
 
+   void onChangesResponse(int status, const std::string& token, bool full, const std::string& list)
+   {
+      cout << "onChangesResponse: " << statusText(status) << endl;
+      cout << "Token: " << token << (full ? " (complete listing)" : " (changes)") << endl;
+      cout << list << endl;
+      cout << endl;
+   }
+
+
+   void onFilterResponse(int status, unsigned long total, const std::string& list)
+   {
+      cout << "onFilterResponse: " << statusText(status) << endl;
+      cout << "Matching: " << total << endl;
+      cout << list << endl;
+      cout << endl;
+   }
+
+
    void onMkdirResponse(int status)
    {
       cout << "onMkdirResponse: " << statusText(status) << endl;
@@ -141,12 +174,39 @@ public:
    }
 
 
+   void onSessionResponse(int status, unsigned int chunkSize)
+   {
+      cout << "onSessionResponse: " << statusText(status) << endl;
+      cout << "Chunk size: " << chunkSize << endl;
+      cout << endl;
+   }
+
+   void onCompressionStat(const FileXferCompressStat& stat)
+   {
+      cout << "onCompressionStat: mode " << stat.mode << ", entropy " << stat.entropy << endl;
+      cout << "Bytes: " << stat.originalBytes << " -> " << stat.encodedBytes << endl;
+      cout << "Blocks: " << stat.compressedBlocks << " compressed, " << stat.storedBlocks << " stored" << endl;
+   }
+
+   void onListEntries(const std::string& current, const std::vector<FileXferStat>& entries)
+   {
+      cout << "onListEntries: " << entries.size() << " entries in " << current << endl;
+   }
+
+   void onIntegrityCheck(uint32_t crc, bool match)
+   {
+      cout << "onIntegrityCheck: CRC " << hex << crc << dec << (match ? " matches" : " MISMATCH") << endl;
+   }
+
+
 
    //file operation
+   //an upload sends the alphabet. a download is stored into a file (of the given name). the blocks of that file
+   //are lent to the client, so an uncompressed download is received in place (see getWriteBuffer)
    bool openFileForRead(const std::string& file, FileHandle_t * handle)
    {
       cout << "openFileForRead: " << file << endl;
-      *handle = (FileHandle_t)1;
+      *handle = READ_FILE;
       return true;
    }
 
@@ -154,13 +214,25 @@ public:
    bool openFileForWrite(const std::string& file, FileHandle_t * handle)
    {
       cout << "openFileForWrite: " << file << endl;
-      *handle = (FileHandle_t)2;
-      return true;
+      return openDownloadFile(file, 0, handle);
+   }
+
+
+   bool openFileForAppend(const std::string& file, FileHandle_t * handle)
+   {
+      cout << "openFileForAppend: " << file << endl;
+      struct stat fileStat;
+      return openDownloadFile(file, (stat(file.c_str(), &fileStat) == 0) ? fileStat.st_size : 0, handle);
    }
 
 
    size_t getFileSize(FileHandle_t file)
    {
+      if (file != READ_FILE)
+      {
+         cout << "getFileSize=" << ((DownloadFile *)file)->size << endl;
+         return ((DownloadFile *)file)->size;
+      }
       cout << "getFileSize=26" << endl;
       return 26;
    }
@@ -177,23 +249,113 @@ public:
    }
 
 
+   size_t readFromFileAt(FileHandle_t file, size_t offset, unsigned char * buffer, size_t bufferSize)
+   {
+      cout << "readFromFileAt: " << offset << endl;
+      return 0;
+   }
+
+
    size_t writeToFile(FileHandle_t file, const unsigned char * data, size_t length)
    {
-      char * hack = (char *)data;
-      hack[length] = 0;
-      cout << "writeToFile: " << hack << endl;
+      cout << "writeToFile: " << length << endl;
+      ((DownloadFile *)file)->file.write(data, length);
       return length;
    }
 
 
+   size_t getWriteBuffer(FileHandle_t file, unsigned char ** buffer)
+   {
+      size_t length;
+      *buffer = ((DownloadFile *)file)->file.getBuffer(&length);
+      return (*buffer != NULL) ? length : 0;
+   }
+
+
+   size_t commitWriteBuffer(FileHandle_t file, size_t length)
+   {
+      cout << "commitWriteBuffer: " << length << endl;
+      ((DownloadFile *)file)->file.commit(length);
+      return length;
+   }
+
+
+   bool createDirectory(const std::string& dir)
+   {
+      cout << "createDirectory: " << dir << endl;
+      return true;
+   }
+
+
    FileHandle_t closeFile(FileHandle_t file)
    {
       if (file != FILE_XFER_CLIENT_INVALID_FILE_HANDLE)
       {
          cout << "closeFile" << endl;
       }
+      if ((file != FILE_XFER_CLIENT_INVALID_FILE_HANDLE) && (file != READ_FILE))
+      {
+         DownloadFile * downloadFile = (DownloadFile *)file;
+         downloadFile->file.finish();
+         if (!downloadFile->file.wait())
+         {
+            cout << "closeFile: write failed" << endl;
+         }
+         downloadFile->file.close();
+         delete downloadFile;
+      }
       return FILE_XFER_CLIENT_INVALID_FILE_HANDLE;
    }
+
+
+private:
+   static bool openDownloadFile(const std::string& file, size_t offset, FileHandle_t * handle)
+   {
+      DownloadFile * downloadFile = new DownloadFile;
+      if (!downloadFile->file.open(file, WriteBehindFile::DURABILITY_NONE, offset))
+      {
+         delete downloadFile;
+         return false;
+      }
+      downloadFile->size = offset;
+      *handle = downloadFile;
+      return true;
+   }
+};
+
+
+
+//run slay2 and the client by the event loop (instead of polling them)
+class ClientEventSource : public FileXferEventSource
+{
+public:
+   ClientEventSource(Slay2Linux * slay2, FileXferClient * client) : slay2(slay2), client(client) { }
+
+   void onEvent()
+   {
+      slay2->task();
+      client->task(slay2->getTime1ms());
+   }
+
+   bool hasTxWork()
+   {
+      return client->hasTxWork();
+   }
+
+   long getWaitTime1ms()
+   {
+      const unsigned long timeout = client->getNextTimeout1ms();
+      const unsigned long now = slay2->getTime1ms();
+      if (timeout == 0)
+      {
+         return -1;
+      }
+      return (timeout >= now) ? (timeout - now + 1) : 0; //the timeout is over, one ms after
+   }
+
+private:
+   Slay2Linux * slay2;
+   FileXferClient * client;
 };
 
 
@@ -258,14 +420,43 @@ int main(int argc, char * argv[])
    DummyClient appClient;
    FileXferClient fxClient(controlChannel, dataChannel, &appClient);
 
+   //additional transfer slots (optional. a transfer is run by a slot, while fxClient is busy)
+   vector<Slay2Channel *> slotChannels;
+   vector<FileXferClient *> slotClients;
+   for (int idx = 0; idx < SLOT_COUNT; ++idx)
+   {
+      Slay2Channel * slotCtrl = slay2.open(SLOT_CHANNEL + 2 * idx);
+      Slay2Channel * slotData = slay2.open(SLOT_CHANNEL + 2 * idx + 1);
+      if ((slotCtrl == NULL) || (slotData == NULL))
+      {
+         cout << "Failed to open channels of transfer slot: " << idx << endl;
+         if (slotCtrl != NULL) slay2.close(slotCtrl);
+         if (slotData != NULL) slay2.close(slotData);
+         break;
+      }
+      slotChannels.push_back(slotCtrl);
+      slotChannels.push_back(slotData);
+      slotClients.push_back(new FileXferClient(slotCtrl, slotData, &appClient));
+      fxClient.addSlot(slotClients.back());
+   }
+
    //start application
    cout << "fx_client is using " << argv[1] << endl;
    cout << "Control-Channel: " << CTRL_CHANNEL << endl;
    cout << "Data-Channel: " << DATA_CHANNEL << endl;
-   cout << "Use CTRL+C to quit!" << endl << endl;
+   cout << "Transfer slots: " << slotClients.size() << " (channels " << SLOT_CHANNEL << " ...)" << endl;
+   cout << "Use CTRL+C to quit!" << endl;
+   cout << "Several commands may be given on one line (e.g. \"Mdir Cdir L\"). They are pipelined." << endl;
+   cout << "Transfers given on one line run in parallel (e.g. \"Dfile1 Dfile2\"), as far as there are transfer slots." << endl << endl;
+
+   //run slay2 and fxClient on input of the tty, TX work and timeouts only
+   FileXferEventLoop eventLoop;
+   ClientEventSource eventSource(&slay2, &fxClient);
+   eventLoop.add(&eventSource, argv[1]);
 
    //register signal handler, to quit program usin CTRL+C
    signal(SIGINT, &m_signal_handler);
+   ios::sync_with_stdio(false); //to see, if there is more input pending (pipelined commands)
 
    buffer[0] = 0;
    while (!ctrlC && (buffer[0] != 'X'))
@@ -304,6 +495,29 @@ int main(int argc, char * argv[])
          cout << DummyClient::errorText(status) << endl;
          break;
 
+      case FILE_XFER_CMD_CHANGES:
+         path = (const char *)&buffer[1];
+         status = fxClient.listChanges(path);
+         cout << "CHANGES " << path << endl;
+         cout << DummyClient::errorText(status) << endl;
+         break;
+
+      case FILE_XFER_CMD_FILTER:
+      {
+         //F<pattern>, or the complete filter: F<pattern>,<types>,<min-size>,<max-size>,<min-time>,<max-time>,<sort>,<offset>,<limit>
+         FileXferListFilter filter;
+         path = (const char *)&buffer[1];
+         if (!filter.parse(path))
+         {
+            filter = FileXferListFilter();
+            filter.pattern = path;
+         }
+         status = fxClient.listFiltered(filter);
+         cout << "FILTER " << filter.format() << endl;
+         cout << DummyClient::errorText(status) << endl;
+         break;
+      }
+
       case FILE_XFER_CMD_MKDIR:
          path = (const char *)&buffer[1];
          status = fxClient.makeDirectory(path);
@@ -325,6 +539,13 @@ int main(int argc, char * argv[])
          cout << DummyClient::errorText(status) << endl;
          break;
 
+      case FILE_XFER_CMD_RESUME_DOWNLOAD:
+         path = (const char *)&buffer[1];
+         status = fxClient.resumeDownload(path, path);
+         cout << "RESUME DOWNLOAD" << endl;
+         cout << DummyClient::errorText(status) << endl;
+         break;
+
       case FILE_XFER_CMD_UPLOAD:
          path = (const char *)&buffer[1];
          status = fxClient.uploadFile(path, path);
@@ -332,28 +553,91 @@ int main(int argc, char * argv[])
          cout << DummyClient::errorText(status) << endl;
          break;
 
+      case FILE_XFER_CMD_RESUME_UPLOAD:
+         path = (const char *)&buffer[1];
+         status = fxClient.resumeUpload(path, path);
+         cout << "RESUME UPLOAD" << endl;
+         cout << DummyClient::errorText(status) << endl;
+         break;
+
+      case FILE_XFER_CMD_SIGNATURES: //delta upload
+         path = (const char *)&buffer[1];
+         status = fxClient.deltaUpload(path, path);
+         cout << "DELTA UPLOAD" << endl;
+         cout << DummyClient::errorText(status) << endl;
+         break;
+
+      case FILE_XFER_CMD_DELTA_DOWNLOAD:
+         path = (const char *)&buffer[1];
+         status = fxClient.deltaDownload(path, path, string(path) + ".new");
+         cout << "DELTA DOWNLOAD" << endl;
+         cout << DummyClient::errorText(status) << endl;
+         break;
+
+      case FILE_XFER_CMD_BUNDLE_DOWNLOAD: //all files of a directory, into current directory
+         path = (const char *)&buffer[1];
+         status = fxClient.downloadBundle(path, ".");
+         cout << "BUNDLE DOWNLOAD" << endl;
+         cout << DummyClient::errorText(status) << endl;
+         break;
+
+      case FILE_XFER_CMD_BUNDLE_UPLOAD: //file into servers working directory
+         path = (const char *)&buffer[1];
+         status = fxClient.uploadBundle(vector<string>(1, path), "");
+         cout << "BUNDLE UPLOAD" << endl;
+         cout << DummyClient::errorText(status) << endl;
+         break;
+
+      case FILE_XFER_CMD_TREE_DOWNLOAD: //directory tree, into current directory
+         path = (const char *)&buffer[1];
+         status = fxClient.downloadTree(path, ".");
+         cout << "TREE DOWNLOAD" << endl;
+         cout << DummyClient::errorText(status) << endl;
+         break;
+
+      case FILE_XFER_CMD_TREE_UPLOAD: //file (relative path) into a tree of the servers working directory
+         path = (const char *)&buffer[1];
+         status = fxClient.uploadTree(".", vector<string>(1, path), "");
+         cout << "TREE UPLOAD" << endl;
+         cout << DummyClient::errorText(status) << endl;
+         break;
+
       case FILE_XFER_CMD_QUIT:
          status = fxClient.quit();
          cout << "QUIT" << endl;
          cout << DummyClient::errorText(status) << endl;
          break;
 
+      case FILE_XFER_CMD_SESSION:
+         status = fxClient.setupSession(true, strchr(&buffer[1], 'b') != NULL); //"Sb" requests binary listings
+         fxClient.setListBatchSize((strchr(&buffer[1], 's') != NULL) ? LIST_BATCH_SIZE : 0); //"Ss" delivers listings in batches
+         cout << "SESSION" << endl;
+         cout << DummyClient::errorText(status) << endl;
+         break;
+
       default:
          break;
       }
 
 
-      //run app
-      while (!fxClient.isIdle())
+      //run app. further commands given on the same input line are pipelined (sent without waiting for
+      //the response of the previous ones), as long as the clients in-flight window isn't full
+      while (!fxClient.isIdle() &&
+             ((cin.rdbuf()->in_avail() <= 1) || (fxClient.getPendingRequests() >= FILE_XFER_CLIENT_PIPELINE_DEPTH)))
       {
-         slay2.task();
-         fxClient.task(slay2.getTime1ms());
-         usleep(300); //5 chars @ 115200 bps takes about 300us
+         eventLoop.run(); //waits for input of the tty or a timer (TX work, timeouts)
       }
-      usleep(300); //5 chars @ 115200 bps takes about 300us
    }
 
    //shut down application
+   for (size_t idx = 0; idx < slotClients.size(); ++idx)
+   {
+      delete slotClients[idx];
+   }
+   for (size_t idx = 0; idx < slotChannels.size(); ++idx)
+   {
+      slay2.close(slotChannels[idx]);
+   }
    slay2.close(dataChannel);
    slay2.close(controlChannel);
    slay2.shutdown();
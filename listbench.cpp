@@ -0,0 +1,214 @@
+//-----------------------------------------------------------------------------
+/*!
+   \file
+   \brief Benchmark of the directory listing engine
+
+   Creates a synthetic directory with many files (and some sub-directories), then
+   formats its listing with the listing engine (FileXferListing) and with the
+   former per-entry approach (readdir, stat of the full path, tzset and localtime
+   per entry). The listing data isn't sent, so only the server side is measured. The text listing
+   of the engine is compared with the one of the former approach (byte by byte). The size of the
+   binary listing format is reported as well, and the time the client takes to parse the text
+   listing into entries (frame by frame, in batches).
+
+   Usage: ./fx_listbench [<file-count> [<directory>]]
+*/
+//-----------------------------------------------------------------------------
+
+/* -- Includes ------------------------------------------------------------ */
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "file_xfer_list.h"
+
+
+/* -- Defines ------------------------------------------------------------- */
+using namespace std;
+
+#define DEFAULT_FILE_COUNT    (50000)
+#define DEFAULT_DIRECTORY     "/tmp/fx_listbench"
+#define FRAME_SIZE            (1024)   //listing is formatted frame by frame
+#define RUNS                  (3)
+#define BATCH_SIZE            (1000)   //entries per batch, the client parses
+
+/* -- Types --------------------------------------------------------------- */
+
+/* -- (Module) Global Variables ------------------------------------------- */
+
+/* -- Module Global Function Prototypes ----------------------------------- */
+
+/* -- Implementation ------------------------------------------------------ */
+
+static double getTime()
+{
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return ts.tv_sec + (ts.tv_nsec / 1e9);
+}
+
+
+//create the synthetic directory (if it doesn't have the requested number of files yet)
+static bool createDirectory(const string& dir, unsigned int count)
+{
+   mkdir(dir.c_str(), 0777);
+   for (unsigned int idx = 0; idx < count; ++idx)
+   {
+      char name[64];
+      snprintf(name, sizeof(name), "%s/file_%07u.log", dir.c_str(), idx);
+      if (access(name, F_OK) == 0) //created by a previous run
+      {
+         continue;
+      }
+      const int fd = open(name, O_WRONLY | O_CREAT, 0666);
+      if (fd < 0)
+      {
+         return false;
+      }
+      const bool ok = (ftruncate(fd, idx % 4096) == 0); //various sizes
+      close(fd);
+      if (!ok)
+      {
+         return false;
+      }
+   }
+   for (unsigned int idx = 0; idx < (count / 100); ++idx)
+   {
+      char name[64];
+      snprintf(name, sizeof(name), "%s/dir_%05u", dir.c_str(), idx);
+      mkdir(name, 0777);
+   }
+   return true;
+}
+
+
+//former approach (as a reference). the listing is collected in "output"
+static void listPerEntry(const string& dir, vector<unsigned char>& output)
+{
+   DIR * directory = opendir(dir.c_str());
+   struct dirent * ent;
+   while ((directory != NULL) && ((ent = readdir(directory)) != NULL))
+   {
+      char entry[512];
+      int len = 0;
+      if ((ent->d_type == DT_DIR) && (strcmp(ent->d_name, ".") != 0))
+      {
+         len = snprintf(entry, sizeof(entry), "d,%s,,\n", ent->d_name);
+      }
+      else if (ent->d_type == DT_REG)
+      {
+         struct stat fileStat;
+         struct tm t;
+         char date[32] = "";
+         const string fileName = dir + "/" + ent->d_name;
+         const int fileStatErr = stat(fileName.c_str(), &fileStat);
+         tzset();
+         if ((fileStatErr == 0) && (localtime_r(&fileStat.st_mtim.tv_sec, &t) != NULL))
+         {
+            strftime(date, sizeof(date), "%F %T", &t);
+         }
+         len = snprintf(entry, sizeof(entry), "f,%s,%d,%s\n", ent->d_name, (int)fileStat.st_size, date);
+      }
+      output.insert(output.end(), entry, entry + len);
+   }
+   if (directory != NULL)
+   {
+      closedir(directory);
+   }
+}
+
+
+//listing engine. the listing is collected in "output", frame by frame
+static void listEngine(const string& dir, bool binary, vector<unsigned char>& output)
+{
+   FileXferListing listing;
+   bool more = listing.open(dir, binary);
+   while (more)
+   {
+      more = listing.read(output, output.size() + FRAME_SIZE);
+   }
+}
+
+
+//listing engine, text listing parsed by the client
+static size_t parseText(const string& dir)
+{
+   size_t total = 0;
+   FileXferListing listing;
+   FileXferListReader reader;
+   vector<unsigned char> frame;
+   FileXferListing::addCurrent(frame, dir, false);
+   bool more = listing.open(dir, false);
+   while (more)
+   {
+      more = listing.read(frame, FRAME_SIZE);
+      if (!more)
+      {
+         frame.push_back(0); //end of listing
+      }
+      reader.feedText(frame.data(), frame.size());
+      frame.clear();
+      if (!more || (reader.entries.size() >= BATCH_SIZE))
+      {
+         total += reader.entries.size();
+         reader.entries.clear();
+      }
+   }
+   return total;
+}
+
+
+int main(int argc, char * argv[])
+{
+   const unsigned int count = (argc > 1) ? strtoul(argv[1], NULL, 10) : DEFAULT_FILE_COUNT;
+   const string dir = (argc > 2) ? argv[2] : DEFAULT_DIRECTORY;
+
+   cout << "Creating " << count << " files in " << dir << " ..." << endl;
+   if (!createDirectory(dir, count))
+   {
+      cout << "Failed to create files!" << endl;
+      return -1;
+   }
+
+   int result = 0;
+   for (int run = 0; run < RUNS; ++run)
+   {
+      vector<unsigned char> perEntryOutput;
+      vector<unsigned char> engineOutput;
+      vector<unsigned char> binaryOutput;
+      perEntryOutput.reserve(count * 64); //so the time of growing the buffers doesn't differ much
+      engineOutput.reserve(count * 64);
+      binaryOutput.reserve(count * 64);
+      double start = getTime();
+      listPerEntry(dir, perEntryOutput);
+      const double perEntryTime = getTime() - start;
+      start = getTime();
+      listEngine(dir, false, engineOutput);
+      const double engineTime = getTime() - start;
+      start = getTime();
+      listEngine(dir, true, binaryOutput);
+      const double binaryTime = getTime() - start;
+      start = getTime();
+      const size_t parsedEntries = parseText(dir);
+      const double parseTime = getTime() - start;
+      const bool identical = (engineOutput.size() == perEntryOutput.size()) &&
+                             (memcmp(engineOutput.data(), perEntryOutput.data(), engineOutput.size()) == 0);
+      cout << "per entry: " << (perEntryTime * 1000) << " ms (" << perEntryOutput.size() << " bytes), engine: "
+           << (engineTime * 1000) << " ms (" << engineOutput.size() << " bytes, " << (identical ? "identical" : "DIFFERENT")
+           << "), speedup: " << (perEntryTime / engineTime)
+           << ", binary: " << (binaryTime * 1000) << " ms (" << binaryOutput.size() << " bytes)"
+           << ", engine + client parse: " << (parseTime * 1000) << " ms (" << parsedEntries << " entries)" << endl;
+      if (!identical)
+      {
+         result = -1;
+      }
+   }
+   return result;
+}
@@ -11,19 +11,17 @@
 
 /* -- Includes ------------------------------------------------------------ */
 #include <signal.h>
-#include <unistd.h>
 #include <iostream>
-#include "slay2.h"
-#include "slay2_linux.h"
+#include <string>
 #include "file_xfer.h"
-#include "file_xfer_server.h"
+#include "file_xfer_host.h"
 
 
 /* -- Defines ------------------------------------------------------------- */
 using namespace std;
 
-#define CTRL_CHANNEL    (5)
-#define DATA_CHANNEL    (6)
+#define SLOT_COUNT      (2)   //number of additional transfer slots per port
+#define DEFAULT_ROOT    "/home/"
 
 /* -- Types --------------------------------------------------------------- */
 
@@ -42,65 +40,45 @@ void m_signal_handler(int a)
 
 int main(int argc, char * argv[])
 {
-   Slay2Linux slay2;    //serial layer 2 protocol driver
+   FileXferServerHost host; //serves all ports from this process
 
    if (argc < 2)
    {
       cout << "Missing argument!" << endl;
-      cout << "Usage: ./fx_server <tty-dev>" << endl;
+      cout << "Usage: ./fx_server <tty-dev>[:<root-dir>] [<tty-dev>[:<root-dir>] ...]" << endl;
       return -1;
    }
 
-   //init communiction driver
-   bool stat = slay2.init(argv[1], 115200);
-   if (stat == false)
+   //init a session per port. each with its own root directory (default: DEFAULT_ROOT)
+   for (int idx = 1; idx < argc; ++idx)
    {
-      cout << "Failed to open tty: " << argv[1] << endl;
-      return -2;
+      string arg(argv[idx]);
+      const size_t colon = arg.find(':');
+      const string ttyDev = arg.substr(0, colon);
+      const string root = (colon != string::npos) ? arg.substr(colon + 1) : DEFAULT_ROOT;
+      if (!host.addPort(ttyDev.c_str(), 115200, root.c_str(), SLOT_COUNT))
+      {
+         return -2;
+      }
    }
-
-   //open control channel
-   Slay2Channel * controlChannel = slay2.open(CTRL_CHANNEL);
-   if (controlChannel == NULL)
-   {
-      cout << "Failed to open control channel: " << CTRL_CHANNEL << endl;
-      slay2.shutdown();
-      return -3;
-   }
-
-   //open control channel
-   Slay2Channel * dataChannel = slay2.open(DATA_CHANNEL);
-   if (dataChannel == NULL)
-   {
-      cout << "Failed to open data channel: " << DATA_CHANNEL << endl;
-      slay2.close(controlChannel);
-      slay2.shutdown();
-      return -4;
-   }
-
-   //fxServer
-   FileXferServer fxServer(controlChannel, dataChannel, "/home/");
+   host.setDurability(WriteBehindFile::DURABILITY_FSYNC_AT_END); //acknowledge uploads, when they are on disk
 
    //start application
-   cout << "fx_server is using " << argv[1] << endl;
-   cout << "Control-Channel: " << CTRL_CHANNEL << endl;
-   cout << "Data-Channel: " << DATA_CHANNEL << endl;
+   cout << "fx_server is serving " << host.getPortCount() << " port(s)" << endl;
+   cout << "Control-Channel: " << FILE_XFER_HOST_CTRL_CHANNEL << endl;
+   cout << "Data-Channel: " << FILE_XFER_HOST_DATA_CHANNEL << endl;
+   cout << "Transfer slots: " << SLOT_COUNT << " (channels " << FILE_XFER_HOST_SLOT_CHANNEL << " ...)" << endl;
    cout << "Use CTRL+C to quit!" << endl << endl;
 
    //register signal handler, to quit program usin CTRL+C
    signal(SIGINT, &m_signal_handler);
 
-   //enter super-loop
+   //enter super-loop. the host sleeps, until there is something to do
    while (!ctrlC)
    {
-      slay2.task();
-      fxServer.task();
-      usleep(300); //5 chars @ 115200 bps takes about 300us
+      host.task();
    }
 
-   //shut down application
-   slay2.close(dataChannel);
-   slay2.close(controlChannel);
-   slay2.shutdown();
+   //shut down application (done by destructor of host)
    return 0;
 }
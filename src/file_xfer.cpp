@@ -17,4 +17,130 @@
 
 /* -- Module Global Function Prototypes ----------------------------------- */
 
-/* -- Implementation ------------------------------------------------------ */
\ No newline at end of file
+/* -- Implementation ------------------------------------------------------ */
+
+
+FileXferChunkPolicy::FileXferChunkPolicy()
+{
+   channel = NULL;
+   limit = FILE_XFER_CHUNK_SIZE_MIN;
+   chunkSize = FILE_XFER_CHUNK_SIZE_MIN;
+   sent = 0;
+   sampleTime1ms = 0;
+   sampleDrained = 0;
+   rate = 0;
+}
+
+
+void FileXferChunkPolicy::setLimit(unsigned int limit)
+{
+   if (limit < FILE_XFER_CHUNK_SIZE_MIN)
+   {
+      limit = FILE_XFER_CHUNK_SIZE_MIN;
+   }
+   if (limit > FILE_XFER_CHUNK_SIZE_MAX)
+   {
+      limit = FILE_XFER_CHUNK_SIZE_MAX;
+   }
+   this->limit = limit;
+}
+
+
+unsigned int FileXferChunkPolicy::getLimit() const
+{
+   return limit;
+}
+
+
+//the measured link rate is kept from transfer to transfer. the link doesn't change that much...
+void FileXferChunkPolicy::start(Slay2Channel * channel, unsigned long time1ms)
+{
+   this->channel = channel;
+   sent = channel->getTxBufferSize() - channel->getTxBufferSpace(); //count what is still pending as "sent"
+   sampleTime1ms = time1ms;
+   sampleDrained = 0;
+}
+
+
+unsigned int FileXferChunkPolicy::getChunkSize(unsigned long time1ms)
+{
+   const unsigned int bufferSize = channel->getTxBufferSize();
+   const unsigned int pending = bufferSize - channel->getTxBufferSpace();
+   const unsigned long drained = (sent > pending) ? (sent - pending) : 0;
+
+   //measure link rate. a sample is only valid, if the link was busy all the time (there are still pending bytes)
+   const unsigned long elapsed = time1ms - sampleTime1ms;
+   if (elapsed >= 100)
+   {
+      if ((pending > 0) && (drained > sampleDrained))
+      {
+         const unsigned long sample = ((drained - sampleDrained) * 1000) / elapsed;
+         rate = (rate == 0) ? sample : ((3 * rate + sample) / 4); //smooth it a little bit
+      }
+      sampleTime1ms = time1ms;
+      sampleDrained = drained;
+   }
+
+   //scale chunk size according to link rate
+   unsigned long size = FILE_XFER_CHUNK_SIZE_MIN;
+   if (rate > 0)
+   {
+      size = (rate * FILE_XFER_CHUNK_TIME_MS) / 1000;
+   }
+   //there shall be space for at least 4 chunks in TX buffer. so link never runs dry, while the next chunk is prepared
+   if (size > (bufferSize / 4))
+   {
+      size = bufferSize / 4;
+   }
+   if (size > limit)
+   {
+      size = limit;
+   }
+   if (size < FILE_XFER_CHUNK_SIZE_MIN)
+   {
+      size = FILE_XFER_CHUNK_SIZE_MIN;
+   }
+   chunkSize = size;
+   return chunkSize;
+}
+
+
+void FileXferChunkPolicy::onSent(unsigned int count)
+{
+   sent += count;
+}
+
+
+
+
+//encode value into buffer. buffer must provide FILE_XFER_VARINT_MAX_LEN bytes.
+//returns the number of bytes used.
+unsigned int fileXferEncodeVarint(unsigned char * buffer, unsigned long long value)
+{
+   unsigned int len = 0;
+   while (value >= 0x80)
+   {
+      buffer[len++] = (unsigned char)(value | 0x80);
+      value >>= 7;
+   }
+   buffer[len++] = (unsigned char)value;
+   return len;
+}
+
+
+//decode value from data. returns the number of bytes consumed, or 0 if data doesn't contain a complete value.
+unsigned int fileXferDecodeVarint(const unsigned char * data, unsigned int len, unsigned long long * value)
+{
+   unsigned long long result = 0;
+   unsigned int idx;
+   for (idx = 0; (idx < len) && (idx < FILE_XFER_VARINT_MAX_LEN); ++idx)
+   {
+      result |= (unsigned long long)(data[idx] & 0x7F) << (7 * idx);
+      if ((data[idx] & 0x80) == 0)
+      {
+         *value = result;
+         return idx + 1;
+      }
+   }
+   return 0;
+}
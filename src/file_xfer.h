@@ -9,6 +9,7 @@
 
 /* -- Includes ------------------------------------------------------------ */
 #include <string>
+#include "slay2.h"
 
 
 /* -- Defines ------------------------------------------------------------- */
@@ -22,21 +23,76 @@
 #define FILE_XFER_CMD_UPLOAD     ((unsigned char)'U') //client sends, server receive
 #define FILE_XFER_CMD_DOWNLOAD   ((unsigned char)'D') //client receive, server sends
 #define FILE_XFER_CMD_QUIT       ((unsigned char)'Q')
+#define FILE_XFER_CMD_SESSION    ((unsigned char)'S') //negotiate session parameters (like the data chunk size)
+#define FILE_XFER_CMD_RESUME_DOWNLOAD ((unsigned char)'G') //download file, starting at a given offset
+#define FILE_XFER_CMD_SIZE       ((unsigned char)'Z') //query size of a file (e.g. the part of a file stored by an interrupted upload)
+#define FILE_XFER_CMD_RESUME_UPLOAD ((unsigned char)'A') //upload (append) tail of a file, starting at a given offset
+#define FILE_XFER_CMD_SIGNATURES ((unsigned char)'K') //get block signatures of a file (basis of a delta upload)
+#define FILE_XFER_CMD_DELTA_UPLOAD ((unsigned char)'Y') //upload a delta, to be applied to a file on the server
+#define FILE_XFER_CMD_DELTA_DOWNLOAD ((unsigned char)'X') //download a delta of a file, against block signatures sent by the client
+#define FILE_XFER_CMD_BUNDLE_DOWNLOAD ((unsigned char)'B') //download all files of a directory, as one bundle
+#define FILE_XFER_CMD_BUNDLE_UPLOAD ((unsigned char)'P') //upload a bundle of files into a directory
+#define FILE_XFER_CMD_TREE_DOWNLOAD ((unsigned char)'T') //download a directory tree (recursively), as one bundle
+#define FILE_XFER_CMD_TREE_UPLOAD ((unsigned char)'V') //upload a bundle of a directory tree, into a directory
+#define FILE_XFER_CMD_CHANGES    ((unsigned char)'H') //list changes of the current directory, since a change token
+#define FILE_XFER_CMD_FILTER     ((unsigned char)'F') //list the current directory filtered, sorted and paginated
 //command responses
 #define FILE_XFER_CMD_ACK        ((unsigned char)'a')
 #define FILE_XFER_CMD_NACK       ((unsigned char)'n')
+#define FILE_XFER_CMD_ERROR      ((unsigned char)'e') //unsolicited: the data-transfer of a download failed (e.g. read error)
 
+//size of data chunks (file data) sent on data channel
+#define FILE_XFER_CHUNK_SIZE_MIN       (256)    //default, if no session was negotiated
+#ifndef FILE_XFER_CHUNK_SIZE_MAX
+#define FILE_XFER_CHUNK_SIZE_MAX       (2048)   //upper limit. must not exceed the payload of a slay2 frame!
+#endif
+#define FILE_XFER_CHUNK_TIME_MS        (50)     //a chunk shall occupy the link for about that time
 
-/* -- Types --------------------------------------------------------------- */
+//optional features, negotiated within the session (bit mask)
+#define FILE_XFER_FEATURE_COMPRESSION  (0x01)   //compression of file and listing data on data channel (see file_xfer_compress.h)
+#define FILE_XFER_FEATURE_BINARY_LISTING (0x02) //directory listings in binary format (see file_xfer_list.h)
+#define FILE_XFER_FEATURE_INTEGRITY    (0x04)   //CRC-32C of the data of up- and downloads, exchanged on completion
+#define FILE_XFER_FEATURES             (FILE_XFER_FEATURE_COMPRESSION | FILE_XFER_FEATURE_BINARY_LISTING | \
+                                        FILE_XFER_FEATURE_INTEGRITY) //features implemented
 
 
+/* -- Types --------------------------------------------------------------- */
 
+
+//policy to determine the size of the data chunks sent on data channel.
+//the chunk size is limited by the (negotiated) session limit and the capacity of the channels TX buffer.
+//within that limits, the chunk size is scaled according to the measured link rate (the rate the TX buffer
+//is drained), so a chunk occupies the link for about FILE_XFER_CHUNK_TIME_MS.
+class FileXferChunkPolicy
+{
+public:
+   FileXferChunkPolicy();
+   void setLimit(unsigned int limit); //limit agreed within the session
+   unsigned int getLimit() const;
+   void start(Slay2Channel * channel, unsigned long time1ms); //to be called at the start of a transfer
+   unsigned int getChunkSize(unsigned long time1ms); //chunk size to be used for the next chunk
+   void onSent(unsigned int count); //must be called for each chunk sent
+
+private:
+   Slay2Channel * channel;
+   unsigned int limit;
+   unsigned int chunkSize;
+   unsigned long sent;           //bytes put into TX buffer (since start)
+   unsigned long sampleTime1ms;  //start of current measurement
+   unsigned long sampleDrained;  //bytes drained at start of current measurement
+   unsigned long rate;           //measured link rate, in bytes per second (0 = unknown)
+};
+
+
+
+//entry of a directory listing
 typedef struct
 {
-   //file-name
-   //file-path
-   //file-size
-   //file-date
+   unsigned char type;        //'d' directory, 'f' file, 'r' removed (listing of changes only)
+   std::string name;
+   unsigned long long size;   //size of file, in bytes
+   unsigned long long mtime;  //modification time of file, in seconds since epoch (0 = unknown)
+   unsigned long mtimeNsec;   //nanoseconds of that time. not transferred by a listing (0 = unknown)
 } FileXferStat;
 
 
@@ -46,6 +102,10 @@ typedef struct
 /* -- Global Variables ---------------------------------------------------- */
 
 /* -- Function Prototypes ------------------------------------------------- */
+//variable length encoding of unsigned integers (7 bits per byte, LSB first, MSB of each byte set if more bytes follow)
+#define FILE_XFER_VARINT_MAX_LEN    (10) //max. number of bytes of an encoded 64-bit value
+unsigned int fileXferEncodeVarint(unsigned char * buffer, unsigned long long value);
+unsigned int fileXferDecodeVarint(const unsigned char * data, unsigned int len, unsigned long long * value); //0, if incomplete
 
 /* -- Implementation ------------------------------------------------------ */
 
@@ -0,0 +1,293 @@
+//-----------------------------------------------------------------------------
+/*!
+   \file
+   \brief File transfer bundles (many files in one transfer)
+*/
+//-----------------------------------------------------------------------------
+
+/* -- Includes ------------------------------------------------------------ */
+#include "file_xfer_bundle.h"
+#include "file_xfer.h"
+
+
+/* -- Defines ------------------------------------------------------------- */
+using namespace std;
+
+
+/* -- Types --------------------------------------------------------------- */
+
+/* -- (Module) Global Variables ------------------------------------------- */
+
+/* -- Module Global Function Prototypes ----------------------------------- */
+static void putVarint(vector<unsigned char>& out, unsigned long long value);
+
+
+/* -- Implementation ------------------------------------------------------ */
+
+
+FileXferBundleWriter::FileXferBundleWriter()
+{
+   reset();
+}
+
+
+void FileXferBundleWriter::reset()
+{
+   output.clear();
+   count = 0;
+}
+
+
+void FileXferBundleWriter::addFile(const string& name, unsigned long long size, unsigned long long mtime)
+{
+   output.push_back(FILE_XFER_BUNDLE_FILE);
+   putVarint(output, size);
+   putVarint(output, mtime);
+   putVarint(output, name.length());
+   output.insert(output.end(), name.begin(), name.end());
+   ++count;
+}
+
+
+void FileXferBundleWriter::addDirectory(const string& name)
+{
+   output.push_back(FILE_XFER_BUNDLE_DIRECTORY);
+   putVarint(output, name.length());
+   output.insert(output.end(), name.begin(), name.end());
+}
+
+
+void FileXferBundleWriter::finish()
+{
+   output.push_back(FILE_XFER_BUNDLE_END);
+   putVarint(output, count);
+}
+
+
+//a name must refer to a file within the directory of the bundle
+bool FileXferBundleWriter::isValidName(const string& name)
+{
+   return !name.empty() && (name.length() <= FILE_XFER_BUNDLE_NAME_MAX) &&
+          (name.find('/') == string::npos) && (name != ".") && (name != "..");
+}
+
+
+//a path must refer to a file or directory within the root of the tree. each component must be a valid name
+bool FileXferBundleWriter::isValidPath(const string& name)
+{
+   if (name.length() > FILE_XFER_BUNDLE_NAME_MAX)
+   {
+      return false;
+   }
+   size_t start = 0;
+   while (true)
+   {
+      const size_t slash = name.find('/', start);
+      if (!isValidName(name.substr(start, (slash == string::npos) ? string::npos : (slash - start))))
+      {
+         return false;
+      }
+      if (slash == string::npos)
+      {
+         return true;
+      }
+      start = slash + 1;
+   }
+}
+
+
+
+
+FileXferBundleReader::FileXferBundleReader()
+{
+   reset(NULL);
+}
+
+
+void FileXferBundleReader::reset(FileXferBundleTarget * target, bool tree)
+{
+   this->target = target;
+   this->tree = tree;
+   directory = false;
+   header.clear();
+   name.clear();
+   nameLength = 0;
+   fileSize = 0;
+   fileTime = 0;
+   dataRemaining = 0;
+   skipping = false;
+   count = 0;
+   result = 0;
+   filePending = false;
+   held.clear();
+}
+
+
+int FileXferBundleReader::feed(const unsigned char * data, size_t len)
+{
+   if (filePending) //paused: hold the data
+   {
+      held.insert(held.end(), data, data + len);
+      return result;
+   }
+   size_t idx = 0;
+   while ((idx < len) && (result == 0))
+   {
+      //file data
+      if (dataRemaining > 0)
+      {
+         size_t n = len - idx;
+         if (n > dataRemaining)
+         {
+            n = dataRemaining;
+         }
+         if (!skipping)
+         {
+            target->writeFile(&data[idx], n);
+         }
+         dataRemaining -= n;
+         idx += n;
+         if ((dataRemaining == 0) && !skipping)
+         {
+            target->endFile();
+         }
+         continue;
+      }
+
+      //file name
+      if (name.length() < nameLength)
+      {
+         size_t n = len - idx;
+         if (n > (nameLength - name.length()))
+         {
+            n = nameLength - name.length();
+         }
+         name.append((const char *)&data[idx], n);
+         idx += n;
+         if (name.length() == nameLength) //header complete
+         {
+            nameLength = 0;
+            if (tree ? !FileXferBundleWriter::isValidPath(name) : !FileXferBundleWriter::isValidName(name))
+            {
+               result = -1;
+               break;
+            }
+            if (directory)
+            {
+               target->createDirectory(name);
+               continue;
+            }
+            filePending = true;
+            if (!beginFile()) //pause. hold the rest of the data
+            {
+               held.assign(data + idx, data + len);
+               break;
+            }
+         }
+         continue;
+      }
+
+      //collect record header. check if it is complete
+      header.push_back(data[idx++]);
+      const unsigned char * arg = header.data() + 1;
+      const unsigned int argLen = header.size() - 1;
+      switch (header[0])
+      {
+         case FILE_XFER_BUNDLE_FILE:
+         {
+            unsigned int sizeLen = fileXferDecodeVarint(arg, argLen, &fileSize);
+            unsigned int timeLen = (sizeLen != 0) ? fileXferDecodeVarint(arg + sizeLen, argLen - sizeLen, &fileTime) : 0;
+            if ((timeLen != 0) && (fileXferDecodeVarint(arg + sizeLen + timeLen, argLen - sizeLen - timeLen, &nameLength) != 0))
+            {
+               if ((nameLength == 0) || (nameLength > FILE_XFER_BUNDLE_NAME_MAX))
+               {
+                  result = -1; //invalid name
+               }
+               name.clear();
+               header.clear();
+               directory = false;
+            }
+            break;
+         }
+
+         case FILE_XFER_BUNDLE_DIRECTORY:
+         {
+            if (!tree)
+            {
+               result = -1; //directories are not allowed
+            }
+            else if (fileXferDecodeVarint(arg, argLen, &nameLength) != 0)
+            {
+               if ((nameLength == 0) || (nameLength > FILE_XFER_BUNDLE_NAME_MAX))
+               {
+                  result = -1; //invalid name
+               }
+               name.clear();
+               header.clear();
+               directory = true;
+            }
+            break;
+         }
+
+         case FILE_XFER_BUNDLE_END:
+         {
+            unsigned long long value;
+            if (fileXferDecodeVarint(arg, argLen, &value) != 0)
+            {
+               result = (value == count) ? 1 : -1;
+            }
+            break;
+         }
+
+         default:
+         {
+            result = -1; //unknown record
+            break;
+         }
+      }
+      if (header.size() > (1 + 3 * FILE_XFER_VARINT_MAX_LEN))
+      {
+         result = -1; //invalid header
+      }
+   }
+   return result;
+}
+
+
+int FileXferBundleReader::resume()
+{
+   if (!filePending || !beginFile())
+   {
+      return result;
+   }
+   vector<unsigned char> data;
+   data.swap(held);
+   return data.empty() ? result : feed(data.data(), data.size());
+}
+
+
+bool FileXferBundleReader::beginFile()
+{
+   if (!target->canBeginFile())
+   {
+      return false;
+   }
+   filePending = false;
+   ++count;
+   skipping = !target->beginFile(name, fileSize, fileTime);
+   dataRemaining = fileSize;
+   if ((dataRemaining == 0) && !skipping) //empty file
+   {
+      target->endFile();
+   }
+   return true;
+}
+
+
+
+
+static void putVarint(vector<unsigned char>& out, unsigned long long value)
+{
+   unsigned char buffer[FILE_XFER_VARINT_MAX_LEN];
+   out.insert(out.end(), buffer, buffer + fileXferEncodeVarint(buffer, value));
+}
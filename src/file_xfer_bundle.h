@@ -0,0 +1,115 @@
+//---------------------------------------------------------------------------------------------------------------------
+/*!
+   \file
+   \brief File transfer bundles (many files in one transfer)
+
+   A bundle is a stream of files, sent back-to-back on the data channel within one command. Each file is
+   preceded by a compact header. So there is no round trip per file.
+
+   Bundle stream (a sequence of records):
+   'F' <size:varint> <mtime:varint> <name-len:varint> <name...> <data...>   file of <size> bytes
+   'D' <name-len:varint> <name...>                                        directory (tree bundles only)
+   'E' <count:varint>                                                     end of bundle. number of files in the bundle
+
+   <mtime> is the modification time of the file, in seconds since epoch (0 = unknown).
+   <name> is the name of the file (without path). It must not contain a '/'.
+
+   A tree bundle holds a whole directory tree. There <name> is the path of the file or directory, relative to
+   the root of the tree ('/' separated). It must not be absolute, nor contain empty, '.' or '..' components.
+   So the tree can't escape its root. A directory record precedes the records of its content.
+*/
+//---------------------------------------------------------------------------------------------------------------------
+#ifndef FILE_XFER_BUNDLE_H
+#define FILE_XFER_BUNDLE_H
+
+/* -- Includes ------------------------------------------------------------ */
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+
+/* -- Defines ------------------------------------------------------------- */
+#define FILE_XFER_BUNDLE_NAME_MAX         (1024)         //max. length of a file name (or path) within a bundle
+
+#define FILE_XFER_BUNDLE_FILE             ((unsigned char)'F')
+#define FILE_XFER_BUNDLE_DIRECTORY        ((unsigned char)'D')
+#define FILE_XFER_BUNDLE_END              ((unsigned char)'E')
+
+
+/* -- Types --------------------------------------------------------------- */
+
+//build the records of a bundle. the records are appended to "output".
+//the data of a file must be sent by the caller, right after the header of that file.
+class FileXferBundleWriter
+{
+public:
+   FileXferBundleWriter();
+   void reset();
+   void addFile(const std::string& name, unsigned long long size, unsigned long long mtime); //append file header
+   void addDirectory(const std::string& name); //append directory record (tree bundles only)
+   void finish(); //append end record
+   static bool isValidName(const std::string& name);
+   static bool isValidPath(const std::string& name); //name within a tree bundle
+
+   std::vector<unsigned char> output;
+
+private:
+   unsigned long count;
+};
+
+
+
+//interface to store the files of a bundle
+class FileXferBundleTarget
+{
+public:
+   virtual ~FileXferBundleTarget() { }
+   virtual bool beginFile(const std::string& name, unsigned long long size, unsigned long long mtime) = 0; //false, to skip the file
+   virtual void writeFile(const unsigned char * data, size_t len) = 0;
+   virtual void endFile() = 0; //only called for files, that weren't skipped
+   virtual void createDirectory(const std::string& name) = 0; //tree bundles only
+   virtual bool canBeginFile() { return true; } //false, to pause the bundle before the next file (see resume)
+};
+
+
+//read a bundle. the bundle can be feed in pieces of any size. while the reader is paused by its target, the data fed
+//is held, until the reader is resumed.
+class FileXferBundleReader
+{
+public:
+   FileXferBundleReader();
+   void reset(FileXferBundleTarget * target, bool tree = false);
+   int feed(const unsigned char * data, size_t len); //returns 0 if more data is expected, 1 when done, -1 on error
+   int resume(); //begin the pending file (if the target is ready now) and continue with the held data. returns as feed
+   bool isPaused() const { return filePending; }
+
+private:
+   bool beginFile(); //false, if the target isn't ready for the next file
+
+   FileXferBundleTarget * target;
+   bool tree;                         //tree bundle (directories and paths)
+   bool directory;                    //current record is a directory
+   std::vector<unsigned char> header; //incomplete record header
+   std::string name;
+   unsigned long long nameLength;
+   unsigned long long fileSize;
+   unsigned long long fileTime;
+   unsigned long long dataRemaining;
+   bool skipping;                     //data of the current file is dropped
+   unsigned long count;               //number of files read
+   int result;
+   bool filePending;                  //header of the next file is read, but the target wasn't ready for it
+   std::vector<unsigned char> held;   //data fed while paused
+};
+
+
+
+/* -- Global Variables ---------------------------------------------------- */
+
+/* -- Function Prototypes ------------------------------------------------- */
+
+/* -- Implementation ------------------------------------------------------ */
+
+
+
+#endif
@@ -0,0 +1,247 @@
+//-----------------------------------------------------------------------------
+/*!
+   \file
+   \brief Cache of directory listings (linux)
+*/
+//-----------------------------------------------------------------------------
+
+/* -- Includes ------------------------------------------------------------ */
+#include <errno.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include "file_xfer_cache.h"
+
+
+/* -- Defines ------------------------------------------------------------- */
+using namespace std;
+
+//changes of a directory, that change its listing. a symbolic link isn't followed (its target may change)
+#define WATCH_MASK   (IN_CREATE | IN_DELETE | IN_MODIFY | IN_ATTRIB | IN_MOVED_FROM | IN_MOVED_TO | \
+                      IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR | IN_DONT_FOLLOW)
+
+
+/* -- Types --------------------------------------------------------------- */
+
+/* -- (Module) Global Variables ------------------------------------------- */
+
+/* -- Module Global Function Prototypes ----------------------------------- */
+
+
+/* -- Implementation ------------------------------------------------------ */
+
+
+FileXferListCache::FileXferListCache(size_t capacity)
+{
+   fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC); //without inotify, nothing is cached
+   this->capacity = capacity;
+   size = 0;
+   counter = 0;
+}
+
+
+FileXferListCache::~FileXferListCache()
+{
+   if (fd >= 0)
+   {
+      close(fd); //removes all watches
+   }
+}
+
+
+FileXferListCache::Listing FileXferListCache::find(const string& dir, bool binary)
+{
+   update();
+   EntryMap::iterator it = entries.find(dir);
+   if ((it == entries.end()) || !it->second.listing[binary] || !verify(it))
+   {
+      return Listing();
+   }
+   it->second.lastUse = ++counter;
+   return it->second.listing[binary];
+}
+
+
+unsigned long FileXferListCache::watch(const string& dir)
+{
+   update();
+   if (fd < 0)
+   {
+      return 0;
+   }
+   EntryMap::iterator it = entries.find(dir);
+   if ((it != entries.end()) && verify(it))
+   {
+      it->second.lastUse = ++counter;
+      return it->second.version;
+   }
+
+   //the identity is taken before and after the watch is added. so it is the one of the watched directory
+   struct stat before;
+   struct stat after;
+   if (stat(dir.c_str(), &before) != 0)
+   {
+      return 0;
+   }
+   const int wd = inotify_add_watch(fd, dir.c_str(), WATCH_MASK);
+   if (wd < 0)
+   {
+      return 0;
+   }
+   if (watches.find(wd) != watches.end()) //same directory by another path. isn't cached twice
+   {
+      return 0;
+   }
+   if ((stat(dir.c_str(), &after) != 0) || (after.st_dev != before.st_dev) || (after.st_ino != before.st_ino))
+   {
+      inotify_rm_watch(fd, wd); //path changed meanwhile
+      return 0;
+   }
+   Entry& entry = entries[dir];
+   entry.wd = wd;
+   entry.dev = after.st_dev;
+   entry.ino = after.st_ino;
+   entry.version = ++counter;
+   entry.lastUse = counter;
+   watches[wd] = dir;
+   evict();
+   return (entries.find(dir) != entries.end()) ? entry.version : 0;
+}
+
+
+void FileXferListCache::store(const string& dir, bool binary, unsigned long token, const vector<unsigned char>& listing)
+{
+   update();
+   EntryMap::iterator it = entries.find(dir);
+   if ((it == entries.end()) || (it->second.version != token) || (listing.size() > getListingLimit()))
+   {
+      return; //changed (or dropped) in the meantime
+   }
+   Entry& entry = it->second;
+   if (entry.listing[binary])
+   {
+      size -= entry.listing[binary]->size();
+   }
+   entry.listing[binary] = make_shared<const vector<unsigned char> >(listing);
+   entry.lastUse = ++counter;
+   size += listing.size();
+   evict();
+}
+
+
+//a single listing must not occupy more than a quarter of the cache
+size_t FileXferListCache::getListingLimit() const
+{
+   return capacity / 4;
+}
+
+
+void FileXferListCache::clear()
+{
+   while (!entries.empty())
+   {
+      remove(entries.begin());
+   }
+}
+
+
+void FileXferListCache::update()
+{
+   union
+   {
+      struct inotify_event event; //for alignment
+      char buffer[4096];
+   } events;
+
+   while (fd >= 0)
+   {
+      const ssize_t len = read(fd, events.buffer, sizeof(events.buffer));
+      if (len <= 0)
+      {
+         if ((len < 0) && (errno == EINTR))
+         {
+            continue;
+         }
+         break; //no more events (EAGAIN)
+      }
+      for (ssize_t offset = 0; offset < len; )
+      {
+         const struct inotify_event * event = (const struct inotify_event *)&events.buffer[offset];
+         offset += sizeof(struct inotify_event) + event->len;
+         if (event->mask & IN_Q_OVERFLOW) //events were lost
+         {
+            clear();
+            continue;
+         }
+         map<int, string>::iterator watch = watches.find(event->wd);
+         if (watch == watches.end())
+         {
+            continue; //already removed
+         }
+         EntryMap::iterator it = entries.find(watch->second);
+         if (event->mask & (IN_IGNORED | IN_DELETE_SELF | IN_MOVE_SELF)) //directory is gone (or the path is stale)
+         {
+            remove(it);
+         }
+         else
+         {
+            invalidate(it->second);
+         }
+      }
+   }
+}
+
+
+//one stat per lookup. inotify doesn't report, that a path names another directory (e.g. after a parent directory
+//was renamed)
+bool FileXferListCache::verify(EntryMap::iterator it)
+{
+   struct stat dirStat;
+   if ((stat(it->first.c_str(), &dirStat) != 0) ||
+       (dirStat.st_dev != it->second.dev) || (dirStat.st_ino != it->second.ino))
+   {
+      remove(it);
+      return false;
+   }
+   return true;
+}
+
+
+void FileXferListCache::invalidate(Entry& entry)
+{
+   for (unsigned int idx = 0; idx < 2; ++idx)
+   {
+      if (entry.listing[idx])
+      {
+         size -= entry.listing[idx]->size();
+         entry.listing[idx].reset();
+      }
+   }
+   entry.version = ++counter; //a listing being read, isn't stored
+}
+
+
+void FileXferListCache::remove(EntryMap::iterator it)
+{
+   invalidate(it->second);
+   watches.erase(it->second.wd);
+   inotify_rm_watch(fd, it->second.wd);
+   entries.erase(it);
+}
+
+
+void FileXferListCache::evict()
+{
+   while (!entries.empty() && ((size > capacity) || (entries.size() > FILE_XFER_CACHE_DIRECTORIES)))
+   {
+      EntryMap::iterator oldest = entries.begin();
+      for (EntryMap::iterator it = entries.begin(); it != entries.end(); ++it)
+      {
+         if (it->second.lastUse < oldest->second.lastUse)
+         {
+            oldest = it;
+         }
+      }
+      remove(oldest);
+   }
+}
@@ -0,0 +1,98 @@
+//---------------------------------------------------------------------------------------------------------------------
+/*!
+   \file
+   \brief Cache of directory listings (linux)
+
+   Keeps the encoded listings (text or binary format, see file_xfer_list.h) of recently listed directories in
+   memory. The directories are watched by inotify. Any change of a directory (entry created, deleted, moved,
+   modified or its attributes changed) invalidates its listings. So a repeated listing of an unchanged directory
+   is served from memory, without any file system access.
+
+   A directory is watched before it is read (see watch). If it is changed while it is read, the listing isn't
+   stored (see store). The cache is keyed by path, but inotify watches the directory itself. So its identity
+   (device and inode) is kept as well: if the path names another directory meanwhile (e.g. a parent directory was
+   renamed, or a symbolic link retargeted), the entry is dropped (see find). Symbolic links aren't watched.
+   The cached text listings hold dates in local time: a change of the time zone isn't detected.
+   The cache is limited in size: the least recently used directories are dropped.
+*/
+//---------------------------------------------------------------------------------------------------------------------
+#ifndef FILE_XFER_CACHE_H
+#define FILE_XFER_CACHE_H
+
+/* -- Includes ------------------------------------------------------------ */
+#include <stddef.h>
+#include <sys/types.h>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+
+/* -- Defines ------------------------------------------------------------- */
+#define FILE_XFER_CACHE_SIZE              (8 * 1024 * 1024) //max. size of all cached listings (in bytes)
+#define FILE_XFER_CACHE_DIRECTORIES       (256)             //max. number of watched directories
+
+
+/* -- Types --------------------------------------------------------------- */
+
+class FileXferListCache
+{
+public:
+   typedef std::shared_ptr<const std::vector<unsigned char> > Listing; //stays valid, even if invalidated in the meantime
+
+   FileXferListCache(size_t capacity = FILE_XFER_CACHE_SIZE);
+   ~FileXferListCache();
+
+   //listing of "dir" (in text or binary format). empty, if not cached or the directory was changed
+   Listing find(const std::string& dir, bool binary);
+
+   //watch "dir" before it is read. returns the token to be passed to store (0, if the directory can't be watched)
+   unsigned long watch(const std::string& dir);
+
+   //store the listing of "dir" (without termination), read after watch. dropped, if the directory was changed
+   //in between
+   void store(const std::string& dir, bool binary, unsigned long token, const std::vector<unsigned char>& listing);
+
+   size_t getListingLimit() const; //max. size of a listing, that is cached
+   void clear();
+
+private:
+   FileXferListCache(const FileXferListCache&); //not copyable
+   FileXferListCache& operator=(const FileXferListCache&);
+
+   typedef struct
+   {
+      int wd;                 //inotify watch
+      dev_t dev;              //identity of the watched directory
+      ino_t ino;
+      unsigned long version;  //changed on invalidation
+      unsigned long lastUse;
+      Listing listing[2];     //text, binary
+   } Entry;
+   typedef std::map<std::string, Entry> EntryMap;
+
+   void update(); //process pending inotify events
+   bool verify(EntryMap::iterator it); //the path still names the watched directory. otherwise the entry is dropped
+   void invalidate(Entry& entry);
+   void remove(EntryMap::iterator it);
+   void evict(); //drop least recently used directories, until within the limits
+
+   int fd;                    //inotify instance
+   size_t capacity;
+   size_t size;               //size of all cached listings
+   unsigned long counter;     //source of versions and use stamps
+   EntryMap entries;          //by directory
+   std::map<int, std::string> watches; //directory by inotify watch
+};
+
+
+
+/* -- Global Variables ---------------------------------------------------- */
+
+/* -- Function Prototypes ------------------------------------------------- */
+
+/* -- Implementation ------------------------------------------------------ */
+
+
+
+#endif
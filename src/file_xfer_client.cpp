@@ -7,9 +7,11 @@
 
 /* -- Includes ------------------------------------------------------------ */
 #include <stdio.h>
+#include <stdlib.h>
 #include <iostream>
+#include <thread>
 #include "file_xfer_client.h"
-#include "file_xfer.h"
+#include "crc32c.h"
 
 
 /* -- Defines ------------------------------------------------------------- */
@@ -24,6 +26,47 @@ using namespace std;
 /* -- Implementation ------------------------------------------------------ */
 
 
+FileXferAppBlockIo::FileXferAppBlockIo()
+{
+   app = NULL;
+}
+
+
+//read piece by piece, until a piece can't be filled completely (end of file)
+size_t FileXferAppBlockIo::readBlocks(FileHandle_t file, unsigned long long offset, const FileXferIoVec * vec, unsigned int count)
+{
+   size_t total = 0;
+   for (unsigned int idx = 0; idx < count; ++idx)
+   {
+      const size_t len = app->readFromFile(file, vec[idx].data, vec[idx].length);
+      total += len;
+      if (len < vec[idx].length)
+      {
+         break;
+      }
+   }
+   return total;
+}
+
+
+size_t FileXferAppBlockIo::writeBlocks(FileHandle_t file, unsigned long long offset, const FileXferIoVec * vec, unsigned int count)
+{
+   size_t total = 0;
+   for (unsigned int idx = 0; idx < count; ++idx)
+   {
+      const size_t len = app->writeToFile(file, vec[idx].data, vec[idx].length);
+      total += len;
+      if (len < vec[idx].length)
+      {
+         break;
+      }
+   }
+   return total;
+}
+
+
+
+
 FileXferClient::FileXferClient(FileXferClientApp * app)
 {
    init();
@@ -45,12 +88,38 @@ void FileXferClient::init()
    ctrlChannel = NULL;
    dataChannel = NULL;
    srcDstFile = FILE_XFER_CLIENT_INVALID_FILE_HANDLE;
-   ctrlState = 0;
    dataState = 0;
    time1ms = 0;
    timeout1ms = 0;
+   syncTag = 0;
+   sync1ms = 0;
    uploadFileSize = 0;
    downloadFileSize = 0;
+   downloadOffset = 0;
+   transferHashed = false;
+   transferCrc = 0;
+   lendBuffer = NULL;
+   lendLimit = 0;
+   lendFill = 0;
+   lendActive = false;
+   lendBusy = false;
+   lendDownload = false;
+   resumeOffset = 0;
+   resumeRemaining = 0;
+   resumeCrc = 0;
+   deltaBasisFile = FILE_XFER_CLIENT_INVALID_FILE_HANDLE;
+   deltaBlockSize = FILE_XFER_DELTA_BLOCK_SIZE_MIN;
+   deltaRemaining = 0;
+   outputSent = 0;
+   sessionFeatures = 0;
+   listReceived = false;
+   listBatchSize = 0;
+   rxBudget = FILE_XFER_CLIENT_RX_BUDGET;
+   session = this;
+   bundleIndex = 0;
+   bundleTree = false;
+   bundleFileTime = 0;
+   bundleFailed = false;
 }
 
 
@@ -70,15 +139,14 @@ void FileXferClient::use(Slay2Channel * ctrl, Slay2Channel * data)
 //request working directory of server
 //return:
 //0, on success
-//-1, failed to send request (not enough TX buffer)
+//-1, failed to send request (not enough TX buffer, or too many requests pending)
 int FileXferClient::workingDirectory()
 {
-   if (ctrlChannel->getTxBufferSize() >= 1)
+   if (canRequest() && (ctrlChannel->getTxBufferSpace() >= 1))
    {
       const unsigned char command = FILE_XFER_CMD_PWD;
       ctrlChannel->send(&command, 1);
-      ctrlState = FILE_XFER_CMD_PWD;
-      timeout1ms = time1ms + 3000; //force quit, if there is no response withing 3 seconds
+      pushRequest(FILE_XFER_CMD_PWD, false, time1ms + 3000); //force quit, if there is no response withing 3 seconds
       return 0;
    }
    return -1;
@@ -88,17 +156,16 @@ int FileXferClient::workingDirectory()
 //request server to change (working) directory to the given <path>
 //return:
 //0, on success
-//-1, failed to send request (not enough TX buffer)
+//-1, failed to send request (not enough TX buffer, or too many requests pending)
 int FileXferClient::changeDirectory(const std::string& path)
 {
-   int pathLength = path.length() + 1; //one more for the zero termination
-   if (ctrlChannel->getTxBufferSize() > pathLength) //one more for the leading command byte
+   unsigned int pathLength = path.length() + 1; //one more for the zero termination
+   if (canRequest() && (ctrlChannel->getTxBufferSpace() > pathLength)) //one more for the leading command byte
    {
       const unsigned char command = FILE_XFER_CMD_CD;
       ctrlChannel->send(&command, 1, true);
       ctrlChannel->send((const unsigned char *)path.c_str(), pathLength);
-      ctrlState = FILE_XFER_CMD_CD;
-      timeout1ms = time1ms + 3000; //force quit, if there is no response withing 3 seconds
+      pushRequest(FILE_XFER_CMD_CD, false, time1ms + 3000); //force quit, if there is no response withing 3 seconds
       return 0;
    }
    return -1;
@@ -109,7 +176,7 @@ int FileXferClient::changeDirectory(const std::string& path)
 //request server to list (content of working) directory
 //return:
 //0, on success
-//-1, failed to send request (not enough TX buffer)
+//-1, failed to send request (not enough TX buffer, or too many requests pending)
 //-2, failed, because client isn't idle!
 int FileXferClient::listDirectory()
 {
@@ -119,14 +186,16 @@ int FileXferClient::listDirectory()
       return -2;
    }
    //check for enough tx buffer
-   if (ctrlChannel->getTxBufferSize() >= 1)
+   if (canRequest() && (ctrlChannel->getTxBufferSpace() >= 1))
    {
       const unsigned char command = FILE_XFER_CMD_LS;
       ctrlChannel->send(&command, 1);
-      ctrlState = FILE_XFER_CMD_LS;
+      pushRequest(FILE_XFER_CMD_LS, true);
       dataState = FILE_XFER_CMD_LS;
       timeout1ms = time1ms + 3000; //force quit, if there is no response withing 3 seconds
       directoryList = "";
+      listReader.reset();
+      dataDecoder.reset();
       return 0;
    }
    return -1;
@@ -136,7 +205,7 @@ int FileXferClient::listDirectory()
 //request server to change (working) directory and list its content
 //return:
 //0, on success
-//-1, failed to send request (not enough TX buffer)
+//-1, failed to send request (not enough TX buffer, or too many requests pending)
 //-2, failed, because client isn't idle!
 int FileXferClient::changeListDirectory(const std::string& path)
 {
@@ -146,16 +215,18 @@ int FileXferClient::changeListDirectory(const std::string& path)
       return -2;
    }
    //check for enough tx buffer
-   int pathLength = path.length() + 1; //one more for the zero termination
-   if (ctrlChannel->getTxBufferSize() > pathLength) //one more for the leading command byte
+   unsigned int pathLength = path.length() + 1; //one more for the zero termination
+   if (canRequest() && (ctrlChannel->getTxBufferSpace() > pathLength)) //one more for the leading command byte
    {
       const unsigned char command = FILE_XFER_CMD_DIR;
       ctrlChannel->send(&command, 1, true);
       ctrlChannel->send((const unsigned char *)path.c_str(), pathLength);
-      ctrlState = FILE_XFER_CMD_DIR;
+      pushRequest(FILE_XFER_CMD_DIR, true);
       dataState = FILE_XFER_CMD_DIR;
       timeout1ms = time1ms + 3000; //force quit, if there is no response withing 3 seconds
       directoryList = "";
+      listReader.reset();
+      dataDecoder.reset();
       return 0;
    }
    return -1;
@@ -166,17 +237,16 @@ int FileXferClient::changeListDirectory(const std::string& path)
 //request server to create the given directory (given by path)
 //return:
 //0, on success
-//-1, failed to send request (not enough TX buffer)
+//-1, failed to send request (not enough TX buffer, or too many requests pending)
 int FileXferClient::makeDirectory(const std::string& path)
 {
-   int pathLength = path.length() + 1; //one more for the zero termination
-   if (ctrlChannel->getTxBufferSize() > pathLength) //one more for the leading command byte
+   unsigned int pathLength = path.length() + 1; //one more for the zero termination
+   if (canRequest() && (ctrlChannel->getTxBufferSpace() > pathLength)) //one more for the leading command byte
    {
       const unsigned char command = FILE_XFER_CMD_MKDIR;
       ctrlChannel->send(&command, 1, true);
       ctrlChannel->send((const unsigned char *)path.c_str(), pathLength);
-      ctrlState = FILE_XFER_CMD_MKDIR;
-      timeout1ms = time1ms + 3000; //force quit, if there is no response withing 3 seconds
+      pushRequest(FILE_XFER_CMD_MKDIR, false, time1ms + 3000); //force quit, if there is no response withing 3 seconds
       return 0;
    }
    return -1;
@@ -185,17 +255,16 @@ int FileXferClient::makeDirectory(const std::string& path)
 //request server to delete the given file or directory (given by path)
 //return:
 //0, on success
-//-1, failed to send request (not enough TX buffer)
+//-1, failed to send request (not enough TX buffer, or too many requests pending)
 int FileXferClient::removeFile(const std::string& path)
 {
-   int pathLength = path.length() + 1; //one more for the zero termination
-   if (ctrlChannel->getTxBufferSize() > pathLength) //one more for the leading command byte
+   unsigned int pathLength = path.length() + 1; //one more for the zero termination
+   if (canRequest() && (ctrlChannel->getTxBufferSpace() > pathLength)) //one more for the leading command byte
    {
       const unsigned char command = FILE_XFER_CMD_RM;
       ctrlChannel->send(&command, 1, true);
       ctrlChannel->send((const unsigned char *)path.c_str(), pathLength);
-      ctrlState = FILE_XFER_CMD_RM;
-      timeout1ms = time1ms + 3000; //force quit, if there is no response withing 3 seconds
+      pushRequest(FILE_XFER_CMD_RM, false, time1ms + 3000); //force quit, if there is no response withing 3 seconds
       return 0;
    }
    return -1;
@@ -205,19 +274,20 @@ int FileXferClient::removeFile(const std::string& path)
 //request to download given source-file from server and store it to the given destination
 //return:
 //0, on success
-//-1, failed to send request (not enough TX buffer)
-//-2, failed, because client isn't idle!
+//-1, failed to send request (not enough TX buffer, or too many requests pending)
+//-2, failed, because client (and all its transfer slots) isn't idle!
 //-3, failed, because destination file not writeable
 int FileXferClient::downloadFile(const std::string& source, const std::string& destination)
 {
-   //check for idle condition
-   if (dataState != 0) //not idle?
+   //check for idle condition. use an idle transfer slot, if busy
+   FileXferClient * slot = selectSlot();
+   if (slot != this)
    {
-      return -2;
+      return (slot != NULL) ? slot->downloadFile(source, destination) : -2;
    }
    //check for enough tx buffer
-   int srcLength = source.length() + 1; //one more for the zero termination
-   if (ctrlChannel->getTxBufferSize() > srcLength) //one more for the leading command byte
+   unsigned int srcLength = source.length() + 1; //one more for the zero termination
+   if (canRequest() && (ctrlChannel->getTxBufferSpace() > srcLength)) //one more for the leading command byte
    {
       //open destination file
       FileXferClientApp::FileHandle_t dstFile;
@@ -226,10 +296,59 @@ int FileXferClient::downloadFile(const std::string& source, const std::string& d
          const unsigned char command = FILE_XFER_CMD_DOWNLOAD;
          ctrlChannel->send(&command, 1, true);
          ctrlChannel->send((const unsigned char *)source.c_str(), srcLength);
-         ctrlState = FILE_XFER_CMD_DOWNLOAD;
+         pushRequest(FILE_XFER_CMD_DOWNLOAD, true);
+         dataState = FILE_XFER_CMD_DOWNLOAD;
+         downloadFileSize = 0; //will be set in the response
+         downloadOffset = 0;
+         srcDstFile = dstFile; //
+         dataDecoder.reset();
+         //can't set a timeout her, as i don't know how long it takes to download the given file
+         //-> user is responsible to quit on failure
+         return 0;
+      }
+      return -3;
+   }
+   return -1;
+}
+
+
+//request to resume the download of the given source-file from server. the download continues at the
+//end of the (partially downloaded) destination file.
+//return:
+//0, on success
+//-1, failed to send request (not enough TX buffer, or too many requests pending)
+//-2, failed, because client (and all its transfer slots) isn't idle!
+//-3, failed, because destination file not appendable
+int FileXferClient::resumeDownload(const std::string& source, const std::string& destination)
+{
+   //check for idle condition. use an idle transfer slot, if busy
+   FileXferClient * slot = selectSlot();
+   if (slot != this)
+   {
+      return (slot != NULL) ? slot->resumeDownload(source, destination) : -2;
+   }
+   //check for enough tx buffer
+   unsigned int srcLength = source.length();
+   if (canRequest() && (ctrlChannel->getTxBufferSpace() > (srcLength + 22))) //one more for the leading command byte and about 21 bytes to specify the offset (in bytes)
+   {
+      //open destination file
+      FileXferClientApp::FileHandle_t dstFile;
+      if (app->openFileForAppend(destination, &dstFile))
+      {
+         const unsigned char command = FILE_XFER_CMD_RESUME_DOWNLOAD;
+         char buffer[24];
+         int len;
+
+         ctrlChannel->send(&command, 1, true);
+         ctrlChannel->send((const unsigned char *)source.c_str(), srcLength, true);
+         downloadOffset = app->getFileSize(dstFile); //continue behind the data i already have
+         len = sprintf(buffer, ",%lu", (unsigned long)downloadOffset);
+         ctrlChannel->send((const unsigned char *)buffer, len + 1); //include zero termination
+         pushRequest(FILE_XFER_CMD_DOWNLOAD, true); //response is handled like the one of a "normal" download
          dataState = FILE_XFER_CMD_DOWNLOAD;
          downloadFileSize = 0; //will be set in the response
          srcDstFile = dstFile; //
+         dataDecoder.reset();
          //can't set a timeout her, as i don't know how long it takes to download the given file
          //-> user is responsible to quit on failure
          return 0;
@@ -243,19 +362,20 @@ int FileXferClient::downloadFile(const std::string& source, const std::string& d
 //request to upload given source-file to server and store it there to the given destination
 //return:
 //0, on success
-//-1, failed to send request (not enough TX buffer)
-//-2, failed, because client isn't idle!
+//-1, failed to send request (not enough TX buffer, or too many requests pending)
+//-2, failed, because client (and all its transfer slots) isn't idle!
 //-3, failed, because source file can'b be read
 int FileXferClient::uploadFile(const std::string& source, const std::string& destination)
 {
-   //check for idle condition
-   if (dataState != 0) //not idle?
+   //check for idle condition. use an idle transfer slot, if busy
+   FileXferClient * slot = selectSlot();
+   if (slot != this)
    {
-      return -2;
+      return (slot != NULL) ? slot->uploadFile(source, destination) : -2;
    }
    //check for enough tx buffer
-   int dstLength = destination.length();
-   if (ctrlChannel->getTxBufferSize() > (dstLength + 11)) //one more for the leading command byte and about 11 bytes to specify the length of the file (in bytes)
+   unsigned int dstLength = destination.length();
+   if (canRequest() && (ctrlChannel->getTxBufferSpace() > (dstLength + 11))) //one more for the leading command byte and about 11 bytes to specify the length of the file (in bytes)
    {
       //open source file
       FileXferClientApp::FileHandle_t srcFile;
@@ -270,9 +390,11 @@ int FileXferClient::uploadFile(const std::string& source, const std::string& des
          uploadFileSize = app->getFileSize(srcFile);
          len = sprintf(buffer, ",%d", (int)uploadFileSize);
          ctrlChannel->send((const unsigned char *)buffer, len + 1); //include zero termination
-         ctrlState = FILE_XFER_CMD_UPLOAD;
+         pushRequest(FILE_XFER_CMD_UPLOAD, true);
          dataState = FILE_XFER_CMD_UPLOAD;
          srcDstFile = srcFile; //
+         dataChunking.start(dataChannel, time1ms);
+         startUpload(srcFile, 0);
          //can't set a timeout her, as i don't know how long it takes to upload the given file
          //-> user is responsible to quit on failure
          return 0;
@@ -283,311 +405,1808 @@ int FileXferClient::uploadFile(const std::string& source, const std::string& des
 }
 
 
-//
-//request server to quit ongoing transfer/operation
+//request to resume the upload of the given source-file to server.
+//this is done in several steps:
+//1. query the size of the (partial) destination file on server. this is the offset to resume at
+//2. checksum the clients source file up to that offset (see doResumeUpload)
+//3. request to resume the upload at the offset. the server verifies the checksum of its stored part
+//4. upload the tail of the file (starting at offset)
+//if the stored part doesn't match, the whole file is uploaded.
 //return:
 //0, on success
-//-1, failed to send request (not enough TX buffer)
-int FileXferClient::quit()
+//-1, failed to send request (not enough TX buffer, or too many requests pending)
+//-2, failed, because client (and all its transfer slots) isn't idle!
+//-3, failed, because source file can'b be read
+int FileXferClient::resumeUpload(const std::string& source, const std::string& destination)
 {
-   if (ctrlChannel->getTxBufferSize() >= 1)
+   //check for idle condition. use an idle transfer slot, if busy
+   FileXferClient * slot = selectSlot();
+   if (slot != this)
    {
-      const unsigned char command = FILE_XFER_CMD_QUIT;
-      ctrlChannel->send(&command, 1);
-      ctrlState = FILE_XFER_CMD_QUIT;
-      timeout1ms = time1ms + 300; //force quit, if there is no response withing 300 ms
-      return 0;                    //(ich hab jetzt schon lange genug gewartet... Zu erlebt der User dann auch "gleich" eine Reaktion ...)
+      return (slot != NULL) ? slot->resumeUpload(source, destination) : -2;
+   }
+   //check for enough tx buffer
+   unsigned int dstLength = destination.length() + 1; //one more for the zero termination
+   if (canRequest() && (ctrlChannel->getTxBufferSpace() > dstLength)) //one more for the leading command byte
+   {
+      //open source file
+      FileXferClientApp::FileHandle_t srcFile;
+      if (app->openFileForRead(source, &srcFile))
+      {
+         const unsigned char command = FILE_XFER_CMD_SIZE;
+         ctrlChannel->send(&command, 1, true);
+         ctrlChannel->send((const unsigned char *)destination.c_str(), dstLength);
+         pushRequest(FILE_XFER_CMD_SIZE, true);
+         dataState = FILE_XFER_CMD_RESUME_UPLOAD;
+         srcDstFile = srcFile; //
+         uploadSource = source;
+         uploadDestination = destination;
+         uploadFileSize = app->getFileSize(srcFile);
+         resumeOffset = 0; //will be set in the response
+         resumeRemaining = 0;
+         resumeCrc = 0;
+         timeout1ms = time1ms + 3000; //force quit, if there is no response withing 3 seconds
+         return 0;
+      }
+      return -3;
    }
    return -1;
 }
 
 
-
-
-void FileXferClient::task(unsigned long time1ms)
+//request to upload the given source-file to server as a delta against the servers version of the file.
+//this is done in several steps:
+//1. request the block signatures of the destination file on server
+//2. request to upload a delta, as far as all signatures were received
+//3. make the delta of the source file against the signatures and upload it (see doDeltaUpload)
+//if the destination file doesn't exist on server, the whole file is uploaded.
+//return:
+//0, on success
+//-1, failed to send request (not enough TX buffer, or too many requests pending)
+//-2, failed, because client (and all its transfer slots) isn't idle!
+//-3, failed, because source file can'b be read
+int FileXferClient::deltaUpload(const std::string& source, const std::string& destination)
 {
-   //set current time
-   this->time1ms = time1ms;
-
-   //handle reception
-   //check for received control bytes
-   if (ctrlRxBuffer.getCount()) //some pending control bytes?
+   //check for idle condition. use an idle transfer slot, if busy
+   FileXferClient * slot = selectSlot();
+   if (slot != this)
    {
-      unsigned char * data;
-      unsigned int len;
-      //process buffered data - within a critial section
-      ctrlChannel->enterCritical();
-      len = ctrlRxBuffer.top(&data); //assert len > 0 (as getCount returned > 0)
-      onCtrlFrame(data, len);
-      ctrlRxBuffer.pop(len); //drop that bytes away
-      ctrlChannel->leaveCritical();
+      return (slot != NULL) ? slot->deltaUpload(source, destination) : -2;
    }
-   //check for received data bytes
-   if (dataRxBuffer.getCount()) //some pending control bytes?
+   //check for enough tx buffer
+   unsigned int dstLength = destination.length() + 1; //one more for the zero termination
+   if (canRequest() && (ctrlChannel->getTxBufferSpace() > dstLength)) //one more for the leading command byte
    {
-      unsigned char * data;
-      unsigned int len;
-      //process buffered data - within a critial section
-      dataChannel->enterCritical();
-      len = dataRxBuffer.top(&data); //assert len > 0 (as getCount returned > 0)
-      onDataFrame(data, len);
-      dataRxBuffer.pop(len); //drop that bytes away
-      dataChannel->leaveCritical();
+      //open source file
+      FileXferClientApp::FileHandle_t srcFile;
+      if (app->openFileForRead(source, &srcFile))
+      {
+         const unsigned char command = FILE_XFER_CMD_SIGNATURES;
+         ctrlChannel->send(&command, 1, true);
+         ctrlChannel->send((const unsigned char *)destination.c_str(), dstLength);
+         pushRequest(FILE_XFER_CMD_SIGNATURES, true);
+         dataState = FILE_XFER_CMD_SIGNATURES;
+         srcDstFile = srcFile; //
+         uploadSource = source;
+         uploadDestination = destination;
+         uploadFileSize = app->getFileSize(srcFile);
+         deltaGenerator.reset(FILE_XFER_DELTA_BLOCK_SIZE_MIN, 0); //will be set in the response
+         timeout1ms = time1ms + 3000; //force quit, if there is no response withing 3 seconds
+         return 0;
+      }
+      return -3;
    }
+   return -1;
+}
 
-   //handle transmission
-   switch (dataState)
-   {
-   case FILE_XFER_CMD_UPLOAD:
-      doFileUpload();
-      break;
-
-   default:
-      break;
-   }
 
-   //check for timeout
-   if (isIdle())
+//request to download the given source-file from server as a delta against the given basis (an older
+//version of that file). the file is rebuilt out of the delta and the basis, into destination.
+//the basis is signed and the signatures are sent to server (see doDeltaDownload). the application must
+//implement "readFromFileAt" for this function.
+//return:
+//0, on success
+//-1, failed to send request (not enough TX buffer, or too many requests pending)
+//-2, failed, because client (and all its transfer slots) isn't idle!
+//-3, failed, because basis file can't be read or destination file not writeable
+int FileXferClient::deltaDownload(const std::string& source, const std::string& basis, const std::string& destination)
+{
+   //check for idle condition. use an idle transfer slot, if busy
+   FileXferClient * slot = selectSlot();
+   if (slot != this)
    {
-      timeout1ms = 0;
+      return (slot != NULL) ? slot->deltaDownload(source, basis, destination) : -2;
    }
-   else if ((timeout1ms != 0) && (time1ms > timeout1ms))
+   //check for enough tx buffer
+   unsigned int srcLength = source.length();
+   if (canRequest() && (ctrlChannel->getTxBufferSpace() > (srcLength + 32))) //one more for the leading command byte and about 31 bytes to specify the signatures
    {
-      doQuit();
+      //open basis and destination file
+      FileXferClientApp::FileHandle_t basisFile;
+      FileXferClientApp::FileHandle_t dstFile;
+      if (app->openFileForRead(basis, &basisFile))
+      {
+         if (app->openFileForWrite(destination, &dstFile))
+         {
+            const unsigned char command = FILE_XFER_CMD_DELTA_DOWNLOAD;
+            const size_t basisSize = app->getFileSize(basisFile);
+            char buffer[32];
+            int len;
+
+            deltaBlockSize = FileXferDelta::getBlockSize(basisSize);
+            size_t blockCount = basisSize / deltaBlockSize; //only complete blocks are signed
+            if (blockCount > FILE_XFER_DELTA_BLOCK_COUNT_MAX)
+            {
+               blockCount = FILE_XFER_DELTA_BLOCK_COUNT_MAX; //the end of a huge basis isn't used (limit of the server)
+            }
+            deltaRemaining = blockCount * deltaBlockSize;
+            outputSent = 0;
+            deltaSignatures.reset(deltaBlockSize);
+            ctrlChannel->send(&command, 1, true);
+            ctrlChannel->send((const unsigned char *)source.c_str(), srcLength, true);
+            len = sprintf(buffer, ",%u,%lu", deltaBlockSize, (unsigned long)blockCount);
+            ctrlChannel->send((const unsigned char *)buffer, len + 1); //include zero termination
+            pushRequest(FILE_XFER_CMD_DELTA_DOWNLOAD, true);
+            dataState = FILE_XFER_CMD_DELTA_DOWNLOAD;
+            downloadFileSize = 0; //will be set in the response
+            srcDstFile = dstFile; //
+            deltaBasisFile = basisFile;
+            selectBlockIo()->advise(basisFile, basisSize, FileXferBlockIo::ACCESS_RANDOM); //blocks are copied out of the basis (see readBasis)
+            //can't set a timeout her, as i don't know how long it takes to download the given file
+            //-> user is responsible to quit on failure
+            return 0;
+         }
+         app->closeFile(basisFile);
+      }
+      return -3;
    }
+   return -1;
 }
 
 
-//The async functions are within the execution context of "Slay2" (slay2.task)!
-//This may be different to the context of "FileXferClient" (fileXferClient.task).
-//That means, these functions may be called aysnchronously!
-void FileXferClient::_onCtrlFrameAsync(void * const obj, const unsigned char * const data, const unsigned int len)
+//request to download all files of the given source-directory from server (as one bundle) and store them
+//into the given destination-directory. sub-directories are not included.
+//return:
+//0, on success
+//-1, failed to send request (not enough TX buffer, or too many requests pending)
+//-2, failed, because client (and all its transfer slots) isn't idle!
+int FileXferClient::downloadBundle(const std::string& source, const std::string& destination)
 {
-   if (len > 0)
+   FileXferClient * slot = selectSlot(); //use an idle transfer slot, if busy
+   if (slot != this)
    {
-      //forward to member function
-      ((FileXferClient *)obj)->onCtrlFrameAsync(data, len);
+      return (slot != NULL) ? slot->downloadBundle(source, destination) : -2;
    }
+   return requestBundleDownload(FILE_XFER_CMD_BUNDLE_DOWNLOAD, source, destination);
 }
-void FileXferClient::onCtrlFrameAsync(const unsigned char * const data, const unsigned int len)
+
+
+//request to upload the given source-files to server (as one bundle) and store them into the given
+//destination-directory. the files are stored under their name (without path).
+//return:
+//0, on success
+//-1, failed to send request (not enough TX buffer, or too many requests pending)
+//-2, failed, because client (and all its transfer slots) isn't idle!
+int FileXferClient::uploadBundle(const std::vector<std::string>& sources, const std::string& destination)
 {
-   //push data into buffer - within a critial section
-   ctrlChannel->enterCritical();
-   ctrlRxBuffer.push(data, len);
-   ctrlChannel->leaveCritical();
+   FileXferClient * slot = selectSlot(); //use an idle transfer slot, if busy
+   if (slot != this)
+   {
+      return (slot != NULL) ? slot->uploadBundle(sources, destination) : -2;
+   }
+   return requestBundleUpload(FILE_XFER_CMD_BUNDLE_UPLOAD, sources, destination);
 }
 
-//this method is called "synchronously" by method "task()". It takes its data out of the buffer,
-//that was filled asynchronously!
-void FileXferClient::onCtrlFrame(const unsigned char * const data, const unsigned int len)
-{
-   //preset ctrl state to IDLE
-   const unsigned int ctrlState = this->ctrlState; //make a copy for futher use
-   this->ctrlState = 0;
 
-   //switch according to the copy
-   const int ack = (data[0] == FILE_XFER_CMD_ACK); //1 on ACK, 0 on NACK
-   switch (ctrlState)
+//request to download the given source-directory from server, including all sub-directories, and store it
+//into the given destination-directory. the server walks the tree. directories (and the destination-directory,
+//if it doesn't exist) are created by the application (see FileXferClientApp::createDirectory).
+//return:
+//0, on success
+//-1, failed to send request (not enough TX buffer, or too many requests pending)
+//-2, failed, because client (and all its transfer slots) isn't idle!
+int FileXferClient::downloadTree(const std::string& source, const std::string& destination)
+{
+   FileXferClient * slot = selectSlot(); //use an idle transfer slot, if busy
+   if (slot != this)
    {
-   case FILE_XFER_CMD_PWD:
-      app->onPwdResponse(ack, (const char *)&data[1]);
-      break;
-
-   case FILE_XFER_CMD_CD:
-      app->onCdResponse(ack, (const char *)&data[1]);
-      break;
+      return (slot != NULL) ? slot->downloadTree(source, destination) : -2;
+   }
+   return requestBundleDownload(FILE_XFER_CMD_TREE_DOWNLOAD, source, destination);
+}
 
-   case FILE_XFER_CMD_LS:
-      if (ack == 0) //negative acknowledge?
-      {
-         dataState = 0;
-         app->onLsResponse(ack, (const char *)&data[1]);
-      }
-      //there is nothing todo here, in case of positive ACK (see "onDataFrame" for this case)
-      break;
 
-   case FILE_XFER_CMD_DIR:
-      if (ack == 0) //negative acknowledge?
+//request to upload the given files and directories of the source-directory to server and store them
+//into the given destination-directory (which is created by the server, if it doesn't exist).
+//names are paths relative to the source-directory. the parent directories of each name are created on
+//server as well. so it is sufficient to give the files (and the empty directories, ending with '/').
+//return:
+//0, on success
+//-1, failed to send request (not enough TX buffer, or too many requests pending)
+//-2, failed, because client (and all its transfer slots) isn't idle!
+int FileXferClient::uploadTree(const std::string& source, const std::vector<std::string>& names, const std::string& destination)
+{
+   FileXferClient * slot = selectSlot(); //use an idle transfer slot, if busy
+   if (slot != this)
+   {
+      return (slot != NULL) ? slot->uploadTree(source, names, destination) : -2;
+   }
+   const int status = requestBundleUpload(FILE_XFER_CMD_TREE_UPLOAD, names, destination);
+   if (status == 0)
+   {
+      bundleTree = true;
+      bundleRoot = source;
+      if (!bundleRoot.empty() && (bundleRoot[bundleRoot.length() - 1] != '/'))
       {
-         dataState = 0;
-         app->onDirResponse(ack, (const char *)&data[1]);
+         bundleRoot += '/';
       }
-      //there is nothing todo here, in case of positive ACK (see "onDataFrame" for this case)
-      break;
-
-   case FILE_XFER_CMD_MKDIR:
-      app->onMkdirResponse(ack);
-      break;
+   }
+   return status;
+}
 
-   case FILE_XFER_CMD_RM:
-      app->onRmResponse(ack);
-      break;
 
-   case FILE_XFER_CMD_DOWNLOAD:
-      if (ack == 0) //negative acknowledge?
-      {
-         dataState = 0;
-         app->onDownloadResponse(ack);
-      }
-      else
+int FileXferClient::requestBundleDownload(unsigned char command, const std::string& source, const std::string& destination)
+{
+   //check for idle condition
+   if (dataState != 0) //not idle?
+   {
+      return -2;
+   }
+   //check for enough tx buffer
+   unsigned int srcLength = source.length() + 1; //one more for the zero termination
+   if (canRequest() && (ctrlChannel->getTxBufferSpace() > srcLength)) //one more for the leading command byte
+   {
+      ctrlChannel->send(&command, 1, true);
+      ctrlChannel->send((const unsigned char *)source.c_str(), srcLength);
+      pushRequest(command, true);
+      dataState = FILE_XFER_CMD_BUNDLE_DOWNLOAD; //the data of a tree download is a bundle as well
+      bundleDestination = destination;
+      if (!bundleDestination.empty() && (bundleDestination[bundleDestination.length() - 1] != '/'))
       {
-         downloadFileSize = atoi((const char *)&data[1]);
+         bundleDestination += '/';
       }
-      break;
-
-   case FILE_XFER_CMD_UPLOAD:
-      if (ack == 0) //negative acknowledge?
+      bundleFailed = false;
+      bundleReader.reset(this, (command == FILE_XFER_CMD_TREE_DOWNLOAD));
+      if ((command == FILE_XFER_CMD_TREE_DOWNLOAD) && !bundleDestination.empty())
       {
-         dataState = 0;
-         app->onUploadResponse(ack);
+         app->createDirectory(bundleDestination); //may already exist
       }
-      //there is nothing todo here, in case of positive ACK (see "onDataFrame" for this case)
-      break;
-
-   case FILE_XFER_CMD_QUIT:
-      doQuit();
-      break;
-
-   default: //IDLE
-      break;
+      dataDecoder.reset();
+      //can't set a timeout her, as i don't know how long it takes to download the files
+      //-> user is responsible to quit on failure
+      return 0;
    }
+   return -1;
 }
 
 
-//The async functions are within the execution context of "Slay2" (slay2.task)!
-//This may be different to the context of "FileXferClient" (fileXferClient.task).
-//That means, these functions may be called aysnchronously!
-void FileXferClient::_onDataFrameAsync(void * const obj, const unsigned char * const data, const unsigned int len)
+int FileXferClient::requestBundleUpload(unsigned char command, const std::vector<std::string>& sources, const std::string& destination)
 {
-   if (len > 0)
+   //check for idle condition
+   if (dataState != 0) //not idle?
    {
-      //forward to member function
-      ((FileXferClient *)obj)->onDataFrameAsync(data, len);
+      return -2;
    }
-}
-void FileXferClient::onDataFrameAsync(const unsigned char * const data, const unsigned int len)
-{
-   //push data into buffer - within a critial section
-   dataChannel->enterCritical();
-   dataRxBuffer.push(data, len);
-   dataChannel->leaveCritical();
-}
-
-
+   //check for enough tx buffer
+   unsigned int dstLength = destination.length() + 1; //one more for the zero termination
+   if (canRequest() && (ctrlChannel->getTxBufferSpace() > dstLength)) //one more for the leading command byte
+   {
+      ctrlChannel->send(&command, 1, true);
+      ctrlChannel->send((const unsigned char *)destination.c_str(), dstLength);
+      pushRequest(command, true);
+      dataState = FILE_XFER_CMD_BUNDLE_UPLOAD; //the data of a tree upload is a bundle as well
+      bundleSources = sources;
+      bundleIndex = 0;
+      bundleTree = false;
+      bundleRoot.clear();
+      bundleDirectory.clear();
+      bundleFailed = false;
+      bundleWriter.reset();
+      timeout1ms = time1ms + 3000; //force quit, if there is no response withing 3 seconds
+      return 0;
+   }
+   return -1;
+}
+
+
+//
+//request server to quit ongoing transfer/operation. the server rejects the requests, it didn't respond yet.
+//no further requests may be sent, until the quit has completed. busy transfer slots are quit as well.
+//return:
+//0, on success
+//-1, failed to send request (not enough TX buffer)
+int FileXferClient::quit()
+{
+   for (size_t idx = 0; idx < slots.size(); ++idx)
+   {
+      if (!slots[idx]->isIdle())
+      {
+         slots[idx]->quit();
+      }
+   }
+   if (ctrlChannel->getTxBufferSpace() >= 1)
+   {
+      const unsigned char command = FILE_XFER_CMD_QUIT;
+      ctrlChannel->send(&command, 1);
+      pushRequest(FILE_XFER_CMD_QUIT);
+      timeout1ms = time1ms + 300; //force quit, if there is no response withing 300 ms
+      return 0;                    //(ich hab jetzt schon lange genug gewartet... Zu erlebt der User dann auch "gleich" eine Reaktion ...)
+   }
+   return -1;
+}
+
+
+
+//request server to list the changes of the working directory since a change token
+//return:
+//0, on success
+//-1, failed to send request (not enough TX buffer, or too many requests pending)
+//-2, failed, because client isn't idle!
+int FileXferClient::listChanges(const std::string& token)
+{
+   //check for idle condition
+   if (dataState != 0) //not idle?
+   {
+      return -2;
+   }
+   //check for enough tx buffer
+   unsigned int tokenLength = token.length() + 1; //one more for the zero termination
+   if (canRequest() && (ctrlChannel->getTxBufferSpace() > tokenLength)) //one more for the leading command byte
+   {
+      const unsigned char command = FILE_XFER_CMD_CHANGES;
+      ctrlChannel->send(&command, 1, true);
+      ctrlChannel->send((const unsigned char *)token.c_str(), tokenLength);
+      pushRequest(FILE_XFER_CMD_CHANGES, true);
+      dataState = FILE_XFER_CMD_CHANGES;
+      timeout1ms = time1ms + 3000; //force quit, if there is no response withing 3 seconds
+      directoryList = "";
+      listReader.reset();
+      dataDecoder.reset();
+      listResponse.clear();
+      listReceived = false;
+      return 0;
+   }
+   return -1;
+}
+
+
+
+//request server to list the entries of the working directory, that match a filter
+//return:
+//0, on success
+//-1, failed to send request (not enough TX buffer, or too many requests pending)
+//-2, failed, because client isn't idle!
+int FileXferClient::listFiltered(const FileXferListFilter& filter)
+{
+   //check for idle condition
+   if (dataState != 0) //not idle?
+   {
+      return -2;
+   }
+   //check for enough tx buffer
+   const string args = filter.format();
+   unsigned int argsLength = args.length() + 1; //one more for the zero termination
+   if (canRequest() && (ctrlChannel->getTxBufferSpace() > argsLength)) //one more for the leading command byte
+   {
+      const unsigned char command = FILE_XFER_CMD_FILTER;
+      ctrlChannel->send(&command, 1, true);
+      ctrlChannel->send((const unsigned char *)args.c_str(), argsLength);
+      pushRequest(FILE_XFER_CMD_FILTER, true);
+      dataState = FILE_XFER_CMD_FILTER;
+      timeout1ms = time1ms + 3000; //force quit, if there is no response withing 3 seconds
+      directoryList = "";
+      listReader.reset();
+      dataDecoder.reset();
+      listResponse.clear();
+      listReceived = false;
+      return 0;
+   }
+   return -1;
+}
+
+
+
+
+void FileXferClient::setListBatchSize(size_t count)
+{
+   listBatchSize = count;
+}
+
+
+void FileXferClient::setRxBudget(unsigned int frames)
+{
+   rxBudget = frames;
+}
+
+
+//request server to agree on session parameters.
+//the client proposes the largest data chunk size it can handle and the optional features it wants to use.
+//the server responds with the agreed ones. each transfer slot negotiates its own session parameters.
+//return:
+//0, on success
+//-1, failed to send request (not enough TX buffer, or too many requests pending)
+int FileXferClient::setupSession(bool compression, bool binaryListing, bool integrity)
+{
+   for (size_t idx = 0; idx < slots.size(); ++idx)
+   {
+      slots[idx]->setupSession(compression, binaryListing, integrity);
+   }
+   const unsigned int features = (compression ? FILE_XFER_FEATURE_COMPRESSION : 0) |
+                                 (binaryListing ? FILE_XFER_FEATURE_BINARY_LISTING : 0) |
+                                 (integrity ? FILE_XFER_FEATURE_INTEGRITY : 0);
+   char buffer[24];
+   const unsigned int len = sprintf(buffer, "%d,%x", FILE_XFER_CHUNK_SIZE_MAX, features);
+   if (canRequest() && (ctrlChannel->getTxBufferSpace() > len + 1)) //one more for the leading command byte
+   {
+      const unsigned char command = FILE_XFER_CMD_SESSION;
+      ctrlChannel->send(&command, 1, true);
+      ctrlChannel->send((const unsigned char *)buffer, len + 1); //include zero termination
+      pushRequest(FILE_XFER_CMD_SESSION, false, time1ms + 3000); //force quit, if there is no response withing 3 seconds
+      return 0;
+   }
+   return -1;
+}
+
+
+
+
+void FileXferClient::task(unsigned long time1ms)
+{
+   //set current time
+   this->time1ms = time1ms;
+
+   //handle reception. the frames are taken out of the rings without a lock (the slay2 callbacks may push
+   //further frames meanwhile). handle all pending responses back-to-back (requests may be pipelined)
+   unsigned char * data;
+   unsigned int len;
+   while ((len = ctrlRxBuffer.top(&data)) != 0) //some pending control bytes?
+   {
+      onCtrlFrame(data, len);
+      ctrlRxBuffer.pop(); //drop that bytes away
+   }
+   //a download received in place is handed to the application, when the lent buffer is full
+   if ((lendBuffer != NULL) && (lendFill.load(std::memory_order_acquire) == lendLimit))
+   {
+      returnWriteBuffer(true);
+   }
+   //handle the pending data frames, up to the budget
+   for (unsigned int count = 0; (rxBudget == 0) || (count < rxBudget); ++count)
+   {
+      len = dataRxBuffer.top(&data);
+      if (len == 0) //no more data bytes?
+      {
+         break;
+      }
+      //data received in place is older than any frame in the ring (see receiveInPlace). the buffer is taken
+      //back, before the application gets data by writeToFile
+      if (lendBuffer != NULL)
+      {
+         returnWriteBuffer(true);
+      }
+      onDataFrame(data, len);
+      dataRxBuffer.pop(); //drop that bytes away
+   }
+   //lend the (next) buffer of a download to the data channel callback
+   if (lendDownload && (lendBuffer == NULL))
+   {
+      lendWriteBuffer();
+   }
+   //write the full blocks of a download, as soon as the previous ones are written
+   if (fileWriter.isOpen())
+   {
+      fileWriter.poll();
+   }
+
+   //handle transmission
+   switch (dataState)
+   {
+   case FILE_XFER_CMD_UPLOAD:
+      doFileUpload();
+      break;
+
+   case FILE_XFER_CMD_RESUME_UPLOAD:
+      doResumeUpload();
+      break;
+
+   case FILE_XFER_CMD_SIGNATURES:
+   case FILE_XFER_CMD_DELTA_UPLOAD:
+      doDeltaUpload();
+      break;
+
+   case FILE_XFER_CMD_DELTA_DOWNLOAD:
+      doDeltaDownload();
+      break;
+
+   case FILE_XFER_CMD_BUNDLE_UPLOAD:
+      doBundleUpload();
+      break;
+
+   default:
+      break;
+   }
+
+   //run the transfer slots
+   for (size_t idx = 0; idx < slots.size(); ++idx)
+   {
+      slots[idx]->task(time1ms);
+   }
+
+   //check for timeout
+   if (ctrlPending.empty() && (dataState == 0)) //idle?
+   {
+      timeout1ms = 0;
+   }
+   else if ((timeout1ms != 0) && (time1ms > timeout1ms))
+   {
+      doQuit(true);
+   }
+   else if (!ctrlPending.empty() && (ctrlPending.front().timeout1ms != 0) && (time1ms > ctrlPending.front().timeout1ms))
+   {
+      doQuit(true); //no response to the oldest request
+   }
+   if ((sync1ms != 0) && (time1ms > sync1ms)) //no echo of the resync quit (older server)
+   {
+      sync1ms = 0;
+   }
+}
+
+
+//The async functions are within the execution context of "Slay2" (slay2.task)!
+//This may be different to the context of "FileXferClient" (fileXferClient.task).
+//That means, these functions may be called aysnchronously!
+void FileXferClient::_onCtrlFrameAsync(void * const obj, const unsigned char * const data, const unsigned int len)
+{
+   if (len > 0)
+   {
+      //forward to member function
+      ((FileXferClient *)obj)->onCtrlFrameAsync(data, len);
+   }
+}
+void FileXferClient::onCtrlFrameAsync(const unsigned char * const data, const unsigned int len)
+{
+   //push data into buffer (lock-free. this is the only producer)
+   ctrlRxBuffer.push(data, len);
+}
+
+//this method is called "synchronously" by method "task()". It takes its data out of the buffer,
+//that was filled asynchronously!
+void FileXferClient::onCtrlFrame(const unsigned char * const data, const unsigned int len)
+{
+   //discard the responses to requests dropped by a timeout, up to the echo of the resync quit (see doQuit)
+   if (sync1ms != 0)
+   {
+      if ((len == 2) && (data[0] == FILE_XFER_CMD_ACK) && (data[1] == syncTag))
+      {
+         sync1ms = 0;
+      }
+      return;
+   }
+
+   //the server failed to send the data of the running download (e.g. read error): e<command>. it isn't a response,
+   //so it isn't matched to a request
+   if (data[0] == FILE_XFER_CMD_ERROR)
+   {
+      if ((len >= 2) && (data[1] != 0) && (data[1] == dataState) && !isTransferPending())
+      {
+         failDownload();
+      }
+      return;
+   }
+
+   //match the response to the oldest pending request (the server responds in order)
+   if (ctrlPending.empty()) //unexpected response (e.g. to a request dropped by a timeout)
+   {
+      return;
+   }
+   const unsigned int ctrlState = ctrlPending.front().command;
+   ctrlPending.pop_front();
+
+   //switch according to the copy
+   const int ack = (data[0] == FILE_XFER_CMD_ACK); //1 on ACK, 0 on NACK
+   switch (ctrlState)
+   {
+   case FILE_XFER_CMD_PWD:
+      app->onPwdResponse(ack, (const char *)&data[1]);
+      break;
+
+   case FILE_XFER_CMD_CD:
+      app->onCdResponse(ack, (const char *)&data[1]);
+      break;
+
+   case FILE_XFER_CMD_LS:
+      if (ack == 0) //negative acknowledge?
+      {
+         dataState = 0;
+         app->onLsResponse(ack, (const char *)&data[1]);
+      }
+      //there is nothing todo here, in case of positive ACK (see "onDataFrame" for this case)
+      break;
+
+   case FILE_XFER_CMD_DIR:
+      if (ack == 0) //negative acknowledge?
+      {
+         dataState = 0;
+         app->onDirResponse(ack, (const char *)&data[1]);
+      }
+      //there is nothing todo here, in case of positive ACK (see "onDataFrame" for this case)
+      break;
+
+   case FILE_XFER_CMD_CHANGES:
+   case FILE_XFER_CMD_FILTER:
+      if (ack == 0) //negative acknowledge?
+      {
+         completeListing(0);
+      }
+      else
+      {
+         //the response (token, or number of matching entries) is reported together with the listing (see "onDataFrame")
+         listResponse = (const char *)&data[1];
+         if (listReceived)
+         {
+            completeListing(1);
+         }
+      }
+      break;
+
+   case FILE_XFER_CMD_MKDIR:
+      app->onMkdirResponse(ack);
+      break;
+
+   case FILE_XFER_CMD_RM:
+      app->onRmResponse(ack);
+      break;
+
+   case FILE_XFER_CMD_DOWNLOAD:
+      if (ack == 0) //negative acknowledge?
+      {
+         dataState = 0;
+         app->onDownloadResponse(ack);
+      }
+      else
+      {
+         char * next;
+         downloadFileSize = strtoul((const char *)&data[1], &next, 10);
+         if (next[0] == ',') //compression decision of server (if compression was negotiated): ,<mode>,<entropy>
+         {
+            dataDecoder.stat.mode = next[1];
+            dataDecoder.stat.entropy = (next[1] != 0) && (next[2] == ',') ? strtoul(&next[3], NULL, 10) : 0;
+         }
+         if (downloadFileSize == 0) //nothing to download (empty file, or resumed download was already complete)
+         {
+            dataState = 0;
+            srcDstFile = app->closeFile(srcDstFile);
+            app->onDownloadResponse(1);
+         }
+         else
+         {
+            //the CRC of the data follows the data (if the integrity check was negotiated)
+            transferHashed = ((sessionFeatures & FILE_XFER_FEATURE_INTEGRITY) != 0);
+            transferCrc = 0;
+            //receive the data in place (if supported, see task). otherwise, the data is written block by block
+            lendDownload = ((sessionFeatures & FILE_XFER_FEATURE_COMPRESSION) == 0);
+            if (lendDownload)
+            {
+               lendWriteBuffer();
+            }
+            if (!lendDownload)
+            {
+               fileWriter.open(selectBlockIo(), srcDstFile, downloadOffset, downloadFileSize);
+            }
+         }
+      }
+      break;
+
+   case FILE_XFER_CMD_UPLOAD:
+      if (ack == 0) //negative acknowledge?
+      {
+         dataState = 0;
+         app->onUploadResponse(ack);
+      }
+      //there is nothing todo here, in case of positive ACK (see "onDataFrame" for this case)
+      break;
+
+   case FILE_XFER_CMD_SIZE:
+      //size of the part stored on server. resume behind that part. if the server has no such file,
+      //or the stored part is longer than my file, the whole file is uploaded (resume at offset 0)
+      resumeOffset = 0;
+      if (ack != 0)
+      {
+         resumeOffset = strtoul((const char *)&data[1], NULL, 10);
+         if (resumeOffset > uploadFileSize)
+         {
+            resumeOffset = 0;
+         }
+      }
+      resumeRemaining = resumeOffset; //checksum the prefix (see doResumeUpload)
+      resumeCrc = 0;
+      timeout1ms = 0;
+      break;
+
+   case FILE_XFER_CMD_RESUME_UPLOAD:
+      if (ack == 0) //negative acknowledge? -> stored part doesn't match. upload the whole file
+      {
+         dataState = 0;
+         srcDstFile = app->closeFile(srcDstFile);
+         if (uploadFile(uploadSource, uploadDestination) != 0)
+         {
+            app->onUploadResponse(0);
+         }
+      }
+      else
+      {
+         dataState = FILE_XFER_CMD_UPLOAD; //continue like a "normal" upload
+         uploadFileSize -= resumeOffset;
+         dataChunking.start(dataChannel, time1ms);
+         startUpload(srcDstFile, resumeOffset);
+      }
+      break;
+
+   case FILE_XFER_CMD_SIGNATURES:
+      if (ack == 0) //negative acknowledge? -> there is no such file on server. upload the whole file
+      {
+         dataState = 0;
+         srcDstFile = app->closeFile(srcDstFile);
+         if (uploadFile(uploadSource, uploadDestination) != 0)
+         {
+            app->onUploadResponse(0);
+         }
+      }
+      else
+      {
+         char * next;
+         deltaBlockSize = strtoul((const char *)&data[1], &next, 10);
+         deltaGenerator.reset(deltaBlockSize, (*next == ',') ? strtoul(next + 1, NULL, 10) : 0);
+         timeout1ms = time1ms + 3000; //signatures follow on data channel
+      }
+      break;
+
+   case FILE_XFER_CMD_DELTA_UPLOAD:
+      if (ack == 0) //negative acknowledge?
+      {
+         dataState = 0;
+         srcDstFile = app->closeFile(srcDstFile);
+         app->onUploadResponse(ack);
+      }
+      else
+      {
+         dataState = FILE_XFER_CMD_DELTA_UPLOAD; //make and send the delta (see doDeltaUpload)
+         outputSent = 0;
+         timeout1ms = 0;
+         dataChunking.start(dataChannel, time1ms);
+      }
+      break;
+
+   case FILE_XFER_CMD_DELTA_DOWNLOAD:
+      if (ack == 0) //negative acknowledge?
+      {
+         dataState = 0;
+         srcDstFile = app->closeFile(srcDstFile);
+         deltaBasisFile = app->closeFile(deltaBasisFile);
+         app->onDownloadResponse(ack);
+      }
+      else
+      {
+         downloadFileSize = strtoul((const char *)&data[1], NULL, 10);
+         deltaApplier.reset(deltaBlockSize, this);
+         dataChunking.start(dataChannel, time1ms); //send the signatures (see doDeltaDownload)
+      }
+      break;
+
+   case FILE_XFER_CMD_BUNDLE_DOWNLOAD:
+   case FILE_XFER_CMD_TREE_DOWNLOAD:
+      if (ack == 0) //negative acknowledge?
+      {
+         dataState = 0;
+         app->onDownloadResponse(ack);
+      }
+      //there is nothing todo here, in case of positive ACK (see "onDataFrame" for this case)
+      break;
+
+   case FILE_XFER_CMD_BUNDLE_UPLOAD:
+   case FILE_XFER_CMD_TREE_UPLOAD:
+      if (ack == 0) //negative acknowledge?
+      {
+         dataState = 0;
+         app->onUploadResponse(ack);
+      }
+      else
+      {
+         timeout1ms = 0;
+         outputSent = 0;
+         dataEncoder.reset(); //compression is decided per block
+         dataChunking.start(dataChannel, time1ms); //send the bundle (see doBundleUpload)
+      }
+      break;
+
+   case FILE_XFER_CMD_QUIT:
+      doQuit();
+      break;
+
+   case FILE_XFER_CMD_SESSION:
+      if (ack != 0)
+      {
+         const char * features = strchr((const char *)&data[1], ',');
+         dataChunking.setLimit(atoi((const char *)&data[1]));
+         sessionFeatures = (features != NULL) ? (strtoul(features + 1, NULL, 16) & FILE_XFER_FEATURES) : 0; //older servers don't reply features
+      }
+      if (session == this) //the response of a slot isn't reported
+      {
+         app->onSessionResponse(ack, dataChunking.getLimit());
+      }
+      break;
+
+   default: //IDLE
+      break;
+   }
+}
+
+
+//The async functions are within the execution context of "Slay2" (slay2.task)!
+//This may be different to the context of "FileXferClient" (fileXferClient.task).
+//That means, these functions may be called aysnchronously!
+void FileXferClient::_onDataFrameAsync(void * const obj, const unsigned char * const data, const unsigned int len)
+{
+   if (len > 0)
+   {
+      //forward to member function
+      ((FileXferClient *)obj)->onDataFrameAsync(data, len);
+   }
+}
+void FileXferClient::onDataFrameAsync(const unsigned char * const data, const unsigned int len)
+{
+   //receive a download into the buffer lent by the application. push (the rest of the) data into buffer
+   //(lock-free. this is the only producer)
+   const unsigned int received = lendActive.load(std::memory_order_acquire) ? receiveInPlace(data, len) : 0;
+   if (received < len)
+   {
+      dataRxBuffer.push(data + received, len - received);
+   }
+}
+
+
+//copy (the first part of) a frame of a download into the lent buffer, as long as there is no older frame in the
+//ring (so the data stays in order). the data of a download is a plain byte stream, so a frame may be split.
+//"lendBusy" tells returnWriteBuffer, that the buffer is in use. returns the number of bytes received
+unsigned int FileXferClient::receiveInPlace(const unsigned char * data, unsigned int len)
+{
+   unsigned int received = 0;
+   lendBusy.store(true);
+   if (lendActive.load() && dataRxBuffer.isEmpty())
+   {
+      const size_t fill = lendFill.load(std::memory_order_relaxed);
+      received = ((lendLimit - fill) < len) ? (unsigned int)(lendLimit - fill) : len;
+      memcpy(lendBuffer + fill, data, received);
+      lendFill.store(fill + received, std::memory_order_release);
+   }
+   lendBusy.store(false, std::memory_order_release);
+   return received;
+}
+
+
 //this method is called "synchronously" by method "task()". It takes its data out of the buffer,
 //that was filled asynchronously!
-void FileXferClient::onDataFrame(const unsigned char * const data, const unsigned int len)
+void FileXferClient::onDataFrame(const unsigned char * data, unsigned int len)
 {
+   //CRC of a download, following all of its data (not compressed): a<crc>\0
+   if ((dataState == FILE_XFER_CMD_DOWNLOAD) && transferHashed && (downloadFileSize == 0))
+   {
+      const bool match = (data[0] == FILE_XFER_CMD_ACK) &&
+                         ((uint32_t)strtoul((const char *)&data[1], NULL, 16) == transferCrc);
+      app->onIntegrityCheck(transferCrc, match);
+      completeDownload(match);
+      return;
+   }
+
+   //decompress listing and download data (if compression was negotiated)
+   if ((sessionFeatures & FILE_XFER_FEATURE_COMPRESSION) &&
+       ((dataState == FILE_XFER_CMD_LS) || (dataState == FILE_XFER_CMD_DIR) || (dataState == FILE_XFER_CMD_CHANGES) ||
+        (dataState == FILE_XFER_CMD_FILTER) || (dataState == FILE_XFER_CMD_DOWNLOAD) ||
+        (dataState == FILE_XFER_CMD_BUNDLE_DOWNLOAD)))
+   {
+      dataDecoder.output.clear();
+      if (!dataDecoder.feed(data, len))
+      {
+         //invalid data. notify application and cancel transfer
+         if ((dataState == FILE_XFER_CMD_LS) || (dataState == FILE_XFER_CMD_DIR) || (dataState == FILE_XFER_CMD_CHANGES) ||
+             (dataState == FILE_XFER_CMD_FILTER))
+         {
+            directoryList = "";
+            completeListing(0);
+         }
+         else
+         {
+            dataState = 0;
+            srcDstFile = app->closeFile(srcDstFile);
+            app->onDownloadResponse(0);
+         }
+         quit();
+         return;
+      }
+      if (dataDecoder.output.empty())
+      {
+         return; //wait for more data
+      }
+      len = dataDecoder.output.size();
+      dataDecoder.output.push_back(0); //zero terminate (like a received frame)
+      data = dataDecoder.output.data();
+   }
+
+   //binary listing (may contain zeros), or any listing delivered in batches. decoded into entries.
+   //a complete binary listing is reported in text format as well
+   const bool binary = ((sessionFeatures & FILE_XFER_FEATURE_BINARY_LISTING) != 0);
+   if ((binary || (listBatchSize != 0)) &&
+       ((dataState == FILE_XFER_CMD_LS) || (dataState == FILE_XFER_CMD_DIR) || (dataState == FILE_XFER_CMD_CHANGES) ||
+        (dataState == FILE_XFER_CMD_FILTER)))
+   {
+      timeout1ms = time1ms + 3000; //i got an response. so restart 3 seconds timeout
+      const int result = binary ? listReader.feed(data, len) : listReader.feedText(data, len);
+      if ((listBatchSize != 0) && !listReader.entries.empty() && ((listReader.entries.size() >= listBatchSize) || (result > 0)))
+      {
+         app->onListEntries(listReader.current, listReader.entries);
+         listReader.entries.clear();
+      }
+      if (result != 0) //end of listing (or invalid data)
+      {
+         if ((result > 0) && (listBatchSize == 0))
+         {
+            app->onListEntries(listReader.current, listReader.entries);
+            directoryList = listReader.toText();
+         }
+         completeListing((result > 0) ? 1 : 0);
+         if (result < 0)
+         {
+            quit();
+         }
+      }
+      return;
+   }
+
    switch (dataState)
    {
-      case FILE_XFER_CMD_LS:
+      case FILE_XFER_CMD_LS:
+      case FILE_XFER_CMD_DIR:
+      case FILE_XFER_CMD_CHANGES:
+      case FILE_XFER_CMD_FILTER:
+      {
+         timeout1ms = time1ms + 3000; //i got an response. so restart 3 seconds timeout
+         const unsigned char * end = (const unsigned char *)memchr(data, 0, len);
+         directoryList.append((const char *)data, (end != NULL) ? (size_t)(end - data) : len);
+         if (end != NULL) //end of listing
+         {
+            completeListing(1);
+         }
+         break;
+      }
+
+
+      case FILE_XFER_CMD_DOWNLOAD:
+      {
+         //do limitation
+         size_t dataLen = len;
+         if (dataLen > downloadFileSize)
+         {
+            dataLen = downloadFileSize;
+         }
+         //write data to file
+         if (fileWriter.isOpen())
+         {
+            fileWriter.write(data, dataLen);
+         }
+         else
+         {
+            app->writeToFile(srcDstFile, data, dataLen);
+         }
+         if (transferHashed)
+         {
+            transferCrc = crc32c(transferCrc, data, dataLen);
+         }
+         downloadFileSize -= dataLen;
+         if (downloadFileSize == 0) //end of data
+         {
+            endOfDownload();
+         }
+         break;
+      }
+
+
+      case FILE_XFER_CMD_UPLOAD:
+      {
+         dataState = 0;
+         //acknowledge of file upload expected here: a, or a<crc>\0 (if the integrity check was negotiated)
+         //notify application, that upload has completed (NACK, if server failed to store the file, or the
+         //CRC of the data the server received doesn't match)
+         bool status = (data[0] == FILE_XFER_CMD_ACK);
+         if (status && transferHashed)
+         {
+            status = (len > 1) && ((uint32_t)strtoul((const char *)&data[1], NULL, 16) == transferCrc);
+            app->onIntegrityCheck(transferCrc, status);
+         }
+         transferHashed = false;
+         if (sessionFeatures & FILE_XFER_FEATURE_COMPRESSION)
+         {
+            app->onCompressionStat(dataEncoder.stat);
+         }
+         app->onUploadResponse(status);
+         break;
+      }
+
+
+      case FILE_XFER_CMD_SIGNATURES:
+      {
+         timeout1ms = time1ms + 3000; //i got an response. so restart 3 seconds timeout
+         deltaGenerator.addSignatures(data, len);
+         break;
+      }
+
+
+      case FILE_XFER_CMD_DELTA_UPLOAD:
+      {
+         dataState = 0;
+         srcDstFile = app->closeFile(srcDstFile); //in case server failed, before the whole delta was sent
+         deltaGenerator.output.clear();
+         //acknowledge of delta upload expected here
+         //notify application, that upload has completed (NACK, if server failed to apply the delta)
+         app->onUploadResponse(data[0] == FILE_XFER_CMD_ACK);
+         break;
+      }
+
+
+      case FILE_XFER_CMD_BUNDLE_DOWNLOAD:
+      {
+         //store the files of the bundle
+         const int result = bundleReader.feed(data, len);
+         if (result != 0) //end of bundle (or invalid bundle)
+         {
+            dataState = 0;
+            srcDstFile = app->closeFile(srcDstFile); //incomplete file (if any)
+            //notify application about end of download (failure, if any file couldn't be stored)
+            if (sessionFeatures & FILE_XFER_FEATURE_COMPRESSION)
+            {
+               app->onCompressionStat(dataDecoder.stat);
+            }
+            app->onDownloadResponse((result > 0) && !bundleFailed);
+            if (result < 0)
+            {
+               quit(); //server may still be sending
+            }
+         }
+         break;
+      }
+
+
+      case FILE_XFER_CMD_BUNDLE_UPLOAD:
+      {
+         dataState = 0;
+         srcDstFile = app->closeFile(srcDstFile); //in case server failed, before the whole bundle was sent
+         bundleWriter.output.clear();
+         dataEncoder.output.clear();
+         //acknowledge of bundle upload expected here
+         //notify application, that upload has completed (failure, if any file couldn't be read or stored)
+         if (sessionFeatures & FILE_XFER_FEATURE_COMPRESSION)
+         {
+            app->onCompressionStat(dataEncoder.stat);
+         }
+         app->onUploadResponse((data[0] == FILE_XFER_CMD_ACK) && !bundleFailed);
+         break;
+      }
+
+
+      case FILE_XFER_CMD_DELTA_DOWNLOAD:
+      {
+         //apply delta. write the rebuilt file
+         const int result = deltaApplier.feed(data, len);
+         if (result != 0) //end of delta (or invalid delta)
+         {
+            dataState = 0;
+            //close files
+            srcDstFile = app->closeFile(srcDstFile);
+            deltaBasisFile = app->closeFile(deltaBasisFile);
+            //notify application about end of download
+            app->onDownloadResponse(result > 0);
+            if (result < 0)
+            {
+               quit(); //server may still be sending
+            }
+         }
+         break;
+      }
+   }
+}
+
+
+
+//report the end (or failure) of a listing to the application. a listing of changes (or a filtered listing)
+//is reported, as far as its response on control channel was received as well
+void FileXferClient::completeListing(int status)
+{
+   const unsigned char command = dataState;
+   if (((command == FILE_XFER_CMD_CHANGES) || (command == FILE_XFER_CMD_FILTER)) && (status != 0) && listResponse.empty())
+   {
+      listReceived = true; //wait for the response
+      return;
+   }
+   dataState = 0;
+   listReceived = false;
+   if (command == FILE_XFER_CMD_LS)
+   {
+      app->onLsResponse(status, directoryList);
+   }
+   else if (command == FILE_XFER_CMD_DIR)
+   {
+      app->onDirResponse(status, directoryList);
+   }
+   else if (command == FILE_XFER_CMD_CHANGES)
+   {
+      //response: <token>,<mode>
+      const size_t mode = listResponse.find(',');
+      const bool full = (mode == string::npos) || (listResponse.compare(mode, 2, ",D") != 0);
+      app->onChangesResponse(status, listResponse.substr(0, mode), full, directoryList);
+   }
+   else
+   {
+      app->onFilterResponse(status, strtoul(listResponse.c_str(), NULL, 10), directoryList);
+   }
+}
+
+
+//block I/O of the files of up- and downloads
+FileXferBlockIo * FileXferClient::selectBlockIo()
+{
+   FileXferBlockIo * io = app->getBlockIo();
+   if (io == NULL) //by the file operations of the application
+   {
+      appBlockIo.app = app;
+      io = &appBlockIo;
+   }
+   return io;
+}
+
+
+//start sending the file data of an upload, beginning at "offset". the file is read block by block (ahead of
+//sending). start compression of the upload (if compression was negotiated): sample the first blocks of the
+//file, to decide if the file is worth to be compressed. if the application doesn't support "readFromFileAt",
+//the decision is made per block.
+void FileXferClient::startUpload(FileXferClientApp::FileHandle_t file, size_t offset)
+{
+   outputSent = 0;
+   transferHashed = ((sessionFeatures & FILE_XFER_FEATURE_INTEGRITY) != 0);
+   transferCrc = 0;
+   if (sessionFeatures & FILE_XFER_FEATURE_COMPRESSION)
+   {
+      uploadBuffer.resize(FILE_XFER_COMPRESS_SAMPLE_SIZE);
+      dataEncoder.resetBySample(uploadBuffer.data(), app->readFromFileAt(file, 0, uploadBuffer.data(), uploadBuffer.size()));
+   }
+   fileReader.open(selectBlockIo(), file, offset, uploadFileSize);
+}
+
+
+void FileXferClient::closeUploadFile()
+{
+   fileReader.close();
+   srcDstFile = app->closeFile(srcDstFile);
+}
+
+
+void FileXferClient::doFileUpload()
+{
+   if (isTransferPending()) //waiting for the acknowledge. the server may defer the request, while it is busy
+   {
+      return;
+   }
+   const unsigned int chunkSize = dataChunking.getChunkSize(time1ms);
+
+   //compress file block by block (if compression was negotiated)
+   if (sessionFeatures & FILE_XFER_FEATURE_COMPRESSION)
+   {
+      while (dataChannel->getTxBufferSpace() >= chunkSize)
+      {
+         //send pending compressed data
+         if (outputSent < dataEncoder.output.size())
+         {
+            unsigned int count = chunkSize;
+            if (count > (dataEncoder.output.size() - outputSent))
+            {
+               count = dataEncoder.output.size() - outputSent;
+            }
+            dataChannel->send(&dataEncoder.output[outputSent], count);
+            dataChunking.onSent(count);
+            outputSent += count;
+            continue;
+         }
+         dataEncoder.output.clear();
+         outputSent = 0;
+         if (srcDstFile == FILE_XFER_CLIENT_INVALID_FILE_HANDLE)
+         {
+            break; //all data sent
+         }
+
+         //compress next block of the file
+         const unsigned char * data;
+         size_t count = fileReader.peek(&data);
+         if ((count == 0) && !fileReader.isEnd())
+         {
+            break; //wait for the block being read
+         }
+         if (count > FILE_XFER_COMPRESS_BLOCK_SIZE)
+         {
+            count = FILE_XFER_COMPRESS_BLOCK_SIZE;
+         }
+         if (count > 0)
+         {
+            dataEncoder.encode(data, count);
+            if (transferHashed)
+            {
+               transferCrc = crc32c(transferCrc, data, count);
+            }
+            fileReader.consume(count);
+         }
+         uploadFileSize = (uploadFileSize > count) ? (uploadFileSize - count) : 0;
+         if (fileReader.isEnd())
+         {
+            closeUploadFile();
+         }
+      }
+      return;
+   }
+
+   //if there are data for upload, we must ensure that there is enough free space in tx buffer
+   while ((uploadFileSize != 0) &&
+          (dataChannel->getTxBufferSpace() >= chunkSize))
+   {
+      //send data of the file, as far as it was read
+      const unsigned char * data;
+      size_t count = fileReader.peek(&data);
+      if ((count == 0) && !fileReader.isEnd())
+      {
+         break; //wait for the block being read
+      }
+      if (count > chunkSize)
+      {
+         count = chunkSize;
+      }
+      if (count > 0)
+      {
+         dataChannel->send(data, count);
+         dataChunking.onSent(count);
+         if (transferHashed)
+         {
+            transferCrc = crc32c(transferCrc, data, count);
+         }
+         fileReader.consume(count);
+      }
+
+      //handle end of file
+      if (uploadFileSize > count)
+      {
+         uploadFileSize -= count;
+      }
+      else
+      {
+         uploadFileSize = 0;
+      }
+      if ((count == 0) || (uploadFileSize == 0))
+      {
+         closeUploadFile();
+         break; //nothing more to read
+      }
+   }
+   //nothing to upload at all (e.g. resumed upload of a file, that was already complete)
+   if ((uploadFileSize == 0) && (srcDstFile != FILE_XFER_CLIENT_INVALID_FILE_HANDLE))
+   {
+      closeUploadFile();
+   }
+}
+
+
+//checksum the prefix of the file (up to resume offset) and request server to resume the upload.
+//the prefix is read a bunch of bytes per call. afterwards, the file is positioned at the resume offset.
+void FileXferClient::doResumeUpload()
+{
+   if (isTransferPending()) //waiting for a response
+   {
+      return;
+   }
+   size_t budget = 256 * 1024; //limit the time spent per call
+   while ((resumeRemaining > 0) && (budget > 0))
+   {
+      unsigned char buffer[4096];
+      size_t count = (resumeRemaining < sizeof(buffer)) ? resumeRemaining : sizeof(buffer);
+      count = app->readFromFile(srcDstFile, buffer, count);
+      if (count == 0) //read error -> send anyway. the checksum won't match, so the whole file will be uploaded
+      {
+         resumeRemaining = 0;
+         break;
+      }
+      resumeCrc = crc32c(resumeCrc, buffer, count);
+      resumeRemaining -= count;
+      budget = (budget > count) ? (budget - count) : 0;
+   }
+   if (resumeRemaining == 0)
+   {
+      //request server to resume
+      unsigned int dstLength = uploadDestination.length();
+      if (ctrlChannel->getTxBufferSpace() > (dstLength + 42)) //command byte, 2 decimal numbers, 1 hex number and 3 KOMMAs
+      {
+         const unsigned char command = FILE_XFER_CMD_RESUME_UPLOAD;
+         char buffer[48];
+         int len;
+
+         ctrlChannel->send(&command, 1, true);
+         ctrlChannel->send((const unsigned char *)uploadDestination.c_str(), dstLength, true);
+         len = sprintf(buffer, ",%lu,%lu,%08x", (unsigned long)resumeOffset, (unsigned long)(uploadFileSize - resumeOffset), (unsigned int)resumeCrc);
+         ctrlChannel->send((const unsigned char *)buffer, len + 1); //include zero termination
+         pushRequest(FILE_XFER_CMD_RESUME_UPLOAD, true);
+         //can't set a timeout her, as i don't know how long it takes the server to verify its stored data
+      }
+   }
+}
+
+
+//make the delta of the source file and send it to server (a bunch of bytes per call).
+//before, wait for all signatures of the servers version of the file and request server to accept the delta.
+void FileXferClient::doDeltaUpload()
+{
+   if (isTransferPending()) //waiting for a response
+   {
+      return;
+   }
+   if (dataState == FILE_XFER_CMD_SIGNATURES)
+   {
+      //request server to accept the delta, as far as all signatures were received
+      unsigned int dstLength = uploadDestination.length();
+      if (deltaGenerator.hasAllSignatures() && (ctrlChannel->getTxBufferSpace() > (dstLength + 12))) //command byte, KOMMA and block size
       {
-         timeout1ms = time1ms + 3000; //i got an response. so restart 3 seconds timeout
-         directoryList += (const char *)data;
-         if (data[len -1] == 0) //end of listing
+         const unsigned char command = FILE_XFER_CMD_DELTA_UPLOAD;
+         char buffer[16];
+         int len;
+
+         ctrlChannel->send(&command, 1, true);
+         ctrlChannel->send((const unsigned char *)uploadDestination.c_str(), dstLength, true);
+         len = sprintf(buffer, ",%u", deltaBlockSize);
+         ctrlChannel->send((const unsigned char *)buffer, len + 1); //include zero termination
+         pushRequest(FILE_XFER_CMD_DELTA_UPLOAD, true);
+         timeout1ms = time1ms + 3000; //force quit, if there is no response withing 3 seconds
+      }
+      return;
+   }
+
+   //send delta
+   const unsigned int chunkSize = dataChunking.getChunkSize(time1ms);
+   size_t budget = 256 * 1024; //limit the time spent per call
+   while ((dataChannel->getTxBufferSpace() >= chunkSize) && (budget > 0))
+   {
+      //send pending output
+      if (outputSent < deltaGenerator.output.size())
+      {
+         unsigned int count = chunkSize;
+         if (count > (deltaGenerator.output.size() - outputSent))
          {
-            dataState = 0;
-            app->onLsResponse(1, directoryList);
+            count = deltaGenerator.output.size() - outputSent;
          }
-         break;
+         dataChannel->send(&deltaGenerator.output[outputSent], count);
+         dataChunking.onSent(count);
+         outputSent += count;
+         continue;
+      }
+      deltaGenerator.output.clear();
+      outputSent = 0;
+      if (srcDstFile == FILE_XFER_CLIENT_INVALID_FILE_HANDLE)
+      {
+         break; //whole delta sent. waiting for the servers acknowledge (see onDataFrame)
       }
 
+      //read out file and make (more) delta
+      unsigned char buffer[4096];
+      size_t count = (uploadFileSize < sizeof(buffer)) ? uploadFileSize : sizeof(buffer);
+      if (count > 0)
+      {
+         count = app->readFromFile(srcDstFile, buffer, count);
+         deltaGenerator.feed(buffer, count);
+      }
+      uploadFileSize = (uploadFileSize > count) ? (uploadFileSize - count) : 0;
+      budget = (budget > count) ? (budget - count) : 0;
 
-      case FILE_XFER_CMD_DIR:
+      //handle end of file
+      if ((count == 0) || (uploadFileSize == 0))
       {
-         timeout1ms = time1ms + 3000; //i got an response. so restart 3 seconds timeout
-         directoryList += (const char *)data;
-         if (data[len -1] == 0) //end of listing
-         {
-            dataState = 0;
-            app->onDirResponse(1, directoryList);
-         }
-         break;
+         deltaGenerator.finish();
+         srcDstFile = app->closeFile(srcDstFile); //close file
       }
+   }
+}
 
 
-      case FILE_XFER_CMD_DOWNLOAD:
+//sign the basis and send the signatures to server (a bunch of bytes per call).
+//the delta, the server responds, is handled by onDataFrame.
+void FileXferClient::doDeltaDownload()
+{
+   if (isTransferPending()) //waiting for a response
+   {
+      return;
+   }
+   const unsigned int chunkSize = dataChunking.getChunkSize(time1ms);
+   size_t budget = 256 * 1024; //limit the time spent per call
+   while ((dataChannel->getTxBufferSpace() >= chunkSize) && (budget > 0))
+   {
+      //send pending signatures
+      if (outputSent < deltaSignatures.output.size())
       {
-         //do limitation
-         size_t dataLen = len;
-         if (dataLen > downloadFileSize)
-         {
-            dataLen = downloadFileSize;
-         }
-         //write data to file
-         app->writeToFile(srcDstFile, data, dataLen);
-         downloadFileSize -= dataLen;
-         if (downloadFileSize == 0) //end of data
+         unsigned int count = chunkSize;
+         if (count > (deltaSignatures.output.size() - outputSent))
          {
-            dataState = 0;
-            //close file
-            srcDstFile = app->closeFile(srcDstFile);
-            //notify application about end of download
-            app->onDownloadResponse(1);
+            count = deltaSignatures.output.size() - outputSent;
          }
-         break;
+         dataChannel->send(&deltaSignatures.output[outputSent], count);
+         dataChunking.onSent(count);
+         outputSent += count;
+         continue;
+      }
+      deltaSignatures.output.clear();
+      outputSent = 0;
+      if (deltaRemaining == 0)
+      {
+         break; //all signatures sent
       }
 
-
-      case FILE_XFER_CMD_UPLOAD:
+      //read out basis and sign it
+      unsigned char buffer[4096];
+      size_t count = (deltaRemaining < sizeof(buffer)) ? deltaRemaining : sizeof(buffer);
+      count = app->readFromFile(deltaBasisFile, buffer, count);
+      if (count == 0) //read error -> server can't get all signatures. cancel download
       {
+         deltaRemaining = 0;
+         srcDstFile = app->closeFile(srcDstFile);
+         deltaBasisFile = app->closeFile(deltaBasisFile);
          dataState = 0;
-         //acknowledge of file upload expected here
-         //if (data[0] == FILE_XFER_CMD_ACK) {
-         //notify application, that upload has completed
-         app->onUploadResponse(1);
-         break;
+         app->onDownloadResponse(0);
+         quit();
+         return;
       }
+      deltaSignatures.feed(buffer, count);
+      deltaRemaining -= count;
+      budget = (budget > count) ? (budget - count) : 0;
    }
 }
 
 
+//read from the basis of a delta download
+size_t FileXferClient::readBasis(size_t offset, unsigned char * buffer, size_t len)
+{
+   return app->readFromFileAt(deltaBasisFile, offset, buffer, len);
+}
+
 
-void FileXferClient::doFileUpload()
+//write to the destination of a delta download
+void FileXferClient::writeTarget(const unsigned char * data, size_t len)
 {
-   //if there are data for upload, we must ensure that there is enough free space in tx buffer
-   while ((uploadFileSize != 0) &&
-          (dataChannel->getTxBufferSpace() >= 256))
-   {
-      unsigned char buffer[256];
-      unsigned int count;
+   app->writeToFile(srcDstFile, data, len);
+}
 
-      //read out file and send data to server
-      count = app->readFromFile(srcDstFile, buffer, sizeof(buffer));
-      if (count > 0)
+
+//send the files of a bundle upload (a bunch of bytes per call). each file is preceded by its header.
+//files that can't be read, are skipped. the result of the upload is handled by onDataFrame.
+//without compression, the file data is sent as it is read. with compression, headers and file data are
+//collected and compressed block by block.
+void FileXferClient::doBundleUpload()
+{
+   if (isTransferPending()) //waiting for a response
+   {
+      return;
+   }
+   const bool compressed = ((sessionFeatures & FILE_XFER_FEATURE_COMPRESSION) != 0);
+   vector<unsigned char>& output = compressed ? dataEncoder.output : bundleWriter.output;
+   const unsigned int chunkSize = dataChunking.getChunkSize(time1ms);
+   size_t budget = 256 * 1024; //limit the time spent per call
+   while ((dataChannel->getTxBufferSpace() >= chunkSize) && (budget > 0))
+   {
+      //send pending output
+      if (outputSent < output.size())
+      {
+         unsigned int count = chunkSize;
+         if (count > (output.size() - outputSent))
+         {
+            count = output.size() - outputSent;
+         }
+         dataChannel->send(&output[outputSent], count);
+         dataChunking.onSent(count);
+         outputSent += count;
+         continue;
+      }
+      output.clear();
+      outputSent = 0;
+      if (bundleIndex > bundleSources.size())
       {
-         dataChannel->send(buffer, count);
+         break; //whole bundle sent. waiting for the servers acknowledge (see onDataFrame)
       }
 
-      //handle end of file
-      if (uploadFileSize > count)
+      if (srcDstFile == FILE_XFER_CLIENT_INVALID_FILE_HANDLE)
       {
-         uploadFileSize -= count;
+         //header of the next file (or end of bundle)
+         if (bundleIndex < bundleSources.size())
+         {
+            const string& source = bundleSources[bundleIndex];
+            const size_t slash = source.find_last_of("/\\");
+            const string name = bundleTree ? source : ((slash != string::npos) ? source.substr(slash + 1) : source);
+            if (bundleTree && !addBundleDirectories(name))
+            {
+               bundleFailed = true; //skip that name
+            }
+            else if (bundleTree && (name[name.length() - 1] == '/'))
+            {
+               //directory only
+            }
+            else if ((bundleTree || FileXferBundleWriter::isValidName(name)) && app->openFileForRead(bundleTree ? (bundleRoot + name) : source, &srcDstFile))
+            {
+               uploadFileSize = app->getFileSize(srcDstFile);
+               bundleWriter.addFile(name, uploadFileSize, app->getFileTime(srcDstFile));
+            }
+            else
+            {
+               srcDstFile = FILE_XFER_CLIENT_INVALID_FILE_HANDLE;
+               bundleFailed = true; //skip that file
+            }
+         }
+         else
+         {
+            bundleWriter.finish();
+         }
+         ++bundleIndex;
+      }
+      else if (uploadFileSize == 0) //end of file
+      {
+         srcDstFile = app->closeFile(srcDstFile);
       }
       else
       {
-         uploadFileSize = 0;
+         //read out file
+         uploadBuffer.resize(compressed ? FILE_XFER_COMPRESS_BLOCK_SIZE : chunkSize);
+         size_t count = (uploadFileSize < uploadBuffer.size()) ? uploadFileSize : uploadBuffer.size();
+         count = app->readFromFile(srcDstFile, uploadBuffer.data(), count);
+         if (count == 0) //read error -> the size given by the header can't be kept. cancel upload
+         {
+            dataState = 0;
+            srcDstFile = app->closeFile(srcDstFile);
+            app->onUploadResponse(0);
+            quit();
+            return;
+         }
+         if (compressed)
+         {
+            bundleWriter.output.insert(bundleWriter.output.end(), uploadBuffer.data(), uploadBuffer.data() + count);
+         }
+         else
+         {
+            dataChannel->send(uploadBuffer.data(), count);
+            dataChunking.onSent(count);
+         }
+         uploadFileSize -= count;
+         budget = (budget > count) ? (budget - count) : 0;
       }
-      if ((count == 0) || (uploadFileSize == 0))
+
+      //compress the collected data. full blocks only, unless the bundle is complete
+      if (compressed)
       {
-         srcDstFile = app->closeFile(srcDstFile); //close file
+         const size_t count = (bundleIndex > bundleSources.size()) ? bundleWriter.output.size() :
+                              (bundleWriter.output.size() / FILE_XFER_COMPRESS_BLOCK_SIZE) * FILE_XFER_COMPRESS_BLOCK_SIZE;
+         if (count > 0)
+         {
+            dataEncoder.encode(bundleWriter.output.data(), count);
+            bundleWriter.output.erase(bundleWriter.output.begin(), bundleWriter.output.begin() + count);
+         }
       }
    }
 }
 
 
-void FileXferClient::doQuit()
+//append the directory records of a tree upload, needed for the given name. that are its parent directories,
+//unless they were already sent. a name ending with '/' is a directory itself.
+//return false, if the name isn't a valid path
+bool FileXferClient::addBundleDirectories(const std::string& name)
+{
+   const size_t slash = name.find_last_of('/');
+   const string path = (slash != string::npos) ? name.substr(0, slash) : string();
+   if (!FileXferBundleWriter::isValidPath((slash + 1 == name.length()) ? path : name))
+   {
+      return false;
+   }
+   //send each directory of the path, that isn't a parent of (or equal to) the last one sent
+   const string last = bundleDirectory + '/';
+   size_t end = 0;
+   while ((end != string::npos) && !path.empty())
+   {
+      end = path.find('/', end + 1);
+      const string dir = path.substr(0, end);
+      if (last.compare(0, dir.length() + 1, dir + '/') != 0)
+      {
+         bundleWriter.addDirectory(dir);
+      }
+   }
+   bundleDirectory = path;
+   return true;
+}
+
+
+//create a file of a bundle download
+bool FileXferClient::beginFile(const std::string& name, unsigned long long size, unsigned long long mtime)
+{
+   bundleFileName = bundleDestination + name;
+   bundleFileTime = mtime;
+   if (app->openFileForWrite(bundleFileName, &srcDstFile))
+   {
+      return true;
+   }
+   srcDstFile = FILE_XFER_CLIENT_INVALID_FILE_HANDLE;
+   bundleFailed = true; //skip that file
+   return false;
+}
+
+
+//write to a file of a bundle download
+void FileXferClient::writeFile(const unsigned char * data, size_t len)
+{
+   app->writeToFile(srcDstFile, data, len);
+}
+
+
+//complete a file of a bundle download
+void FileXferClient::endFile()
+{
+   srcDstFile = app->closeFile(srcDstFile);
+   if (bundleFileTime != 0)
+   {
+      app->setFileTime(bundleFileName, bundleFileTime);
+   }
+}
+
+
+//create a directory of a tree download
+void FileXferClient::createDirectory(const std::string& name)
+{
+   if (!app->createDirectory(bundleDestination + name))
+   {
+      bundleFailed = true; //the files of that directory will fail as well
+   }
+}
+
+
+//all data of a download was received. the CRC of the server is waited for, if the integrity check was negotiated
+//(see onDataFrame)
+void FileXferClient::endOfDownload()
+{
+   if (transferHashed)
+   {
+      lendDownload = false;
+      timeout1ms = time1ms + 3000; //force quit, if there is no CRC withing 3 seconds
+      return;
+   }
+   completeDownload();
+}
+
+
+//"intact": the CRC of the received data matches the one of the server (or wasn't checked)
+void FileXferClient::completeDownload(bool intact)
+{
+   dataState = 0;
+   lendDownload = false;
+   transferHashed = false;
+   //write the rest of the data and close file
+   const bool written = !fileWriter.isOpen() || fileWriter.flush();
+   fileWriter.close();
+   srcDstFile = app->closeFile(srcDstFile);
+   //notify application about end of download
+   if (sessionFeatures & FILE_XFER_FEATURE_COMPRESSION)
+   {
+      app->onCompressionStat(dataDecoder.stat);
+   }
+   app->onDownloadResponse((intact && written) ? 1 : 0);
+}
+
+
+//the server failed to send the data of the running download (see FILE_XFER_CMD_ERROR). it is idle already,
+//so there is nothing to quit. the data received so far is dropped (the server dropped the rest)
+void FileXferClient::failDownload()
+{
+   unsigned char * frame;
+   while (dataRxBuffer.top(&frame) != 0)
+   {
+      dataRxBuffer.pop();
+   }
+   dataState = 0;
+   timeout1ms = 0;
+   downloadFileSize = 0;
+   transferHashed = false;
+   lendDownload = false;
+   if (lendBuffer != NULL)
+   {
+      returnWriteBuffer(false);
+   }
+   fileWriter.close();
+   srcDstFile = app->closeFile(srcDstFile);
+   deltaBasisFile = app->closeFile(deltaBasisFile);
+   app->onDownloadResponse(0);
+}
+
+
+//let the data channel callback receive a download directly into a buffer of the application (only the data of
+//an uncompressed download is stored as is)
+void FileXferClient::lendWriteBuffer()
+{
+   const size_t size = app->getWriteBuffer(srcDstFile, &lendBuffer);
+   if ((size == 0) || (lendBuffer == NULL)) //not supported. the data is passed by writeToFile
+   {
+      lendBuffer = NULL;
+      lendDownload = false;
+      return;
+   }
+   lendLimit = (size < downloadFileSize) ? size : downloadFileSize;
+   lendFill.store(0, std::memory_order_relaxed);
+   lendActive.store(true); //publishes buffer, limit and fill
+}
+
+
+//take back the lent buffer from the data channel callback. "commit" hands the received data to the application
+void FileXferClient::returnWriteBuffer(bool commit)
+{
+   lendActive.store(false);
+   while (lendBusy.load()) //the callback may be copying a frame right now
+   {
+      std::this_thread::yield();
+   }
+   const size_t fill = lendFill.load(std::memory_order_acquire);
+   const unsigned char * const buffer = lendBuffer;
+   lendBuffer = NULL;
+   if (!commit)
+   {
+      return;
+   }
+   if (transferHashed)
+   {
+      transferCrc = crc32c(transferCrc, buffer, fill); //before the application may change the data
+   }
+   app->commitWriteBuffer(srcDstFile, fill);
+   downloadFileSize -= fill;
+   if (downloadFileSize == 0) //end of data
+   {
+      endOfDownload();
+   }
+}
+
+
+//quit the ongoing transfer and drop all pending requests. on a timeout (resync), the responses to the dropped
+//requests may still arrive, and must not be matched to later requests. so the server is quit by a tagged quit,
+//that it echoes. all responses up to the echo are discarded. no request may be sent meanwhile
+void FileXferClient::doQuit(bool resync)
 {
    timeout1ms = 0;
-   ctrlState = 0;
+   ctrlPending.clear();
    dataState = 0;
    uploadFileSize = 0;
    downloadFileSize = 0;
-   //close file (if open)
+   transferHashed = false;
+   lendDownload = false;
+   if (lendBuffer != NULL)
+   {
+      returnWriteBuffer(false); //received data is dropped
+   }
+   //close file (if open). a block read or written right now is waited for
+   fileReader.close();
+   fileWriter.close();
    srcDstFile = app->closeFile(srcDstFile);
+   deltaBasisFile = app->closeFile(deltaBasisFile);
+   deltaSignatures.output.clear();
+   deltaGenerator.output.clear();
+   bundleWriter.output.clear();
+   dataEncoder.output.clear();
    //flush communication channels
    ctrlChannel->flushTxBuffer();
    dataChannel->flushTxBuffer();
+   if (resync)
+   {
+      syncTag = (syncTag % 255) + 1; //never 0 (e.g. the response "a\0" of an empty result)
+      const unsigned char command[2] = { FILE_XFER_CMD_QUIT, syncTag };
+      ctrlChannel->send(command, 2);
+      sync1ms = time1ms + 3000; //older servers reply a plain ACK. so give up waiting for the echo after 3 seconds
+   }
    //notify application
    app->onQuitResponse(1);
 }
@@ -595,6 +2214,168 @@ void FileXferClient::doQuit()
 
 bool FileXferClient::isIdle()
 {
-   return ((ctrlState == 0) && (dataState == 0));
+   for (size_t idx = 0; idx < slots.size(); ++idx)
+   {
+      if (!slots[idx]->isIdle())
+      {
+         return false;
+      }
+   }
+   return (ctrlPending.empty() && (dataState == 0) && (sync1ms == 0));
+}
+
+
+//task has to be run again, without waiting for input: received frames are pending, or data is to be
+//sent (as far as there is TX buffer space). checks all slots. a transfer waiting for a response (e.g. the
+//acknowledge of an upload) waits for input, so it has no TX work
+bool FileXferClient::hasTxWork()
+{
+   for (size_t idx = 0; idx < slots.size(); ++idx)
+   {
+      if (slots[idx]->hasTxWork())
+      {
+         return true;
+      }
+   }
+   if (!ctrlRxBuffer.isEmpty() || !dataRxBuffer.isEmpty() ||
+       ((lendBuffer != NULL) && (lendFill.load(std::memory_order_acquire) == lendLimit)) || //lent buffer is full
+       fileWriter.isPending()) //poll for the completion of a block being written
+   {
+      return true;
+   }
+   if ((dataState == 0) || isTransferPending())
+   {
+      return false;
+   }
+   switch (dataState)
+   {
+   case FILE_XFER_CMD_UPLOAD: //the file is closed, as soon as all of it is read
+      return (srcDstFile != FILE_XFER_CLIENT_INVALID_FILE_HANDLE) || (outputSent < dataEncoder.output.size());
+
+   case FILE_XFER_CMD_RESUME_UPLOAD: //checksum the prefix and request to resume
+      return true;
+
+   case FILE_XFER_CMD_SIGNATURES: //request to accept the delta, as soon as all signatures were received
+      return deltaGenerator.hasAllSignatures();
+
+   case FILE_XFER_CMD_DELTA_UPLOAD:
+      return (srcDstFile != FILE_XFER_CLIENT_INVALID_FILE_HANDLE) || (outputSent < deltaGenerator.output.size());
+
+   case FILE_XFER_CMD_DELTA_DOWNLOAD: //the delta is received afterwards
+      return (deltaRemaining > 0) || (outputSent < deltaSignatures.output.size());
+
+   case FILE_XFER_CMD_BUNDLE_UPLOAD:
+      return (bundleIndex <= bundleSources.size()) ||
+             (outputSent < (((sessionFeatures & FILE_XFER_FEATURE_COMPRESSION) != 0) ? dataEncoder.output.size() : bundleWriter.output.size()));
+
+   default:
+      return false;
+   }
+}
+
+
+//earliest timeout of this client and all its slots. the timeout is checked by task, so task has to be
+//run after that time (even without input)
+unsigned long FileXferClient::getNextTimeout1ms()
+{
+   unsigned long next = 0;
+   if (!ctrlPending.empty() || (dataState != 0)) //timeouts are only checked while busy
+   {
+      next = timeout1ms;
+      if (!ctrlPending.empty() && (ctrlPending.front().timeout1ms != 0) &&
+          ((next == 0) || (ctrlPending.front().timeout1ms < next)))
+      {
+         next = ctrlPending.front().timeout1ms;
+      }
+   }
+   if ((sync1ms != 0) && ((next == 0) || (sync1ms < next)))
+   {
+      next = sync1ms;
+   }
+   for (size_t idx = 0; idx < slots.size(); ++idx)
+   {
+      const unsigned long timeout = slots[idx]->getNextTimeout1ms();
+      if ((timeout != 0) && ((next == 0) || (timeout < next)))
+      {
+         next = timeout;
+      }
+   }
+   return next;
+}
+
+
+//add a transfer slot. the slot is a client on its own pair of control and data channel (connected to a slot
+//of the server). transfers are run by the slot, while this client is busy. the slot reports to its own
+//application (which may be the application of this client). the slot is run by the task of this client.
+void FileXferClient::addSlot(FileXferClient * slot)
+{
+   slot->session = this;
+   slots.push_back(slot);
+}
+
+
+//select the client to run a transfer: this one, if idle. otherwise an idle slot.
+//NULL, if all are busy, or if a change of the working directory is pending. as a slot uses other channels,
+//its request could overtake the change.
+FileXferClient * FileXferClient::selectSlot()
+{
+   if (dataState == 0)
+   {
+      return this;
+   }
+   for (size_t idx = 0; idx < ctrlPending.size(); ++idx)
+   {
+      if ((ctrlPending[idx].command == FILE_XFER_CMD_CD) || (ctrlPending[idx].command == FILE_XFER_CMD_DIR))
+      {
+         return NULL;
+      }
+   }
+   for (size_t idx = 0; idx < slots.size(); ++idx)
+   {
+      if (slots[idx]->dataState == 0)
+      {
+         return slots[idx];
+      }
+   }
+   return NULL;
+}
+
+
+unsigned int FileXferClient::getPendingRequests()
+{
+   return ctrlPending.size();
+}
+
+
+//a further request may be sent, if the in-flight window isn't full. no request may follow a quit,
+//until the quit has completed (or a resync, see doQuit)
+bool FileXferClient::canRequest()
+{
+   return (sync1ms == 0) && (ctrlPending.size() < FILE_XFER_CLIENT_PIPELINE_DEPTH) &&
+          (ctrlPending.empty() || (ctrlPending.back().command != FILE_XFER_CMD_QUIT));
+}
+
+
+void FileXferClient::pushRequest(unsigned char command, bool transfer, unsigned long timeout1ms)
+{
+   FileXferClientRequest request;
+   request.command = command;
+   request.transfer = transfer;
+   request.timeout1ms = timeout1ms;
+   ctrlPending.push_back(request);
+}
+
+
+//check if the data-transfer waits for the response of one of its requests
+bool FileXferClient::isTransferPending()
+{
+   for (size_t idx = 0; idx < ctrlPending.size(); ++idx)
+   {
+      if (ctrlPending[idx].transfer)
+      {
+         return true;
+      }
+   }
+   return false;
 }
 
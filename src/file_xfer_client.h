@@ -8,12 +8,30 @@
 #define FILE_XFER_CLIENT_H
 
 /* -- Includes ------------------------------------------------------------ */
+#include <stdint.h>
 #include <string.h>
+#include <atomic>
+#include <deque>
+#include <string>
+#include <vector>
 #include "slay2.h"
+#include "spscring.h"
+#include "file_xfer.h"
+#include "file_xfer_delta.h"
+#include "file_xfer_compress.h"
+#include "file_xfer_bundle.h"
+#include "file_xfer_list.h"
+#include "file_xfer_io.h"
 
 
 /* -- Defines ------------------------------------------------------------- */
 #define FILE_XFER_CLIENT_INVALID_FILE_HANDLE   ((void *)-1)
+#ifndef FILE_XFER_CLIENT_PIPELINE_DEPTH
+#define FILE_XFER_CLIENT_PIPELINE_DEPTH        (8)   //max. number of requests awaiting their response (in-flight window)
+#endif
+#ifndef FILE_XFER_CLIENT_RX_BUDGET
+#define FILE_XFER_CLIENT_RX_BUDGET             (64)  //max. number of data frames processed per task (0 = no limit)
+#endif
 
 
 /* -- Types --------------------------------------------------------------- */
@@ -33,19 +51,62 @@ public:
    virtual void onDownloadResponse(int status) = 0;
    virtual void onUploadResponse(int status) = 0;
    virtual void onQuitResponse(int status) = 0;
+   virtual void onSessionResponse(int status, unsigned int chunkSize) { } //optional
+   virtual void onCompressionStat(const FileXferCompressStat& stat) { } //optional (called before the response of a compressed up-/download)
+   virtual void onChangesResponse(int status, const std::string& token, bool full, const std::string& list) { } //optional. full: complete listing, not just the changes
+   virtual void onFilterResponse(int status, unsigned long total, const std::string& list) { } //optional. total: number of matching entries
+   virtual void onListEntries(const std::string& current, const std::vector<FileXferStat>& entries) { } //optional (called before the response of a binary listing, or per batch, see setListBatchSize)
+   virtual void onIntegrityCheck(uint32_t crc, bool match) { } //optional (called before the response of an up-/download, if the integrity check was negotiated). CRC-32C of the transferred data
 
    //file operation
    virtual bool openFileForRead(const std::string& file, FileHandle_t * handle) = 0;
    virtual bool openFileForWrite(const std::string& file, FileHandle_t * handle) = 0;
+   virtual bool openFileForAppend(const std::string& file, FileHandle_t * handle) { return false; } //optional (needed to resume downloads)
    virtual size_t getFileSize(FileHandle_t file) = 0;
    virtual size_t readFromFile(FileHandle_t file, unsigned char * buffer, size_t bufferSize) = 0;
+   virtual size_t readFromFileAt(FileHandle_t file, size_t offset, unsigned char * buffer, size_t bufferSize) { return 0; } //optional (needed for delta downloads)
    virtual size_t writeToFile(FileHandle_t file, const unsigned char * data, size_t length) = 0;
+   //optional (zero-copy download): lend a buffer for the next bytes of the file. the received data is copied into
+   //it directly by the data channel callback. returns its size (0 = not supported: the data is passed by writeToFile)
+   virtual size_t getWriteBuffer(FileHandle_t file, unsigned char ** buffer) { return 0; }
+   //the first "length" bytes of the lent buffer were received. the buffer is returned (see getWriteBuffer)
+   virtual size_t commitWriteBuffer(FileHandle_t file, size_t length) { return 0; }
+   virtual unsigned long long getFileTime(FileHandle_t file) { return 0; } //optional. modification time in seconds since epoch (0 = unknown)
+   virtual void setFileTime(const std::string& file, unsigned long long time) { } //optional. set modification time of a (closed) file
+   virtual bool createDirectory(const std::string& dir) { return false; } //optional (needed for tree downloads). true, if the directory exists afterwards
    virtual FileHandle_t closeFile(FileHandle_t file = FILE_XFER_CLIENT_INVALID_FILE_HANDLE) = 0;
+   //optional (large block I/O): positioned, vectored reads and writes of the files of up- and downloads. NULL: the
+   //files are accessed by readFromFile and writeToFile (see FileXferAppBlockIo)
+   virtual FileXferBlockIo * getBlockIo() { return NULL; }
+};
+
+
+
+//block I/O by the file operations of an application, that doesn't provide it (see FileXferClientApp::getBlockIo).
+//the blocks are accessed sequentially, so the offset is given by the position of the file
+class FileXferAppBlockIo : public FileXferBlockIo
+{
+public:
+   FileXferAppBlockIo();
+   size_t readBlocks(FileHandle_t file, unsigned long long offset, const FileXferIoVec * vec, unsigned int count);
+   size_t writeBlocks(FileHandle_t file, unsigned long long offset, const FileXferIoVec * vec, unsigned int count);
+
+   FileXferClientApp * app;
 };
 
 
 
-class FileXferClient
+//request sent to server, awaiting its response. the server responds in order, so responses are matched in order
+typedef struct
+{
+   unsigned char command;  //command the response belongs to
+   bool transfer;          //request of the data-transfer (that waits for its response)
+   unsigned long timeout1ms; //force quit, if there is no response until then (0 = no timeout)
+} FileXferClientRequest;
+
+
+
+class FileXferClient : private FileXferDeltaTarget, private FileXferBundleTarget
 {
 public:
    FileXferClient(FileXferClientApp * app);
@@ -65,6 +126,13 @@ public:
    //dir <path>
    int changeListDirectory(const std::string& path); //change and list directory
 
+   //list changes of the working directory since "token" (of a previous listing of changes). an empty token,
+   //or one the server doesn't know (any longer), lists the directory completely
+   int listChanges(const std::string& token = "");
+
+   //list the entries of the working directory, that match "filter". sorted and paginated (see FileXferListFilter)
+   int listFiltered(const FileXferListFilter& filter);
+
 
    //mkdir <path>
    int makeDirectory(const std::string& path);
@@ -75,14 +143,60 @@ public:
    //download <file>
    int downloadFile(const std::string& source, const std::string& destination);
 
+   //resume download <file>. continue a (partial) download, at the end of the destination
+   int resumeDownload(const std::string& source, const std::string& destination);
+
    //upload <file>
    int uploadFile(const std::string& source, const std::string& destination);
 
+   //resume upload <file>. only the part of the file not yet stored on server is uploaded
+   int resumeUpload(const std::string& source, const std::string& destination);
+
+   //delta upload <file>. only the parts of the file, that differ from the servers version are uploaded
+   int deltaUpload(const std::string& source, const std::string& destination);
+
+   //delta download <file>. only the parts of the file, that differ from basis are downloaded
+   //(destination must be a different file than basis)
+   int deltaDownload(const std::string& source, const std::string& basis, const std::string& destination);
+
+   //download all files of a directory (as one bundle) into the destination directory
+   int downloadBundle(const std::string& source, const std::string& destination);
+
+   //upload the given files (as one bundle) into the destination directory
+   int uploadBundle(const std::vector<std::string>& sources, const std::string& destination);
+
+   //download a directory tree (recursively) into the destination directory
+   int downloadTree(const std::string& source, const std::string& destination);
+
+   //upload the given files and directories of the source directory (as a tree) into the destination directory.
+   //names are paths relative to source. a name ending with '/' denotes a (maybe empty) directory
+   int uploadTree(const std::string& source, const std::vector<std::string>& names, const std::string& destination);
+
    //quit ongoing transfer/operation
    int quit();
 
+   //negotiate session parameters (data chunk size and optional features like compression).
+   //binaryListing: directory listings are sent in binary format, and are decoded into FileXferStat entries.
+   //integrity: the CRC-32C of the data of up- and downloads is compared with the one of the server on completion
+   int setupSession(bool compression = true, bool binaryListing = false, bool integrity = true);
+
+   //deliver the entries of listings (text or binary) in batches of about "count" entries, while they are received
+   //(see FileXferClientApp::onListEntries). the listing isn't collected then: the response reports an empty list.
+   //so the memory doesn't grow with the size of the directory. 0: disabled (default)
+   void setListBatchSize(size_t count);
+
+   //max. number of received data frames processed per task call (0 = all pending). all pending control frames
+   //are always processed
+   void setRxBudget(unsigned int frames);
+
+
+   //additional transfer slot (on its own channels). it is run by the task of this client
+   void addSlot(FileXferClient * slot);
 
-   bool isIdle();
+   bool isIdle(); //this client and all its slots
+   bool hasTxWork(); //task has work to do, that doesn't wait for input or a timer (e.g. sending an upload)
+   unsigned long getNextTimeout1ms(); //task has to be run after that time, to check for a timeout (0 = none). same time base as task
+   unsigned int getPendingRequests(); //number of requests awaiting their response. up to FILE_XFER_CLIENT_PIPELINE_DEPTH
 
 
 protected:
@@ -94,26 +208,103 @@ private:
    void onCtrlFrame(const unsigned char * const data, const unsigned int len);
    static void _onDataFrameAsync(void * const obj, const unsigned char * const data, const unsigned int len); //wrapper to forward to member function
    void onDataFrameAsync(const unsigned char * const data, const unsigned int len);
-   void onDataFrame(const unsigned char * const data, const unsigned int len);
+   void onDataFrame(const unsigned char * data, unsigned int len);
+   void completeListing(int status);
 
+   FileXferBlockIo * selectBlockIo();
+   void startUpload(FileXferClientApp::FileHandle_t file, size_t offset);
+   void closeUploadFile();
    void doFileUpload();
-   void doQuit();
+   void doResumeUpload();
+   void doDeltaUpload();
+   void doDeltaDownload();
+   size_t readBasis(size_t offset, unsigned char * buffer, size_t len); //FileXferDeltaTarget
+   void writeTarget(const unsigned char * data, size_t len); //FileXferDeltaTarget
+   int requestBundleDownload(unsigned char command, const std::string& source, const std::string& destination);
+   int requestBundleUpload(unsigned char command, const std::vector<std::string>& sources, const std::string& destination);
+   void doBundleUpload();
+   bool addBundleDirectories(const std::string& name);
+   bool beginFile(const std::string& name, unsigned long long size, unsigned long long mtime); //FileXferBundleTarget
+   void writeFile(const unsigned char * data, size_t len); //FileXferBundleTarget
+   void endFile(); //FileXferBundleTarget
+   void createDirectory(const std::string& name); //FileXferBundleTarget
+   void endOfDownload();
+   void completeDownload(bool intact = true);
+   void failDownload();
+   void lendWriteBuffer();
+   void returnWriteBuffer(bool commit);
+   unsigned int receiveInPlace(const unsigned char * data, unsigned int len);
+   void doQuit(bool resync = false);
+   FileXferClient * selectSlot();
+   bool canRequest();
+   void pushRequest(unsigned char command, bool transfer = false, unsigned long timeout1ms = 0);
+   bool isTransferPending();
 
    Slay2Channel * ctrlChannel;
-   Slay2LinearFifo<1*1024> ctrlRxBuffer;
+   SpscFrameRing<4*1024> ctrlRxBuffer;   //filled by the slay2 callback, taken by task (lock-free)
    Slay2Channel * dataChannel;
-   Slay2LinearFifo<10*1024> dataRxBuffer;
+   SpscFrameRing<64*1024> dataRxBuffer;
+   unsigned int rxBudget;     //max. number of data frames processed per task (0 = no limit)
 
    FileXferClientApp * app;
    FileXferClientApp::FileHandle_t srcDstFile;
 
-   unsigned char ctrlState;
+   std::deque<FileXferClientRequest> ctrlPending; //requests awaiting their response (oldest first)
+   FileXferClient * session;  //client owning the session. this, unless it is a slot of another client
+   std::vector<FileXferClient *> slots; //additional transfer slots
    unsigned char dataState;
    unsigned long time1ms;
    unsigned long timeout1ms;
+   unsigned char syncTag;     //tag of the last resync quit (see doQuit)
+   unsigned long sync1ms;     //responses are discarded up to the echo of the resync quit, at most until then (0 = in sync)
    std::string directoryList;
+   FileXferListReader listReader; //binary listing, or any listing delivered in batches
+   size_t listBatchSize;      //0: listing isn't delivered in batches
+   std::string listResponse;  //response of a listing of changes or a filtered listing (empty, until received)
+   bool listReceived;         //listing was received completely (waiting for the response)
    size_t uploadFileSize;
    size_t downloadFileSize;
+   size_t downloadOffset;     //the download is written at that offset of the destination file (end of a resumed download)
+   FileXferAppBlockIo appBlockIo; //block I/O of an application, that doesn't provide it
+   FileXferBlockReader fileReader; //file of an upload
+   FileXferBlockWriter fileWriter; //file of a download (unless it is received in place)
+   bool transferHashed;       //the CRC of the up-/download is checked on completion (integrity check negotiated)
+   uint32_t transferCrc;      //CRC-32C of the data of the up-/download so far
+   //download received in place (see FileXferClientApp::getWriteBuffer). shared with the data channel callback
+   bool lendDownload;            //download is received in place (as far as there is no older frame in the ring)
+   unsigned char * lendBuffer;   //buffer lent by the application (NULL, if none)
+   size_t lendLimit;             //max. number of bytes received into it
+   std::atomic<size_t> lendFill; //number of bytes received into it
+   std::atomic<bool> lendActive; //the callback may receive into it
+   std::atomic<bool> lendBusy;   //the callback is accessing it
+   std::string uploadSource;
+   std::string uploadDestination;
+   size_t resumeOffset;       //upload is resumed at that offset
+   size_t resumeRemaining;    //number of bytes of the prefix (up to offset), still to be checksummed
+   uint32_t resumeCrc;        //CRC-32C of the prefix
+   FileXferChunkPolicy dataChunking;
+   unsigned int sessionFeatures;  //features agreed within the session
+   FileXferEncoder dataEncoder;   //compression of upload data
+   FileXferDecoder dataDecoder;   //decompression of listing and download data
+   std::vector<unsigned char> uploadBuffer;
+   FileXferClientApp::FileHandle_t deltaBasisFile; //basis of a delta download
+   unsigned int deltaBlockSize;
+   size_t deltaRemaining;     //number of bytes of the basis, still to be signed
+   size_t outputSent;          //number of bytes of the pending output (compressed data, signatures or delta) sent so far
+   FileXferSignatureBuilder deltaSignatures;
+   FileXferDeltaGenerator deltaGenerator;
+   FileXferDeltaApplier deltaApplier;
+   std::vector<std::string> bundleSources; //files of a bundle upload
+   size_t bundleIndex;        //next file of the bundle upload (beyond the last one, when the end record was sent)
+   bool bundleTree;           //tree bundle upload
+   std::string bundleRoot;    //source directory of a tree upload
+   std::string bundleDirectory;   //last directory sent by a tree upload
+   std::string bundleDestination; //destination directory of a bundle download
+   std::string bundleFileName;    //file currently received by a bundle download
+   unsigned long long bundleFileTime; //its modification time
+   bool bundleFailed;         //any file of the bundle couldn't be read or stored
+   FileXferBundleWriter bundleWriter;
+   FileXferBundleReader bundleReader;
 };
 
 
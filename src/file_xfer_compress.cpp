@@ -0,0 +1,214 @@
+//-----------------------------------------------------------------------------
+/*!
+   \file
+   \brief File transfer data compression
+*/
+//-----------------------------------------------------------------------------
+
+/* -- Includes ------------------------------------------------------------ */
+#include <math.h>
+#include <string.h>
+#include "file_xfer_compress.h"
+#include "lz4block.h"
+
+
+/* -- Defines ------------------------------------------------------------- */
+using namespace std;
+
+#define BLOCK_HEADER_SIZE(type)  (((type) == FILE_XFER_COMPRESS_COMPRESSED) ? 5 : 3)
+
+
+/* -- Types --------------------------------------------------------------- */
+
+/* -- (Module) Global Variables ------------------------------------------- */
+
+/* -- Module Global Function Prototypes ----------------------------------- */
+
+
+/* -- Implementation ------------------------------------------------------ */
+
+
+FileXferEncoder::FileXferEncoder()
+{
+   packed.resize(LZ4BLOCK_BOUND(FILE_XFER_COMPRESS_BLOCK_SIZE));
+   reset();
+}
+
+
+void FileXferEncoder::reset(unsigned char mode, unsigned int entropy)
+{
+   output.clear();
+   memset(&stat, 0, sizeof(stat));
+   stat.mode = mode;
+   stat.entropy = entropy;
+}
+
+
+//decide per file: bypass compression, if the sample isn't compressible. an empty sample (e.g. if the file
+//can't be sampled) leaves the decision to each block.
+void FileXferEncoder::resetBySample(const unsigned char * sample, size_t len)
+{
+   const unsigned int entropy = estimateEntropy(sample, len);
+   reset((entropy >= FILE_XFER_COMPRESS_ENTROPY_LIMIT) ? FILE_XFER_COMPRESS_STORED : FILE_XFER_COMPRESS_COMPRESSED, entropy);
+}
+
+
+void FileXferEncoder::encode(const unsigned char * data, size_t len)
+{
+   const size_t start = output.size();
+   stat.originalBytes += len;
+   while (len > 0)
+   {
+      const size_t count = (len < FILE_XFER_COMPRESS_BLOCK_SIZE) ? len : FILE_XFER_COMPRESS_BLOCK_SIZE;
+      //probe a block from time to time, if compression is bypassed. the file may contain compressible parts as well
+      if ((stat.mode == FILE_XFER_COMPRESS_STORED) && ((stat.storedBlocks % FILE_XFER_COMPRESS_REPROBE) == (FILE_XFER_COMPRESS_REPROBE - 1)) &&
+          (estimateEntropy(data, count) < FILE_XFER_COMPRESS_ENTROPY_LIMIT))
+      {
+         stat.mode = FILE_XFER_COMPRESS_COMPRESSED;
+      }
+      //compress. store data, if compression is bypassed, the block isn't compressible, or compression doesn't gain anything
+      size_t packedLen = 0;
+      if ((stat.mode == FILE_XFER_COMPRESS_COMPRESSED) && (estimateEntropy(data, count) < FILE_XFER_COMPRESS_ENTROPY_LIMIT))
+      {
+         packedLen = lz4blockCompress(data, count, packed.data(), count - 1);
+      }
+      if (packedLen > 0)
+      {
+         ++stat.compressedBlocks;
+         output.push_back(FILE_XFER_COMPRESS_COMPRESSED);
+         output.push_back((unsigned char)count);
+         output.push_back((unsigned char)(count >> 8));
+         output.push_back((unsigned char)packedLen);
+         output.push_back((unsigned char)(packedLen >> 8));
+         output.insert(output.end(), packed.data(), packed.data() + packedLen);
+      }
+      else
+      {
+         ++stat.storedBlocks;
+         output.push_back(FILE_XFER_COMPRESS_STORED);
+         output.push_back((unsigned char)count);
+         output.push_back((unsigned char)(count >> 8));
+         output.insert(output.end(), data, data + count);
+      }
+      data += count;
+      len -= count;
+   }
+   stat.encodedBytes += output.size() - start;
+}
+
+
+//order-0 (shannon) entropy of the data: -sum(p * log2(p)) over the byte frequencies
+unsigned int FileXferEncoder::estimateEntropy(const unsigned char * data, size_t len)
+{
+   unsigned int histogram[256];
+   double sum = 0;
+   if (len == 0)
+   {
+      return 0;
+   }
+   memset(histogram, 0, sizeof(histogram));
+   for (size_t idx = 0; idx < len; ++idx)
+   {
+      ++histogram[data[idx]];
+   }
+   for (unsigned int idx = 0; idx < 256; ++idx)
+   {
+      if (histogram[idx] > 0)
+      {
+         sum += histogram[idx] * log2((double)histogram[idx]);
+      }
+   }
+   return (unsigned int)((log2((double)len) - (sum / len)) * 100 + 0.5);
+}
+
+
+
+
+FileXferDecoder::FileXferDecoder()
+{
+   reset();
+}
+
+
+void FileXferDecoder::reset()
+{
+   memset(&stat, 0, sizeof(stat));
+   block.clear();
+   storedRemaining = 0;
+   failed = false;
+}
+
+
+bool FileXferDecoder::feed(const unsigned char * data, size_t len)
+{
+   const size_t start = output.size();
+   stat.encodedBytes += len;
+   while ((len > 0) && !failed)
+   {
+      //payload of a stored block is passed through
+      if (storedRemaining > 0)
+      {
+         const size_t count = (len < storedRemaining) ? len : storedRemaining;
+         output.insert(output.end(), data, data + count);
+         storedRemaining -= count;
+         data += count;
+         len -= count;
+         continue;
+      }
+
+      //collect block header
+      block.push_back(*data++);
+      --len;
+      const unsigned char type = block[0];
+      if ((type != FILE_XFER_COMPRESS_STORED) && (type != FILE_XFER_COMPRESS_COMPRESSED))
+      {
+         failed = true; //invalid block
+         break;
+      }
+      if (block.size() < BLOCK_HEADER_SIZE(type))
+      {
+         continue;
+      }
+      const size_t blockLen = block[1] | ((size_t)block[2] << 8);
+      if (blockLen > FILE_XFER_COMPRESS_BLOCK_SIZE)
+      {
+         failed = true;
+         break;
+      }
+      if (type == FILE_XFER_COMPRESS_STORED)
+      {
+         ++stat.storedBlocks;
+         storedRemaining = blockLen;
+         block.clear();
+         continue;
+      }
+
+      //collect compressed data (as far as it is available)
+      const size_t packedLen = block[3] | ((size_t)block[4] << 8);
+      const size_t count = packedLen + 5 - block.size();
+      if (count > 0)
+      {
+         const size_t n = (len < count) ? len : count;
+         block.insert(block.end(), data, data + n);
+         data += n;
+         len -= n;
+         if (n < count)
+         {
+            break; //wait for more data
+         }
+      }
+      //decompress
+      const size_t offset = output.size();
+      output.resize(offset + blockLen);
+      if (lz4blockDecompress(block.data() + 5, packedLen, output.data() + offset, blockLen) != (long)blockLen)
+      {
+         output.resize(offset);
+         failed = true;
+         break;
+      }
+      ++stat.compressedBlocks;
+      block.clear();
+   }
+   stat.originalBytes += output.size() - start;
+   return !failed;
+}
@@ -0,0 +1,108 @@
+//---------------------------------------------------------------------------------------------------------------------
+/*!
+   \file
+   \brief File transfer data compression
+
+   If compression was negotiated for the session, the data of a file or listing transfer on the data channel
+   is sent as a sequence of blocks. Each block holds up to FILE_XFER_COMPRESS_BLOCK_SIZE bytes of the original data.
+   The sender decides per block, whether it is compressed (LZ4 block format) or stored as is:
+
+   'S' <len:2> <data...>                   stored block
+   'C' <len:2> <packed-len:2> <data...>    compressed block. <len> is the original length
+
+   Lengths are 16-bit, little endian.
+
+   Compressing data, that is already compressed (like JPEGs or archives), costs CPU time for nothing.
+   So the sender samples the first blocks of a file and estimates their entropy. If the entropy is too high,
+   the whole file is stored (bypass). Otherwise each block is compressed - unless the entropy of the block
+   itself is too high, or compression doesn't gain anything. While bypassed, every FILE_XFER_COMPRESS_REPROBE-th
+   block is probed. If it is compressible, compression is resumed block by block.
+*/
+//---------------------------------------------------------------------------------------------------------------------
+#ifndef FILE_XFER_COMPRESS_H
+#define FILE_XFER_COMPRESS_H
+
+/* -- Includes ------------------------------------------------------------ */
+#include <stddef.h>
+#include <vector>
+
+
+/* -- Defines ------------------------------------------------------------- */
+#ifndef FILE_XFER_COMPRESS_BLOCK_SIZE
+#define FILE_XFER_COMPRESS_BLOCK_SIZE     (8 * 1024)     //max. number of original bytes per block
+#endif
+
+#ifndef FILE_XFER_COMPRESS_SAMPLE_SIZE
+#define FILE_XFER_COMPRESS_SAMPLE_SIZE    (4 * FILE_XFER_COMPRESS_BLOCK_SIZE) //size of the sample at the start of a file
+#endif
+#ifndef FILE_XFER_COMPRESS_ENTROPY_LIMIT
+#define FILE_XFER_COMPRESS_ENTROPY_LIMIT  (750)          //data with an entropy of 7.5 bits per byte (or more) is stored
+#endif
+#define FILE_XFER_COMPRESS_REPROBE        (16)           //while bypassed, every n-th block is probed again
+
+#define FILE_XFER_COMPRESS_STORED         ((unsigned char)'S')
+#define FILE_XFER_COMPRESS_COMPRESSED     ((unsigned char)'C')
+
+
+/* -- Types --------------------------------------------------------------- */
+
+//statistics of a compressed transfer
+typedef struct
+{
+   unsigned char mode;                 //per-file decision: FILE_XFER_COMPRESS_STORED (bypass) or FILE_XFER_COMPRESS_COMPRESSED (per block). may change to the latter, by a probe
+   unsigned int entropy;               //estimated entropy of the sample, in 1/100 bits per byte (0 = not sampled)
+   unsigned long long originalBytes;   //number of bytes of the original data
+   unsigned long long encodedBytes;    //number of bytes on the data channel
+   unsigned long storedBlocks;
+   unsigned long compressedBlocks;
+} FileXferCompressStat;
+
+
+
+//encode data into blocks. the encoded blocks are appended to "output".
+class FileXferEncoder
+{
+public:
+   FileXferEncoder();
+   void reset(unsigned char mode = FILE_XFER_COMPRESS_COMPRESSED, unsigned int entropy = 0); //start of a transfer
+   void resetBySample(const unsigned char * sample, size_t len); //start of a transfer. decide mode by the given sample of the file
+   void encode(const unsigned char * data, size_t len);
+   static unsigned int estimateEntropy(const unsigned char * data, size_t len); //in 1/100 bits per byte
+
+   std::vector<unsigned char> output;
+   FileXferCompressStat stat;
+
+private:
+   std::vector<unsigned char> packed;
+};
+
+
+
+//decode blocks. the data can be feed in pieces of any size. the decoded data is appended to "output".
+class FileXferDecoder
+{
+public:
+   FileXferDecoder();
+   void reset();
+   bool feed(const unsigned char * data, size_t len); //returns false, on invalid data
+
+   std::vector<unsigned char> output;
+   FileXferCompressStat stat; //mode and entropy are not known by the decoder (0). the receiver may set them, if reported by the sender
+
+private:
+   std::vector<unsigned char> block; //incomplete block
+   size_t storedRemaining;           //number of bytes of a stored block, not yet received
+   bool failed;
+};
+
+
+
+/* -- Global Variables ---------------------------------------------------- */
+
+/* -- Function Prototypes ------------------------------------------------- */
+
+/* -- Implementation ------------------------------------------------------ */
+
+
+
+#endif
@@ -0,0 +1,438 @@
+//-----------------------------------------------------------------------------
+/*!
+   \file
+   \brief File transfer delta encoding (rsync like)
+*/
+//-----------------------------------------------------------------------------
+
+/* -- Includes ------------------------------------------------------------ */
+#include "file_xfer_delta.h"
+#include "file_xfer.h"
+#include "crc32c.h"
+#include "xxhash64.h"
+
+
+/* -- Defines ------------------------------------------------------------- */
+using namespace std;
+
+
+/* -- Types --------------------------------------------------------------- */
+
+/* -- (Module) Global Variables ------------------------------------------- */
+
+/* -- Module Global Function Prototypes ----------------------------------- */
+static void putLE32(vector<unsigned char>& out, uint32_t value);
+static uint32_t getLE32(const unsigned char * data);
+
+
+/* -- Implementation ------------------------------------------------------ */
+
+
+//block size is about the square root of the file size (power of 2). so the number of signatures and
+//the size of the blocks grow in the same way.
+unsigned int FileXferDelta::getBlockSize(size_t fileSize)
+{
+   unsigned int blockSize = FILE_XFER_DELTA_BLOCK_SIZE_MIN;
+   while ((blockSize < FILE_XFER_DELTA_BLOCK_SIZE_MAX) && (((unsigned long long)blockSize * blockSize) < fileSize))
+   {
+      blockSize *= 2;
+   }
+   return blockSize;
+}
+
+
+//the weak checksum is the one used by rsync. it can be "rolled" over the data (see FileXferDeltaGenerator::process)
+uint32_t FileXferDelta::weakChecksum(const unsigned char * data, size_t len)
+{
+   uint32_t a = 0;
+   uint32_t b = 0;
+   for (size_t idx = 0; idx < len; ++idx)
+   {
+      a += data[idx];
+      b += (uint32_t)(len - idx) * data[idx];
+   }
+   return ((b & 0xFFFF) << 16) | (a & 0xFFFF);
+}
+
+
+uint64_t FileXferDelta::strongChecksum(const unsigned char * data, size_t len)
+{
+   return xxhash64(data, len, 0);
+}
+
+
+
+
+FileXferSignatureBuilder::FileXferSignatureBuilder()
+{
+   blockSize = FILE_XFER_DELTA_BLOCK_SIZE_MIN;
+}
+
+
+void FileXferSignatureBuilder::reset(unsigned int blockSize)
+{
+   this->blockSize = blockSize;
+   block.clear();
+   output.clear();
+}
+
+
+void FileXferSignatureBuilder::feed(const unsigned char * data, size_t len)
+{
+   while (len > 0)
+   {
+      const unsigned char * blockData = data;
+      size_t count = blockSize;
+      if (block.empty() && (len >= blockSize)) //complete block available. no need to copy
+      {
+         data += blockSize;
+         len -= blockSize;
+      }
+      else //collect data, until a block is complete
+      {
+         count = blockSize - block.size();
+         if (count > len)
+         {
+            count = len;
+         }
+         block.insert(block.end(), data, data + count);
+         data += count;
+         len -= count;
+         if (block.size() < blockSize)
+         {
+            break;
+         }
+         blockData = block.data();
+         count = blockSize;
+      }
+      //sign block
+      const uint64_t strong = FileXferDelta::strongChecksum(blockData, count);
+      putLE32(output, FileXferDelta::weakChecksum(blockData, count));
+      putLE32(output, (uint32_t)strong);
+      putLE32(output, (uint32_t)(strong >> 32));
+      block.clear();
+   }
+}
+
+
+
+
+FileXferDeltaGenerator::FileXferDeltaGenerator()
+{
+   reset(FILE_XFER_DELTA_BLOCK_SIZE_MIN, 0);
+}
+
+
+void FileXferDeltaGenerator::reset(unsigned int blockSize, size_t blockCount)
+{
+   this->blockSize = blockSize;
+   this->blockCount = blockCount;
+   signatureBuffer.clear();
+   strong.clear();
+   weak.clear();
+   window.clear();
+   output.clear();
+   position = 0;
+   literalStart = 0;
+   rolling = false;
+   a = 0;
+   b = 0;
+   runStart = 0;
+   runCount = 0;
+   crc = 0;
+}
+
+
+size_t FileXferDeltaGenerator::addSignatures(const unsigned char * data, size_t len)
+{
+   size_t consumed = 0;
+   while ((consumed < len) && (strong.size() < blockCount))
+   {
+      signatureBuffer.push_back(data[consumed++]);
+      if (signatureBuffer.size() == FILE_XFER_DELTA_SIGNATURE_SIZE)
+      {
+         const unsigned char * sig = signatureBuffer.data();
+         weak.insert(make_pair(getLE32(&sig[0]), strong.size()));
+         strong.push_back((uint64_t)getLE32(&sig[4]) | ((uint64_t)getLE32(&sig[8]) << 32));
+         signatureBuffer.clear();
+      }
+   }
+   return consumed;
+}
+
+
+bool FileXferDeltaGenerator::hasAllSignatures() const
+{
+   return (strong.size() == blockCount);
+}
+
+
+void FileXferDeltaGenerator::feed(const unsigned char * data, size_t len)
+{
+   crc = crc32c(crc, data, len);
+   window.insert(window.end(), data, data + len);
+   process(false);
+}
+
+
+void FileXferDeltaGenerator::finish()
+{
+   process(true);
+   output.push_back(FILE_XFER_DELTA_OP_END);
+   putLE32(output, crc);
+}
+
+
+void FileXferDeltaGenerator::process(bool final)
+{
+   while ((blockCount > 0) && ((window.size() - position) >= blockSize))
+   {
+      size_t index;
+      if (!rolling) //(re-)start rolling checksum
+      {
+         const uint32_t weak = FileXferDelta::weakChecksum(&window[position], blockSize);
+         a = weak & 0xFFFF;
+         b = weak >> 16;
+         rolling = true;
+      }
+      if (findBlock(&window[position], ((b & 0xFFFF) << 16) | (a & 0xFFFF), &index))
+      {
+         //flush literal data in front of the block. then add block to the pending run
+         emitLiteral(position);
+         if ((runCount > 0) && (index != (runStart + runCount)))
+         {
+            emitBlocks();
+         }
+         if (runCount == 0)
+         {
+            runStart = index;
+         }
+         ++runCount;
+         position += blockSize;
+         literalStart = position;
+         rolling = false;
+         continue;
+      }
+      //no match. roll checksum by one byte (if there is another one)
+      if ((window.size() - position) == blockSize)
+      {
+         break; //wait for more data
+      }
+      const uint32_t out = window[position];
+      const uint32_t in = window[position + blockSize];
+      a = a - out + in;
+      b = b - (blockSize * out) + a;
+      ++position;
+      if ((position - literalStart) >= FILE_XFER_DELTA_LITERAL_MAX)
+      {
+         emitLiteral(position);
+      }
+   }
+   if (blockCount == 0) //nothing to match against. everything is literal
+   {
+      position = window.size();
+      emitLiteral(position - (position - literalStart) % FILE_XFER_DELTA_LITERAL_MAX);
+   }
+   if (final)
+   {
+      emitLiteral(window.size());
+      emitBlocks();
+   }
+
+   //drop processed data
+   if (literalStart >= FILE_XFER_DELTA_BLOCK_SIZE_MAX)
+   {
+      window.erase(window.begin(), window.begin() + literalStart);
+      position -= literalStart;
+      literalStart = 0;
+   }
+}
+
+
+//emit literal data from "literalStart" to "end"
+void FileXferDeltaGenerator::emitLiteral(size_t end)
+{
+   if (end <= literalStart)
+   {
+      return;
+   }
+   emitBlocks(); //keep order
+   while (literalStart < end)
+   {
+      unsigned char varint[FILE_XFER_VARINT_MAX_LEN];
+      size_t count = end - literalStart;
+      if (count > FILE_XFER_DELTA_LITERAL_MAX)
+      {
+         count = FILE_XFER_DELTA_LITERAL_MAX;
+      }
+      output.push_back(FILE_XFER_DELTA_OP_LITERAL);
+      output.insert(output.end(), varint, varint + fileXferEncodeVarint(varint, count));
+      output.insert(output.end(), &window[literalStart], &window[literalStart] + count);
+      literalStart += count;
+   }
+}
+
+
+//emit pending run of blocks
+void FileXferDeltaGenerator::emitBlocks()
+{
+   if (runCount > 0)
+   {
+      unsigned char varint[FILE_XFER_VARINT_MAX_LEN];
+      output.push_back(FILE_XFER_DELTA_OP_BLOCK);
+      output.insert(output.end(), varint, varint + fileXferEncodeVarint(varint, runStart));
+      output.insert(output.end(), varint, varint + fileXferEncodeVarint(varint, runCount));
+      runCount = 0;
+   }
+}
+
+
+//find a block matching data (of block size). if there are several, prefer the one continuing the current run.
+bool FileXferDeltaGenerator::findBlock(const unsigned char * data, uint32_t weakChecksum, size_t * index)
+{
+   typedef unordered_multimap<uint32_t, size_t>::const_iterator Iterator;
+   const pair<Iterator, Iterator> range = weak.equal_range(weakChecksum);
+   if (range.first == range.second)
+   {
+      return false; //most likely case. no need to calculate the strong checksum
+   }
+   const uint64_t strongChecksum = FileXferDelta::strongChecksum(data, blockSize);
+   bool found = false;
+   for (Iterator it = range.first; it != range.second; ++it)
+   {
+      if (strong[it->second] == strongChecksum)
+      {
+         if (!found || (it->second == (runStart + runCount)))
+         {
+            *index = it->second;
+            found = true;
+         }
+      }
+   }
+   return found;
+}
+
+
+
+
+FileXferDeltaApplier::FileXferDeltaApplier()
+{
+   reset(FILE_XFER_DELTA_BLOCK_SIZE_MIN, NULL);
+}
+
+
+void FileXferDeltaApplier::reset(unsigned int blockSize, FileXferDeltaTarget * target)
+{
+   this->blockSize = blockSize;
+   this->target = target;
+   header.clear();
+   literalRemaining = 0;
+   crc = 0;
+   result = 0;
+}
+
+
+int FileXferDeltaApplier::feed(const unsigned char * data, size_t len)
+{
+   size_t idx = 0;
+   while ((idx < len) && (result == 0))
+   {
+      //literal data
+      if (literalRemaining > 0)
+      {
+         size_t count = len - idx;
+         if (count > literalRemaining)
+         {
+            count = literalRemaining;
+         }
+         target->writeTarget(&data[idx], count);
+         crc = crc32c(crc, &data[idx], count);
+         literalRemaining -= count;
+         idx += count;
+         continue;
+      }
+
+      //collect operation header. check if it is complete
+      header.push_back(data[idx++]);
+      const unsigned char * arg = header.data() + 1;
+      const unsigned int argLen = header.size() - 1;
+      switch (header[0])
+      {
+         case FILE_XFER_DELTA_OP_LITERAL:
+         {
+            if (fileXferDecodeVarint(arg, argLen, &literalRemaining) != 0)
+            {
+               header.clear();
+            }
+            break;
+         }
+
+         case FILE_XFER_DELTA_OP_BLOCK:
+         {
+            unsigned long long start, count;
+            unsigned int startLen = fileXferDecodeVarint(arg, argLen, &start);
+            if ((startLen != 0) && (fileXferDecodeVarint(arg + startLen, argLen - startLen, &count) != 0))
+            {
+               const unsigned long long blockMax = (size_t)-1 / blockSize; //offset of this block overflows
+               if ((start >= blockMax) || (count > (blockMax - start)))
+               {
+                  result = -1; //beyond any basis
+                  break;
+               }
+
+               //copy blocks from basis
+               block.resize(blockSize);
+               for (unsigned long long i = 0; (i < count) && (result == 0); ++i)
+               {
+                  if (target->readBasis((start + i) * blockSize, block.data(), blockSize) != blockSize)
+                  {
+                     result = -1; //basis doesn't match the signatures
+                     break;
+                  }
+                  target->writeTarget(block.data(), blockSize);
+                  crc = crc32c(crc, block.data(), blockSize);
+               }
+               header.clear();
+            }
+            break;
+         }
+
+         case FILE_XFER_DELTA_OP_END:
+         {
+            if (argLen == 4)
+            {
+               result = (getLE32(arg) == crc) ? 1 : -1;
+            }
+            break;
+         }
+
+         default:
+         {
+            result = -1; //unknown operation
+            break;
+         }
+      }
+      if (header.size() > (1 + 2 * FILE_XFER_VARINT_MAX_LEN))
+      {
+         result = -1; //invalid header
+      }
+   }
+   return result;
+}
+
+
+
+
+static void putLE32(vector<unsigned char>& out, uint32_t value)
+{
+   out.push_back((unsigned char)value);
+   out.push_back((unsigned char)(value >> 8));
+   out.push_back((unsigned char)(value >> 16));
+   out.push_back((unsigned char)(value >> 24));
+}
+
+
+static uint32_t getLE32(const unsigned char * data)
+{
+   return (uint32_t)data[0] | ((uint32_t)data[1] << 8) | ((uint32_t)data[2] << 16) | ((uint32_t)data[3] << 24);
+}
@@ -0,0 +1,150 @@
+//---------------------------------------------------------------------------------------------------------------------
+/*!
+   \file
+   \brief File transfer delta encoding (rsync like)
+
+   The receiver of a file sends the signatures of the blocks of its (old) version of the file - the "basis".
+   A block signature consists of a weak rolling checksum and a strong hash of the block.
+   The sender of the file searches its (new) version of the file for blocks matching these signatures
+   (at any offset, using the rolling checksum) and sends a delta. A delta is a sequence of literal data and
+   references to blocks of the basis. The receiver rebuilds the new file out of the delta and its basis.
+
+   Only complete blocks of the basis are signed.
+
+   Signature stream:  <weak:4><strong:8>... (little endian, one record per block)
+
+   Delta stream (a sequence of operations):
+   'L' <len:varint> <data...>        literal data
+   'B' <block:varint> <count:varint> copy <count> consecutive blocks of the basis, starting at block index <block>
+   'E' <crc:4>                       end of delta. CRC-32C of the whole (new) file (little endian)
+*/
+//---------------------------------------------------------------------------------------------------------------------
+#ifndef FILE_XFER_DELTA_H
+#define FILE_XFER_DELTA_H
+
+/* -- Includes ------------------------------------------------------------ */
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+#include <unordered_map>
+
+
+/* -- Defines ------------------------------------------------------------- */
+#define FILE_XFER_DELTA_SIGNATURE_SIZE    (12)           //size of one encoded block signature
+#define FILE_XFER_DELTA_BLOCK_SIZE_MIN    (512)
+#define FILE_XFER_DELTA_BLOCK_SIZE_MAX    (64 * 1024)
+#define FILE_XFER_DELTA_BLOCK_COUNT_MAX   (256 * 1024)   //max. number of signed blocks of a basis (bounds the memory of the signatures)
+#define FILE_XFER_DELTA_LITERAL_MAX       (32 * 1024)    //max. length of a literal operation
+
+#define FILE_XFER_DELTA_OP_LITERAL        ((unsigned char)'L')
+#define FILE_XFER_DELTA_OP_BLOCK          ((unsigned char)'B')
+#define FILE_XFER_DELTA_OP_END            ((unsigned char)'E')
+
+
+/* -- Types --------------------------------------------------------------- */
+
+class FileXferDelta
+{
+public:
+   static unsigned int getBlockSize(size_t fileSize); //block size to be used for a file of the given size
+   static uint32_t weakChecksum(const unsigned char * data, size_t len);
+   static uint64_t strongChecksum(const unsigned char * data, size_t len);
+};
+
+
+
+//build the signatures of a (basis) file. the file data can be feed in pieces of any size.
+//encoded signatures are appended to "output".
+class FileXferSignatureBuilder
+{
+public:
+   FileXferSignatureBuilder();
+   void reset(unsigned int blockSize);
+   void feed(const unsigned char * data, size_t len);
+
+   std::vector<unsigned char> output;
+
+private:
+   unsigned int blockSize;
+   std::vector<unsigned char> block;
+};
+
+
+
+//generate a delta of a (new) file, against the signatures of a basis.
+//the file data can be feed in pieces of any size. the encoded delta is appended to "output".
+class FileXferDeltaGenerator
+{
+public:
+   FileXferDeltaGenerator();
+   void reset(unsigned int blockSize, size_t blockCount);
+   size_t addSignatures(const unsigned char * data, size_t len); //returns number of bytes consumed
+   bool hasAllSignatures() const;
+   void feed(const unsigned char * data, size_t len);
+   void finish(); //no more data. flush delta and append end operation
+
+   std::vector<unsigned char> output;
+
+private:
+   void process(bool final);
+   void emitLiteral(size_t end);
+   void emitBlocks();
+   bool findBlock(const unsigned char * data, uint32_t weak, size_t * index);
+
+   unsigned int blockSize;
+   size_t blockCount;
+   std::vector<unsigned char> signatureBuffer;     //incomplete signature record
+   std::vector<uint64_t> strong;                   //strong checksum per block
+   std::unordered_multimap<uint32_t, size_t> weak; //weak checksum -> block index
+
+   std::vector<unsigned char> window;  //data not yet processed
+   size_t position;                    //position of the rolling checksum within "window"
+   size_t literalStart;                //start of pending literal data within "window"
+   bool rolling;                       //checksum at "position" is valid
+   uint32_t a, b;                      //rolling checksum
+   size_t runStart;                    //pending run of matching blocks
+   size_t runCount;
+   uint32_t crc;                       //CRC-32C of the file
+};
+
+
+
+//interface to the basis and the (new) file, used to apply a delta
+class FileXferDeltaTarget
+{
+public:
+   virtual ~FileXferDeltaTarget() { }
+   virtual size_t readBasis(size_t offset, unsigned char * buffer, size_t len) = 0;
+   virtual void writeTarget(const unsigned char * data, size_t len) = 0;
+};
+
+
+//apply a delta to a basis. the delta can be feed in pieces of any size.
+class FileXferDeltaApplier
+{
+public:
+   FileXferDeltaApplier();
+   void reset(unsigned int blockSize, FileXferDeltaTarget * target);
+   int feed(const unsigned char * data, size_t len); //returns 0 if more data is expected, 1 when done, -1 on error
+
+private:
+   FileXferDeltaTarget * target;
+   unsigned int blockSize;
+   std::vector<unsigned char> header; //incomplete operation header
+   std::vector<unsigned char> block;
+   unsigned long long literalRemaining;
+   uint32_t crc;
+   int result;
+};
+
+
+
+/* -- Global Variables ---------------------------------------------------- */
+
+/* -- Function Prototypes ------------------------------------------------- */
+
+/* -- Implementation ------------------------------------------------------ */
+
+
+
+#endif
@@ -0,0 +1,224 @@
+//-----------------------------------------------------------------------------
+/*!
+   \file
+   \brief Event loop for file transfer servers and clients (linux, epoll)
+*/
+//-----------------------------------------------------------------------------
+
+/* -- Includes ------------------------------------------------------------ */
+#include <fcntl.h>
+#include <poll.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include "file_xfer_event.h"
+
+
+/* -- Defines ------------------------------------------------------------- */
+using namespace std;
+
+#define TIMER_ID           (~(uint64_t)0)    //epoll data of the timer (sources are identified by their index)
+#define NOTIFY_FLAG        ((uint64_t)1 << 62) //epoll data of the fd of a source: its index and this flag
+#define MAX_EVENTS         (16)              //events fetched by one epoll_wait
+
+
+/* -- Types --------------------------------------------------------------- */
+
+/* -- (Module) Global Variables ------------------------------------------- */
+
+/* -- Module Global Function Prototypes ----------------------------------- */
+static unsigned long getTime1ms(); //utility function
+
+
+/* -- Implementation ------------------------------------------------------ */
+
+
+FileXferEventLoop::FileXferEventLoop()
+{
+   epollFd = epoll_create1(EPOLL_CLOEXEC);
+   timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+   if ((epollFd >= 0) && (timerFd >= 0))
+   {
+      struct epoll_event event;
+      event.events = EPOLLIN;
+      event.data.u64 = TIMER_ID;
+      epoll_ctl(epollFd, EPOLL_CTL_ADD, timerFd, &event);
+   }
+}
+
+
+FileXferEventLoop::~FileXferEventLoop()
+{
+   for (size_t idx = 0; idx < sources.size(); ++idx)
+   {
+      if (sources[idx].watchFd >= 0)
+      {
+         close(sources[idx].watchFd);
+      }
+   }
+   if (timerFd >= 0)
+   {
+      close(timerFd);
+   }
+   if (epollFd >= 0)
+   {
+      close(epollFd);
+   }
+}
+
+
+//add a source. it is run on input of the given tty, when its own fd is readable, and by timer (see file header).
+//return false, if the tty can't be watched. then the source is run by timer only
+bool FileXferEventLoop::add(FileXferEventSource * source, const char * ttyDev)
+{
+   Source entry;
+   entry.source = source;
+   entry.watchFd = -1;
+   entry.lastRun1ms = getTime1ms();
+   if ((source->getFd() >= 0) && (epollFd >= 0))
+   {
+      struct epoll_event event;
+      event.events = EPOLLIN;
+      event.data.u64 = sources.size() | NOTIFY_FLAG;
+      epoll_ctl(epollFd, EPOLL_CTL_ADD, source->getFd(), &event);
+   }
+   if ((ttyDev != NULL) && (epollFd >= 0))
+   {
+      entry.watchFd = open(ttyDev, O_RDONLY | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+      struct epoll_event event;
+      event.events = EPOLLIN;
+      event.data.u64 = sources.size();
+      if ((entry.watchFd >= 0) && (epoll_ctl(epollFd, EPOLL_CTL_ADD, entry.watchFd, &event) != 0))
+      {
+         close(entry.watchFd);
+         entry.watchFd = -1;
+      }
+   }
+   sources.push_back(entry);
+   arm(entry.lastRun1ms);
+   return (ttyDev == NULL) || (entry.watchFd >= 0);
+}
+
+
+int FileXferEventLoop::getFd()
+{
+   return ((epollFd >= 0) && (timerFd >= 0)) ? epollFd : -1;
+}
+
+
+//run the sources with input, TX work or a due deadline. all the others, that weren't run for FILE_XFER_EVENT_IDLE_MS
+void FileXferEventLoop::dispatch()
+{
+   vector<bool> input(sources.size(), false);
+   struct epoll_event events[MAX_EVENTS];
+   int count = MAX_EVENTS;
+   while ((count == MAX_EVENTS) && (epollFd >= 0))
+   {
+      count = epoll_wait(epollFd, events, MAX_EVENTS, 0);
+      for (int idx = 0; idx < count; ++idx)
+      {
+         const uint64_t id = events[idx].data.u64;
+         if (id == TIMER_ID)
+         {
+            uint64_t expirations;
+            read(timerFd, &expirations, sizeof(expirations)); //clear the timer
+         }
+         else if (id & NOTIFY_FLAG) //cleared by the source, when it is run
+         {
+            input[id & ~NOTIFY_FLAG] = true;
+         }
+         else if (id < sources.size())
+         {
+            input[id] = true;
+            if (events[idx].events & (EPOLLERR | EPOLLHUP)) //tty gone. run by timer only
+            {
+               epoll_ctl(epollFd, EPOLL_CTL_DEL, sources[id].watchFd, NULL);
+               close(sources[id].watchFd);
+               sources[id].watchFd = -1;
+            }
+         }
+      }
+   }
+
+   const unsigned long now = getTime1ms();
+   for (size_t idx = 0; idx < sources.size(); ++idx)
+   {
+      Source& entry = sources[idx];
+      if (input[idx] || entry.source->hasTxWork() || (entry.source->getWaitTime1ms() == 0) ||
+          ((now - entry.lastRun1ms) >= FILE_XFER_EVENT_IDLE_MS))
+      {
+         entry.source->onEvent();
+         entry.lastRun1ms = now;
+      }
+   }
+   arm(now);
+}
+
+
+//the timer is set again before waiting, as the sources may have got new deadlines in between
+//(e.g. a request to the client)
+void FileXferEventLoop::run(int timeout1ms)
+{
+   arm(getTime1ms());
+   struct pollfd ready;
+   ready.fd = epollFd;
+   ready.events = POLLIN;
+   ready.revents = 0;
+   poll(&ready, 1, timeout1ms); //interrupted by signals as well
+   dispatch();
+}
+
+
+void FileXferEventLoop::arm(unsigned long time1ms)
+{
+   long long wait1us = FILE_XFER_EVENT_IDLE_MS * 1000LL;
+   for (size_t idx = 0; idx < sources.size(); ++idx)
+   {
+      Source& entry = sources[idx];
+      const long waitTime1ms = entry.source->getWaitTime1ms();
+      const long long idle1us = (FILE_XFER_EVENT_IDLE_MS - (long long)(time1ms - entry.lastRun1ms)) * 1000LL;
+      if (entry.source->hasTxWork() && (wait1us > FILE_XFER_EVENT_BUSY_US))
+      {
+         wait1us = FILE_XFER_EVENT_BUSY_US;
+      }
+      if ((waitTime1ms >= 0) && (wait1us > (waitTime1ms * 1000LL)))
+      {
+         wait1us = waitTime1ms * 1000LL;
+      }
+      if (wait1us > idle1us)
+      {
+         wait1us = idle1us;
+      }
+   }
+   struct itimerspec spec;
+   spec.it_interval.tv_sec = 0;
+   spec.it_interval.tv_nsec = 0;
+   if (wait1us <= 0)
+   {
+      wait1us = 1; //0 would disarm the timer
+   }
+   spec.it_value.tv_sec = wait1us / 1000000; //tv_nsec must be below 1 second
+   spec.it_value.tv_nsec = (wait1us % 1000000) * 1000;
+   if (sources.empty())
+   {
+      spec.it_value.tv_sec = 0;
+      spec.it_value.tv_nsec = 0;
+   }
+   if (timerFd >= 0)
+   {
+      timerfd_settime(timerFd, 0, &spec, NULL);
+   }
+}
+
+
+
+
+//monotonic time in milliseconds
+static unsigned long getTime1ms()
+{
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return (unsigned long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
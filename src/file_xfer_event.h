@@ -0,0 +1,93 @@
+//---------------------------------------------------------------------------------------------------------------------
+/*!
+   \file
+   \brief Event loop for file transfer servers and clients (linux, epoll)
+
+   Instead of polling slay2.task() and the task of the server/client every few hundred microseconds, the event
+   loop runs a source (a slay2 driver and the server/client using it) only when:
+   - there is input on its tty,
+   - the server/client has TX work (FileXferServer::hasTxWork, FileXferClient::hasTxWork),
+   - a file thread of the server completed (sync of an upload, block read ahead for a download. FileXferServer::getFd),
+   - the next deadline of the server/client is reached (FileXferClient::getNextTimeout1ms),
+   - FILE_XFER_EVENT_IDLE_MS elapsed (slay2 timers like retransmission, as slay2 doesn't expose them).
+
+   The input of a tty is watched on a second (read only) file descriptor, as slay2 doesn't expose its own one.
+   Reading is still done by the slay2 driver. slay2 doesn't signal TX buffer space either. So while there is TX
+   work, the source is run every FILE_XFER_EVENT_BUSY_US (or earlier on input, e.g. an acknowledge).
+
+   The deadlines are kept by a timerfd within the epoll set. So the epoll file descriptor (getFd) becomes readable,
+   whenever dispatch() has to be called. That way the loop can be embedded into another event loop (epoll, libuv,
+   ...): watch getFd() for input and call dispatch(). Call dispatch() as well, after a request to the client (new
+   deadline). Or use run() as the event loop of the application.
+*/
+//---------------------------------------------------------------------------------------------------------------------
+#ifndef FILE_XFER_EVENT_H
+#define FILE_XFER_EVENT_H
+
+/* -- Includes ------------------------------------------------------------ */
+#include <stddef.h>
+#include <vector>
+
+
+/* -- Defines ------------------------------------------------------------- */
+#ifndef FILE_XFER_EVENT_IDLE_MS
+#define FILE_XFER_EVENT_IDLE_MS        (20)  //max. time, a source is not run (slay2 timers)
+#endif
+#ifndef FILE_XFER_EVENT_BUSY_US
+#define FILE_XFER_EVENT_BUSY_US        (300) //time between runs, while a source has TX work (5 chars @ 115200 bps take about 300us)
+#endif
+
+
+/* -- Types --------------------------------------------------------------- */
+
+//application must implement this interface, for each source of the event loop. typically a slay2
+//driver and the server/client using it
+class FileXferEventSource
+{
+public:
+   virtual ~FileXferEventSource() { }
+   virtual void onEvent() = 0; //run slay2 driver and server/client (e.g. slay2.task(); fxServer.task();)
+   virtual bool hasTxWork() = 0; //e.g. fxServer.hasTxWork()
+   virtual long getWaitTime1ms() { return -1; } //optional. time until the next deadline (-1 = none, 0 = now)
+   virtual int getFd() { return -1; } //optional. readable, when the source is to be run (e.g. fxServer.getFd())
+};
+
+
+
+class FileXferEventLoop
+{
+public:
+   FileXferEventLoop();
+   ~FileXferEventLoop();
+   bool add(FileXferEventSource * source, const char * ttyDev = NULL); //watch input of ttyDev (NULL: run by timer only)
+   int getFd(); //readable, when dispatch has to be called (-1, if the loop couldn't be created)
+   void dispatch(); //run the sources, that are due. doesn't block
+   void run(int timeout1ms = -1); //wait for getFd to become readable (or timeout), then dispatch
+
+private:
+   //a source and its state
+   typedef struct
+   {
+      FileXferEventSource * source;
+      int watchFd;               //read only fd of its tty. -1, if not watched
+      unsigned long lastRun1ms;  //last time, the source was run
+   } Source;
+
+   void arm(unsigned long time1ms); //set timer to the next time, a source is due
+
+   int epollFd;
+   int timerFd;
+   std::vector<Source> sources;
+};
+
+
+
+/* -- Global Variables ---------------------------------------------------- */
+
+/* -- Function Prototypes ------------------------------------------------- */
+
+/* -- Implementation ------------------------------------------------------ */
+
+
+
+#endif
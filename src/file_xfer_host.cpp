@@ -0,0 +1,154 @@
+//-----------------------------------------------------------------------------
+/*!
+   \file
+   \brief File transfer server host (several serial ports served by one process)
+*/
+//-----------------------------------------------------------------------------
+
+/* -- Includes ------------------------------------------------------------ */
+#include <iostream>
+#include "file_xfer_host.h"
+
+
+/* -- Defines ------------------------------------------------------------- */
+using namespace std;
+
+/* -- Types --------------------------------------------------------------- */
+
+/* -- (Module) Global Variables ------------------------------------------- */
+
+/* -- Module Global Function Prototypes ----------------------------------- */
+
+
+/* -- Implementation ------------------------------------------------------ */
+
+
+FileXferServerHost::FileXferServerHost()
+{
+}
+
+
+FileXferServerHost::~FileXferServerHost()
+{
+   for (size_t idx = 0; idx < ports.size(); ++idx)
+   {
+      closePort(ports[idx]);
+   }
+}
+
+
+//add a serial port, served by its own session with the given root directory. optionally with
+//additional transfer slots (see FileXferServer::addSlot).
+//return false, if the tty or the channels of the session can't be opened
+bool FileXferServerHost::addPort(const char * ttyDev, unsigned int baudrate, const char * root, unsigned int slots)
+{
+   Port * port = new Port;
+   port->ttyDev = ttyDev;
+   if (!port->slay2.init(ttyDev, baudrate))
+   {
+      cout << "Failed to open tty: " << ttyDev << endl;
+      delete port;
+      return false;
+   }
+
+   //open the channels of the session and its slots
+   for (unsigned int idx = 0; idx <= slots; ++idx)
+   {
+      const int ctrl = (idx == 0) ? FILE_XFER_HOST_CTRL_CHANNEL : (FILE_XFER_HOST_SLOT_CHANNEL + 2 * (idx - 1));
+      Slay2Channel * ctrlChannel = port->slay2.open(ctrl);
+      Slay2Channel * dataChannel = port->slay2.open((idx == 0) ? FILE_XFER_HOST_DATA_CHANNEL : (ctrl + 1));
+      if (ctrlChannel != NULL)
+      {
+         port->channels.push_back(ctrlChannel);
+      }
+      if (dataChannel != NULL)
+      {
+         port->channels.push_back(dataChannel);
+      }
+      if ((ctrlChannel == NULL) || (dataChannel == NULL))
+      {
+         cout << "Failed to open channels of " << ttyDev << ": " << ctrl << endl;
+         closePort(port);
+         return false;
+      }
+      port->servers.push_back(new FileXferServer(ctrlChannel, dataChannel, root));
+      if (idx > 0)
+      {
+         port->servers[0]->addSlot(port->servers.back());
+      }
+   }
+   port->servers[0]->setListCache(&listCache);
+
+   //run the port on input of the tty
+   if (!eventLoop.add(port, ttyDev))
+   {
+      cout << "Can't watch " << ttyDev << ". Run periodically!" << endl;
+   }
+   ports.push_back(port);
+   cout << "Serving " << ttyDev << " (root " << root << ", " << slots << " slots)" << endl;
+   return true;
+}
+
+
+void FileXferServerHost::setDurability(WriteBehindFile::Durability durability)
+{
+   for (size_t idx = 0; idx < ports.size(); ++idx)
+   {
+      ports[idx]->servers[0]->setDurability(durability);
+   }
+}
+
+
+//wait for input on any port, or a timer (see FileXferEventLoop), then run the ports that are due
+void FileXferServerHost::task()
+{
+   eventLoop.run();
+}
+
+
+unsigned int FileXferServerHost::getPortCount()
+{
+   return ports.size();
+}
+
+
+FileXferEventLoop& FileXferServerHost::getEventLoop()
+{
+   return eventLoop;
+}
+
+
+void FileXferServerHost::closePort(Port * port)
+{
+   for (size_t idx = 0; idx < port->servers.size(); ++idx)
+   {
+      delete port->servers[idx];
+   }
+   for (size_t idx = 0; idx < port->channels.size(); ++idx)
+   {
+      port->slay2.close(port->channels[idx]);
+   }
+   port->slay2.shutdown();
+   delete port;
+}
+
+
+
+
+void FileXferServerHost::Port::onEvent()
+{
+   slay2.task();
+   servers[0]->task(); //runs the slots as well
+}
+
+
+bool FileXferServerHost::Port::hasTxWork()
+{
+   return servers[0]->hasTxWork();
+}
+
+
+int FileXferServerHost::Port::getFd()
+{
+   return servers[0]->getFd(); //signaled by the slots as well
+}
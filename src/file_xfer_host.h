@@ -0,0 +1,77 @@
+//---------------------------------------------------------------------------------------------------------------------
+/*!
+   \file
+   \brief File transfer server host (several serial ports served by one process)
+
+   The host owns a slay2 driver and a file transfer server (session) per serial port. Each session has its own root
+   directory and state. One event loop (see file_xfer_event.h) multiplexes all ports: a port is only run on input on
+   its tty, while its session has data to send, when a file thread of its session completed (read ahead, sync), or
+   for the slay2 timers (acknowledge, retransmission). So idle ports cost (almost) no CPU time. Directory listings are cached for all ports (see
+   file_xfer_cache.h).
+*/
+//---------------------------------------------------------------------------------------------------------------------
+#ifndef FILE_XFER_HOST_H
+#define FILE_XFER_HOST_H
+
+/* -- Includes ------------------------------------------------------------ */
+#include <string>
+#include <vector>
+#include "slay2.h"
+#include "slay2_linux.h"
+#include "file_xfer_server.h"
+#include "file_xfer_event.h"
+#include "file_xfer_cache.h"
+
+
+/* -- Defines ------------------------------------------------------------- */
+#define FILE_XFER_HOST_CTRL_CHANNEL    (5)   //slay2 channels used by the session of each port
+#define FILE_XFER_HOST_DATA_CHANNEL    (6)
+#define FILE_XFER_HOST_SLOT_CHANNEL    (7)   //first channel of the transfer slots. each slot uses 2 channels (control + data)
+
+
+/* -- Types --------------------------------------------------------------- */
+
+class FileXferServerHost
+{
+public:
+   FileXferServerHost();
+   ~FileXferServerHost();
+   bool addPort(const char * ttyDev, unsigned int baudrate, const char * root, unsigned int slots = 0);
+   void setDurability(WriteBehindFile::Durability durability); //durability of uploaded files (all ports)
+   void task(); //wait for an event (see above), then run the ports
+   unsigned int getPortCount();
+   FileXferEventLoop& getEventLoop(); //e.g. to embed the host into another event loop
+
+private:
+   //a serial port and its session
+   class Port : public FileXferEventSource
+   {
+   public:
+      void onEvent();
+      bool hasTxWork();
+      int getFd();
+
+      std::string ttyDev;
+      Slay2Linux slay2;
+      std::vector<Slay2Channel *> channels;
+      std::vector<FileXferServer *> servers; //session and its transfer slots. the first one runs the others
+   };
+
+   void closePort(Port * port);
+
+   std::vector<Port *> ports;
+   FileXferEventLoop eventLoop;
+   FileXferListCache listCache; //shared by all ports
+};
+
+
+
+/* -- Global Variables ---------------------------------------------------- */
+
+/* -- Function Prototypes ------------------------------------------------- */
+
+/* -- Implementation ------------------------------------------------------ */
+
+
+
+#endif
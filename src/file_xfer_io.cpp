@@ -0,0 +1,379 @@
+//-----------------------------------------------------------------------------
+/*!
+   \file
+   \brief Block I/O of the files of a transfer
+*/
+//-----------------------------------------------------------------------------
+
+/* -- Includes ------------------------------------------------------------ */
+#include <string.h>
+#include <thread>
+#include "file_xfer_io.h"
+
+
+/* -- Defines ------------------------------------------------------------- */
+using namespace std;
+
+
+/* -- Types --------------------------------------------------------------- */
+
+/* -- (Module) Global Variables ------------------------------------------- */
+
+/* -- Module Global Function Prototypes ----------------------------------- */
+
+
+/* -- Implementation ------------------------------------------------------ */
+
+
+FileXferBlockReader::FileXferBlockReader()
+{
+   io = NULL;
+   file = NULL;
+   offset = 0;
+   remaining = 0;
+   for (unsigned int idx = 0; idx < FILE_XFER_IO_BLOCK_COUNT; ++idx)
+   {
+      length[idx] = 0;
+   }
+   tail = 0;
+   ready = 0;
+   head = 0;
+   position = 0;
+   pending = false;
+}
+
+
+//read "size" bytes of the file, starting at "offset". the first blocks are read right away
+void FileXferBlockReader::open(FileXferBlockIo * io, FileXferBlockIo::FileHandle_t file, unsigned long long offset, unsigned long long size)
+{
+   close();
+   for (unsigned int idx = 0; idx < FILE_XFER_IO_BLOCK_COUNT; ++idx)
+   {
+      blocks[idx].resize(FILE_XFER_IO_BLOCK_SIZE); //kept for further files
+   }
+   this->io = io;
+   this->file = file;
+   this->offset = offset;
+   remaining = size;
+   tail = 0;
+   ready = 0;
+   head = 0;
+   position = 0;
+   io->advise(file, size, FileXferBlockIo::ACCESS_SEQUENTIAL);
+   submit();
+}
+
+
+void FileXferBlockReader::close()
+{
+   while (pending)
+   {
+      poll();
+      if (pending)
+      {
+         std::this_thread::yield();
+      }
+   }
+   io = NULL;
+   remaining = 0;
+   tail = ready = head = 0;
+}
+
+
+bool FileXferBlockReader::isOpen() const
+{
+   return (io != NULL);
+}
+
+
+size_t FileXferBlockReader::peek(const unsigned char ** data)
+{
+   poll();
+   if (tail == ready)
+   {
+      return 0;
+   }
+   const unsigned int idx = tail % FILE_XFER_IO_BLOCK_COUNT;
+   *data = blocks[idx].data() + position;
+   return length[idx] - position;
+}
+
+
+//the block is free again, as soon as all its data was taken. so it is read again right away
+void FileXferBlockReader::consume(size_t len)
+{
+   position += len;
+   if (position >= length[tail % FILE_XFER_IO_BLOCK_COUNT])
+   {
+      ++tail;
+      position = 0;
+      submit();
+   }
+}
+
+
+bool FileXferBlockReader::isEnd() const
+{
+   return (!pending && (remaining == 0) && (tail == ready));
+}
+
+
+bool FileXferBlockReader::isPending() const
+{
+   return pending;
+}
+
+
+//read all free blocks by one call (as far as they are needed)
+void FileXferBlockReader::submit()
+{
+   if (pending || (remaining == 0) || (head == (tail + FILE_XFER_IO_BLOCK_COUNT)))
+   {
+      return;
+   }
+   FileXferIoVec vec[FILE_XFER_IO_BLOCK_COUNT];
+   unsigned int count = 0;
+   unsigned long long rest = remaining;
+   while ((head != (tail + FILE_XFER_IO_BLOCK_COUNT)) && (rest > 0))
+   {
+      const unsigned int idx = head % FILE_XFER_IO_BLOCK_COUNT;
+      length[idx] = (rest < FILE_XFER_IO_BLOCK_SIZE) ? (size_t)rest : FILE_XFER_IO_BLOCK_SIZE;
+      vec[count].data = blocks[idx].data();
+      vec[count].length = length[idx];
+      rest -= length[idx];
+      ++count;
+      ++head;
+   }
+   const size_t result = io->readBlocks(file, offset, vec, count);
+   if (result == FILE_XFER_IO_PENDING)
+   {
+      pending = true;
+      return;
+   }
+   complete(result);
+}
+
+
+//the blocks are filled in order. a block, that got less than requested, is the last one read. the blocks behind
+//it are free again. nothing read at all, is the end of the file (or a read error)
+void FileXferBlockReader::complete(size_t result)
+{
+   pending = false;
+   if (result == 0)
+   {
+      remaining = 0;
+   }
+   while ((ready != head) && (result > 0))
+   {
+      const unsigned int idx = ready % FILE_XFER_IO_BLOCK_COUNT;
+      const bool full = (result >= length[idx]);
+      if (!full)
+      {
+         length[idx] = result;
+      }
+      result -= length[idx];
+      offset += length[idx];
+      remaining -= length[idx];
+      ++ready;
+      if (!full)
+      {
+         break;
+      }
+   }
+   head = ready;
+}
+
+
+void FileXferBlockReader::poll()
+{
+   if (pending)
+   {
+      const size_t result = io->poll(file);
+      if (result == FILE_XFER_IO_PENDING)
+      {
+         return;
+      }
+      complete(result);
+   }
+   submit();
+}
+
+
+
+
+FileXferBlockWriter::FileXferBlockWriter()
+{
+   io = NULL;
+   file = NULL;
+   offset = 0;
+   for (unsigned int idx = 0; idx < FILE_XFER_IO_BLOCK_COUNT; ++idx)
+   {
+      length[idx] = 0;
+   }
+   done = 0;
+   submitted = 0;
+   filling = 0;
+   pending = false;
+   error = false;
+}
+
+
+//write "size" bytes of the file (0 = unknown), starting at "offset"
+void FileXferBlockWriter::open(FileXferBlockIo * io, FileXferBlockIo::FileHandle_t file, unsigned long long offset, unsigned long long size)
+{
+   close();
+   for (unsigned int idx = 0; idx < FILE_XFER_IO_BLOCK_COUNT; ++idx)
+   {
+      blocks[idx].resize(FILE_XFER_IO_BLOCK_SIZE + 1); //one more for a zero termination. kept for further files
+   }
+   this->io = io;
+   this->file = file;
+   this->offset = offset;
+   error = false;
+   io->advise(file, size, FileXferBlockIo::ACCESS_SEQUENTIAL);
+}
+
+
+void FileXferBlockWriter::close()
+{
+   wait();
+   io = NULL;
+   for (unsigned int idx = 0; idx < FILE_XFER_IO_BLOCK_COUNT; ++idx)
+   {
+      length[idx] = 0;
+   }
+   done = submitted = filling = 0;
+}
+
+
+bool FileXferBlockWriter::isOpen() const
+{
+   return (io != NULL);
+}
+
+
+void FileXferBlockWriter::write(const unsigned char * data, size_t len)
+{
+   while (len > 0)
+   {
+      const unsigned int idx = filling % FILE_XFER_IO_BLOCK_COUNT;
+      if (length[idx] == FILE_XFER_IO_BLOCK_SIZE) //block is full. continue with the next one
+      {
+         ++filling;
+         submit(false);
+         while (filling == (done + FILE_XFER_IO_BLOCK_COUNT)) //no block free
+         {
+            wait();
+            submit(false);
+         }
+         continue;
+      }
+      size_t count = FILE_XFER_IO_BLOCK_SIZE - length[idx];
+      if (count > len)
+      {
+         count = len;
+      }
+      memcpy(blocks[idx].data() + length[idx], data, count);
+      length[idx] += count;
+      data += count;
+      len -= count;
+   }
+}
+
+
+bool FileXferBlockWriter::flush()
+{
+   wait();
+   submit(true);
+   wait();
+   return !error;
+}
+
+
+bool FileXferBlockWriter::isPending() const
+{
+   return pending;
+}
+
+
+void FileXferBlockWriter::poll()
+{
+   if (pending)
+   {
+      const size_t result = io->poll(file);
+      if (result == FILE_XFER_IO_PENDING)
+      {
+         return;
+      }
+      complete(result);
+   }
+   submit(false);
+}
+
+
+//write the full blocks by one call. "all": the block being filled as well
+void FileXferBlockWriter::submit(bool all)
+{
+   if (pending)
+   {
+      return;
+   }
+   if (all && (length[filling % FILE_XFER_IO_BLOCK_COUNT] > 0))
+   {
+      ++filling;
+   }
+   if (submitted == filling)
+   {
+      return;
+   }
+   FileXferIoVec vec[FILE_XFER_IO_BLOCK_COUNT];
+   unsigned int count = 0;
+   for (; submitted != filling; ++submitted)
+   {
+      const unsigned int idx = submitted % FILE_XFER_IO_BLOCK_COUNT;
+      blocks[idx][length[idx]] = 0; //zero terminate (like a received frame)
+      vec[count].data = blocks[idx].data();
+      vec[count].length = length[idx];
+      ++count;
+   }
+   const size_t result = io->writeBlocks(file, offset, vec, count);
+   if (result == FILE_XFER_IO_PENDING)
+   {
+      pending = true;
+      return;
+   }
+   complete(result);
+}
+
+
+void FileXferBlockWriter::complete(size_t result)
+{
+   pending = false;
+   size_t expected = 0;
+   for (; done != submitted; ++done)
+   {
+      const unsigned int idx = done % FILE_XFER_IO_BLOCK_COUNT;
+      expected += length[idx];
+      length[idx] = 0;
+   }
+   if (result != expected)
+   {
+      error = true;
+   }
+   offset += expected;
+}
+
+
+void FileXferBlockWriter::wait()
+{
+   while (pending)
+   {
+      const size_t result = io->poll(file);
+      if (result == FILE_XFER_IO_PENDING)
+      {
+         std::this_thread::yield();
+         continue;
+      }
+      complete(result);
+   }
+}
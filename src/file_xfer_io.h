@@ -0,0 +1,158 @@
+//---------------------------------------------------------------------------------------------------------------------
+/*!
+   \file
+   \brief Block I/O of the files of a transfer
+
+   The file data of a transfer is read (or written) in large blocks, instead of per data frame. A stream keeps a
+   few blocks (FILE_XFER_IO_BLOCK_COUNT): the free blocks are read (or the full blocks are written) by a single
+   vectored call at the position of the file, while the other blocks are sent (or filled). An implementation of
+   FileXferBlockIo may complete a call asynchronously. The stream polls for its completion, so a transfer
+   continues, while the storage is busy.
+
+   Only one call per file is in progress at a time.
+*/
+//---------------------------------------------------------------------------------------------------------------------
+#ifndef FILE_XFER_IO_H
+#define FILE_XFER_IO_H
+
+/* -- Includes ------------------------------------------------------------ */
+#include <stddef.h>
+#include <vector>
+
+
+/* -- Defines ------------------------------------------------------------- */
+#ifndef FILE_XFER_IO_BLOCK_SIZE
+#define FILE_XFER_IO_BLOCK_SIZE     (256 * 1024)   //size of one block of a stream (in bytes)
+#endif
+#define FILE_XFER_IO_BLOCK_COUNT    (2)            //number of blocks of a stream
+#define FILE_XFER_IO_PENDING        ((size_t)-1)   //a call completes asynchronously (see FileXferBlockIo::poll)
+
+
+/* -- Types --------------------------------------------------------------- */
+
+//a piece of memory of a vectored read or write
+typedef struct
+{
+   unsigned char * data;
+   size_t length;
+} FileXferIoVec;
+
+
+//block I/O of the files (e.g. implemented by the application of a client)
+class FileXferBlockIo
+{
+public:
+   typedef void * FileHandle_t;
+
+   //how a file is accessed
+   enum Access
+   {
+      ACCESS_SEQUENTIAL,   //from start to end (e.g. to read ahead, or to write behind)
+      ACCESS_RANDOM        //at any offset (e.g. the basis of a delta download)
+   };
+
+public:
+   virtual ~FileXferBlockIo() { }
+
+   //optional. hint: "size" bytes of the file will be accessed (0 = unknown). e.g. to preallocate a file to be written
+   virtual void advise(FileHandle_t file, unsigned long long size, Access access) { }
+
+   //read into the pieces of "vec" (in order), starting at "offset" of the file. returns the number of bytes read
+   //(less than requested at the end of the file, 0 on error), or FILE_XFER_IO_PENDING (see poll)
+   virtual size_t readBlocks(FileHandle_t file, unsigned long long offset, const FileXferIoVec * vec, unsigned int count) = 0;
+
+   //write the pieces of "vec" (in order), starting at "offset" of the file. returns the number of bytes written
+   //(less than given on error), or FILE_XFER_IO_PENDING (see poll)
+   virtual size_t writeBlocks(FileHandle_t file, unsigned long long offset, const FileXferIoVec * vec, unsigned int count) = 0;
+
+   //optional (asynchronous implementations only). result of the call in progress, or FILE_XFER_IO_PENDING while
+   //it is still in progress. the memory of "vec" must not be used any longer, once the result is returned
+   virtual size_t poll(FileHandle_t file) { return 0; }
+};
+
+
+
+//read a file sequentially, block by block. the blocks are read ahead, while the data is taken
+class FileXferBlockReader
+{
+public:
+   FileXferBlockReader();
+
+   void open(FileXferBlockIo * io, FileXferBlockIo::FileHandle_t file, unsigned long long offset, unsigned long long size);
+   void close(); //waits for a read in progress (its blocks are in use)
+   bool isOpen() const;
+
+   //get the next data of the file. returns its length (at most the rest of a block), 0 if there is no data yet
+   //(a read is in progress) or at the end (see isEnd). the data is valid until consume
+   size_t peek(const unsigned char ** data);
+   void consume(size_t len);
+   bool isEnd() const;        //all data taken (or the file couldn't be read further)
+   bool isPending() const;    //a read is in progress
+
+private:
+   FileXferBlockReader(const FileXferBlockReader&); //not copyable
+   FileXferBlockReader& operator=(const FileXferBlockReader&);
+   void submit();
+   void complete(size_t result);
+   void poll();
+
+   FileXferBlockIo * io;
+   FileXferBlockIo::FileHandle_t file;
+   unsigned long long offset;    //of the next read
+   unsigned long long remaining; //number of bytes not yet read
+   std::vector<unsigned char> blocks[FILE_XFER_IO_BLOCK_COUNT];
+   size_t length[FILE_XFER_IO_BLOCK_COUNT]; //number of bytes requested for (or read into) a block
+   unsigned int tail;            //block being taken. blocks [tail, ready) are read
+   unsigned int ready;           //blocks [ready, head) are being read
+   unsigned int head;            //blocks [head, tail + BLOCK_COUNT) are free
+   size_t position;              //within the tail block
+   bool pending;
+};
+
+
+
+//write a file sequentially, block by block. full blocks are written, while the next block is filled
+class FileXferBlockWriter
+{
+public:
+   FileXferBlockWriter();
+
+   void open(FileXferBlockIo * io, FileXferBlockIo::FileHandle_t file, unsigned long long offset, unsigned long long size);
+   void close(); //waits for a write in progress (its blocks are in use). data not yet written is dropped
+   bool isOpen() const;
+
+   void write(const unsigned char * data, size_t len); //waits for a write in progress, if all blocks are full
+   bool flush(); //write all data. waits until it is written. false, if any data couldn't be written
+   bool isPending() const; //a write is in progress
+   void poll(); //check for the completion of a write in progress (and write the full blocks)
+
+private:
+   FileXferBlockWriter(const FileXferBlockWriter&); //not copyable
+   FileXferBlockWriter& operator=(const FileXferBlockWriter&);
+   void submit(bool all);
+   void complete(size_t result);
+   void wait();
+
+   FileXferBlockIo * io;
+   FileXferBlockIo::FileHandle_t file;
+   unsigned long long offset;    //of the next write
+   std::vector<unsigned char> blocks[FILE_XFER_IO_BLOCK_COUNT];
+   size_t length[FILE_XFER_IO_BLOCK_COUNT]; //number of bytes of a block
+   unsigned int done;            //blocks [done, submitted) are being written
+   unsigned int submitted;       //blocks [submitted, filling) are full
+   unsigned int filling;         //block being filled
+   bool pending;
+   bool error;
+};
+
+
+
+/* -- Global Variables ---------------------------------------------------- */
+
+/* -- Function Prototypes ------------------------------------------------- */
+
+/* -- Implementation ------------------------------------------------------ */
+
+
+
+#endif
@@ -0,0 +1,504 @@
+//-----------------------------------------------------------------------------
+/*!
+   \file
+   \brief Binary directory listing format
+*/
+//-----------------------------------------------------------------------------
+
+/* -- Includes ------------------------------------------------------------ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "file_xfer_list.h"
+
+
+/* -- Defines ------------------------------------------------------------- */
+using namespace std;
+
+
+/* -- Types --------------------------------------------------------------- */
+
+/* -- (Module) Global Variables ------------------------------------------- */
+
+/* -- Module Global Function Prototypes ----------------------------------- */
+static void putVarint(vector<unsigned char>& out, unsigned long long value);
+static unsigned int decodeName(const unsigned char * data, unsigned int len, unsigned long long * shared, unsigned long long * suffixLength);
+static const char * findLast(const char * text, size_t len, char c);
+static string formatNumber(unsigned long long value, unsigned long long none);
+static bool parseNumber(const string& text, unsigned long long none, unsigned long long * value);
+
+
+/* -- Implementation ------------------------------------------------------ */
+
+
+FileXferListWriter::FileXferListWriter()
+{
+   reset();
+}
+
+
+void FileXferListWriter::reset()
+{
+   previous.clear();
+}
+
+
+void FileXferListWriter::addCurrent(vector<unsigned char>& output, const string& name)
+{
+   output.push_back(FILE_XFER_LIST_CURRENT);
+   putVarint(output, name.length());
+   output.insert(output.end(), name.begin(), name.end());
+}
+
+
+void FileXferListWriter::addDirectory(vector<unsigned char>& output, const char * name, size_t nameLength)
+{
+   output.push_back(FILE_XFER_LIST_DIRECTORY);
+   addName(output, name, nameLength);
+}
+
+
+void FileXferListWriter::addFile(vector<unsigned char>& output, const char * name, size_t nameLength,
+                                 unsigned long long size, unsigned long long mtime)
+{
+   output.push_back(FILE_XFER_LIST_FILE);
+   putVarint(output, size);
+   putVarint(output, mtime);
+   addName(output, name, nameLength);
+}
+
+
+void FileXferListWriter::addRemoved(vector<unsigned char>& output, const char * name, size_t nameLength)
+{
+   output.push_back(FILE_XFER_LIST_REMOVED);
+   addName(output, name, nameLength);
+}
+
+
+//front coding: only the part, that differs from the previous name is sent
+void FileXferListWriter::addName(vector<unsigned char>& output, const char * name, size_t nameLength)
+{
+   size_t shared = 0;
+   while ((shared < nameLength) && (shared < previous.length()) && (name[shared] == previous[shared]))
+   {
+      ++shared;
+   }
+   putVarint(output, shared);
+   putVarint(output, nameLength - shared);
+   output.insert(output.end(), (const unsigned char *)name + shared, (const unsigned char *)name + nameLength);
+   previous.replace(shared, string::npos, name + shared, nameLength - shared);
+}
+
+
+
+
+FileXferListReader::FileXferListReader()
+{
+   reset();
+}
+
+
+void FileXferListReader::reset()
+{
+   current.clear();
+   entries.clear();
+   header.clear();
+   type = 0;
+   name.clear();
+   previous.clear();
+   nameLength = 0;
+   fileSize = 0;
+   fileTime = 0;
+   line.clear();
+   memset(hourText, 0, sizeof(hourText));
+   hourStart = 0;
+   result = 0;
+}
+
+
+int FileXferListReader::feed(const unsigned char * data, size_t len)
+{
+   size_t idx = 0;
+   while ((idx < len) && (result == 0))
+   {
+      //name (suffix of a front coded name)
+      if (name.length() < nameLength)
+      {
+         size_t n = len - idx;
+         if (n > (nameLength - name.length()))
+         {
+            n = nameLength - name.length();
+         }
+         name.append((const char *)&data[idx], n);
+         idx += n;
+      }
+      else
+      {
+         //collect record header. check if it is complete
+         header.push_back(data[idx++]);
+         const unsigned char * arg = header.data() + 1;
+         const unsigned int argLen = header.size() - 1;
+         unsigned long long shared = 0;
+         unsigned long long suffixLength = 0;
+         unsigned int used = 0;
+         switch (header[0])
+         {
+            case FILE_XFER_LIST_END:
+            {
+               result = 1;
+               continue;
+            }
+
+            case FILE_XFER_LIST_CURRENT:
+            {
+               used = fileXferDecodeVarint(arg, argLen, &suffixLength);
+               break;
+            }
+
+            case FILE_XFER_LIST_DIRECTORY:
+            case FILE_XFER_LIST_REMOVED:
+            {
+               used = decodeName(arg, argLen, &shared, &suffixLength);
+               break;
+            }
+
+            case FILE_XFER_LIST_FILE:
+            {
+               unsigned int sizeLen = fileXferDecodeVarint(arg, argLen, &fileSize);
+               unsigned int timeLen = (sizeLen != 0) ? fileXferDecodeVarint(arg + sizeLen, argLen - sizeLen, &fileTime) : 0;
+               used = (timeLen != 0) ? decodeName(arg + sizeLen + timeLen, argLen - sizeLen - timeLen, &shared, &suffixLength) : 0;
+               break;
+            }
+
+            default:
+            {
+               result = -1; //unknown record
+               continue;
+            }
+         }
+         if (used == 0) //header incomplete
+         {
+            if (header.size() > (1 + 4 * FILE_XFER_VARINT_MAX_LEN))
+            {
+               result = -1; //invalid header
+            }
+            continue;
+         }
+
+         //header complete. the name starts with the shared part of the previous name
+         if ((shared > previous.length()) || ((shared + suffixLength) == 0) || ((shared + suffixLength) > FILE_XFER_LIST_NAME_MAX))
+         {
+            result = -1; //invalid name
+            continue;
+         }
+         type = header[0];
+         header.clear();
+         name.clear();
+         if (shared != 0)
+         {
+            name.assign(previous, 0, shared);
+         }
+         nameLength = shared + suffixLength;
+      }
+
+      //record complete?
+      if (name.length() == nameLength)
+      {
+         if (type == FILE_XFER_LIST_CURRENT)
+         {
+            current = name;
+         }
+         else if (name.find('/') != string::npos)
+         {
+            result = -1; //an entry must not be a path
+         }
+         else
+         {
+            FileXferStat entry;
+            entry.type = type;
+            entry.name = name;
+            entry.size = (type == FILE_XFER_LIST_FILE) ? fileSize : 0;
+            entry.mtime = (type == FILE_XFER_LIST_FILE) ? fileTime : 0;
+            entry.mtimeNsec = 0;
+            entries.push_back(entry);
+            previous.swap(name);
+         }
+         name.clear();
+         nameLength = 0;
+      }
+   }
+   return result;
+}
+
+
+//lines are split with memchr (vectorized by the c library). only an incomplete line at the end of "data"
+//is copied, to be completed by the next piece
+int FileXferListReader::feedText(const unsigned char * data, size_t len)
+{
+   const unsigned char * end = (const unsigned char *)memchr(data, 0, len); //end of listing
+   if (end != NULL)
+   {
+      len = end - data;
+   }
+   size_t idx = 0;
+   while ((idx < len) && (result == 0))
+   {
+      const unsigned char * lf = (const unsigned char *)memchr(data + idx, '\n', len - idx);
+      const size_t lineEnd = (lf != NULL) ? (size_t)(lf - data) : len;
+      if ((lf != NULL) && line.empty())
+      {
+         if (!parseLine((const char *)data + idx, lineEnd - idx)) //complete line within data, parsed in place
+         {
+            result = -1;
+         }
+      }
+      else
+      {
+         line.append((const char *)data + idx, lineEnd - idx);
+         if (line.length() > (FILE_XFER_LIST_NAME_MAX + FILE_XFER_LIST_ENTRY_MAX))
+         {
+            result = -1; //line too long
+         }
+         else if ((lf != NULL) && !parseLine(line.data(), line.length()))
+         {
+            result = -1;
+         }
+         if (lf != NULL)
+         {
+            line.clear();
+         }
+      }
+      idx = lineEnd + 1;
+   }
+   if ((end != NULL) && (result == 0))
+   {
+      result = line.empty() ? 1 : -1; //the listing ends with a complete line
+   }
+   return result;
+}
+
+
+//<type>,<name>,<size>,<date>. the name may contain a KOMMA, so size and date are split from the right
+bool FileXferListReader::parseLine(const char * text, size_t len)
+{
+   if ((len < 4) || (text[1] != ','))
+   {
+      return false;
+   }
+   const char * date = findLast(text + 2, len - 2, ',');
+   const char * size = (date != NULL) ? findLast(text + 2, date - text - 2, ',') : NULL;
+   if (size == NULL)
+   {
+      return false;
+   }
+   const size_t length = size - text - 2;
+   if (text[0] == FILE_XFER_LIST_CURRENT)
+   {
+      current.assign(text + 2, length);
+      return true;
+   }
+   if (((text[0] != FILE_XFER_LIST_DIRECTORY) && (text[0] != FILE_XFER_LIST_FILE) && (text[0] != FILE_XFER_LIST_REMOVED)) ||
+       (length == 0) || (memchr(text + 2, '/', length) != NULL))
+   {
+      return false;
+   }
+   FileXferStat entry;
+   entry.type = text[0];
+   entry.name.assign(text + 2, length);
+   entry.size = 0;
+   entry.mtimeNsec = 0;
+   for (const char * c = size + 1; c < date; ++c)
+   {
+      if ((*c < '0') || (*c > '9'))
+      {
+         return false;
+      }
+      entry.size = entry.size * 10 + (*c - '0');
+   }
+   entry.mtime = parseTime(date + 1, len - (date + 1 - text));
+   entries.push_back(entry);
+   return true;
+}
+
+
+//0, if empty or invalid. the conversion from local time is cached for the current hour (like the server
+//does, see FileXferListing::formatTime)
+unsigned long long FileXferListReader::parseTime(const char * date, size_t len)
+{
+   unsigned int minute;
+   unsigned int second;
+   if ((len != 19) || (sscanf(date + 14, "%2u:%2u", &minute, &second) != 2))
+   {
+      return 0;
+   }
+   if (memcmp(date, hourText, 14) != 0)
+   {
+      struct tm t;
+      memset(&t, 0, sizeof(t));
+      if (sscanf(date, "%4d-%2d-%2d %2d:", &t.tm_year, &t.tm_mon, &t.tm_mday, &t.tm_hour) != 4)
+      {
+         return 0;
+      }
+      t.tm_year -= 1900;
+      t.tm_mon -= 1;
+      t.tm_isdst = -1;
+      const time_t start = mktime(&t);
+      if (start == (time_t)-1)
+      {
+         return 0;
+      }
+      memcpy(hourText, date, 14);
+      hourText[14] = 0;
+      hourStart = start;
+   }
+   return hourStart + minute * 60 + second;
+}
+
+
+//same format as the text listing (see FileXferServer::onLS_Command). dates are converted into the local time
+//of the client
+string FileXferListReader::toText() const
+{
+   string text = ".," + current + ",,\n";
+   for (size_t idx = 0; idx < entries.size(); ++idx)
+   {
+      const FileXferStat& entry = entries[idx];
+      text += (char)entry.type;
+      text += ',';
+      text += entry.name;
+      text += ',';
+      char date[32] = "";
+      const time_t mtime = (time_t)entry.mtime;
+      const struct tm * t = (entry.mtime != 0) ? localtime(&mtime) : NULL;
+      if (t != NULL)
+      {
+         strftime(date, sizeof(date), "%Y-%m-%d %H:%M:%S", t);
+         text += to_string(entry.size);
+      }
+      text += ',';
+      text += date;
+      text += '\n';
+   }
+   return text;
+}
+
+
+
+
+FileXferListFilter::FileXferListFilter()
+{
+   minSize = 0;
+   maxSize = FILE_XFER_LIST_UNLIMITED;
+   minTime = 0;
+   maxTime = FILE_XFER_LIST_UNLIMITED;
+   sort = 'n';
+   offset = 0;
+   limit = 0;
+}
+
+
+//<pattern>,<types>,<min-size>,<max-size>,<min-time>,<max-time>,<sort>,<offset>,<limit>
+//numbers are decimal. an empty number is the default (no limit). the pattern may contain a KOMMA
+string FileXferListFilter::format() const
+{
+   return pattern + "," + types + "," + formatNumber(minSize, 0) + "," + formatNumber(maxSize, FILE_XFER_LIST_UNLIMITED) + "," +
+          formatNumber(minTime, 0) + "," + formatNumber(maxTime, FILE_XFER_LIST_UNLIMITED) + "," + sort + "," +
+          formatNumber(offset, 0) + "," + formatNumber(limit, 0);
+}
+
+
+bool FileXferListFilter::parse(const string& args)
+{
+   //split the arguments from the right
+   string values[8];
+   size_t end = args.length();
+   for (int idx = 7; idx >= 0; --idx)
+   {
+      const size_t comma = args.rfind(',', (end > 0) ? (end - 1) : 0);
+      if ((comma == string::npos) || (comma >= end))
+      {
+         return false;
+      }
+      values[idx] = args.substr(comma + 1, end - comma - 1);
+      end = comma;
+   }
+   pattern = args.substr(0, end);
+   types = values[0];
+   unsigned long long number;
+   if (!parseNumber(values[1], 0, &minSize) || !parseNumber(values[2], FILE_XFER_LIST_UNLIMITED, &maxSize) ||
+       !parseNumber(values[3], 0, &minTime) || !parseNumber(values[4], FILE_XFER_LIST_UNLIMITED, &maxTime))
+   {
+      return false;
+   }
+   if (types.find_first_not_of("df") != string::npos)
+   {
+      return false;
+   }
+   sort = values[5].empty() ? 'n' : values[5][0];
+   if ((values[5].length() > 1) || (string("nstNST").find(sort) == string::npos))
+   {
+      return false;
+   }
+   if (!parseNumber(values[6], 0, &number))
+   {
+      return false;
+   }
+   offset = number;
+   if (!parseNumber(values[7], 0, &number))
+   {
+      return false;
+   }
+   limit = number;
+   return true;
+}
+
+
+
+static void putVarint(vector<unsigned char>& out, unsigned long long value)
+{
+   unsigned char buffer[FILE_XFER_VARINT_MAX_LEN];
+   out.insert(out.end(), buffer, buffer + fileXferEncodeVarint(buffer, value));
+}
+
+
+//decode <shared> and <suffix-len> of a front coded name. returns the number of bytes consumed, or 0 if incomplete
+static unsigned int decodeName(const unsigned char * data, unsigned int len, unsigned long long * shared, unsigned long long * suffixLength)
+{
+   const unsigned int sharedLen = fileXferDecodeVarint(data, len, shared);
+   const unsigned int suffixLen = (sharedLen != 0) ? fileXferDecodeVarint(data + sharedLen, len - sharedLen, suffixLength) : 0;
+   return (suffixLen != 0) ? (sharedLen + suffixLen) : 0;
+}
+
+
+static string formatNumber(unsigned long long value, unsigned long long none)
+{
+   return (value == none) ? string() : to_string(value);
+}
+
+
+static bool parseNumber(const string& text, unsigned long long none, unsigned long long * value)
+{
+   char * end;
+   if (text.empty())
+   {
+      *value = none;
+      return true;
+   }
+   *value = strtoull(text.c_str(), &end, 10);
+   return (*end == 0) && (text[0] >= '0') && (text[0] <= '9');
+}
+
+
+//like memrchr (which isn't available everywhere)
+static const char * findLast(const char * text, size_t len, char c)
+{
+   while (len > 0)
+   {
+      if (text[--len] == c)
+      {
+         return text + len;
+      }
+   }
+   return NULL;
+}
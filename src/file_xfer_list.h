@@ -0,0 +1,187 @@
+//---------------------------------------------------------------------------------------------------------------------
+/*!
+   \file
+   \brief Directory listing engine (linux) and binary listing format
+
+   Formats the entries of a directory into the listing format of the LS command (see FileXferServer::onLS_Command):
+   'd,<name>,,\n' for sub-directories, 'f,<name>,<size>,<date>\n' for regular files. Other files are skipped, as
+   well as the '.' directory.
+
+   If the binary listing was negotiated (FILE_XFER_FEATURE_BINARY_LISTING), the entries are encoded as a sequence
+   of records instead:
+   '.' <name-len:varint> <name...>                                         current directory (first record)
+   'd' <shared:varint> <suffix-len:varint> <suffix...>                      sub-directory
+   'f' <size:varint> <mtime:varint> <shared:varint> <suffix-len:varint> <suffix...>   regular file
+   'r' <shared:varint> <suffix-len:varint> <suffix...>                      removed entry (listing of changes only)
+   0                                                                        end of listing
+
+   Names are front coded: <shared> is the number of leading characters, the name has in common with the name
+   of the previous 'd' or 'f' record. Only the remaining <suffix> is sent. <mtime> is the modification time in
+   seconds since epoch. A file, that couldn't be stat'ed has <size> and <mtime> 0 (0 = unknown). The end of
+   the listing is the same single zero byte, that terminates the text listing.
+
+   A listing of changes (see FileXferServer::onCHANGES_Command) contains the added and modified entries, and
+   a removed entry for each entry that is gone. In text format, a removed entry is given by 'r,<name>,,\n'.
+
+   The directory is read in large batches (getdents64) and the files are stat'ed relative to the open directory
+   (fstatat), so no path has to be built per entry. The time zone is set up once per listing, and the conversion
+   into local time is cached for the current hour (files of a directory are often modified at similar times).
+   Entries are formatted into one contiguous buffer, so a listing frame is sent at once.
+*/
+//---------------------------------------------------------------------------------------------------------------------
+#ifndef FILE_XFER_LIST_H
+#define FILE_XFER_LIST_H
+
+/* -- Includes ------------------------------------------------------------ */
+#include <stddef.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <string>
+#include <vector>
+#include "file_xfer.h"
+
+
+/* -- Defines ------------------------------------------------------------- */
+#define FILE_XFER_LIST_BATCH_SIZE         (32 * 1024)    //buffer size for directory reads (in bytes)
+#define FILE_XFER_LIST_ENTRY_MAX          (300)          //max. length of one entry (name up to NAME_MAX)
+#define FILE_XFER_LIST_NAME_MAX           (4096)         //max. length of a name (or of the current directory) within a binary listing
+#define FILE_XFER_LIST_UNLIMITED          (~0ULL)        //upper bound of a range of a filtered listing, that isn't limited
+
+//record types of the binary listing
+#define FILE_XFER_LIST_CURRENT            ((unsigned char)'.')
+#define FILE_XFER_LIST_DIRECTORY          ((unsigned char)'d')
+#define FILE_XFER_LIST_FILE               ((unsigned char)'f')
+#define FILE_XFER_LIST_REMOVED            ((unsigned char)'r')
+#define FILE_XFER_LIST_END                ((unsigned char)0)
+
+
+/* -- Types --------------------------------------------------------------- */
+
+//build the records of a binary listing. the records are appended to "output".
+class FileXferListWriter
+{
+public:
+   FileXferListWriter();
+   void reset();
+   static void addCurrent(std::vector<unsigned char>& output, const std::string& name);
+   void addDirectory(std::vector<unsigned char>& output, const char * name, size_t nameLength);
+   void addFile(std::vector<unsigned char>& output, const char * name, size_t nameLength, unsigned long long size, unsigned long long mtime);
+   void addRemoved(std::vector<unsigned char>& output, const char * name, size_t nameLength);
+
+private:
+   void addName(std::vector<unsigned char>& output, const char * name, size_t nameLength);
+
+   std::string previous; //name of the previous entry
+};
+
+
+//read a listing (binary or text format). the listing can be feed in pieces of any size. the decoded entries are
+//appended to "entries". they may be taken away (cleared) at any time, to process a large listing in batches.
+class FileXferListReader
+{
+public:
+   FileXferListReader();
+   void reset();
+   int feed(const unsigned char * data, size_t len); //binary listing. returns 0 if more data is expected, 1 when done, -1 on error
+   int feedText(const unsigned char * data, size_t len); //text listing. same as feed
+   std::string toText() const; //the listing in text format (without termination)
+
+   std::string current; //current directory
+   std::vector<FileXferStat> entries;
+
+private:
+   bool parseLine(const char * line, size_t len); //one line of a text listing (without '\n')
+   unsigned long long parseTime(const char * date, size_t len); //YYYY-mm-dd HH:MM:SS (local time)
+
+   std::vector<unsigned char> header; //incomplete record header
+   unsigned char type;                //type of the current record
+   std::string name;
+   std::string previous;              //name of the previous entry (front coding)
+   unsigned long long nameLength;
+   unsigned long long fileSize;
+   unsigned long long fileTime;
+   std::string line;                  //incomplete line of a text listing
+   char hourText[16];                 //"YYYY-mm-dd HH:" of the cached hour
+   unsigned long long hourStart;      //start of the cached hour
+   int result;
+};
+
+
+//options of a filtered listing (see FileXferServer::onFILTER_Command)
+class FileXferListFilter
+{
+public:
+   FileXferListFilter();
+   std::string format() const;               //arguments of the request
+   bool parse(const std::string& args);      //false, if invalid
+
+   std::string pattern;       //names matching this glob pattern (or extended regular expression, if starting with '~'). empty: all
+   std::string types;         //entries of these types ('d', 'f'). empty: all
+   unsigned long long minSize; //files of at least that size (in bytes)
+   unsigned long long maxSize; //files of at most that size (FILE_XFER_LIST_UNLIMITED: no limit)
+   unsigned long long minTime; //files modified at or after that time (seconds since epoch)
+   unsigned long long maxTime; //files modified at or before that time (FILE_XFER_LIST_UNLIMITED: no limit)
+   char sort;                 //sort key: 'n' name, 's' size, 't' modification time. upper case: descending order
+   unsigned long offset;      //number of (sorted) entries to skip
+   unsigned long limit;       //max. number of entries (0: no limit)
+};
+
+
+//the entries of a directory (linux)
+class FileXferListing
+{
+public:
+   FileXferListing();
+   ~FileXferListing();
+
+   bool open(const std::string& dir, bool binary = false); //binary: format the entries as binary listing
+   void close();
+   bool isOpen() const;
+
+   //append the first entry (the current directory "name") to "output"
+   static void addCurrent(std::vector<unsigned char>& output, const std::string& name, bool binary);
+
+   //append further entries to "output", until it holds at least "size" bytes (or the end of the directory
+   //is reached). returns false at the end of the directory (or on read error, see hasError)
+   bool read(std::vector<unsigned char>& output, size_t size);
+
+   //instead of read: append the directories and regular files of the next "count" directory entries to "entries"
+   //(unformatted, with the nanoseconds of the modification time). returns false at the end of the directory (or on
+   //read error, see hasError)
+   bool readEntries(std::vector<FileXferStat>& entries, size_t count);
+   bool hasError() const; //the directory couldn't be read completely
+
+   //append the given entries to "output" (instead of the entries of the directory). an entry of an unknown
+   //modification time (0) is formatted without size and date
+   void format(std::vector<unsigned char>& output, const std::vector<FileXferStat>& entries, bool binary);
+
+   //format into YYYY-mm-dd HH:MM:SS (local time). buf needs to store 24 characters. returns the length
+   unsigned int formatTime(char * buf, time_t time);
+
+private:
+   FileXferListing(const FileXferListing&); //not copyable
+   FileXferListing& operator=(const FileXferListing&);
+   const char * next(unsigned char& type, struct stat& fileStat, bool& fileStatOk);
+
+   int fd;
+   bool binary;
+   bool error;
+   FileXferListWriter writer; //binary listing
+   std::vector<unsigned char> batch; //directory entries (as read by getdents64)
+   size_t batchOffset;        //next entry within batch
+   size_t batchLength;
+   time_t hourStart;          //start of the cached hour
+   char hourText[16];         //"YYYY-mm-dd HH:" of that hour
+};
+
+
+
+/* -- Global Variables ---------------------------------------------------- */
+
+/* -- Function Prototypes ------------------------------------------------- */
+
+/* -- Implementation ------------------------------------------------------ */
+
+
+
+#endif
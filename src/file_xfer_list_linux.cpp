@@ -0,0 +1,324 @@
+//-----------------------------------------------------------------------------
+/*!
+   \file
+   \brief Directory listing engine (linux)
+*/
+//-----------------------------------------------------------------------------
+
+/* -- Includes ------------------------------------------------------------ */
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include "file_xfer_list.h"
+
+
+/* -- Defines ------------------------------------------------------------- */
+using namespace std;
+
+
+/* -- Types --------------------------------------------------------------- */
+
+//directory entry, as returned by getdents64
+typedef struct
+{
+   uint64_t d_ino;
+   int64_t d_off;
+   unsigned short d_reclen;
+   unsigned char d_type;
+   char d_name[1]; //zero terminated
+} LinuxDirent64;
+
+
+/* -- (Module) Global Variables ------------------------------------------- */
+
+/* -- Module Global Function Prototypes ----------------------------------- */
+static void append(vector<unsigned char>& output, const char * data, size_t len);
+static void appendNumber(vector<unsigned char>& output, unsigned long long value);
+
+
+/* -- Implementation ------------------------------------------------------ */
+
+
+FileXferListing::FileXferListing()
+{
+   fd = -1;
+   binary = false;
+   error = false;
+   batchOffset = 0;
+   batchLength = 0;
+   hourStart = 0;
+   hourText[0] = 0;
+}
+
+
+FileXferListing::~FileXferListing()
+{
+   close();
+}
+
+
+bool FileXferListing::open(const string& dir, bool binary)
+{
+   close(); //close a previously opened directory (if any)
+   fd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+   if (fd < 0)
+   {
+      return false;
+   }
+   this->binary = binary;
+   error = false;
+   writer.reset();
+   batch.resize(FILE_XFER_LIST_BATCH_SIZE);
+   batchOffset = 0;
+   batchLength = 0;
+   tzset(); //once per listing. the time zone may have been changed in between
+   hourText[0] = 0;
+   return true;
+}
+
+
+void FileXferListing::close()
+{
+   if (fd >= 0)
+   {
+      ::close(fd);
+      fd = -1;
+   }
+}
+
+
+bool FileXferListing::isOpen() const
+{
+   return (fd >= 0);
+}
+
+
+bool FileXferListing::hasError() const
+{
+   return error;
+}
+
+
+void FileXferListing::addCurrent(vector<unsigned char>& output, const string& name, bool binary)
+{
+   if (binary)
+   {
+      FileXferListWriter::addCurrent(output, name);
+      return;
+   }
+   append(output, ".,", 2);
+   append(output, name.c_str(), name.length());
+   append(output, ",,\n", 3); //no size, no date
+}
+
+
+bool FileXferListing::read(vector<unsigned char>& output, size_t size)
+{
+   while (output.size() < size)
+   {
+      unsigned char type;
+      struct stat fileStat;
+      bool fileStatOk;
+      const char * name = next(type, fileStat, fileStatOk);
+      if (name == NULL) //end of directory (or read error)
+      {
+         return false;
+      }
+
+      //          directory                 regular file      (other files will be skipped)
+      if (binary)
+      {
+         if ((type == DT_DIR) && (strcmp(name, ".") != 0)) //skip "." directory
+         {
+            writer.addDirectory(output, name, strlen(name));
+         }
+         else if (type == DT_REG)
+         {
+            writer.addFile(output, name, strlen(name), fileStatOk ? fileStat.st_size : 0, fileStatOk ? fileStat.st_mtim.tv_sec : 0);
+         }
+      }
+      else if ((type == DT_DIR) && (strcmp(name, ".") != 0)) //skip "." directory
+      {
+         append(output, "d,", 2);
+         append(output, name, strlen(name));
+         append(output, ",,\n", 3); //no size, no date
+      }
+      else if (type == DT_REG)
+      {
+         append(output, "f,", 2);
+         append(output, name, strlen(name));
+         append(output, ",", 1);
+         if (fileStatOk)
+         {
+            char date[24];
+            appendNumber(output, fileStat.st_size);
+            append(output, ",", 1);
+            append(output, date, formatTime(date, fileStat.st_mtim.tv_sec));
+         }
+         else
+         {
+            append(output, ",", 1);
+         }
+         append(output, "\n", 1);
+      }
+   }
+   return true;
+}
+
+
+bool FileXferListing::readEntries(vector<FileXferStat>& entries, size_t count)
+{
+   for (size_t idx = 0; idx < count; ++idx)
+   {
+      unsigned char type;
+      struct stat fileStat;
+      bool fileStatOk;
+      const char * name = next(type, fileStat, fileStatOk);
+      if (name == NULL) //end of directory (or read error)
+      {
+         return false;
+      }
+      if (((type == DT_DIR) && (strcmp(name, ".") != 0)) || (type == DT_REG)) //other files will be skipped
+      {
+         FileXferStat entry;
+         entry.type = (type == DT_DIR) ? FILE_XFER_LIST_DIRECTORY : FILE_XFER_LIST_FILE;
+         entry.name = name;
+         entry.size = ((type == DT_REG) && fileStatOk) ? fileStat.st_size : 0;
+         entry.mtime = ((type == DT_REG) && fileStatOk) ? fileStat.st_mtim.tv_sec : 0;
+         entry.mtimeNsec = ((type == DT_REG) && fileStatOk) ? fileStat.st_mtim.tv_nsec : 0;
+         entries.push_back(entry);
+      }
+   }
+   return true;
+}
+
+
+//next directory entry: its name (NULL at the end of the directory, or on read error) and type (DT_xxx).
+//regular files are stat'ed for their size and date. so are files of unknown type (some file systems
+//don't report the type). symbolic links aren't followed (skipped like other files)
+const char * FileXferListing::next(unsigned char& type, struct stat& fileStat, bool& fileStatOk)
+{
+   //next batch of directory entries
+   if (batchOffset >= batchLength)
+   {
+      const long count = syscall(SYS_getdents64, fd, batch.data(), batch.size());
+      if (count <= 0) //end of directory (or read error)
+      {
+         error = (count < 0);
+         return NULL;
+      }
+      batchOffset = 0;
+      batchLength = count;
+   }
+   const LinuxDirent64 * ent = (const LinuxDirent64 *)&batch[batchOffset];
+   batchOffset += ent->d_reclen;
+
+   const char * name = ent->d_name;
+   type = ent->d_type;
+   fileStatOk = false;
+   if ((type == DT_REG) || (type == DT_UNKNOWN))
+   {
+      fileStatOk = (fstatat(fd, name, &fileStat, AT_SYMLINK_NOFOLLOW) == 0);
+      if (type == DT_UNKNOWN)
+      {
+         type = !fileStatOk ? DT_UNKNOWN : S_ISDIR(fileStat.st_mode) ? DT_DIR : S_ISREG(fileStat.st_mode) ? DT_REG : DT_UNKNOWN;
+      }
+   }
+   return name;
+}
+
+
+void FileXferListing::format(vector<unsigned char>& output, const vector<FileXferStat>& entries, bool binary)
+{
+   writer.reset();
+   tzset();
+   hourText[0] = 0;
+   for (size_t idx = 0; idx < entries.size(); ++idx)
+   {
+      const FileXferStat& entry = entries[idx];
+      const bool known = (entry.type == FILE_XFER_LIST_FILE) && (entry.mtime != 0);
+      if (binary)
+      {
+         if (entry.type == FILE_XFER_LIST_FILE)
+         {
+            writer.addFile(output, entry.name.c_str(), entry.name.length(), entry.size, entry.mtime);
+         }
+         else if (entry.type == FILE_XFER_LIST_REMOVED)
+         {
+            writer.addRemoved(output, entry.name.c_str(), entry.name.length());
+         }
+         else
+         {
+            writer.addDirectory(output, entry.name.c_str(), entry.name.length());
+         }
+         continue;
+      }
+      output.push_back(entry.type);
+      append(output, ",", 1);
+      append(output, entry.name.c_str(), entry.name.length());
+      append(output, ",", 1);
+      if (known)
+      {
+         char date[24];
+         appendNumber(output, entry.size);
+         append(output, ",", 1);
+         append(output, date, formatTime(date, entry.mtime));
+      }
+      else
+      {
+         append(output, ",", 1); //no size, no date
+      }
+      append(output, "\n", 1);
+   }
+}
+
+
+//the text of an hour is cached. that is exact, as long as the time zone offset only changes at full hours
+//(like daylight saving time does)
+unsigned int FileXferListing::formatTime(char * buf, time_t time)
+{
+   if ((hourText[0] == 0) || (time < hourStart) || (time >= (hourStart + 3600)))
+   {
+      struct tm t;
+      if ((localtime_r(&time, &t) == NULL) || (strftime(hourText, sizeof(hourText), "%F %H:", &t) == 0))
+      {
+         hourText[0] = 0;
+         return 0;
+      }
+      hourStart = time - (t.tm_min * 60 + t.tm_sec);
+   }
+   const unsigned int seconds = time - hourStart;
+   const size_t len = strlen(hourText);
+   memcpy(buf, hourText, len);
+   buf[len] = '0' + (seconds / 600);
+   buf[len + 1] = '0' + ((seconds / 60) % 10);
+   buf[len + 2] = ':';
+   buf[len + 3] = '0' + ((seconds % 60) / 10);
+   buf[len + 4] = '0' + (seconds % 10);
+   return len + 5;
+}
+
+
+
+
+static void append(vector<unsigned char>& output, const char * data, size_t len)
+{
+   output.insert(output.end(), (const unsigned char *)data, (const unsigned char *)data + len);
+}
+
+
+static void appendNumber(vector<unsigned char>& output, unsigned long long value)
+{
+   char digits[24];
+   unsigned int idx = sizeof(digits);
+   do
+   {
+      digits[--idx] = '0' + (value % 10);
+      value /= 10;
+   } while (value != 0);
+   append(output, &digits[idx], sizeof(digits) - idx);
+}
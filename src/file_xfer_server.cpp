@@ -9,19 +9,28 @@
 #include <limits.h> /* PATH_MAX */
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <regex.h>
+#include <time.h>
 #include <unistd.h>
+#include <sys/eventfd.h>
+#include <algorithm>
 #include <iostream>
 #include "file_xfer_server.h"
 #include "file_xfer.h"
 #include "stdutils.h"
+#include "crc32c.h"
 
 
 /* -- Defines ------------------------------------------------------------- */
 using namespace std;
 
 /* -- Types --------------------------------------------------------------- */
+typedef bool (*CompareFunction)(const FileXferStat& a, const FileXferStat& b);
 
 /* -- (Module) Global Variables ------------------------------------------- */
 const unsigned char FileXferServer::ACK = FILE_XFER_CMD_ACK;
@@ -30,7 +39,16 @@ const unsigned char FileXferServer::ZERO = 0;
 
 
 /* -- Module Global Function Prototypes ----------------------------------- */
-static unsigned int timespec2str(char *buf, uint len, struct timespec *ts); //utility function
+static bool compareEntries(const FileXferStat& a, const FileXferStat& b);
+static bool compareEntriesDescending(const FileXferStat& a, const FileXferStat& b);
+static bool compareSize(const FileXferStat& a, const FileXferStat& b);
+static bool compareSizeDescending(const FileXferStat& a, const FileXferStat& b);
+static bool compareTime(const FileXferStat& a, const FileXferStat& b);
+static bool compareTimeDescending(const FileXferStat& a, const FileXferStat& b);
+static CompareFunction getSortOrder(char sort);
+static unsigned long getTime1ms(); //utility function
+static bool makeTempFile(const std::string& path, std::string& tempName); //utility function
+static bool splitArguments(char * str, char ** args, int count); //utility function
 
 
 /* -- Implementation ------------------------------------------------------ */
@@ -45,11 +63,37 @@ FileXferServer::FileXferServer(Slay2Channel * ctrl, Slay2Channel * data, const c
    dataChannel->setReceiver(FileXferServer::onDataFrame, this);
 
    //set members
+   session = this;
    rootDir = root;
    state = FILE_XFER_SERVER_STATE_IDLE;
-   listDirectory = NULL;
-   uploadFile = NULL;
-   downloadFile = NULL;
+   uploadDurability = WriteBehindFile::DURABILITY_NONE;
+   uploadFileSize = 0;
+   resumeOffset = 0;
+   resumeVerified = 0;
+   resumeCrc = 0;
+   resumeExpectedCrc = 0;
+   downloadOffset = 0;
+   transferHashed = false;
+   transferCrc = 0;
+   deltaOffset = 0;
+   deltaEnd = 0;
+   sessionFeatures = 0;
+   listCache = NULL;
+   listCachedOffset = 0;
+   listCacheToken = 0;
+   listCommand = 0;
+   listToken = 0;
+   listVersion = 0;
+   listRegexUsed = false;
+   listMatches = 0;
+   snapshotToken = (unsigned long long)time(NULL) << 20; //tokens of a previous run of the server aren't valid
+   outputSent = 0;
+   bundleTree = false;
+   bundleFile = NULL;
+   bundleFileTime = 0;
+   bundleFailed = false;
+   eventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+   setNotifyFd(eventFd);
 
    //check if "/" must be appended to "rootDir"
    if (rootDir[rootDir.length() - 1] != '/')
@@ -59,20 +103,34 @@ FileXferServer::FileXferServer(Slay2Channel * ctrl, Slay2Channel * data, const c
 }
 
 
+FileXferServer::~FileXferServer()
+{
+   clearCollection();
+   setNotifyFd(-1);
+   for (size_t idx = 0; idx < slots.size(); ++idx) //the slots may be deleted later on
+   {
+      slots[idx]->setNotifyFd(-1);
+   }
+   if (eventFd >= 0)
+   {
+      close(eventFd);
+   }
+}
+
+
 
 //-------------------------------------------------------------------------------------------------
 /*
    \brief Handle reception of ctrl frames.
 
-   There are no seqmented control frames. That means there is exactly one control frame per command!
-   Format:
-   data[0]:          command specifier
-   data[1 .. len-1]: optional command arguments (must be zero terminated)
-
-   Function returns with
-   ACK (+ optional arguments)
-   or NACK
-   depending, wheather the command can be executed or not!
+   Commands may be pipelined by the client. The responses must be sent in the order the commands
+   were received. So a command, that requires the server to be idle, is deferred while a data-transfer
+   is in progress. As long as there are deferred commands, all further commands are deferred as well.
+   The deferred commands are executed by "task", as far as the server is idle (see execCtrlQueue).
+   While the entries of a listing of changes or filtered listing are collected, its response is pending. So all
+   commands are deferred meanwhile (see collectListing).
+   Quit isn't deferred: it rejects the pending listing and all deferred commands (NACK), before it is executed.
+   If too many commands are deferred, all of them are rejected (NACK) - and so is the received one.
 */
 //-------------------------------------------------------------------------------------------------
 void FileXferServer::onCtrlFrame(void * const obj, const unsigned char * const data, const unsigned int len)
@@ -87,6 +145,100 @@ void FileXferServer::onCtrlFrame(void * const obj, const unsigned char * const d
    ((FileXferServer *)obj)->onCtrlFrame(data, len);
 }
 void FileXferServer::onCtrlFrame(const unsigned char * const data, const unsigned int len)
+{
+   if ((len >= 1) && (data[0] == FILE_XFER_CMD_QUIT))
+   {
+      rejectCollection();
+      flushCtrlQueue();
+   }
+   else if (!ctrlQueue.empty() || (listCommand != 0) || ((len >= 1) && (state != FILE_XFER_SERVER_STATE_IDLE) && requiresIdle(data[0])))
+   {
+      if (ctrlQueue.size() < FILE_XFER_SERVER_CTRL_QUEUE_MAX)
+      {
+         ctrlQueue.push_back(vector<unsigned char>(data, data + len));
+         std::cout << "Command deferred: " << (char)data[0] << endl;
+         return;
+      }
+      rejectCollection();
+      flushCtrlQueue();
+      ctrlChannel->send(&NACK, 1);
+      std::cout << "Too many deferred commands!" << endl;
+      return;
+   }
+   execCtrlFrame(data, len);
+}
+
+
+//execute the deferred ctrl frames back-to-back, in the order they were received. stop at the first
+//one, that requires the server to be idle, while a data-transfer (started by a previous one) is in progress.
+//none is executed, while the response of a listing is pending.
+void FileXferServer::execCtrlQueue()
+{
+   while (!ctrlQueue.empty() && (listCommand == 0) &&
+          ((state == FILE_XFER_SERVER_STATE_IDLE) || ctrlQueue.front().empty() || !requiresIdle(ctrlQueue.front()[0])))
+   {
+      const vector<unsigned char> frame = ctrlQueue.front();
+      ctrlQueue.pop_front();
+      execCtrlFrame(frame.data(), frame.size());
+   }
+}
+
+
+//reject all deferred ctrl frames
+void FileXferServer::flushCtrlQueue()
+{
+   while (!ctrlQueue.empty())
+   {
+      ctrlQueue.pop_front();
+      ctrlChannel->send(&NACK, 1);
+   }
+}
+
+
+//commands that start a data-transfer. they are only accepted by an idle server
+bool FileXferServer::requiresIdle(unsigned char command)
+{
+   switch (command)
+   {
+      case FILE_XFER_CMD_LS:
+      case FILE_XFER_CMD_DIR:
+      case FILE_XFER_CMD_CHANGES:
+      case FILE_XFER_CMD_FILTER:
+      case FILE_XFER_CMD_UPLOAD:
+      case FILE_XFER_CMD_DOWNLOAD:
+      case FILE_XFER_CMD_RESUME_DOWNLOAD:
+      case FILE_XFER_CMD_RESUME_UPLOAD:
+      case FILE_XFER_CMD_SIGNATURES:
+      case FILE_XFER_CMD_DELTA_UPLOAD:
+      case FILE_XFER_CMD_DELTA_DOWNLOAD:
+      case FILE_XFER_CMD_BUNDLE_DOWNLOAD:
+      case FILE_XFER_CMD_BUNDLE_UPLOAD:
+      case FILE_XFER_CMD_TREE_DOWNLOAD:
+      case FILE_XFER_CMD_TREE_UPLOAD:
+         return true;
+
+      default:
+         return false;
+   }
+}
+
+
+//-------------------------------------------------------------------------------------------------
+/*
+   \brief Execute a ctrl frame.
+
+   There are no seqmented control frames. That means there is exactly one control frame per command!
+   Format:
+   data[0]:          command specifier
+   data[1 .. len-1]: optional command arguments (must be zero terminated)
+
+   Function returns with
+   ACK (+ optional arguments)
+   or NACK
+   depending, wheather the command can be executed or not!
+*/
+//-------------------------------------------------------------------------------------------------
+void FileXferServer::execCtrlFrame(const unsigned char * const data, const unsigned int len)
 {
    unsigned char command = '?';
    //there must be at least 1 bytes in a command frame - error otherwise
@@ -170,6 +322,50 @@ void FileXferServer::onCtrlFrame(const unsigned char * const data, const unsigne
             break;
          }
 
+         //list changes of the current directory since a change token (or list it completely)
+         //REQ: H<token>\0
+         //RES: a<new-token>,<mode>\0
+         //on error: n
+         //list (of changes) will be sent via data-channel
+         case FILE_XFER_CMD_CHANGES:
+         {
+            if (state == FILE_XFER_SERVER_STATE_IDLE) //server must be idle to accept that command
+            {
+               //ensure the given string is zero terminated
+               if (data[len - 1] == 0)
+               {
+                  bool stat = onCHANGES_Command((const char *)(data + 1));
+                  if (stat)
+                  {
+                     return;
+                  }
+               }
+            }
+            break;
+         }
+
+         //list current directory, filtered, sorted and paginated
+         //REQ: F<pattern>,<types>,<min-size>,<max-size>,<min-time>,<max-time>,<sort>,<offset>,<limit>\0
+         //RES: a<total>\0
+         //on error: n
+         //list will be sent via data-channel
+         case FILE_XFER_CMD_FILTER:
+         {
+            if (state == FILE_XFER_SERVER_STATE_IDLE) //server must be idle to accept that command
+            {
+               //ensure the given string is zero terminated
+               if (data[len - 1] == 0)
+               {
+                  bool stat = onFILTER_Command((const char *)(data + 1));
+                  if (stat)
+                  {
+                     return;
+                  }
+               }
+            }
+            break;
+         }
+
          //make directory
          //REQ: M<dir-name>\0
          //RES: a
@@ -212,7 +408,7 @@ void FileXferServer::onCtrlFrame(const unsigned char * const data, const unsigne
          //REQ: U<filename>,<filesize>\0  /*filesize as decimal ascii number*/
          //RES: a
          //on error: n
-         //data are expected to be received on data-channel.
+         //data are expected to be received on data-channel. completion is replied on data-channel: a (or a<crc>\0, see completeUPLOAD_Command)
          case FILE_XFER_CMD_UPLOAD:
          {
             if (state == FILE_XFER_SERVER_STATE_IDLE) //server must be idle to accept that command
@@ -254,7 +450,8 @@ void FileXferServer::onCtrlFrame(const unsigned char * const data, const unsigne
          //REQ: D<filename>\0
          //RES: a<filesize>\0   /*Success: filesize as decimal ascii number*/
          //on error: n
-         //data are sent on data-channel.
+         //data are sent on data-channel (followed by a<crc>\0, see completeDOWNLOAD_Command).
+         //on read error, while the data are sent: eD (unsolicited, on control-channel)
          case FILE_XFER_CMD_DOWNLOAD:
          {
             if (state == FILE_XFER_SERVER_STATE_IDLE) //server must be idle to accept that command
@@ -273,80 +470,516 @@ void FileXferServer::onCtrlFrame(const unsigned char * const data, const unsigne
             break;
          }
 
-         //abort/cancel/quit an ongoin command and reset server into idle state
-         //REQ: Q
-         //RES: a
-         case FILE_XFER_CMD_QUIT:
+         //resume download of a file from server
+         //REQ: G<filename>,<offset>\0  /*offset as decimal ascii number*/
+         //RES: a<remaining>\0          /*Success: number of bytes following (filesize - offset) as decimal ascii number*/
+         //on error: n
+         //data (starting at offset) are sent on data-channel (followed by a<crc>\0, see completeDOWNLOAD_Command).
+         //on read error, while the data are sent: eD (unsolicited, on control-channel)
+         case FILE_XFER_CMD_RESUME_DOWNLOAD:
          {
-            state = FILE_XFER_SERVER_STATE_IDLE; //set server into idle state
-            if (listDirectory != NULL) //close directory (in case a list-directory command was canceled)
+            if (state == FILE_XFER_SERVER_STATE_IDLE) //server must be idle to accept that command
             {
-               closedir(listDirectory);
-               listDirectory = NULL;
+               //ensure the given string is zero terminated
+               if (data[len - 1] == 0)
+               {
+                  char * fileName = (char *)(data + 1); //first argument is download file name
+                  char * komma = strrchr(fileName, ','); //last KOMMA separates the offset (file name may contain a KOMMA)
+                  if (komma != NULL)
+                  {
+                     *komma = 0; //replace KOMMA by ZERO to terminate file name
+                     bool stat = onDOWNLOAD_Command(fileName, strtoul(komma + 1, NULL, 10));
+                     if (stat)
+                     {
+                        return;
+                     }
+                  }
+               }
             }
-            if (uploadFile != NULL) //close upload file (in caste a upload command was canceled)
+            break;
+         }
+
+         //query size of a file
+         //REQ: Z<filename>\0
+         //RES: a<filesize>\0   /*Success: filesize as decimal ascii number*/
+         //on error: n
+         case FILE_XFER_CMD_SIZE:
+         {
+            //ensure the given string is zero terminated
+            if (data[len - 1] == 0)
             {
-               fclose(uploadFile);
-               uploadFile = NULL;
-               uploadFileSize = 0;
+               const char * fileName = (const char *)(data + 1);
+               bool stat = onSIZE_Command(fileName);
+               if (stat)
+               {
+                  return;
+               }
             }
-            if (downloadFile != NULL) //close download file (in caste a download command was canceled)
+            break;
+         }
+
+         //resume upload to server
+         //REQ: A<filename>,<offset>,<size>,<crc>\0  /*offset and size as decimal ascii number, crc as hex ascii number*/
+         //RES: a
+         //on error: n
+         //data (the tail of the file, starting at offset) are expected to be received on data-channel. completion is replied like the one of an upload.
+         case FILE_XFER_CMD_RESUME_UPLOAD:
+         {
+            if (state == FILE_XFER_SERVER_STATE_IDLE) //server must be idle to accept that command
             {
-               fclose(downloadFile);
-               downloadFile = NULL;
+               //ensure the given string is zero terminated
+               if (data[len - 1] == 0)
+               {
+                  char * fileName = (char *)(data + 1);
+                  char * args[3];
+                  if (splitArguments(fileName, args, 3))
+                  {
+                     bool stat = onRESUME_UPLOAD_Command(fileName,
+                                                         strtoull(args[0], NULL, 10),
+                                                         strtoull(args[1], NULL, 10),
+                                                         strtoul(args[2], NULL, 16));
+                     if (stat)
+                     {
+                        return;
+                     }
+                  }
+               }
             }
-            dataChannel->flushTxBuffer(); //flush data channel
-            ctrlChannel->send(&ACK, 1); //acknowledge quit (cancel) command
-            std::cout << "QUIT command received. Server reset to IDLE!" << endl;
-            return;
+            break;
          }
 
-         default:
+         //get block signatures of a file (the basis of a delta upload)
+         //REQ: K<filename>\0
+         //RES: a<block-size>,<block-count>\0   /*as decimal ascii numbers*/
+         //on error: n
+         //signatures are sent on data-channel.
+         case FILE_XFER_CMD_SIGNATURES:
          {
+            if (state == FILE_XFER_SERVER_STATE_IDLE) //server must be idle to accept that command
+            {
+               //ensure the given string is zero terminated
+               if (data[len - 1] == 0)
+               {
+                  const char * fileName = (const char *)(data + 1);
+                  bool stat = onSIGNATURES_Command(fileName);
+                  if (stat)
+                  {
+                     return;
+                  }
+               }
+            }
             break;
          }
-      }
-   }
-
-   //error - reply with NACK
-   ctrlChannel->send(&NACK, 1);
-   std::cout << "Failed to execute command: " << (char)command << endl;
-}
 
+         //upload a delta, to be applied to a file on server
+         //REQ: Y<filename>,<block-size>\0   /*block size of the signatures, the delta was made of*/
+         //RES: a
+         //on error: n
+         //delta is expected to be received on data-channel.
+         case FILE_XFER_CMD_DELTA_UPLOAD:
+         {
+            if (state == FILE_XFER_SERVER_STATE_IDLE) //server must be idle to accept that command
+            {
+               //ensure the given string is zero terminated
+               if (data[len - 1] == 0)
+               {
+                  char * fileName = (char *)(data + 1);
+                  char * args[1];
+                  if (splitArguments(fileName, args, 1))
+                  {
+                     bool stat = onDELTA_UPLOAD_Command(fileName, strtoul(args[0], NULL, 10));
+                     if (stat)
+                     {
+                        return;
+                     }
+                  }
+               }
+            }
+            break;
+         }
 
+         //download a delta of a file from server
+         //REQ: X<filename>,<block-size>,<block-count>\0   /*signatures of the clients version of the file*/
+         //RES: a<filesize>\0
+         //on error: n
+         //signatures are expected to be received on data-channel. then the delta is sent on data-channel.
+         //on read error, while the delta is sent: eX (unsolicited, on control-channel)
+         case FILE_XFER_CMD_DELTA_DOWNLOAD:
+         {
+            if (state == FILE_XFER_SERVER_STATE_IDLE) //server must be idle to accept that command
+            {
+               //ensure the given string is zero terminated
+               if (data[len - 1] == 0)
+               {
+                  char * fileName = (char *)(data + 1);
+                  char * args[2];
+                  if (splitArguments(fileName, args, 2))
+                  {
+                     bool stat = onDELTA_DOWNLOAD_Command(fileName,
+                                                          strtoul(args[0], NULL, 10),
+                                                          strtoul(args[1], NULL, 10));
+                     if (stat)
+                     {
+                        return;
+                     }
+                  }
+               }
+            }
+            break;
+         }
 
-//handle reception of data frames
-//currently only used, when client uploads a file
-void FileXferServer::onDataFrame(void * const obj, const unsigned char * const data, const unsigned int len)
-{
-   /* ensure zero termination: not needed, as SLAY2 data ARE zero terminated!
-   ((unsigned char *)data)[len] = 0; //thats a hack ... but works with SLAY2
-   */
-   // cout << "onDataFrame is called. len=" << len << endl;
-   // cout << data << endl;
-
-   //forward to member function
-   ((FileXferServer *)obj)->onDataFrame(data, len);
-}
-void FileXferServer::onDataFrame(const unsigned char * const data, const unsigned int len)
-{
-   switch (state)
-   {
-      //receiving file-upload from client
-      case FILE_XFER_SERVER_STATE_UPLOADING:
-         execUPLOAD_Command(data, len);
-         break;
-
-      default:
-         break;
-   }
-}
+         //download all files of a directory, as one bundle
+         //REQ: B<directory>\0
+         //RES: a
+         //on error: n
+         //bundle is sent on data-channel.
+         //on read error, while the bundle is sent: eB (unsolicited, on control-channel)
+         case FILE_XFER_CMD_BUNDLE_DOWNLOAD:
+         {
+            if (state == FILE_XFER_SERVER_STATE_IDLE) //server must be idle to accept that command
+            {
+               //ensure the given string is zero terminated
+               if (data[len - 1] == 0)
+               {
+                  const char * directory = (const char *)(data + 1);
+                  bool stat = onBUNDLE_DOWNLOAD_Command(directory);
+                  if (stat)
+                  {
+                     return;
+                  }
+               }
+            }
+            break;
+         }
+
+         //upload a bundle of files into a directory
+         //REQ: P<directory>\0
+         //RES: a
+         //on error: n
+         //bundle is expected to be received on data-channel.
+         case FILE_XFER_CMD_BUNDLE_UPLOAD:
+         {
+            if (state == FILE_XFER_SERVER_STATE_IDLE) //server must be idle to accept that command
+            {
+               //ensure the given string is zero terminated
+               if (data[len - 1] == 0)
+               {
+                  const char * directory = (const char *)(data + 1);
+                  bool stat = onBUNDLE_UPLOAD_Command(directory);
+                  if (stat)
+                  {
+                     return;
+                  }
+               }
+            }
+            break;
+         }
+
+         //download a directory tree (recursively), as one bundle
+         //REQ: T<directory>\0
+         //RES: a
+         //on error: n
+         //bundle is sent on data-channel.
+         //on read error, while the bundle is sent: eB (unsolicited, on control-channel)
+         case FILE_XFER_CMD_TREE_DOWNLOAD:
+         {
+            if (state == FILE_XFER_SERVER_STATE_IDLE) //server must be idle to accept that command
+            {
+               //ensure the given string is zero terminated
+               if (data[len - 1] == 0)
+               {
+                  const char * directory = (const char *)(data + 1);
+                  bool stat = onBUNDLE_DOWNLOAD_Command(directory, true);
+                  if (stat)
+                  {
+                     return;
+                  }
+               }
+            }
+            break;
+         }
+
+         //upload a bundle of a directory tree, into a directory
+         //REQ: V<directory>\0
+         //RES: a
+         //on error: n
+         //bundle is expected to be received on data-channel.
+         case FILE_XFER_CMD_TREE_UPLOAD:
+         {
+            if (state == FILE_XFER_SERVER_STATE_IDLE) //server must be idle to accept that command
+            {
+               //ensure the given string is zero terminated
+               if (data[len - 1] == 0)
+               {
+                  const char * directory = (const char *)(data + 1);
+                  bool stat = onBUNDLE_UPLOAD_Command(directory, true);
+                  if (stat)
+                  {
+                     return;
+                  }
+               }
+            }
+            break;
+         }
+
+         //negotiate session parameters
+         //REQ: S<chunk-size>[,<features>]\0   /*max. data chunk size proposed by client, as decimal ascii number. optional features as hex ascii number*/
+         //RES: a<chunk-size>,<features>\0     /*data chunk size and features agreed by server*/
+         case FILE_XFER_CMD_SESSION:
+         {
+            //ensure the given string is zero terminated
+            if (data[len - 1] == 0)
+            {
+               const char * args = (const char *)(data + 1);
+               bool stat = onSESSION_Command(args);
+               if (stat)
+               {
+                  return;
+               }
+            }
+            break;
+         }
+
+         //abort/cancel/quit an ongoin command and reset server into idle state. an optional <tag> byte is
+         //echoed. the client resyncs by it after a timeout: it discards all responses up to the echo
+         //REQ: Q[<tag>]
+         //RES: a[<tag>]
+         case FILE_XFER_CMD_QUIT:
+         {
+            state = FILE_XFER_SERVER_STATE_IDLE; //set server into idle state
+            listing.close(); //close directory (in case a list-directory command was canceled)
+            clearCollection();
+            listCached.reset();
+            listCacheToken = 0;
+            listCollect.clear();
+            uploadFile.abort(); //close upload file (in caste a upload command was canceled)
+            uploadFileSize = 0;
+            abortBUNDLE_File(); //files of a bundle upload, received completely, are kept. task closes them
+            bundleReader.reset(this); //drop held data
+            transferHashed = false;
+            resumeFile.close();
+            downloadFile.close(); //close download file (in caste a download command was canceled)
+            closeBUNDLE_Directories();
+            deltaFile.close(); //close file of a delta command
+            if (!deltaTempName.empty()) //remove incomplete file of a delta upload
+            {
+               unlink(deltaTempName.c_str());
+               deltaTempName.clear();
+            }
+            deltaSignatures.output.clear();
+            deltaGenerator.output.clear();
+            bundleWriter.output.clear();
+            dataEncoder.output.clear();
+            listBuffer.clear();
+            outputSent = 0;
+            dataChannel->flushTxBuffer(); //flush data channel
+            if (len >= 2) //tagged quit?
+            {
+               const unsigned char response[2] = { ACK, data[1] };
+               ctrlChannel->send(response, 2); //acknowledge quit (cancel) command, echo the tag
+            }
+            else
+            {
+               ctrlChannel->send(&ACK, 1); //acknowledge quit (cancel) command
+            }
+            std::cout << "QUIT command received. Server reset to IDLE!" << endl;
+            return;
+         }
+
+         default:
+         {
+            break;
+         }
+      }
+   }
+
+   //error - reply with NACK
+   ctrlChannel->send(&NACK, 1);
+   std::cout << "Failed to execute command: " << (char)command << endl;
+}
+
+
+
+//handle reception of data frames
+//used, when client uploads a file (or a delta) and sends signatures
+void FileXferServer::onDataFrame(void * const obj, const unsigned char * const data, const unsigned int len)
+{
+   /* ensure zero termination: not needed, as SLAY2 data ARE zero terminated!
+   ((unsigned char *)data)[len] = 0; //thats a hack ... but works with SLAY2
+   */
+   // cout << "onDataFrame is called. len=" << len << endl;
+   // cout << data << endl;
+
+   //forward to member function
+   ((FileXferServer *)obj)->onDataFrame(data, len);
+}
+void FileXferServer::onDataFrame(const unsigned char * const data, const unsigned int len)
+{
+   switch (state)
+   {
+      //receiving file-upload from client
+      case FILE_XFER_SERVER_STATE_UPLOADING:
+         execUPLOAD_Command(data, len);
+         break;
+
+      //receiving delta-upload from client
+      case FILE_XFER_SERVER_STATE_DELTA_UPLOADING:
+         execDELTA_UPLOAD_Command(data, len);
+         break;
+
+      //receiving bundle-upload from client
+      case FILE_XFER_SERVER_STATE_BUNDLE_UPLOADING:
+         execBUNDLE_UPLOAD_Command(data, len);
+         break;
+
+      //receiving signatures for a delta-download from client
+      case FILE_XFER_SERVER_STATE_DELTA_SIGNATURES:
+         deltaGenerator.addSignatures(data, len);
+         if (deltaGenerator.hasAllSignatures())
+         {
+            state = FILE_XFER_SERVER_STATE_DELTA_DOWNLOADING;
+         }
+         break;
+
+      default:
+         break;
+   }
+}
+
+
+//set durability of uploaded files. the final acknowledge of an upload is sent, as far as
+//the file is durable according to that setting.
+void FileXferServer::setDurability(WriteBehindFile::Durability durability)
+{
+   uploadDurability = durability;
+   for (size_t idx = 0; idx < slots.size(); ++idx)
+   {
+      slots[idx]->setDurability(durability);
+   }
+}
+
+
+//set the cache of directory listings. the cache may be shared by several servers (of the same thread).
+//without a cache, each listing is read from the directory
+void FileXferServer::setListCache(FileXferListCache * cache)
+{
+   listCache = cache;
+   for (size_t idx = 0; idx < slots.size(); ++idx)
+   {
+      slots[idx]->setListCache(cache);
+   }
+}
+
+
+//check if the server (and all its slots) is idle. an idle server only has to be run, when a command is received
+bool FileXferServer::isIdle()
+{
+   for (size_t idx = 0; idx < slots.size(); ++idx)
+   {
+      if (!slots[idx]->isIdle())
+      {
+         return false;
+      }
+   }
+   return (state == FILE_XFER_SERVER_STATE_IDLE) && ctrlQueue.empty() && bundleCloses.empty();
+}
+
+
+//task has to be run again, without waiting for input: data is ready to be sent (as far as there is TX buffer space),
+//or deferred commands are ready to be processed (on any slot).
+//otherwise the server only has to be run on input (received frames are processed by slay2.task), or when a file
+//thread completed (see getFd): a block read ahead, an uploaded file synced.
+bool FileXferServer::hasTxWork()
+{
+   for (size_t idx = 0; idx < slots.size(); ++idx)
+   {
+      if (slots[idx]->hasTxWork())
+      {
+         return true;
+      }
+   }
+   switch (state)
+   {
+      case FILE_XFER_SERVER_STATE_LISTING:
+      case FILE_XFER_SERVER_STATE_SIGNING:
+      case FILE_XFER_SERVER_STATE_DELTA_DOWNLOADING:
+         return true;
+
+      case FILE_XFER_SERVER_STATE_DOWNLOADING:
+         return !dataEncoder.output.empty() || downloadFile.isReady(downloadOffset);
+
+      case FILE_XFER_SERVER_STATE_BUNDLE_DOWNLOADING:
+      {
+         const bool compressed = ((sessionFeatures & FILE_XFER_FEATURE_COMPRESSION) != 0);
+         return !(compressed ? dataEncoder.output : bundleWriter.output).empty() || !downloadFile.isOpen() ||
+                downloadFile.isReady(downloadOffset);
+      }
+
+      case FILE_XFER_SERVER_STATE_UPLOAD_VERIFYING:
+         return (resumeVerified >= resumeOffset) || resumeFile.isReady(resumeVerified);
+
+      case FILE_XFER_SERVER_STATE_IDLE:
+         return !ctrlQueue.empty();
+
+      default:
+         return false;
+   }
+}
+
+
+//add a transfer slot. the slot is a server on its own pair of control and data channel. it shares
+//the session of this server: root directory, working directory, durability and listing cache. the slot negotiates
+//its own session parameters (chunk size, compression) and processes its commands independent of this server.
+//the slot is run by the task of this server.
+void FileXferServer::addSlot(FileXferServer * slot)
+{
+   slot->session = session;
+   slot->rootDir = rootDir;
+   slot->uploadDurability = uploadDurability;
+   slot->listCache = listCache;
+   slot->setNotifyFd(notifyFd);
+   slots.push_back(slot);
+}
+
+
+//the eventfd of the session. it is signaled by the threads of the files of this server and its slots, when they
+//completed (see hasTxWork). it is cleared by the task
+int FileXferServer::getFd()
+{
+   return notifyFd;
+}
+
+
+//let the threads of all files signal the given eventfd
+void FileXferServer::setNotifyFd(int fd)
+{
+   notifyFd = fd;
+   uploadFile.setNotifyFd(fd);
+   resumeFile.setNotifyFd(fd);
+   downloadFile.setNotifyFd(fd);
+   for (size_t idx = 0; idx < bundleFiles.size(); ++idx)
+   {
+      bundleFiles[idx]->setNotifyFd(fd);
+   }
+}
 
 
 //handle transmission of data frames
 //currently only usewd, for "ls" and file download
 void FileXferServer::task(void)
 {
+   //clear the eventfd, before the files are checked. so a thread completing meanwhile signals it again
+   uint64_t events;
+   if (notifyFd >= 0)
+   {
+      read(notifyFd, &events, sizeof(events));
+   }
+
+   //close the files of a bundle upload, that became durable (also after the upload was quit)
+   while (closeBUNDLE_File())
+   {
+   }
+
    switch (state)
    {
       //sending directory listing to client
@@ -359,9 +992,56 @@ void FileXferServer::task(void)
          execDOWNLOAD_Command();
          break;
 
+      //verifying the stored part of a file, before upload is resumed
+      case FILE_XFER_SERVER_STATE_UPLOAD_VERIFYING:
+         verifyRESUME_UPLOAD_Command();
+         break;
+
+      //sending signatures to client
+      case FILE_XFER_SERVER_STATE_SIGNING:
+         execSIGNATURES_Command();
+         break;
+
+      //sending delta to client
+      case FILE_XFER_SERVER_STATE_DELTA_DOWNLOADING:
+         execDELTA_DOWNLOAD_Command();
+         break;
+
+      //sending bundle to client
+      case FILE_XFER_SERVER_STATE_BUNDLE_DOWNLOADING:
+         execBUNDLE_DOWNLOAD_Command();
+         break;
+
+      //waiting for the uploaded file to become durable
+      case FILE_XFER_SERVER_STATE_UPLOAD_SYNCING:
+         completeUPLOAD_Command();
+         break;
+
+      //continue a bundle upload, that was paused until files became durable
+      case FILE_XFER_SERVER_STATE_BUNDLE_UPLOADING:
+         if (bundleReader.isPaused())
+         {
+            checkBUNDLE_UPLOAD_Result(bundleReader.resume());
+         }
+         break;
+
+      //waiting for the last files of a bundle upload to become durable
+      case FILE_XFER_SERVER_STATE_BUNDLE_SYNCING:
+         completeBUNDLE_UPLOAD_Command();
+         break;
+
       default:
          break;
    }
+
+   //process deferred commands (if any)
+   execCtrlQueue();
+
+   //run the transfer slots
+   for (size_t idx = 0; idx < slots.size(); ++idx)
+   {
+      slots[idx]->task();
+   }
 }
 
 
@@ -383,7 +1063,7 @@ void FileXferServer::task(void)
 //-------------------------------------------------------------------------------------------------
 bool FileXferServer::onPWD_Command()
 {
-   const string& cwd = currentDir.getCurrentDirectory();
+   const string& cwd = session->currentDir.getCurrentDirectory();
    ctrlChannel->send(&ACK, 1, true); //acknowledge command
    ctrlChannel->send((unsigned char *)"/", 1, true); //leading directory slash
    ctrlChannel->send((unsigned char *)cwd.c_str(), cwd.length() + 1);
@@ -418,40 +1098,40 @@ bool FileXferServer::onCD_Command(const char * path, bool response)
    //cd command with empty path changes to root-directory
    if (path[0] == 0)
    {
-      currentDir.changeDirectory();
+      session->currentDir.changeDirectory();
       if (response)
       {
          ctrlChannel->send(&ACK, 1); //acknowledge command
-         std::cout << "Working directory changed to: /" << currentDir.getCurrentDirectory() << endl;
+         std::cout << "Working directory changed to: /" << session->currentDir.getCurrentDirectory() << endl;
       }
       return true;
    }
    //try to change current directory
-   DirectoryNavigator tmp = currentDir; //use a tmp copy
+   DirectoryNavigator tmp = session->currentDir; //use a tmp copy
    tmp.changeDirectory(path);
    //check if that directory exists ...
    if (DirectoryNavigatorLinux::directoryExists(rootDir + tmp.getCurrentDirectory())) //prefix root directory
    {
-      currentDir = tmp;
+      session->currentDir = tmp;
       if (response)
       {
          ctrlChannel->send(&ACK, 1); //acknowledge command
-         std::cout << "Working directory changed to: /" << currentDir.getCurrentDirectory() << endl;
+         std::cout << "Working directory changed to: /" << session->currentDir.getCurrentDirectory() << endl;
       }
       return true;
    }
    //Sonderbehandlung, fuer den Fall, dass Vorgangerpfad plotzlich nicht mehr existiert.
    //Das koennte zB dann pasieren, wenn der Pfad zu einem USB Stick fuehrt, der entfernt wurde ...
    //directory does not exists ... check if its an ancestor path to "current"
-   if (currentDir.isAncestorOrSelf(tmp))
+   if (session->currentDir.isAncestorOrSelf(tmp))
    {
       //EXCEPTION!
       //Tatsachlich! Jetzt kann ich nur noch zuruck nach "root"
-      currentDir.changeDirectory();
+      session->currentDir.changeDirectory();
       if (response)
       {
          ctrlChannel->send(&ACK, 1); //acknowledge command
-         std::cout << "Working directory changed to: /" << currentDir.getCurrentDirectory() << endl;
+         std::cout << "Working directory changed to: /" << session->currentDir.getCurrentDirectory() << endl;
       }
       return true;
    }
@@ -500,6 +1180,10 @@ bool FileXferServer::onCD_Command(const char * path, bool response)
    - last modification date of file. format: "YYYY-mm-dd HH:MM:SS"
    - empty, for "non-file-types"
 
+   If the binary listing was negotiated (see onSESSION_Command), the same entries are sent as compact binary
+   records (varint sizes, modification times in seconds since epoch, front coded names). The binary listing
+   ends with '\0' as well. See file_xfer_list.h for the format.
+
    If parameter "response" equals true, this function sends (in case of success) a response on
    control channel. Otherwise not!
 
@@ -509,22 +1193,31 @@ bool FileXferServer::onCD_Command(const char * path, bool response)
 //-------------------------------------------------------------------------------------------------
 bool FileXferServer::onLS_Command(bool response)
 {
-   string cwd = currentDir.getCurrentDirectory();
-   listDir = rootDir + cwd; //prefix root director
-   listDirectory = opendir(listDir.c_str());
-   if (listDirectory == NULL) //EXCEPTION!
+   const bool binary = ((sessionFeatures & FILE_XFER_FEATURE_BINARY_LISTING) != 0);
+   string cwd = session->currentDir.getCurrentDirectory();
+   listCached.reset();
+   listCachedOffset = 0;
+   listCacheDir = rootDir + cwd;
+   listCacheToken = 0;
+   listCollect.clear();
+   if (listCache != NULL)
+   {
+      listCached = listCache->find(listCacheDir, binary); //unchanged directory is served from memory
+      listCacheToken = !listCached ? listCache->watch(listCacheDir) : 0; //watch the directory before it is read
+   }
+   if (!listCached && !listing.open(rootDir + cwd, binary)) //EXCEPTION!
    {
       //Sonder-/Ausnahmebehandlung!
       //Current working directory kann nicht geoffnet/gelesen werden.
       //Das kann zB. dadurch passieren, dass CWD auf ein USB Stick zeigt, der entfernt wurde ...
       //Jetzt kann ich nur noch zuruck nach "root"
-      currentDir.changeDirectory();
+      session->currentDir.changeDirectory();
       // ... und es nochmal probieren...
-      cwd = currentDir.getCurrentDirectory();
-      listDir = rootDir + cwd; //prefix root director
-      listDirectory = opendir(listDir.c_str());
+      cwd = session->currentDir.getCurrentDirectory();
+      listing.open(rootDir + cwd, binary);
+      listCacheToken = 0;
    }
-   if (listDirectory != NULL)
+   if (listCached || listing.isOpen())
    {
       //schedule LS command
       state = FILE_XFER_SERVER_STATE_LISTING; //set server into listing state
@@ -535,9 +1228,12 @@ bool FileXferServer::onLS_Command(bool response)
       std::cout << "LS command scheduled!" << endl;
 
       //output first LS entry (the current directory)
-      dataChannel->send((const unsigned char *)".,/", 3, true); //current directory
-      dataChannel->send((const unsigned char *)cwd.c_str(), cwd.length(), true); //name
-      dataChannel->send((const unsigned char *)",,\n", 3, true); //no size, no date
+      dataEncoder.reset();
+      outputSent = 0;
+      dataChunking.start(dataChannel, getTime1ms());
+      listFrame.clear();
+      FileXferListing::addCurrent(listFrame, "/" + cwd, binary);
+      sendListing(listFrame.data(), listFrame.size(), true);
       return true;
    }
    return false;
@@ -545,67 +1241,87 @@ bool FileXferServer::onLS_Command(bool response)
 
 //send the file/directory list entries on data channel. terminate list with ZERO.
 //return to IDLE state when done.
+//the entries are formatted by the listing engine into one buffer per frame (of up to chunk size).
+//a listing read completely, is stored into the listing cache. a cached listing is sent from memory.
 void FileXferServer::execLS_Command()
 {
+   if (listCommand != 0) //entries of a listing of changes or filtered listing are collected first
+   {
+      collectListing();
+      return;
+   }
+   const unsigned int chunkSize = dataChunking.getChunkSize(getTime1ms());
+   const bool compressed = ((sessionFeatures & FILE_XFER_FEATURE_COMPRESSION) != 0);
+
+   //send pending compressed listing data first
+   if (!sendOutput(dataEncoder.output, chunkSize))
+   {
+      return;
+   }
+   if (!listing.isOpen() && !listCached) //listing was already terminated
+   {
+      state = FILE_XFER_SERVER_STATE_IDLE;
+      std::cout << "LS command completed!" << endl;
+      return;
+   }
+
    //there must be enough buffer space (for at least one more entry)
-   while (dataChannel->getTxBufferSpace() >= 300) //assumption: max length of one file entry may be 300 bytes
+   while ((dataChannel->getTxBufferSpace() >= FILE_XFER_LIST_ENTRY_MAX) && dataEncoder.output.empty())
    {
-      struct dirent *ent = readdir(listDirectory);
-      if (ent == NULL) //end of directory listing
+      size_t frameSize = dataChannel->getTxBufferSpace();
+      if (frameSize > chunkSize)
       {
-         dataChannel->send(&ZERO, 1); //send termination
-         closedir(listDirectory);
-         listDirectory = NULL;
-         state = FILE_XFER_SERVER_STATE_IDLE;
-         std::cout << "LS command completed!" << endl;
-         return;
+         frameSize = chunkSize;
       }
-      //otherwise
-      //          directory                 regular file      (other files will be skipped)
-      if ((ent->d_type == DT_DIR) || (ent->d_type == DT_REG))
+      frameSize = (frameSize > FILE_XFER_LIST_ENTRY_MAX) ? (frameSize - FILE_XFER_LIST_ENTRY_MAX) : 1;
+      listFrame.clear();
+      bool more;
+      if (listCached)
       {
-         if (ent->d_type == DT_DIR) //directory
+         size_t len = listCached->size() - listCachedOffset;
+         if (len > frameSize)
          {
-            if (strcmp(ent->d_name, ".") != 0) //skip "." directory
-            {
-               dataChannel->send((const unsigned char *)"d,", 2, true); //directory
-               dataChannel->send((const unsigned char *)ent->d_name, strlen(ent->d_name), true); //name
-               dataChannel->send((const unsigned char *)",,\n", 3, true); //no size, no date
-               // std::cout << "LS <dir>: " << ent->d_name << endl;
-            }
+            len = frameSize;
          }
-         else // regular file
+         listFrame.insert(listFrame.end(), listCached->begin() + listCachedOffset, listCached->begin() + listCachedOffset + len);
+         listCachedOffset += len;
+         more = (listCachedOffset < listCached->size());
+      }
+      else
+      {
+         more = listing.read(listFrame, frameSize);
+         if (listCacheToken != 0)
          {
-            char listEntry[32];
-            unsigned int listEntryLen;
-            string fileName;
-            struct stat fileStat;
-            int fileStatErr;
-
-
-            //read further file information
-            fileName = listDir + ent->d_name;
-            fileStatErr = stat(fileName.c_str(), &fileStat);
-
-            //assembly entry
-            dataChannel->send((const unsigned char *)"f,", 2, true); //file
-            dataChannel->send((const unsigned char *)ent->d_name, strlen(ent->d_name), true); //name
-            dataChannel->send((const unsigned char *)",", 1, true);
-            if (fileStatErr == 0)
-            {
-               listEntryLen = snprintf(listEntry, sizeof(listEntry), "%d", (int)fileStat.st_size); //size
-               dataChannel->send((const unsigned char *)listEntry, listEntryLen, true);
-            }
-            dataChannel->send((const unsigned char *)",", 1, true);
-            if (fileStatErr == 0)
+            listCollect.insert(listCollect.end(), listFrame.begin(), listFrame.end());
+            if ((listCollect.size() > listCache->getListingLimit()) || listing.hasError()) //isn't cached
             {
-               listEntryLen = timespec2str(listEntry, sizeof(listEntry), &fileStat.st_mtim);
-               dataChannel->send((const unsigned char *)listEntry, listEntryLen, true);
+               listCacheToken = 0;
+               vector<unsigned char>().swap(listCollect);
             }
-            dataChannel->send((const unsigned char *)"\n", 1, true);
-            // std::cout << "LS <file>: " << ent->d_name << endl;
          }
       }
+      if (!more) //end of directory listing
+      {
+         listFrame.push_back(ZERO); //append termination
+         listing.close();
+         listCached.reset();
+         if (listCacheToken != 0)
+         {
+            listCache->store(listCacheDir, ((sessionFeatures & FILE_XFER_FEATURE_BINARY_LISTING) != 0), listCacheToken, listCollect);
+            listCacheToken = 0;
+            listCollect.clear();
+         }
+      }
+      sendListing(listFrame.data(), listFrame.size(), compressed && more);
+      if (!more)
+      {
+         if (dataEncoder.output.empty()) //otherwise, wait until compressed data was sent
+         {
+            state = FILE_XFER_SERVER_STATE_IDLE;
+            std::cout << "LS command completed!" << endl;
+         }
+         return;
+      }
    }
 }
 
@@ -613,70 +1329,423 @@ void FileXferServer::execLS_Command()
 
 //-------------------------------------------------------------------------------------------------
 /*
-   \brief Make directory on server.
+   \brief List the changes of the current working directory, since a change token.
 
-   Requested on control channel: M<directory>\0
+   Requested on control channel: H<token>\0
    Response on control channel:
-   - on success: a
+   - on success: a<new-token>,<mode>\0
 
-   <directory> shall contain the directory name for creation.
-   If it starts with '/' it is expected to be "root-based" path to the directory.
-   Otherwise it is expected to be a path relative to current directory.
+   Each listing of changes returns a new change token (hexadecimal ascii). The token refers to the
+   state of the directory, as it was listed. Passing it to the next request, only the entries that were
+   added, removed or modified since then are listed (<mode> 'D'). If the token is empty, unknown or too old
+   (the server keeps the listings of the last FILE_XFER_SERVER_SNAPSHOTS tokens, with up to
+   FILE_XFER_SERVER_SNAPSHOT_ENTRIES entries all together), or refers to another directory, the directory is
+   listed completely (<mode> 'F').
 
-   \retval true   if directory was successfully created.
+   The directory is read by the task (see collectListing), the response is sent when it was read completely. A file
+   is modified, if its size or modification time (seconds and nanoseconds) changed. If the listing cache reports the
+   directory unchanged since the listing, the token refers to, it isn't read at all.
+
+   The listing is sent on data channel, in the format of the list directory command (see onLS_Command).
+   A listing of changes contains the added and modified entries, and a removed entry ('r') for each entry,
+   that is gone. If the directory wasn't changed, the token is returned unchanged.
+
+   \retval true   on success
    \retval false  otherwise
 */
 //-------------------------------------------------------------------------------------------------
-bool FileXferServer::onMKDIR_Command(const char * directory)
+bool FileXferServer::onCHANGES_Command(const char * token)
 {
-   string fn = rootDir; //prefix root director
-   if (directory[0] == '/') //relative to root?
+   const string cwd = session->currentDir.getCurrentDirectory();
+   const string dir = rootDir + cwd;
+   listToken = strtoull(token, NULL, 16);
+   listVersion = (listCache != NULL) ? listCache->watch(dir) : 0; //watch the directory before it is read
+
+   //an unchanged directory isn't read again (the listing cache reports any change of the directory)
+   const FileXferSnapshot * previous = findSnapshot(dir, listToken);
+   if ((previous != NULL) && (listVersion != 0) && (previous->version == listVersion))
    {
-      fn += &directory[1]; //append to root directory
-   }
-   else //relative to current directory
-   {
-      fn += currentDir.getCurrentDirectory() + directory; //append current directory to file-name
+      char argStr[32];
+      const int argStrLen = snprintf(argStr, sizeof(argStr), "%llx,%c", listToken, 'D');
+      ctrlChannel->send(&ACK, 1, true); //acknowledge command
+      ctrlChannel->send((const unsigned char *)argStr, argStrLen + 1);
+      std::cout << "CHANGES command scheduled! 0 changes" << endl;
+      startListing(new vector<unsigned char>, cwd);
+      return true;
    }
-   //try to make the given directory
-   int err = mkdir(fn.c_str(), 0777);
-   if (err == 0)
+
+   if (!listing.open(dir))
    {
-      ctrlChannel->send(&ACK, 1); //acknowledge command
-      std::cout << "Directory " << fn << " created!" << endl;
-      return true;
+      return false;
    }
-   return false;
+   listCommand = FILE_XFER_CMD_CHANGES;
+   listEntries.clear();
+   listCwd = cwd;
+   listCacheDir = dir;
+   state = FILE_XFER_SERVER_STATE_LISTING; //the response is sent, as far as the directory was read
+   return true;
 }
 
 
-//-------------------------------------------------------------------------------------------------
-/*
-   \brief Delete/remove file from server.
-
-   Requested on control channel: R<filename>\0
-   Response on control channel:
-   - on success: a
-
-   <filename> shall contain the filename of the file to remove.
-   If it starts with '/' it is expected to be "root-based" path to the file.
-   Otherwise it is expected to be a path relative to current directory.
+//the directory was read completely: list the changes since the requested listing, and keep the new one
+void FileXferServer::completeCHANGES_Command()
+{
+   const bool binary = ((sessionFeatures & FILE_XFER_FEATURE_BINARY_LISTING) != 0);
+   sort(listEntries.begin(), listEntries.end(), compareEntries);
+
+   //changes: both listings are sorted by name. a file rewritten within the same second is detected by the
+   //nanoseconds of its modification time
+   const FileXferSnapshot * previous = findSnapshot(listCacheDir, listToken); //may have been dropped meanwhile
+   vector<FileXferStat> changes;
+   if (previous != NULL)
+   {
+      size_t oldIdx = 0;
+      size_t newIdx = 0;
+      while ((oldIdx < previous->entries.size()) || (newIdx < listEntries.size()))
+      {
+         const FileXferStat * oldEntry = (oldIdx < previous->entries.size()) ? &previous->entries[oldIdx] : NULL;
+         const FileXferStat * newEntry = (newIdx < listEntries.size()) ? &listEntries[newIdx] : NULL;
+         if ((newEntry == NULL) || ((oldEntry != NULL) && (oldEntry->name < newEntry->name))) //removed
+         {
+            FileXferStat removed;
+            removed.type = FILE_XFER_LIST_REMOVED;
+            removed.name = oldEntry->name;
+            removed.size = 0;
+            removed.mtime = 0;
+            removed.mtimeNsec = 0;
+            changes.push_back(removed);
+            ++oldIdx;
+         }
+         else if ((oldEntry == NULL) || (newEntry->name < oldEntry->name)) //added
+         {
+            changes.push_back(*newEntry);
+            ++newIdx;
+         }
+         else //modified?
+         {
+            if ((oldEntry->type != newEntry->type) || (oldEntry->size != newEntry->size) ||
+                (oldEntry->mtime != newEntry->mtime) || (oldEntry->mtimeNsec != newEntry->mtimeNsec))
+            {
+               changes.push_back(*newEntry);
+            }
+            ++oldIdx;
+            ++newIdx;
+         }
+      }
+   }
 
-   \retval true   if file was successfully removed.
+   //format the listing
+   const bool delta = (previous != NULL);
+   vector<unsigned char> * output = new vector<unsigned char>;
+   listing.format(*output, delta ? changes : listEntries, binary);
+
+   //a new token, unless nothing has changed. the listing is kept within the limits of the session: the oldest
+   //listings are dropped (so may the previous one). a listing exceeding them isn't kept at all, so the next
+   //request lists the directory completely
+   unsigned long long newToken = listToken;
+   if (!delta || !changes.empty())
+   {
+      newToken = ++session->snapshotToken;
+      if (listEntries.size() <= FILE_XFER_SERVER_SNAPSHOT_ENTRIES)
+      {
+         FileXferSnapshot snapshot;
+         snapshot.token = newToken;
+         snapshot.dir = listCacheDir;
+         snapshot.version = listVersion;
+         session->snapshots.push_back(snapshot);
+         session->snapshots.back().entries.swap(listEntries);
+         size_t total = 0;
+         for (size_t idx = 0; idx < session->snapshots.size(); ++idx)
+         {
+            total += session->snapshots[idx].entries.size();
+         }
+         while ((session->snapshots.size() > FILE_XFER_SERVER_SNAPSHOTS) || (total > FILE_XFER_SERVER_SNAPSHOT_ENTRIES))
+         {
+            total -= session->snapshots.front().entries.size();
+            session->snapshots.pop_front();
+         }
+      }
+   }
+
+   char argStr[32];
+   const int argStrLen = snprintf(argStr, sizeof(argStr), "%llx,%c", newToken, delta ? 'D' : 'F');
+   ctrlChannel->send(&ACK, 1, true); //acknowledge command
+   ctrlChannel->send((const unsigned char *)argStr, argStrLen + 1);
+   std::cout << "CHANGES command scheduled! " << changes.size() << " changes" << endl;
+   const string cwd = listCwd;
+   clearCollection();
+   startListing(output, cwd);
+}
+
+
+//listing of "dir", a change token refers to. NULL, if unknown (or dropped)
+const FileXferSnapshot * FileXferServer::findSnapshot(const string& dir, unsigned long long token) const
+{
+   for (size_t idx = 0; idx < session->snapshots.size(); ++idx)
+   {
+      if ((token != 0) && (session->snapshots[idx].token == token) && (session->snapshots[idx].dir == dir))
+      {
+         return &session->snapshots[idx];
+      }
+   }
+   return NULL;
+}
+
+
+
+//-------------------------------------------------------------------------------------------------
+/*
+   \brief List the current working directory, filtered, sorted and paginated.
+
+   Requested on control channel: F<pattern>,<types>,<min-size>,<max-size>,<min-time>,<max-time>,<sort>,<offset>,<limit>\0
+   Response on control channel:
+   - on success: a<total>\0
+
+   <pattern>   names matching that glob pattern (see fnmatch). if it starts with '~', the rest is an extended
+               regular expression (see regcomp). empty: all names. it may contain a KOMMA
+   <types>     types of the entries to list: 'd' and/or 'f'. empty: all
+   <min-size>, <max-size>   range of the file size (in bytes)
+   <min-time>, <max-time>   range of the modification time (in seconds since epoch)
+   <sort>      sort key: 'n' name, 's' size, 't' modification time. upper case: descending order
+   <offset>    number of (sorted) entries to skip
+   <limit>     max. number of entries to list
+
+   Numbers are decimal. An empty number is the default: no limit, offset 0. A size or time range only
+   selects files. <total> is the number of entries matching the filter (before offset and limit).
+   The entries are filtered while the directory is read by the task (see collectListing). The response is sent,
+   when it was read completely.
+   The selected entries are sent on data channel, in the format of the list directory command (see
+   onLS_Command). So "the 50 newest log files" are requested by: F*.log,f,,,,,T,0,50\0
+
+   \retval true   on success
    \retval false  otherwise
 */
 //-------------------------------------------------------------------------------------------------
-bool FileXferServer::onRM_Command(const char * filename)
+bool FileXferServer::onFILTER_Command(const char * args)
+{
+   const string cwd = session->currentDir.getCurrentDirectory();
+   if (!listFilter.parse(args))
+   {
+      return false;
+   }
+   if ((args[0] == '~') && (regcomp(&listRegex, listFilter.pattern.c_str() + 1, REG_EXTENDED | REG_NOSUB) != 0))
+   {
+      return false;
+   }
+   listRegexUsed = (args[0] == '~');
+   if (!listing.open(rootDir + cwd))
+   {
+      clearCollection();
+      return false;
+   }
+   listCommand = FILE_XFER_CMD_FILTER;
+   listEntries.clear();
+   listMatches = 0;
+   listCwd = cwd;
+   state = FILE_XFER_SERVER_STATE_LISTING; //the response is sent, as far as the directory was read
+   return true;
+}
+
+
+//filter the entries collected from index "first" on, while the directory is read. if the number of entries
+//is limited, only the first ones (in sort order) are kept
+void FileXferServer::filterEntries(size_t first)
+{
+   const bool ranged = (listFilter.minSize != 0) || (listFilter.maxSize != FILE_XFER_LIST_UNLIMITED) ||
+                       (listFilter.minTime != 0) || (listFilter.maxTime != FILE_XFER_LIST_UNLIMITED);
+   size_t count = first;
+   for (size_t idx = first; idx < listEntries.size(); ++idx)
+   {
+      const FileXferStat& entry = listEntries[idx];
+      bool match = listFilter.types.empty() || (listFilter.types.find(entry.type) != string::npos);
+      if (match && ranged)
+      {
+         match = (entry.type == FILE_XFER_LIST_FILE) && (entry.size >= listFilter.minSize) && (entry.size <= listFilter.maxSize) &&
+                 (entry.mtime >= listFilter.minTime) && (entry.mtime <= listFilter.maxTime);
+      }
+      if (match && !listFilter.pattern.empty())
+      {
+         match = listRegexUsed ? (regexec(&listRegex, entry.name.c_str(), 0, NULL, 0) == 0) :
+                                 (fnmatch(listFilter.pattern.c_str(), entry.name.c_str(), 0) == 0);
+      }
+      if (match)
+      {
+         if (count != idx)
+         {
+            listEntries[count] = listEntries[idx];
+         }
+         ++count;
+      }
+   }
+   listMatches += count - first;
+   listEntries.resize(count);
+
+   //if the number of entries is limited, the first ones (in sort order) are kept only
+   const size_t keep = listFilter.offset + listFilter.limit;
+   if ((listFilter.limit != 0) && (keep >= listFilter.offset) && ((listEntries.size() / 2) > keep))
+   {
+      const CompareFunction compare = getSortOrder(listFilter.sort);
+      nth_element(listEntries.begin(), listEntries.begin() + keep, listEntries.end(), compare);
+      listEntries.resize(keep);
+   }
+}
+
+
+//the directory was read completely: sort and paginate the entries matching the filter
+void FileXferServer::completeFILTER_Command()
+{
+   const bool binary = ((sessionFeatures & FILE_XFER_FEATURE_BINARY_LISTING) != 0);
+   sort(listEntries.begin(), listEntries.end(), getSortOrder(listFilter.sort));
+   const size_t count = listEntries.size();
+   const size_t first = (listFilter.offset < count) ? listFilter.offset : count;
+   const size_t last = ((listFilter.limit != 0) && (listFilter.limit < (count - first))) ? (first + listFilter.limit) : count;
+   listEntries.erase(listEntries.begin() + last, listEntries.end());
+   listEntries.erase(listEntries.begin(), listEntries.begin() + first);
+
+   //format the listing
+   vector<unsigned char> * output = new vector<unsigned char>;
+   listing.format(*output, listEntries, binary);
+
+   char argStr[24];
+   const int argStrLen = snprintf(argStr, sizeof(argStr), "%lu", (unsigned long)listMatches);
+   ctrlChannel->send(&ACK, 1, true); //acknowledge command
+   ctrlChannel->send((const unsigned char *)argStr, argStrLen + 1);
+   std::cout << "FILTER command scheduled! " << listEntries.size() << " of " << listMatches << " entries" << endl;
+   const string cwd = listCwd;
+   clearCollection();
+   startListing(output, cwd);
+}
+
+
+//collect the entries of a listing of changes or filtered listing. a batch of directory entries is read per call,
+//so a large directory doesn't block the task. as far as the directory was read completely, the response is
+//sent, and the listing is sent from memory
+void FileXferServer::collectListing()
+{
+   const size_t first = listEntries.size();
+   const bool more = listing.readEntries(listEntries, FILE_XFER_SERVER_COLLECT_BATCH);
+   if (listCommand == FILE_XFER_CMD_FILTER)
+   {
+      filterEntries(first);
+   }
+   if (more)
+   {
+      return;
+   }
+   const bool error = listing.hasError();
+   listing.close();
+   if (error)
+   {
+      std::cout << "Directory listing failed!" << endl;
+      rejectCollection();
+   }
+   else if (listCommand == FILE_XFER_CMD_CHANGES)
+   {
+      completeCHANGES_Command();
+   }
+   else
+   {
+      completeFILTER_Command();
+   }
+}
+
+
+//reject the listing being collected (if any). its response is pending, so it's sent before any further response
+void FileXferServer::rejectCollection()
+{
+   if (listCommand != 0)
+   {
+      listing.close();
+      clearCollection();
+      state = FILE_XFER_SERVER_STATE_IDLE;
+      ctrlChannel->send(&NACK, 1);
+   }
+}
+
+
+//drop the entries (and filter) of the listing being collected
+void FileXferServer::clearCollection()
 {
-   string fn = rootDir; //prefix root director
-   if (filename[0] == '/') //relative to root?
+   if (listRegexUsed)
    {
-      fn += &filename[1]; //append to root directory
+      regfree(&listRegex);
+      listRegexUsed = false;
    }
-   else //relative to current directory
+   listCommand = 0;
+   vector<FileXferStat>().swap(listEntries);
+}
+
+
+//send a listing formatted in memory: the current directory "cwd", then the entries of "output".
+//it is sent like a cached listing (see execLS_Command)
+void FileXferServer::startListing(vector<unsigned char> * output, const string& cwd)
+{
+   listCached = FileXferListCache::Listing(output);
+   listCachedOffset = 0;
+   listCacheToken = 0;
+   listCollect.clear();
+   state = FILE_XFER_SERVER_STATE_LISTING;
+
+   //output first entry (the current directory)
+   dataEncoder.reset();
+   outputSent = 0;
+   dataChunking.start(dataChannel, getTime1ms());
+   listFrame.clear();
+   FileXferListing::addCurrent(listFrame, "/" + cwd, ((sessionFeatures & FILE_XFER_FEATURE_BINARY_LISTING) != 0));
+   sendListing(listFrame.data(), listFrame.size(), true);
+}
+
+
+//-------------------------------------------------------------------------------------------------
+/*
+   \brief Make directory on server.
+
+   Requested on control channel: M<directory>\0
+   Response on control channel:
+   - on success: a
+
+   <directory> shall contain the directory name for creation.
+   If it starts with '/' it is expected to be "root-based" path to the directory.
+   Otherwise it is expected to be a path relative to current directory.
+
+   \retval true   if directory was successfully created.
+   \retval false  otherwise
+*/
+//-------------------------------------------------------------------------------------------------
+bool FileXferServer::onMKDIR_Command(const char * directory)
+{
+   const string fn = makeSystemPath(directory);
+   //try to make the given directory
+   int err = mkdir(fn.c_str(), 0777);
+   if (err == 0)
    {
-      fn += currentDir.getCurrentDirectory() + filename; //append current directory to file-name
+      ctrlChannel->send(&ACK, 1); //acknowledge command
+      std::cout << "Directory " << fn << " created!" << endl;
+      return true;
    }
+   return false;
+}
+
+
+//-------------------------------------------------------------------------------------------------
+/*
+   \brief Delete/remove file from server.
+
+   Requested on control channel: R<filename>\0
+   Response on control channel:
+   - on success: a
+
+   <filename> shall contain the filename of the file to remove.
+   If it starts with '/' it is expected to be "root-based" path to the file.
+   Otherwise it is expected to be a path relative to current directory.
+
+   \retval true   if file was successfully removed.
+   \retval false  otherwise
+*/
+//-------------------------------------------------------------------------------------------------
+bool FileXferServer::onRM_Command(const char * filename)
+{
+   const string fn = makeSystemPath(filename);
    //try to delete the given file
    int err = remove(fn.c_str());
    if (err == 0)
@@ -705,27 +1774,24 @@ bool FileXferServer::onRM_Command(const char * filename)
    <size> is the file size. It is given as a decimal ascii number.
    The server expects to receive exactly that number of bytes on the data channel.
 
+   If the integrity check was negotiated, the CRC-32C of the received data is computed on the fly. It is replied
+   on completion (see completeUPLOAD_Command).
+
    \retval true   if file was successfully opend for write.
    \retval false  otherwise
 */
 //-------------------------------------------------------------------------------------------------
 bool FileXferServer::onUPLOAD_Command(const char * filename, unsigned int size)
 {
-   string fn = rootDir; //prefix root director
-   if (filename[0] == '/') //relative to root?
-   {
-      fn += &filename[1]; //append to root directory
-   }
-   else //relative to current directory
-   {
-      fn += currentDir.getCurrentDirectory() + filename; //append current directory to file-name
-   }
-   uploadFile = fopen(fn.c_str(), "w");
-   if (uploadFile != NULL)
+   const string fn = makeSystemPath(filename);
+   if (uploadFile.open(fn, uploadDurability))
    {
       //schedule UPLOAD command
       state = FILE_XFER_SERVER_STATE_UPLOADING; //set server into uploading state
       uploadFileSize = size; //store number of bytes for upload
+      transferHashed = ((sessionFeatures & FILE_XFER_FEATURE_INTEGRITY) != 0);
+      transferCrc = 0;
+      dataDecoder.reset();
       ctrlChannel->send(&ACK, 1); //acknowledge command
       std::cout << "UPLOAD command scheduled! Len=" << size << endl;
       return true;
@@ -733,12 +1799,25 @@ bool FileXferServer::onUPLOAD_Command(const char * filename, unsigned int size)
    return false;
 }
 
-//recieve the file upload data on data channel. as far as all data was received:
-// - the file is closed
-// - a ACK ('a') is returned on the data channel, to let the client know, that all data was process
-// - return to IDLE state
-void FileXferServer::execUPLOAD_Command(const unsigned char * const data, const unsigned int len)
+//recieve the file upload data on data channel (and decompress it). as far as all data was received:
+// - the file is handed over to the write-behind stage to be flushed and synced
+// - the server waits for the write-behind stage to complete (see completeUPLOAD_Command)
+//data is written by the writer thread of the write-behind stage. so a slow storage doesn't block
+//the link (until the write-behind ring is full).
+void FileXferServer::execUPLOAD_Command(const unsigned char * data, unsigned int len)
 {
+   //decompress data (if compression was negotiated)
+   if (!decompress(&data, &len))
+   {
+      uploadFile.abort();
+      uploadFileSize = 0;
+      transferHashed = false;
+      state = FILE_XFER_SERVER_STATE_IDLE;
+      dataChannel->send(&NACK, 1); //reply NACK on data-channel, to indicate that the upload failed
+      std::cout << "UPLOAD failed. Invalid compressed data!" << endl;
+      return;
+   }
+
    //determine number of bytes to write into file
    unsigned int count = len;
    if (count > uploadFileSize)
@@ -746,7 +1825,11 @@ void FileXferServer::execUPLOAD_Command(const unsigned char * const data, const
       count = uploadFileSize; //limitation: do not write more bytes than expected
    }
    //write data into buffer
-   fwrite(data, 1, count, uploadFile);
+   uploadFile.write(data, count);
+   if (transferHashed)
+   {
+      transferCrc = crc32c(transferCrc, data, count);
+   }
    //reduce number of remaining bytes to write
    if (uploadFileSize >= count)
    {
@@ -755,10 +1838,48 @@ void FileXferServer::execUPLOAD_Command(const unsigned char * const data, const
    //handle end of file
    if (uploadFileSize == 0)
    {
-      fclose(uploadFile); //close file
-      uploadFile = NULL;
+      uploadFile.finish(); //flush and sync (in background)
+      state = FILE_XFER_SERVER_STATE_UPLOAD_SYNCING;
+      if (sessionFeatures & FILE_XFER_FEATURE_COMPRESSION)
+      {
+         const FileXferCompressStat& stat = dataDecoder.stat;
+         std::cout << "UPLOAD received! Ratio=" << stat.originalBytes << "/" << stat.encodedBytes
+                   << " Blocks=" << stat.compressedBlocks << "C/" << stat.storedBlocks << "S" << endl;
+      }
+   }
+}
+
+//as far as the write-behind stage has completed:
+// - the file is closed
+// - a ACK ('a') is returned on the data channel, to let the client know, that all data was process
+//   (or a NACK ('n'), if the data couldn't be written). if the integrity check was negotiated, the ACK
+//   of an upload contains the CRC-32C of the received data: a<crc>\0 (<crc> as hexadecimal ascii number)
+// - return to IDLE state
+void FileXferServer::completeUPLOAD_Command()
+{
+   bool ok;
+   if (uploadFile.isFinished(&ok))
+   {
+      uploadFile.close(); //close file
+      if (!deltaTempName.empty()) //delta upload: replace the basis by the new file
+      {
+         ok = ok && (rename(deltaTempName.c_str(), uploadFileName.c_str()) == 0);
+         if (!ok)
+         {
+            unlink(deltaTempName.c_str());
+         }
+         deltaTempName.clear();
+      }
       state = FILE_XFER_SERVER_STATE_IDLE; //set server into IDLE state
-      dataChannel->send(&ACK, 1); //finally reply ACK on data-channel, to indicate that server has completed
+      if (ok && transferHashed)
+      {
+         sendTransferCrc(); //finally reply ACK (and CRC) on data-channel, to indicate that server has completed
+      }
+      else
+      {
+         dataChannel->send(ok ? &ACK : &NACK, 1); //finally reply ACK on data-channel, to indicate that server has completed
+      }
+      transferHashed = false;
       std::cout << "UPLOAD has completed!" << endl;
    }
 }
@@ -769,9 +1890,11 @@ void FileXferServer::execUPLOAD_Command(const unsigned char * const data, const
 /*
    \brief Download file from server.
 
-   Requested on control channel: U<filename>\0
+   Requested on control channel: D<filename>\0
+   or (resume download):         G<filename>,<offset>\0
    Response on control channel:
-   - on success: a<filesize>
+   - on success: a<filesize>\0
+   - or (resume download): a<remaining>\0
 
    <filename> shall contain the filename of the file for download.
    If it starts with '/' it is expected to be "root-based" path to the file.
@@ -780,39 +1903,58 @@ void FileXferServer::execUPLOAD_Command(const unsigned char * const data, const
    If file exist, the command is acknowledged together with the size of the file <filesize>
    on the control channel. <filesize< is given as a decimal ascii number.
 
+   If compression was negotiated, the response is a<filesize>,<mode>,<entropy>\0. The server samples the
+   first blocks of the file and estimates their <entropy> (decimal ascii, in 1/100 bits per byte). If the file
+   isn't compressible, compression is bypassed for the whole file (<mode> S). Otherwise the data is
+   compressed block by block (<mode> C). See file_xfer_compress.h.
+
+   When resuming a download, data is sent starting at <offset>. The command is acknowledged with the number
+   of bytes following (filesize - offset). The command fails, if <offset> is beyond the end of the file.
+
+   If the integrity check was negotiated, the data is followed by the CRC-32C of the sent (original) data on the
+   data channel (see completeDOWNLOAD_Command). Nothing follows, if there is no data at all.
+
    \retval true   if file was successfully opend for read.
    \retval false  otherwise
 */
 //-------------------------------------------------------------------------------------------------
-bool FileXferServer::onDOWNLOAD_Command(const char * filename)
+bool FileXferServer::onDOWNLOAD_Command(const char * filename, size_t offset)
 {
-   string fn = rootDir; //prefix root director
-   if (filename[0] == '/') //relative to root?
+   const string fn = makeSystemPath(filename);
+   if (downloadFile.open(fn))
    {
-      fn += &filename[1]; //append to root directory
-   }
-   else //relative to current directory
-   {
-      fn += currentDir.getCurrentDirectory() + filename; //append current directory to file-name
-   }
-   downloadFile = fopen(fn.c_str(), "r");
-   if (downloadFile != NULL)
-   {
-      unsigned int fileSize;
-      char fileSizeStr[16];
+      size_t fileSize;
+      char fileSizeStr[24];
       int fileSizeStrLen;
 
       //determine file size
-      fseek(downloadFile, 0L, SEEK_END); //go to end of file
-      fileSize = ftell(downloadFile); //read file pointer - that the file size
-      rewind(downloadFile); //go back to begin of file
+      fileSize = downloadFile.getSize();
+      if (offset > fileSize)
+      {
+         downloadFile.close();
+         return false;
+      }
+      downloadOffset = offset;
+      dataChunking.start(dataChannel, getTime1ms());
+      outputSent = 0;
+      transferHashed = ((sessionFeatures & FILE_XFER_FEATURE_INTEGRITY) != 0) && (offset < fileSize);
+      transferCrc = 0;
 
       //schedule DOWNLOAD command
       state = FILE_XFER_SERVER_STATE_DOWNLOADING; //set server into downloading state
       ctrlChannel->send(&ACK, 1, true); //acknowledge command
-      fileSizeStrLen = snprintf(fileSizeStr, sizeof(fileSizeStr), "%d", fileSize); //size
+      fileSizeStrLen = snprintf(fileSizeStr, sizeof(fileSizeStr), "%lu", (unsigned long)(fileSize - offset)); //(remaining) size
+      if (sessionFeatures & FILE_XFER_FEATURE_COMPRESSION)
+      {
+         //sample the first blocks, to decide if the file is worth to be compressed. report that decision
+         size_t sampleLen = FILE_XFER_COMPRESS_SAMPLE_SIZE;
+         const unsigned char * sample = (offset < fileSize) ? downloadFile.map(offset, &sampleLen) : NULL;
+         dataEncoder.resetBySample(sample, (sample != NULL) ? sampleLen : 0);
+         ctrlChannel->send((const unsigned char *)fileSizeStr, fileSizeStrLen, true);
+         fileSizeStrLen = snprintf(fileSizeStr, sizeof(fileSizeStr), ",%c,%u", dataEncoder.stat.mode, dataEncoder.stat.entropy);
+      }
       ctrlChannel->send((const unsigned char *)fileSizeStr, fileSizeStrLen + 1);
-      std::cout << "DOWNLOAD command scheduled!" << endl;
+      std::cout << "DOWNLOAD command scheduled! Offset=" << offset << endl;
       return true;
    }
    return false;
@@ -821,51 +1963,1162 @@ bool FileXferServer::onDOWNLOAD_Command(const char * filename)
 //send file download data on data channel. as far as all data was sent:
 // - the file is closed
 // - return to IDLE state
+//the data is sent out of the blocks read ahead by the reader thread of the download file. a block, that isn't
+//read yet, is waited for by the next call (so slow storage doesn't block the task).
+//if compression was negotiated, the data is compressed block by block, out of that blocks.
 void FileXferServer::execDOWNLOAD_Command()
 {
+   const unsigned int chunkSize = dataChunking.getChunkSize(getTime1ms());
+
+   if (sessionFeatures & FILE_XFER_FEATURE_COMPRESSION)
+   {
+      //send compressed block. then compress next one
+      while (sendOutput(dataEncoder.output, chunkSize))
+      {
+         const unsigned char * data = NULL;
+         size_t count = FILE_XFER_COMPRESS_BLOCK_SIZE;
+         if (!downloadFile.isReady(downloadOffset))
+         {
+            return; //wait for the reader thread
+         }
+         if (downloadOffset < downloadFile.getSize())
+         {
+            data = downloadFile.map(downloadOffset, &count);
+         }
+         if (data == NULL) //end of file (or read error)
+         {
+            const FileXferCompressStat& stat = dataEncoder.stat;
+            if (!completeDOWNLOAD_Command())
+            {
+               return; //wait for TX buffer space (or read error)
+            }
+            std::cout << "DOWNLOAD has completed! Mode=" << stat.mode << " Entropy=" << stat.entropy
+                      << " Ratio=" << stat.originalBytes << "/" << stat.encodedBytes
+                      << " Blocks=" << stat.compressedBlocks << "C/" << stat.storedBlocks << "S" << endl;
+            return;
+         }
+         dataEncoder.encode(data, count);
+         if (transferHashed)
+         {
+            transferCrc = crc32c(transferCrc, data, count);
+         }
+         downloadOffset += count;
+      }
+      return;
+   }
+
    //there must be enough buffer space
-   while (dataChannel->getTxBufferSpace() >= 256)
+   while (dataChannel->getTxBufferSpace() >= chunkSize)
    {
-      unsigned char buffer[256];
-      unsigned int count;
+      const unsigned char * data;
+      size_t count = chunkSize;
 
-      //read out file and send data to client
-      count = fread(buffer, 1, sizeof(buffer), downloadFile);
-      if (count > 0)
+      //get next slice of the file and send it to client
+      if (!downloadFile.isReady(downloadOffset))
+      {
+         return; //wait for the reader thread
+      }
+      data = (downloadOffset < downloadFile.getSize()) ? downloadFile.map(downloadOffset, &count) : NULL;
+      if (data != NULL)
       {
-         dataChannel->send(buffer, count);
+         dataChannel->send(data, count);
+         dataChunking.onSent(count);
+         if (transferHashed)
+         {
+            transferCrc = crc32c(transferCrc, data, count);
+         }
+         downloadOffset += count;
       }
 
-      //handle end of file
-      if ((count == 0) || (feof(downloadFile)))
+      //handle end of file (or read error)
+      if ((data == NULL) || (downloadOffset >= downloadFile.getSize()))
       {
-         fclose(downloadFile); //close file
-         downloadFile = NULL;
-         state = FILE_XFER_SERVER_STATE_IDLE; //set server into IDLE state
-         std::cout << "DOWNLOAD has completed!" << endl;
+         if (completeDOWNLOAD_Command())
+         {
+            std::cout << "DOWNLOAD has completed!" << endl;
+         }
          return;
       }
    }
 }
 
+//end of a download:
+// - if the integrity check was negotiated, the CRC-32C of the sent data follows the data on data channel:
+//   a<crc>\0 (<crc> as hexadecimal ascii number). not on read error (the client doesn't get all data anyway)
+// - on read error, the error is sent on control channel: eD
+// - the file is closed
+// - return to IDLE state
+//returns false, while there isn't enough TX buffer space for the CRC (to be called again)
+bool FileXferServer::completeDOWNLOAD_Command()
+{
+   const bool failed = (downloadOffset < downloadFile.getSize());
+   if (transferHashed && !failed)
+   {
+      if (dataChannel->getTxBufferSpace() < 10) //ACK, 8 hex digits and zero termination
+      {
+         return false;
+      }
+      sendTransferCrc();
+   }
+   if (failed)
+   {
+      sendTransferError(FILE_XFER_CMD_DOWNLOAD);
+      std::cout << "DOWNLOAD failed! Offset=" << downloadOffset << endl;
+   }
+   transferHashed = false;
+   downloadFile.close(); //close file
+   state = FILE_XFER_SERVER_STATE_IDLE; //set server into IDLE state
+   return !failed;
+}
+
+//reply ACK together with the CRC of the transferred data on data channel
+void FileXferServer::sendTransferCrc()
+{
+   char crcStr[16];
+   const int crcStrLen = snprintf(crcStr, sizeof(crcStr), "%08x", (unsigned int)transferCrc);
+   dataChannel->send(&ACK, 1, true);
+   dataChannel->send((const unsigned char *)crcStr, crcStrLen + 1); //include zero termination
+}
+
+//the file of a download can't be read. the data can't be completed, so the client is told on control channel:
+//e<command> (the command of the data-transfer on client side: D, B or X). so it doesn't wait for a timeout.
+//the data not sent yet is dropped (it mustn't be taken for the data of the next transfer)
+void FileXferServer::sendTransferError(unsigned char command)
+{
+   const unsigned char error[2] = { FILE_XFER_CMD_ERROR, command };
+   dataChannel->flushTxBuffer();
+   ctrlChannel->send(error, 2);
+}
+
+
+
+
 
 
 
 
+//-------------------------------------------------------------------------------------------------
+/*
+   \brief Negotiate session parameters.
+
+   Requested on control channel: S<chunk-size>[,<features>]\0
+   Response on control channel:
+   - on success: a<chunk-size>,<features>\0
 
+   <chunk-size> is the maximum size of the data chunks, the client is able to handle. The server limits that
+   value to what it is able to handle (see FILE_XFER_CHUNK_SIZE_MAX) and replies the agreed value.
+   Both sides then use chunks up to that size on the data channel - for the rest of the session.
+   Without that command, a chunk size of FILE_XFER_CHUNK_SIZE_MIN is used.
 
+   <features> is the bit mask (hexadecimal ascii) of the optional features the client wants to use
+   (see FILE_XFER_FEATURE_...). The server replies the subset of these features, it implements.
+   Features are used for the rest of the session. Without that command, no optional feature is used.
 
-//format into YYYY-mm-dd HH:MM:SS
-//buf needs to store 30 characters
-static unsigned int timespec2str(char *buf, uint len, struct timespec *ts)
+   \retval true   on success
+*/
+//-------------------------------------------------------------------------------------------------
+bool FileXferServer::onSESSION_Command(const char * args)
 {
-    int ret;
-    struct tm t;
+   char argStr[32];
+   int argStrLen;
+   const char * features = strchr(args, ',');
+
+   dataChunking.setLimit(atoi(args));
+   sessionFeatures = (features != NULL) ? (strtoul(features + 1, NULL, 16) & FILE_XFER_FEATURES) : 0;
+   ctrlChannel->send(&ACK, 1, true); //acknowledge command
+   argStrLen = snprintf(argStr, sizeof(argStr), "%u,%x", dataChunking.getLimit(), sessionFeatures);
+   ctrlChannel->send((const unsigned char *)argStr, argStrLen + 1);
+   std::cout << "Session chunk size is " << dataChunking.getLimit() << ", features " << sessionFeatures << endl;
+   return true;
+}
+
 
-    tzset();
-    if (localtime_r(&(ts->tv_sec), &t) == NULL)
-        return 0;
 
-    ret = strftime(buf, len, "%F %T", &t);
-    return ret;
+
+
+
+
+
+//-------------------------------------------------------------------------------------------------
+/*
+   \brief Query size of a file.
+
+   Requested on control channel: Z<filename>\0
+   Response on control channel:
+   - on success: a<filesize>\0
+
+   Used by the client to determine, how many bytes of a file were stored by an interrupted upload.
+   <filesize> is given as a decimal ascii number.
+
+   \retval true   if file exists.
+   \retval false  otherwise
+*/
+//-------------------------------------------------------------------------------------------------
+bool FileXferServer::onSIZE_Command(const char * filename)
+{
+   const string fn = makeSystemPath(filename);
+   struct stat fileStat;
+   if ((stat(fn.c_str(), &fileStat) == 0) && S_ISREG(fileStat.st_mode))
+   {
+      char fileSizeStr[24];
+      int fileSizeStrLen;
+
+      ctrlChannel->send(&ACK, 1, true); //acknowledge command
+      fileSizeStrLen = snprintf(fileSizeStr, sizeof(fileSizeStr), "%lu", (unsigned long)fileStat.st_size); //size
+      ctrlChannel->send((const unsigned char *)fileSizeStr, fileSizeStrLen + 1);
+      return true;
+   }
+   return false;
+}
+
+
+//-------------------------------------------------------------------------------------------------
+/*
+   \brief Resume upload of a file to server.
+
+   Requested on control channel: A<filename>,<offset>,<size>,<crc>\0
+   Response on control channel:
+   - on success: a
+
+   The server keeps the first <offset> bytes of the (already existing) file and appends the following
+   <size> bytes received on the data channel. Any stored data behind <offset> is dropped.
+   <crc> is the CRC-32C of the first <offset> bytes of the clients file. The server verifies its stored
+   bytes against that checksum, before the command is acknowledged. So the response is sent delayed
+   (see verifyRESUME_UPLOAD_Command). With an <offset> of 0, this command equals the upload command.
+
+   <offset> and <size> are given as decimal ascii number, <crc> as hexadecimal ascii number.
+
+   \retval true   if resume was scheduled
+   \retval false  otherwise
+*/
+//-------------------------------------------------------------------------------------------------
+bool FileXferServer::onRESUME_UPLOAD_Command(const char * filename, size_t offset, unsigned long long size, uint32_t crc)
+{
+   uploadFileName = makeSystemPath(filename);
+   uploadFileSize = size;
+   resumeOffset = offset;
+   resumeVerified = 0;
+   resumeCrc = 0;
+   resumeExpectedCrc = crc;
+   if (offset > 0)
+   {
+      //the stored part must be (at least) as long as the offset
+      if (!resumeFile.open(uploadFileName) || (resumeFile.getSize() < offset))
+      {
+         resumeFile.close();
+         return false;
+      }
+   }
+   state = FILE_XFER_SERVER_STATE_UPLOAD_VERIFYING; //verification is done in "task"
+   std::cout << "RESUME UPLOAD command scheduled! Offset=" << offset << " Len=" << size << endl;
+   return true;
+}
+
+//verify the stored part of the file (a bunch of bytes per call, as far as it was read ahead). when done:
+// - on success, open the file for writing at offset. ACK and continue like a "normal" upload.
+// - otherwise NACK and return to IDLE state
+void FileXferServer::verifyRESUME_UPLOAD_Command()
+{
+   size_t budget = 1024 * 1024; //limit the time spent per call
+   while ((resumeVerified < resumeOffset) && (budget > 0))
+   {
+      size_t count = resumeOffset - resumeVerified;
+      if (count > budget)
+      {
+         count = budget;
+      }
+      if (!resumeFile.isReady(resumeVerified))
+      {
+         return; //wait for the reader thread
+      }
+      const unsigned char * data = resumeFile.map(resumeVerified, &count);
+      if (data == NULL)
+      {
+         break; //read error
+      }
+      resumeCrc = crc32c(resumeCrc, data, count);
+      resumeVerified += count;
+      budget -= count;
+   }
+   if ((resumeVerified < resumeOffset) && (budget == 0))
+   {
+      return; //continue with next call
+   }
+   resumeFile.close();
+
+   //check the result and open file for writing
+   if ((resumeVerified == resumeOffset) && (resumeCrc == resumeExpectedCrc) &&
+       uploadFile.open(uploadFileName, uploadDurability, resumeOffset))
+   {
+      state = FILE_XFER_SERVER_STATE_UPLOADING; //set server into uploading state
+      transferHashed = ((sessionFeatures & FILE_XFER_FEATURE_INTEGRITY) != 0);
+      transferCrc = 0;
+      dataDecoder.reset();
+      ctrlChannel->send(&ACK, 1); //acknowledge command
+      std::cout << "RESUME UPLOAD verified!" << endl;
+      if (uploadFileSize == 0) //nothing to upload (file already complete)
+      {
+         uploadFile.finish();
+         state = FILE_XFER_SERVER_STATE_UPLOAD_SYNCING;
+      }
+      return;
+   }
+   state = FILE_XFER_SERVER_STATE_IDLE;
+   ctrlChannel->send(&NACK, 1);
+   std::cout << "RESUME UPLOAD rejected. Stored data doesn't match!" << endl;
+}
+
+
+//-------------------------------------------------------------------------------------------------
+/*
+   \brief Get block signatures of a file.
+
+   Requested on control channel: K<filename>\0
+   Response on control channel:
+   - on success: a<block-size>,<block-count>\0
+
+   This is the first step of a delta upload. The server splits its version of the file into blocks of
+   <block-size> bytes and sends the signatures of the <block-count> complete blocks on the data channel
+   (FILE_XFER_DELTA_SIGNATURE_SIZE bytes per block, see file_xfer_delta.h). The client makes a delta
+   of its version of the file against these signatures and uploads that delta (see Y command).
+
+   \retval true   if file was successfully opend for read.
+   \retval false  otherwise
+*/
+//-------------------------------------------------------------------------------------------------
+bool FileXferServer::onSIGNATURES_Command(const char * filename)
+{
+   if (deltaFile.open(makeSystemPath(filename)))
+   {
+      char argStr[48];
+      int argStrLen;
+      const unsigned int blockSize = FileXferDelta::getBlockSize(deltaFile.getSize());
+      const size_t blockCount = deltaFile.getSize() / blockSize;
+
+      deltaOffset = 0;
+      deltaEnd = blockCount * blockSize; //only complete blocks are signed
+      outputSent = 0;
+      deltaSignatures.reset(blockSize);
+      dataChunking.start(dataChannel, getTime1ms());
+
+      //schedule SIGNATURES command
+      state = FILE_XFER_SERVER_STATE_SIGNING;
+      ctrlChannel->send(&ACK, 1, true); //acknowledge command
+      argStrLen = snprintf(argStr, sizeof(argStr), "%u,%lu", blockSize, (unsigned long)blockCount);
+      ctrlChannel->send((const unsigned char *)argStr, argStrLen + 1);
+      std::cout << "SIGNATURES command scheduled! Blocks=" << blockCount << " of " << blockSize << endl;
+      return true;
+   }
+   return false;
+}
+
+//sign the file (a bunch of bytes per call) and send the signatures on data channel. as far as all
+//signatures were sent, return to IDLE state.
+void FileXferServer::execSIGNATURES_Command()
+{
+   const unsigned int chunkSize = dataChunking.getChunkSize(getTime1ms());
+   size_t budget = 1024 * 1024; //limit the time spent per call
+   while (sendOutput(deltaSignatures.output, chunkSize) && (budget > 0))
+   {
+      const unsigned char * data = NULL;
+      size_t count = deltaEnd - deltaOffset;
+      if (count > FILE_XFER_DELTA_BLOCK_SIZE_MAX)
+      {
+         count = FILE_XFER_DELTA_BLOCK_SIZE_MAX;
+      }
+      if (count > 0)
+      {
+         data = deltaFile.map(deltaOffset, &count);
+      }
+      if (data == NULL) //all signatures sent (or read error)
+      {
+         deltaFile.close();
+         state = FILE_XFER_SERVER_STATE_IDLE;
+         std::cout << "SIGNATURES command completed!" << endl;
+         return;
+      }
+      deltaSignatures.feed(data, count);
+      deltaOffset += count;
+      budget -= (count < budget) ? count : budget;
+   }
+}
+
+
+
+//-------------------------------------------------------------------------------------------------
+/*
+   \brief Upload a delta to server.
+
+   Requested on control channel: Y<filename>,<block-size>\0
+   Response on control channel:
+   - on success: a
+
+   The client has made a delta of its version of the file, against the signatures of the servers version
+   (the basis, see K command). <block-size> is the block size of these signatures.
+   The server expects to receive the delta on the data channel. It rebuilds the new file out of the
+   literal data of the delta and the blocks of the basis. The new file is written to a temporary file (with a
+   unique name, in the same directory), which replaces the basis, as far as the delta is complete and the CRC-32C
+   of the rebuilt file matches the one given by the delta. It gets the mode (and owner) of the basis.
+   Like an upload, the result is replied on the data channel.
+   If the file doesn't exist on the server, the delta must not refer to any block.
+
+   \retval true   if file was successfully opend for write.
+   \retval false  otherwise
+*/
+//-------------------------------------------------------------------------------------------------
+bool FileXferServer::onDELTA_UPLOAD_Command(const char * filename, unsigned int blockSize)
+{
+   if ((blockSize < FILE_XFER_DELTA_BLOCK_SIZE_MIN) || (blockSize > FILE_XFER_DELTA_BLOCK_SIZE_MAX))
+   {
+      return false;
+   }
+   uploadFileName = makeSystemPath(filename);
+   if (!uploadFileName.empty() && makeTempFile(uploadFileName, deltaTempName) &&
+       uploadFile.open(deltaTempName, uploadDurability))
+   {
+      deltaFile.open(uploadFileName); //basis (may not exist)
+      deltaApplier.reset(blockSize, this);
+
+      //schedule DELTA UPLOAD command
+      state = FILE_XFER_SERVER_STATE_DELTA_UPLOADING;
+      ctrlChannel->send(&ACK, 1); //acknowledge command
+      std::cout << "DELTA UPLOAD command scheduled!" << endl;
+      return true;
+   }
+   if (!deltaTempName.empty())
+   {
+      unlink(deltaTempName.c_str());
+      deltaTempName.clear();
+   }
+   return false;
+}
+
+//receive the delta on data channel and apply it. as far as the delta is complete:
+// - on success, the new file is handed over to the write-behind stage (see completeUPLOAD_Command)
+// - otherwise the new file is dropped, a NACK ('n') is returned on the data channel and the server returns to IDLE state
+void FileXferServer::execDELTA_UPLOAD_Command(const unsigned char * const data, const unsigned int len)
+{
+   const int result = deltaApplier.feed(data, len);
+   if (result > 0)
+   {
+      deltaFile.close();
+      uploadFile.finish(); //flush and sync (in background)
+      state = FILE_XFER_SERVER_STATE_UPLOAD_SYNCING;
+   }
+   else if (result < 0)
+   {
+      deltaFile.close();
+      uploadFile.abort();
+      unlink(deltaTempName.c_str());
+      deltaTempName.clear();
+      state = FILE_XFER_SERVER_STATE_IDLE;
+      dataChannel->send(&NACK, 1);
+      std::cout << "DELTA UPLOAD failed!" << endl;
+   }
+}
+
+
+
+//-------------------------------------------------------------------------------------------------
+/*
+   \brief Download a delta of a file from server.
+
+   Requested on control channel: X<filename>,<block-size>,<block-count>\0
+   Response on control channel:
+   - on success: a<filesize>\0
+
+   The client owns an (old) version of the file - the basis. It expects to receive <block-count>
+   signatures of blocks of <block-size> bytes of its basis on the data channel (see K command for the format).
+   <block-size> must be the one for a basis of <block-count> blocks (see FileXferDelta::getBlockSize). So
+   <block-count> can't exceed <block-size>, or FILE_XFER_DELTA_BLOCK_COUNT_MAX for the largest block size.
+   After all signatures were received, the server makes a delta of its version of the file against these
+   signatures and sends it on the data channel. The client rebuilds the file out of the delta and its basis.
+   <filesize> is the size of the servers version of the file. It is given as a decimal ascii number.
+
+   \retval true   if file was successfully opend for read.
+   \retval false  otherwise
+*/
+//-------------------------------------------------------------------------------------------------
+bool FileXferServer::onDELTA_DOWNLOAD_Command(const char * filename, unsigned int blockSize, size_t blockCount)
+{
+   if ((blockSize < FILE_XFER_DELTA_BLOCK_SIZE_MIN) || (blockSize > FILE_XFER_DELTA_BLOCK_SIZE_MAX))
+   {
+      return false;
+   }
+   //the signatures are kept in memory. so their number is limited
+   if (blockCount > ((blockSize < FILE_XFER_DELTA_BLOCK_SIZE_MAX) ? blockSize : FILE_XFER_DELTA_BLOCK_COUNT_MAX))
+   {
+      return false;
+   }
+   if (deltaFile.open(makeSystemPath(filename)))
+   {
+      char fileSizeStr[24];
+      int fileSizeStrLen;
+
+      deltaOffset = 0;
+      deltaEnd = deltaFile.getSize();
+      outputSent = 0;
+      deltaGenerator.reset(blockSize, blockCount);
+      dataChunking.start(dataChannel, getTime1ms());
+
+      //schedule DELTA DOWNLOAD command. first receive the signatures (if any)
+      state = (blockCount > 0) ? FILE_XFER_SERVER_STATE_DELTA_SIGNATURES : FILE_XFER_SERVER_STATE_DELTA_DOWNLOADING;
+      ctrlChannel->send(&ACK, 1, true); //acknowledge command
+      fileSizeStrLen = snprintf(fileSizeStr, sizeof(fileSizeStr), "%lu", (unsigned long)deltaEnd);
+      ctrlChannel->send((const unsigned char *)fileSizeStr, fileSizeStrLen + 1);
+      std::cout << "DELTA DOWNLOAD command scheduled! Blocks=" << blockCount << " of " << blockSize << endl;
+      return true;
+   }
+   return false;
+}
+
+//make the delta of the file (a bunch of bytes per call) and send it on data channel. as far as the
+//complete delta was sent:
+// - the file is closed
+// - return to IDLE state
+void FileXferServer::execDELTA_DOWNLOAD_Command()
+{
+   const unsigned int chunkSize = dataChunking.getChunkSize(getTime1ms());
+   size_t budget = 1024 * 1024; //limit the time spent per call
+   while (sendOutput(deltaGenerator.output, chunkSize) && (budget > 0))
+   {
+      if (!deltaFile.isOpen()) //delta was sent completely
+      {
+         state = FILE_XFER_SERVER_STATE_IDLE;
+         std::cout << "DELTA DOWNLOAD has completed!" << endl;
+         return;
+      }
+      const unsigned char * data = NULL;
+      size_t count = deltaEnd - deltaOffset;
+      if (count > FILE_XFER_DELTA_BLOCK_SIZE_MAX)
+      {
+         count = FILE_XFER_DELTA_BLOCK_SIZE_MAX;
+      }
+      if (count > 0)
+      {
+         data = deltaFile.map(deltaOffset, &count);
+      }
+      if (data == NULL) //end of file
+      {
+         if (deltaOffset < deltaEnd) //read error. the delta is not terminated, so the client is told
+         {
+            deltaGenerator.output.clear();
+            deltaFile.close();
+            state = FILE_XFER_SERVER_STATE_IDLE;
+            sendTransferError(FILE_XFER_CMD_DELTA_DOWNLOAD);
+            std::cout << "DELTA DOWNLOAD failed!" << endl;
+            return;
+         }
+         deltaGenerator.finish();
+         deltaFile.close();
+         continue;
+      }
+      deltaGenerator.feed(data, count);
+      deltaOffset += count;
+      budget -= (count < budget) ? count : budget;
+   }
+}
+
+
+//send pending output (signatures or delta) on data channel, as far as there is buffer space.
+//returns true, when all output was sent.
+bool FileXferServer::sendOutput(vector<unsigned char>& output, unsigned int chunkSize)
+{
+   while ((outputSent < output.size()) && (dataChannel->getTxBufferSpace() >= chunkSize))
+   {
+      unsigned int count = chunkSize;
+      if (count > (output.size() - outputSent))
+      {
+         count = output.size() - outputSent;
+      }
+      dataChannel->send(&output[outputSent], count);
+      dataChunking.onSent(count);
+      outputSent += count;
+   }
+   if (outputSent < output.size())
+   {
+      return false;
+   }
+   output.clear();
+   outputSent = 0;
+   return (dataChannel->getTxBufferSpace() >= chunkSize); //only worth to produce more output, if it can be sent
+}
+
+
+//read from the basis of a delta upload
+size_t FileXferServer::readBasis(size_t offset, unsigned char * buffer, size_t len)
+{
+   size_t done = 0;
+   while (done < len)
+   {
+      size_t count = len - done;
+      const unsigned char * data = deltaFile.map(offset + done, &count);
+      if ((data == NULL) || (count == 0))
+      {
+         break;
+      }
+      memcpy(&buffer[done], data, count);
+      done += count;
+   }
+   return done;
+}
+
+
+//write to the new file of a delta upload
+void FileXferServer::writeTarget(const unsigned char * data, size_t len)
+{
+   uploadFile.write(data, len);
+}
+
+
+
+//-------------------------------------------------------------------------------------------------
+/*
+   \brief Download all files of a directory (or a directory tree), as one bundle.
+
+   Requested on control channel: B<directory>\0
+   or (tree download):           T<directory>\0
+   Response on control channel:
+   - on success: a
+
+   All regular files of <directory> are sent back-to-back on the data channel. Each file is preceded by
+   a header, giving its name, size and modification time. The bundle ends with an end record, giving the
+   number of files. See file_xfer_bundle.h for the format.
+   A tree download includes the sub-directories (recursively). The server walks the tree itself: each
+   directory is sent as a directory record, followed by its content. Names are paths, relative to <directory>.
+   Symbolic links (and other special files) are skipped. So the walk can't leave the tree.
+   If compression was negotiated, the bundle is compressed block by block (like a listing).
+
+   Like "cd", <directory> is confined to the root directory. An empty <directory> is the current directory.
+
+   \retval true   if directory was successfully opend for read.
+   \retval false  otherwise
+*/
+//-------------------------------------------------------------------------------------------------
+bool FileXferServer::onBUNDLE_DOWNLOAD_Command(const char * directory, bool tree)
+{
+   bundleDir = makeSystemDirectory(directory);
+   DIR * dir = opendir(bundleDir.c_str());
+   if (dir != NULL)
+   {
+      bundleTree = tree;
+      bundleDirectories.push_back(dir);
+      bundlePaths.push_back("");
+      bundleWriter.reset();
+      dataEncoder.reset();
+      outputSent = 0;
+      dataChunking.start(dataChannel, getTime1ms());
+
+      //schedule BUNDLE DOWNLOAD command
+      state = FILE_XFER_SERVER_STATE_BUNDLE_DOWNLOADING;
+      ctrlChannel->send(&ACK, 1); //acknowledge command
+      std::cout << (tree ? "TREE" : "BUNDLE") << " DOWNLOAD command scheduled!" << endl;
+      return true;
+   }
+   return false;
+}
+
+//send the files of the directory (a bunch of bytes per call). as far as the bundle was sent completely,
+//return to IDLE state.
+//without compression, the file data is sent directly out of the memory mapped file (like a download).
+//with compression, headers and file data are collected and compressed block by block.
+void FileXferServer::execBUNDLE_DOWNLOAD_Command()
+{
+   const bool compressed = ((sessionFeatures & FILE_XFER_FEATURE_COMPRESSION) != 0);
+   const unsigned int chunkSize = dataChunking.getChunkSize(getTime1ms());
+   size_t budget = 1024 * 1024; //limit the time spent per call
+   while (sendOutput(compressed ? dataEncoder.output : bundleWriter.output, chunkSize) && (budget > 0))
+   {
+      if (!downloadFile.isOpen())
+      {
+         if (bundleDirectories.empty()) //bundle was sent completely
+         {
+            state = FILE_XFER_SERVER_STATE_IDLE;
+            std::cout << "BUNDLE DOWNLOAD has completed!" << endl;
+            return;
+         }
+         nextBUNDLE_File(); //header of the next file (or end of bundle)
+      }
+      else
+      {
+         //next slice of the current file
+         const unsigned char * data = NULL;
+         size_t count = compressed ? FILE_XFER_COMPRESS_BLOCK_SIZE : chunkSize;
+         if (!downloadFile.isReady(downloadOffset))
+         {
+            return; //wait for the reader thread
+         }
+         if (downloadOffset < downloadFile.getSize())
+         {
+            data = downloadFile.map(downloadOffset, &count);
+            if (data == NULL) //read error. the bundle can't be continued, so the client is told
+            {
+               downloadFile.close();
+               closeBUNDLE_Directories();
+               bundleWriter.output.clear();
+               state = FILE_XFER_SERVER_STATE_IDLE;
+               sendTransferError(FILE_XFER_CMD_BUNDLE_DOWNLOAD);
+               std::cout << "BUNDLE DOWNLOAD failed!" << endl;
+               return;
+            }
+         }
+         if (data == NULL) //end of file
+         {
+            downloadFile.close();
+         }
+         else if (compressed)
+         {
+            bundleWriter.output.insert(bundleWriter.output.end(), data, data + count);
+            downloadOffset += count;
+         }
+         else
+         {
+            dataChannel->send(data, count);
+            dataChunking.onSent(count);
+            downloadOffset += count;
+         }
+         budget -= (count < budget) ? count : budget;
+      }
+
+      //compress the collected data. full blocks only, unless the bundle is complete
+      if (compressed)
+      {
+         const bool complete = bundleDirectories.empty() && !downloadFile.isOpen();
+         const size_t count = complete ? bundleWriter.output.size() :
+                              (bundleWriter.output.size() / FILE_XFER_COMPRESS_BLOCK_SIZE) * FILE_XFER_COMPRESS_BLOCK_SIZE;
+         if (count > 0)
+         {
+            dataEncoder.encode(bundleWriter.output.data(), count);
+            bundleWriter.output.erase(bundleWriter.output.begin(), bundleWriter.output.begin() + count);
+         }
+      }
+   }
+}
+
+//open the next regular file of the directory and append its header to the bundle. on a tree download,
+//append the record of the next sub-directory and descend into it, before its files are sent.
+//at the end of the (root) directory, append the end record.
+void FileXferServer::nextBUNDLE_File()
+{
+   while (!bundleDirectories.empty())
+   {
+      struct dirent * ent = readdir(bundleDirectories.back());
+      if (ent == NULL) //end of directory. continue with its parent
+      {
+         closedir(bundleDirectories.back());
+         bundleDirectories.pop_back();
+         bundlePaths.pop_back();
+         continue;
+      }
+      const string name = bundlePaths.back() + ent->d_name; //relative to "bundleDir"
+      const string fileName = bundleDir + name;
+      struct stat fileStat;
+      if (!FileXferBundleWriter::isValidName(ent->d_name) || (lstat(fileName.c_str(), &fileStat) != 0))
+      {
+         continue;
+      }
+      if (name.length() > FILE_XFER_BUNDLE_NAME_MAX) //the client would reject the whole bundle
+      {
+         std::cout << "BUNDLE DOWNLOAD skips " << fileName << " (path too long)" << endl;
+         continue;
+      }
+      if (bundleTree && S_ISDIR(fileStat.st_mode))
+      {
+         DIR * dir = opendir(fileName.c_str());
+         if (dir != NULL)
+         {
+            bundleWriter.addDirectory(name);
+            bundleDirectories.push_back(dir);
+            bundlePaths.push_back(name + '/');
+            return;
+         }
+      }
+      else if (S_ISREG(fileStat.st_mode) && downloadFile.open(fileName))
+      {
+         downloadOffset = 0;
+         bundleWriter.addFile(name, downloadFile.getSize(), fileStat.st_mtime);
+         return;
+      }
+   }
+   bundleWriter.finish();
+}
+
+//close the directories of a bundle download
+void FileXferServer::closeBUNDLE_Directories()
+{
+   while (!bundleDirectories.empty())
+   {
+      closedir(bundleDirectories.back());
+      bundleDirectories.pop_back();
+   }
+   bundlePaths.clear();
+}
+
+
+
+//-------------------------------------------------------------------------------------------------
+/*
+   \brief Upload a bundle of files (or a directory tree) into a directory.
+
+   Requested on control channel: P<directory>\0
+   or (tree upload):             V<directory>\0
+   Response on control channel:
+   - on success: a
+
+   The server expects to receive a bundle on the data channel (see file_xfer_bundle.h for the format).
+   Each file of the bundle is stored into <directory> (which must exist), and gets the modification time
+   given by its header. Existing files are overwritten. Each file is made durable according to the
+   durability setting. This is done in background, while the next files are stored (up to
+   FILE_XFER_SERVER_BUNDLE_CLOSES files at once). If there are as many files being synced, the bundle is paused
+   and the received data is held, until the oldest file is durable. The result is replied, as far as all files
+   are durable.
+   A tree upload receives a tree bundle. The server creates <directory> (if it doesn't exist yet) and
+   the sub-directories given by the directory records. The paths of a tree bundle can't leave <directory>.
+   Like an upload, the result is replied on the data channel, as far as the whole bundle was received:
+   a, if all files were stored. n otherwise.
+
+   Like "cd", <directory> is confined to the root directory. An empty <directory> is the current directory.
+
+   \retval true   if directory exists (or was created).
+   \retval false  otherwise
+*/
+//-------------------------------------------------------------------------------------------------
+bool FileXferServer::onBUNDLE_UPLOAD_Command(const char * directory, bool tree)
+{
+   bundleDir = makeSystemDirectory(directory);
+   if (tree)
+   {
+      mkdir(bundleDir.c_str(), 0777); //may already exist
+   }
+   if (DirectoryNavigatorLinux::directoryExists(bundleDir))
+   {
+      bundleFailed = false;
+      bundleReader.reset(this, tree);
+      dataDecoder.reset();
+
+      //schedule BUNDLE UPLOAD command
+      state = FILE_XFER_SERVER_STATE_BUNDLE_UPLOADING;
+      ctrlChannel->send(&ACK, 1); //acknowledge command
+      std::cout << (tree ? "TREE" : "BUNDLE") << " UPLOAD command scheduled!" << endl;
+      return true;
+   }
+   return false;
+}
+
+//receive the bundle on data channel (and decompress it) and store its files.
+void FileXferServer::execBUNDLE_UPLOAD_Command(const unsigned char * data, unsigned int len)
+{
+   checkBUNDLE_UPLOAD_Result(decompress(&data, &len) ? bundleReader.feed(data, len) : -1);
+}
+
+//as far as the bundle is complete (or invalid), wait for its files to become durable
+//(see completeBUNDLE_UPLOAD_Command).
+void FileXferServer::checkBUNDLE_UPLOAD_Result(int result)
+{
+   if (result != 0)
+   {
+      if (result < 0)
+      {
+         abortBUNDLE_File(); //incomplete file (if any)
+         bundleFailed = true;
+      }
+      state = FILE_XFER_SERVER_STATE_BUNDLE_SYNCING;
+      std::cout << "BUNDLE UPLOAD received! Result=" << result << endl;
+   }
+}
+
+//as far as all files of the bundle upload are durable (and closed by task):
+// - a ACK ('a') is returned on the data channel, if all files were stored. a NACK ('n') otherwise
+// - return to IDLE state
+void FileXferServer::completeBUNDLE_UPLOAD_Command()
+{
+   if (bundleCloses.empty())
+   {
+      state = FILE_XFER_SERVER_STATE_IDLE;
+      dataChannel->send(bundleFailed ? &NACK : &ACK, 1);
+      std::cout << "BUNDLE UPLOAD has completed!" << endl;
+   }
+}
+
+
+//close the oldest file of a bundle upload, as far as it is durable. then set its modification time.
+//returns false, if there is no such file (or it isn't durable yet)
+bool FileXferServer::closeBUNDLE_File()
+{
+   bool ok;
+   if (bundleCloses.empty() || !bundleCloses.front().file->isFinished(&ok))
+   {
+      return false;
+   }
+   FileXferBundleClose& pending = bundleCloses.front();
+   pending.file->close();
+   bundleFailed = !ok || bundleFailed;
+   if (pending.mtime != 0) //after close, as the last write would change it
+   {
+      struct timespec times[2];
+      times[0].tv_sec = 0;
+      times[0].tv_nsec = UTIME_OMIT; //keep access time
+      times[1].tv_sec = (time_t)pending.mtime;
+      times[1].tv_nsec = 0;
+      utimensat(AT_FDCWD, pending.name.c_str(), times, 0);
+   }
+   bundleSpares.push_back(pending.file);
+   bundleCloses.pop_front();
+   return true;
+}
+
+
+//drop the file of a bundle upload, currently received (if any)
+void FileXferServer::abortBUNDLE_File()
+{
+   if (bundleFile != NULL)
+   {
+      bundleFile->abort();
+      bundleSpares.push_back(bundleFile);
+      bundleFile = NULL;
+   }
+}
+
+
+//check if the next file of a bundle upload can be created. if too many files are still synced in background,
+//the bundle is paused (and resumed by task)
+bool FileXferServer::canBeginFile()
+{
+   return bundleCloses.size() < FILE_XFER_SERVER_BUNDLE_CLOSES;
+}
+
+
+//create a file of a bundle upload. the previous files may still be synced in background
+bool FileXferServer::beginFile(const string& name, unsigned long long size, unsigned long long mtime)
+{
+   if (bundleSpares.empty())
+   {
+      bundleFiles.push_back(std::unique_ptr<WriteBehindFile>(new WriteBehindFile()));
+      bundleFiles.back()->setNotifyFd(notifyFd);
+      bundleSpares.push_back(bundleFiles.back().get());
+   }
+   bundleFileName = bundleDir + name;
+   bundleFileTime = mtime;
+   if (bundleSpares.back()->open(bundleFileName, uploadDurability))
+   {
+      bundleFile = bundleSpares.back();
+      bundleSpares.pop_back();
+      return true;
+   }
+   bundleFailed = true;
+   std::cout << "BUNDLE UPLOAD failed to create " << bundleFileName << endl;
+   return false;
+}
+
+
+//write to a file of a bundle upload
+void FileXferServer::writeFile(const unsigned char * data, size_t len)
+{
+   bundleFile->write(data, len);
+}
+
+
+//complete a file of a bundle upload. it is made durable in background (see closeBUNDLE_File), while the next file
+//is stored.
+void FileXferServer::endFile()
+{
+   FileXferBundleClose pending;
+   bundleFile->finish();
+   pending.file = bundleFile;
+   pending.name = bundleFileName;
+   pending.mtime = bundleFileTime;
+   bundleCloses.push_back(pending);
+   bundleFile = NULL;
+}
+
+
+//create a directory of a tree upload
+void FileXferServer::createDirectory(const string& name)
+{
+   const string dirName = bundleDir + name;
+   if ((mkdir(dirName.c_str(), 0777) != 0) && !DirectoryNavigatorLinux::directoryExists(dirName))
+   {
+      bundleFailed = true; //the files of that directory will fail as well
+      std::cout << "BUNDLE UPLOAD failed to create " << dirName << endl;
+   }
+}
+
+
+//decompress data received on data channel (if compression was negotiated). on return, "data" and "len"
+//refer to the decompressed data. returns false, on invalid data.
+bool FileXferServer::decompress(const unsigned char ** data, unsigned int * len)
+{
+   if (sessionFeatures & FILE_XFER_FEATURE_COMPRESSION)
+   {
+      dataDecoder.output.clear();
+      if (!dataDecoder.feed(*data, *len))
+      {
+         return false;
+      }
+      *data = dataDecoder.output.data();
+      *len = dataDecoder.output.size();
+   }
+   return true;
+}
+
+
+
+//send listing data on data channel. if compression was negotiated, the listing is collected and sent
+//compressed, block by block. a block ends, as far as it is full or the listing ends ("more" equals false).
+void FileXferServer::sendListing(const unsigned char * data, unsigned int len, bool more)
+{
+   if ((sessionFeatures & FILE_XFER_FEATURE_COMPRESSION) == 0)
+   {
+      dataChannel->send(data, len, more);
+      return;
+   }
+   listBuffer.insert(listBuffer.end(), data, data + len);
+   if (!more || (listBuffer.size() >= FILE_XFER_COMPRESS_BLOCK_SIZE))
+   {
+      dataEncoder.encode(listBuffer.data(), listBuffer.size());
+      listBuffer.clear();
+   }
+}
+
+
+//make (system) path of a file given by client.
+//if it starts with '/' it is expected to be "root-based" path to the file.
+//otherwise it is expected to be a path relative to current directory.
+//like "cd", "." and ".." are resolved and the path is confined to the root directory. the path is empty, if
+//nothing is left (the root directory itself is no file). so any file operation on it fails
+string FileXferServer::makeSystemPath(const char * path) const
+{
+   DirectoryNavigator file = session->currentDir; //use a tmp copy
+   string fn = file.changeDirectory(path); //ends with '/'
+   if (fn.empty())
+   {
+      return string();
+   }
+   fn.erase(fn.length() - 1); //remove the trailing '/'
+   return rootDir + fn; //prefix root directory
+}
+
+
+//make (system) path of a directory given by client. like "cd", the path is confined to the root directory.
+//an empty path is the current directory. the returned path ends with '/'.
+string FileXferServer::makeSystemDirectory(const char * path) const
+{
+   DirectoryNavigator dir = session->currentDir; //use a tmp copy
+   if (path[0] != 0)
+   {
+      dir.changeDirectory(path);
+   }
+   return rootDir + dir.getCurrentDirectory(); //prefix root directory
+}
+
+
+//monotonic time in milliseconds
+static unsigned long getTime1ms()
+{
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return (ts.tv_sec * 1000UL) + (ts.tv_nsec / 1000000UL);
+}
+
+
+//create a new, empty file to be written instead of "path" (and renamed to it, when done). it is created in the same
+//directory, with a unique name. it gets the mode and owner of "path" (if it exists). otherwise the mode of a newly
+//created file
+static bool makeTempFile(const string& path, string& tempName)
+{
+   struct stat fileStat;
+   vector<char> name(path.begin(), path.end());
+   const char suffix[] = ".fxdelta.XXXXXX";
+   name.insert(name.end(), suffix, suffix + sizeof(suffix)); //including zero termination
+
+   const int fd = mkstemp(name.data()); //created with mode 0600
+   if (fd < 0)
+   {
+      return false;
+   }
+   if (stat(path.c_str(), &fileStat) == 0)
+   {
+      if (fchown(fd, fileStat.st_uid, fileStat.st_gid) != 0) //not allowed to give away the file
+      {
+         std::cout << "Owner of " << path << " isn't kept!" << endl;
+      }
+      fchmod(fd, fileStat.st_mode & 07777);
+   }
+   else
+   {
+      const mode_t mask = umask(0); //only readable together with setting it
+      umask(mask);
+      fchmod(fd, 0666 & ~mask);
+   }
+   close(fd);
+   tempName = name.data();
+   return true;
+}
+
+
+//split "count" arguments from the right of "str" (<name>,<arg0>,..,<argN-1>). the name may contain a KOMMA.
+//the KOMMAs are replaced by ZERO, so "str" is the name afterwards.
+static bool splitArguments(char * str, char ** args, int count)
+{
+   for (int idx = count - 1; idx >= 0; --idx)
+   {
+      args[idx] = strrchr(str, ',');
+      if (args[idx] == NULL)
+      {
+         return false;
+      }
+      *args[idx]++ = 0; //replace KOMMA by ZERO to terminate the previous argument
+   }
+   return true;
+}
+
+
+//order of the entries of a snapshot
+static bool compareEntries(const FileXferStat& a, const FileXferStat& b)
+{
+   return a.name < b.name;
+}
+
+
+//orders of a filtered listing. entries of equal key are ordered by name
+static bool compareEntriesDescending(const FileXferStat& a, const FileXferStat& b)
+{
+   return a.name > b.name;
+}
+static bool compareSize(const FileXferStat& a, const FileXferStat& b)
+{
+   return (a.size != b.size) ? (a.size < b.size) : (a.name < b.name);
+}
+static bool compareSizeDescending(const FileXferStat& a, const FileXferStat& b)
+{
+   return (a.size != b.size) ? (a.size > b.size) : (a.name < b.name);
+}
+static bool compareTime(const FileXferStat& a, const FileXferStat& b)
+{
+   return (a.mtime != b.mtime) ? (a.mtime < b.mtime) : (a.name < b.name);
+}
+static bool compareTimeDescending(const FileXferStat& a, const FileXferStat& b)
+{
+   return (a.mtime != b.mtime) ? (a.mtime > b.mtime) : (a.name < b.name);
+}
+
+
+//order of a filtered listing, by its sort key ('n' name, 's' size, 't' modification time. upper case: descending)
+static CompareFunction getSortOrder(char sort)
+{
+   switch (sort)
+   {
+      case 'N':
+         return compareEntriesDescending;
+      case 's':
+         return compareSize;
+      case 'S':
+         return compareSizeDescending;
+      case 't':
+         return compareTime;
+      case 'T':
+         return compareTimeDescending;
+      default: //by name
+         return compareEntries;
+   }
 }
\ No newline at end of file
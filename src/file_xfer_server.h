@@ -19,9 +19,51 @@
    Change and list directory           I<path>           a<dir>\0           -             <listing>\0
    Make directory                      M<path>           a                  -                  -
    Remove dir/file                     R<path>           a                  -                  -
-   Upload file                         U<name>,<size>\0  a               <binary-data>    a *on completion*
-   Download file                       D<name>           a<size>\0          -             <binary-data>
-   Quit/Canel operation                Q                 a                  -             *fill by flushed*
+   Upload file                         U<name>,<size>\0  a               <binary-data>    a[<crc>] *on completion*
+   Download file                       D<name>           a<size>\0          -             <binary-data>[a<crc>]
+   Quit/Canel operation                Q[<tag>]          a[<tag>]           -             *fill by flushed*
+   Negotiate session                   S<chunk>,<feat>\0 a<chunk>,<feat>\0  -                  -
+   Resume download                     G<name>,<offs>\0  a<remaining>\0     -             <binary-data>[a<crc>]
+   Query file size                     Z<name>\0         a<size>\0          -                  -
+   Resume upload                       A<name>,<offs>,   a               <binary-data>    a[<crc>] *on completion*
+                                        <size>,<crc>\0
+   Get block signatures                K<name>\0         a<bsize>,<cnt>\0  -             <signatures>
+   Delta upload                        Y<name>,<bsize>\0 a               <delta>          a *on completion*
+   Delta download                      X<name>,<bsize>,  a<size>\0      <signatures>      <delta>
+                                        <cnt>\0
+   Bundle download                     B<dir>\0          a                  -             <bundle>
+   Bundle upload                       P<dir>\0          a               <bundle>         a *on completion*
+   Tree download                       T<dir>\0          a                  -             <bundle>
+   Tree upload                         V<dir>\0          a               <bundle>         a *on completion*
+   List changes                        H<token>\0        a<token>,<mode>\0  -             <listing>\0
+   Filtered listing                    F<filter>\0       a<total>\0         -             <listing>\0
+
+   A <listing> is sent as text (see onLS_Command), or as compact binary records, if the binary listing was
+   negotiated within the session (see file_xfer_list.h).
+
+   If the integrity check was negotiated within the session, both sides compute the CRC-32C of the data of an up-
+   or download, while it is transferred. The server reports its <crc> on completion (see completeUPLOAD_Command and
+   completeDOWNLOAD_Command). The client compares it with its own one.
+
+   If the file of a download (resumed, bundle, tree or delta download) can't be read while it is sent (I/O error or
+   file truncated meanwhile), the server returns to idle and sends the unsolicited error e<command> on control
+   channel (see sendTransferError). It isn't a response, so the client doesn't match it to a request.
+
+   The client may pipeline commands (send further commands, before the response of the previous one was received).
+   The server replies in the order the commands were received. A command that requires the server to be idle, is
+   deferred while a data-transfer is in progress - and so are all commands received after it. The deferred commands
+   are processed back-to-back, as far as the server becomes idle. A listing of changes or filtered listing reads the
+   directory by the task (a batch of entries per call), before it responds. Meanwhile all commands are deferred.
+   Quit replies a NACK to a pending listing and all deferred commands.
+   Responses are matched to the commands by their order only. The client resyncs after a timeout by a quit with a
+   <tag> byte: the tag is echoed, and the client discards all responses up to the echo.
+
+   Listings may be cached, so a repeated listing of an unchanged directory is served from memory (see setListCache
+   and file_xfer_cache.h).
+
+   Further transfer slots may be added, each using its own pair of control and data channel (see addSlot). A slot
+   shares the session (root and working directory) of the server, it was added to. So several files can be transferred
+   concurrently. The slay2 channels share the link, and a stalled (retransmitting) channel doesn't block the others.
 
    See the "switch-case" description and function header of CPP module for a more detailed protocol description.
 */
@@ -31,28 +73,85 @@
 
 /* -- Includes ------------------------------------------------------------ */
 #include <dirent.h>
+#include <regex.h>
 #include <cstdio>
+#include <stdint.h>
+#include <deque>
+#include <memory>
+#include <vector>
 #include "dirutils.h"
+#include "mapfile.h"
+#include "readahead.h"
+#include "writebehind.h"
 #include "slay2.h"
+#include "file_xfer.h"
+#include "file_xfer_delta.h"
+#include "file_xfer_compress.h"
+#include "file_xfer_bundle.h"
+#include "file_xfer_list.h"
+#include "file_xfer_cache.h"
 
 
 /* -- Defines ------------------------------------------------------------- */
-
+#ifndef FILE_XFER_SERVER_CTRL_QUEUE_MAX
+#define FILE_XFER_SERVER_CTRL_QUEUE_MAX   (16)     //max. number of deferred control frames
+#endif
+#ifndef FILE_XFER_SERVER_SNAPSHOTS
+#define FILE_XFER_SERVER_SNAPSHOTS        (4)      //max. number of listings, change tokens refer to (per session)
+#endif
+#ifndef FILE_XFER_SERVER_SNAPSHOT_ENTRIES
+#define FILE_XFER_SERVER_SNAPSHOT_ENTRIES (65536)  //max. number of entries of these listings (all together, per session)
+#endif
+#ifndef FILE_XFER_SERVER_COLLECT_BATCH
+#define FILE_XFER_SERVER_COLLECT_BATCH    (256)    //number of directory entries read per task call, while a listing of changes or filtered listing is collected
+#endif
+#ifndef FILE_XFER_SERVER_BUNDLE_CLOSES
+#define FILE_XFER_SERVER_BUNDLE_CLOSES    (4)      //max. number of files of a bundle upload, being synced in background
+#endif
 
 /* -- Types --------------------------------------------------------------- */
 
+//file of a bundle upload, received completely. it is closed, as far as it is synced (see closeBUNDLE_File)
+typedef struct
+{
+   WriteBehindFile * file;
+   std::string name;
+   unsigned long long mtime;
+} FileXferBundleClose;
+
+//listing of a directory, a change token refers to (see onCHANGES_Command)
+typedef struct
+{
+   unsigned long long token;
+   std::string dir;
+   unsigned long version; //version of the directory within the listing cache, when it was read (0 = unknown)
+   std::vector<FileXferStat> entries; //sorted by name
+} FileXferSnapshot;
 
-class FileXferServer
+
+class FileXferServer : private FileXferDeltaTarget, private FileXferBundleTarget
 {
 public:
    FileXferServer(Slay2Channel * ctrl, Slay2Channel * data, const char * root = "/");
+   ~FileXferServer();
+   void setDurability(WriteBehindFile::Durability durability); //durability of uploaded files
+   void setListCache(FileXferListCache * cache); //cache of directory listings (may be shared by several servers). NULL = none
+   void addSlot(FileXferServer * slot); //additional transfer slot (on its own channels). it is run by the task of this server
    void task();
+   bool isIdle(); //no transfer in progress and no deferred commands (on all slots)
+   bool hasTxWork(); //task has work to do, that doesn't wait for input (e.g. sending a download). the server has no timers
+   int getFd(); //readable, when a file thread completed (e.g. sync of an upload). the task is to be run then. -1 = none
 
 protected:
 
 private:
    static void onCtrlFrame(void * const obj, const unsigned char * const data, const unsigned int len); //wrapper to forward to member function
    void onCtrlFrame(const unsigned char * const data, const unsigned int len);
+   void execCtrlFrame(const unsigned char * const data, const unsigned int len);
+   void execCtrlQueue();
+   void setNotifyFd(int fd);
+   void flushCtrlQueue();
+   static bool requiresIdle(unsigned char command);
    static void onDataFrame(void * const obj, const unsigned char * const data, const unsigned int len); //wrapper to forward to member function
    void onDataFrame(const unsigned char * const data, const unsigned int len);
 
@@ -62,15 +161,66 @@ private:
 
    bool onLS_Command(bool response = true);
    void execLS_Command();
+   void startListing(std::vector<unsigned char> * output, const std::string& cwd);
+   bool onCHANGES_Command(const char * token);
+   void completeCHANGES_Command();
+   const FileXferSnapshot * findSnapshot(const std::string& dir, unsigned long long token) const;
+   bool onFILTER_Command(const char * args);
+   void filterEntries(size_t first);
+   void completeFILTER_Command();
+   void collectListing();
+   void rejectCollection();
+   void clearCollection();
 
    bool onMKDIR_Command(const char * directory);
    bool onRM_Command(const char * filename);
 
    bool onUPLOAD_Command(const char * filename, unsigned int size);
-   void execUPLOAD_Command(const unsigned char * const data, const unsigned int len);
+   void execUPLOAD_Command(const unsigned char * data, unsigned int len);
+   void completeUPLOAD_Command();
 
-   bool onDOWNLOAD_Command(const char * filename);
+   bool onDOWNLOAD_Command(const char * filename, size_t offset = 0);
    void execDOWNLOAD_Command();
+   bool completeDOWNLOAD_Command();
+   void sendTransferCrc();
+   void sendTransferError(unsigned char command);
+
+   bool onSESSION_Command(const char * args);
+
+   bool onSIZE_Command(const char * filename);
+   bool onRESUME_UPLOAD_Command(const char * filename, size_t offset, unsigned long long size, uint32_t crc);
+   void verifyRESUME_UPLOAD_Command();
+
+   bool onSIGNATURES_Command(const char * filename);
+   void execSIGNATURES_Command();
+   bool onDELTA_UPLOAD_Command(const char * filename, unsigned int blockSize);
+   void execDELTA_UPLOAD_Command(const unsigned char * const data, const unsigned int len);
+   bool onDELTA_DOWNLOAD_Command(const char * filename, unsigned int blockSize, size_t blockCount);
+   void execDELTA_DOWNLOAD_Command();
+   size_t readBasis(size_t offset, unsigned char * buffer, size_t len); //FileXferDeltaTarget
+   void writeTarget(const unsigned char * data, size_t len); //FileXferDeltaTarget
+
+   bool onBUNDLE_DOWNLOAD_Command(const char * directory, bool tree = false);
+   void execBUNDLE_DOWNLOAD_Command();
+   void nextBUNDLE_File();
+   void closeBUNDLE_Directories();
+   bool onBUNDLE_UPLOAD_Command(const char * directory, bool tree = false);
+   void execBUNDLE_UPLOAD_Command(const unsigned char * data, unsigned int len);
+   void checkBUNDLE_UPLOAD_Result(int result);
+   void completeBUNDLE_UPLOAD_Command();
+   bool closeBUNDLE_File();
+   void abortBUNDLE_File();
+   bool beginFile(const std::string& name, unsigned long long size, unsigned long long mtime); //FileXferBundleTarget
+   void writeFile(const unsigned char * data, size_t len); //FileXferBundleTarget
+   void endFile(); //FileXferBundleTarget
+   void createDirectory(const std::string& name); //FileXferBundleTarget
+   bool canBeginFile(); //FileXferBundleTarget
+
+   bool decompress(const unsigned char ** data, unsigned int * len);
+   bool sendOutput(std::vector<unsigned char>& output, unsigned int chunkSize);
+   void sendListing(const unsigned char * data, unsigned int len, bool more = false);
+   std::string makeSystemPath(const char * path) const;
+   std::string makeSystemDirectory(const char * path) const;
 
 
    static const unsigned char ACK;
@@ -80,20 +230,87 @@ private:
    enum
    {
       FILE_XFER_SERVER_STATE_IDLE = 0,       //server is idle. no data-transfer in progress
-      FILE_XFER_SERVER_STATE_LISTING,        //data-transfer in response to LS command
+      FILE_XFER_SERVER_STATE_LISTING,        //data-transfer in response to LS command (or collecting the entries of a listing of changes or filtered listing)
       FILE_XFER_SERVER_STATE_UPLOADING,      //data-transfer in response to UPLOAD command
-      FILE_XFER_SERVER_STATE_DOWNLOADING     //data-transfer in response to DOWNLOAD command
+      FILE_XFER_SERVER_STATE_UPLOAD_SYNCING, //all upload data received. waiting for the data to become durable
+      FILE_XFER_SERVER_STATE_UPLOAD_VERIFYING, //verifying the already stored part of a file, before an upload is resumed
+      FILE_XFER_SERVER_STATE_DOWNLOADING,    //data-transfer in response to DOWNLOAD command
+      FILE_XFER_SERVER_STATE_SIGNING,        //data-transfer in response to SIGNATURES command
+      FILE_XFER_SERVER_STATE_DELTA_UPLOADING, //receiving (and applying) a delta in response to DELTA UPLOAD command
+      FILE_XFER_SERVER_STATE_DELTA_SIGNATURES, //receiving the signatures in response to DELTA DOWNLOAD command
+      FILE_XFER_SERVER_STATE_DELTA_DOWNLOADING, //data-transfer (of the delta) in response to DELTA DOWNLOAD command
+      FILE_XFER_SERVER_STATE_BUNDLE_DOWNLOADING, //data-transfer in response to BUNDLE DOWNLOAD command
+      FILE_XFER_SERVER_STATE_BUNDLE_UPLOADING, //receiving a bundle in response to BUNDLE UPLOAD command (paused while files sync)
+      FILE_XFER_SERVER_STATE_BUNDLE_SYNCING //bundle received. waiting for its last files to become durable
    } state;
 
    std::string rootDir;
    DirectoryNavigator currentDir;
-   DIR * listDirectory;
-   std::string listDir;
-   FILE *uploadFile;
-   unsigned int uploadFileSize;
-   FILE *downloadFile;
-
-
+   FileXferListing listing;    //directory of a listing
+   std::vector<unsigned char> listFrame; //entries of one listing frame
+   FileXferListCache * listCache;
+   FileXferListCache::Listing listCached; //listing served from the cache
+   size_t listCachedOffset;    //number of bytes of that listing sent so far
+   std::string listCacheDir;   //directory of the listing
+   unsigned long listCacheToken; //listing read from the directory is stored into the cache (0 = not)
+   std::vector<unsigned char> listCollect; //listing read from the directory so far
+   unsigned char listCommand;  //CHANGES or FILTER, whose entries are being collected (its response is pending). 0 = none
+   std::vector<FileXferStat> listEntries; //entries collected so far (matching the filter)
+   std::string listCwd;        //working directory of that listing
+   unsigned long long listToken; //change token of the request (0 = none)
+   unsigned long listVersion;  //version of the directory within the listing cache, before it was read (0 = unknown)
+   FileXferListFilter listFilter;
+   regex_t listRegex;          //pattern of that filter, if it is a regular expression
+   bool listRegexUsed;
+   size_t listMatches;         //number of entries matching the filter so far
+   std::deque<FileXferSnapshot> snapshots; //listings, the recent change tokens refer to (used by the session only)
+   unsigned long long snapshotToken; //last change token issued (used by the session only)
+   WriteBehindFile uploadFile;
+   WriteBehindFile::Durability uploadDurability;
+   unsigned long long uploadFileSize; //number of bytes of the upload, not received yet
+   std::string uploadFileName;
+   ReadAheadFile resumeFile;   //already stored part of a resumed upload
+   size_t resumeOffset;        //size of that part (number of bytes to verify)
+   size_t resumeVerified;      //number of bytes verified so far
+   uint32_t resumeCrc;         //CRC-32C of the verified bytes
+   uint32_t resumeExpectedCrc; //CRC-32C expected by the client
+   ReadAheadFile downloadFile; //file of a download or bundle download. read ahead by a reader thread
+   size_t downloadOffset;
+   bool transferHashed;        //the CRC of the up- or download is reported on completion (integrity check negotiated)
+   uint32_t transferCrc;       //CRC-32C of the (original) data received or sent so far
+   FileXferChunkPolicy dataChunking;
+   unsigned int sessionFeatures; //features agreed within the session
+   FileXferEncoder dataEncoder;  //compression of listing and download data
+   FileXferDecoder dataDecoder;  //decompression of upload data
+   std::vector<unsigned char> listBuffer; //listing data, not yet compressed
+   size_t outputSent;            //number of bytes of the pending output (compressed data, signatures or delta) sent so far
+   MappedFile deltaFile;       //file to sign, basis of a delta upload, or file to be sent as delta
+   size_t deltaOffset;         //number of bytes of that file processed so far
+   size_t deltaEnd;            //number of bytes of that file to process
+   std::string deltaTempName;  //file written by a delta upload. renamed to "uploadFileName" on success
+   FileXferSignatureBuilder deltaSignatures;
+   FileXferDeltaGenerator deltaGenerator;
+   FileXferDeltaApplier deltaApplier;
+   std::string bundleDir;      //(root) directory of the files of a bundle
+   bool bundleTree;            //bundle download includes sub-directories
+   std::vector<DIR *> bundleDirectories; //directories of a bundle download, being read (the current one is the last)
+   std::vector<std::string> bundlePaths; //their path, relative to "bundleDir"
+   std::vector<std::unique_ptr<WriteBehindFile> > bundleFiles; //files of bundle uploads (allocated on demand, reused)
+   std::vector<WriteBehindFile *> bundleSpares; //of these, the ones not in use
+   WriteBehindFile * bundleFile; //file currently received by a bundle upload (NULL, if none)
+   std::string bundleFileName; //its name
+   unsigned long long bundleFileTime; //its modification time
+   std::deque<FileXferBundleClose> bundleCloses; //files received completely, being synced (oldest first)
+   bool bundleFailed;          //any file of the bundle upload couldn't be stored
+   FileXferBundleWriter bundleWriter;
+   FileXferBundleReader bundleReader;
+
+
+   std::deque< std::vector<unsigned char> > ctrlQueue; //control frames deferred, until the server is idle
+   FileXferServer * session;   //server owning the session (working directory). this, unless it is a slot of another server
+   int eventFd;                //eventfd of this server
+   int notifyFd;               //eventfd, signaled by the threads of the files. the one of the session (see getFd)
+   std::vector<FileXferServer *> slots; //additional transfer slots
    Slay2Channel * ctrlChannel;
    Slay2Channel * dataChannel;
 
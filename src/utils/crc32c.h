@@ -0,0 +1,41 @@
+//-----------------------------------------------------------------------------
+/*!
+   \file
+   \brief CRC-32C (Castagnoli) checksum
+
+   Incremental usage:
+      crc = 0;
+      crc = crc32c(crc, chunk1, len1);
+      crc = crc32c(crc, chunk2, len2);
+*/
+//-----------------------------------------------------------------------------
+#ifndef CRC32C_H_
+#define CRC32C_H_
+
+/* -- Includes ------------------------------------------------------------ */
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* -- Defines ------------------------------------------------------------- */
+
+/* -- Types --------------------------------------------------------------- */
+
+/* -- Global Variables ---------------------------------------------------- */
+
+/* -- Function Prototypes ------------------------------------------------- */
+uint32_t crc32c(uint32_t crc, const void * data, size_t len);
+
+
+/* -- Implementation ------------------------------------------------------ */
+
+
+
+#ifdef __cplusplus
+} /* end of extern "C" */
+#endif
+
+#endif
@@ -0,0 +1,231 @@
+//-----------------------------------------------------------------------------
+/*!
+   \file
+   \brief LZ4 block compression
+
+   Greedy matching, using a hash table of the positions of the last 4-byte sequences.
+   Block format (per sequence):
+      token:          upper 4 bits literal length, lower 4 bits match length - 4 (15: more length bytes follow)
+      [literal length bytes of 255 ... last byte < 255]
+      literals
+      offset:         16 bits, little endian (missing in the last sequence)
+      [match length bytes of 255 ... last byte < 255]
+   The last 5 bytes of a block are always literals. The last match starts at least 12 bytes before the end.
+*/
+//-----------------------------------------------------------------------------
+
+/* -- Includes ------------------------------------------------------------ */
+#include <string.h>
+#include "lz4block.h"
+
+
+/* -- Defines ------------------------------------------------------------- */
+#define LZ4BLOCK_HASH_BITS    (12)
+#define LZ4BLOCK_MIN_MATCH    (4)
+#define LZ4BLOCK_LAST_LITERALS (5)
+#define LZ4BLOCK_MF_LIMIT     (12)
+
+
+/* -- Types --------------------------------------------------------------- */
+
+
+/* -- Module Global Function Prototypes ----------------------------------- */
+static uint32_t lz4block_read32(const uint8_t * p);
+static uint32_t lz4block_hash(uint32_t sequence);
+static size_t lz4block_putLength(uint8_t * dst, size_t len);
+
+
+/* -- Module Global Variables --------------------------------------------- */
+
+
+/* -- Implementation ------------------------------------------------------ */
+
+size_t lz4blockCompress(const uint8_t * src, size_t srcLen, uint8_t * dst, size_t dstCapacity)
+{
+   uint16_t table[1 << LZ4BLOCK_HASH_BITS]; /* positions within src */
+   size_t ip = 0;
+   size_t anchor = 0; /* start of pending literals */
+   size_t op = 0;
+   size_t lit;
+
+   if (srcLen > LZ4BLOCK_INPUT_MAX)
+   {
+      return 0;
+   }
+   memset(table, 0, sizeof(table));
+
+   if (srcLen > LZ4BLOCK_MF_LIMIT)
+   {
+      const size_t mfLimit = srcLen - LZ4BLOCK_MF_LIMIT;
+      const size_t matchLimit = srcLen - LZ4BLOCK_LAST_LITERALS;
+      ip = 1;
+      while (ip < mfLimit)
+      {
+         const uint32_t sequence = lz4block_read32(&src[ip]);
+         const uint32_t h = lz4block_hash(sequence);
+         size_t ref = table[h];
+         size_t len;
+         table[h] = (uint16_t)ip;
+         if ((ref >= ip) || (lz4block_read32(&src[ref]) != sequence))
+         {
+            ip += 1 + ((ip - anchor) >> 6); /* skip faster through incompressible data */
+            continue;
+         }
+
+         /* extend match backwards and forwards */
+         while ((ip > anchor) && (ref > 0) && (src[ip - 1] == src[ref - 1]))
+         {
+            --ip;
+            --ref;
+         }
+         len = LZ4BLOCK_MIN_MATCH;
+         while (((ip + len) < matchLimit) && (src[ref + len] == src[ip + len]))
+         {
+            ++len;
+         }
+
+         /* emit sequence. check worst case size first */
+         lit = ip - anchor;
+         if ((op + 1 + (lit / 255) + 1 + lit + 2 + (len / 255) + 1) > dstCapacity)
+         {
+            return 0;
+         }
+         dst[op++] = (uint8_t)(((lit < 15) ? lit : 15) << 4) | (uint8_t)(((len - LZ4BLOCK_MIN_MATCH) < 15) ? (len - LZ4BLOCK_MIN_MATCH) : 15);
+         if (lit >= 15)
+         {
+            op += lz4block_putLength(&dst[op], lit - 15);
+         }
+         memcpy(&dst[op], &src[anchor], lit);
+         op += lit;
+         dst[op++] = (uint8_t)(ip - ref);
+         dst[op++] = (uint8_t)((ip - ref) >> 8);
+         if ((len - LZ4BLOCK_MIN_MATCH) >= 15)
+         {
+            op += lz4block_putLength(&dst[op], len - LZ4BLOCK_MIN_MATCH - 15);
+         }
+         ip += len;
+         anchor = ip;
+         if (ip < mfLimit)
+         {
+            table[lz4block_hash(lz4block_read32(&src[ip - 2]))] = (uint16_t)(ip - 2);
+         }
+      }
+   }
+
+   /* last literals */
+   lit = srcLen - anchor;
+   if ((op + 1 + (lit / 255) + 1 + lit) > dstCapacity)
+   {
+      return 0;
+   }
+   dst[op++] = (uint8_t)(((lit < 15) ? lit : 15) << 4);
+   if (lit >= 15)
+   {
+      op += lz4block_putLength(&dst[op], lit - 15);
+   }
+   memcpy(&dst[op], &src[anchor], lit);
+   op += lit;
+   return op;
+}
+
+
+long lz4blockDecompress(const uint8_t * src, size_t srcLen, uint8_t * dst, size_t dstCapacity)
+{
+   size_t ip = 0;
+   size_t op = 0;
+   while (ip < srcLen)
+   {
+      const uint8_t token = src[ip++];
+      size_t lit = token >> 4;
+      size_t len = token & 15;
+      size_t offset;
+      uint8_t b;
+
+      /* literals */
+      if (lit == 15)
+      {
+         do
+         {
+            if (ip >= srcLen)
+            {
+               return -1;
+            }
+            b = src[ip++];
+            lit += b;
+         } while (b == 255);
+      }
+      if ((lit > (srcLen - ip)) || (lit > (dstCapacity - op)))
+      {
+         return -1;
+      }
+      memcpy(&dst[op], &src[ip], lit);
+      ip += lit;
+      op += lit;
+      if (ip == srcLen)
+      {
+         break; /* last sequence has no match */
+      }
+
+      /* match */
+      if ((srcLen - ip) < 2)
+      {
+         return -1;
+      }
+      offset = src[ip] | ((size_t)src[ip + 1] << 8);
+      ip += 2;
+      if ((offset == 0) || (offset > op))
+      {
+         return -1;
+      }
+      if (len == 15)
+      {
+         do
+         {
+            if (ip >= srcLen)
+            {
+               return -1;
+            }
+            b = src[ip++];
+            len += b;
+         } while (b == 255);
+      }
+      len += LZ4BLOCK_MIN_MATCH;
+      if (len > (dstCapacity - op))
+      {
+         return -1;
+      }
+      for (; len > 0; --len, ++op) /* byte by byte, as source and destination may overlap */
+      {
+         dst[op] = dst[op - offset];
+      }
+   }
+   return (long)op;
+}
+
+
+static uint32_t lz4block_read32(const uint8_t * p)
+{
+   uint32_t value;
+   memcpy(&value, p, sizeof(value));
+   return value;
+}
+
+
+static uint32_t lz4block_hash(uint32_t sequence)
+{
+   return (sequence * 2654435761u) >> (32 - LZ4BLOCK_HASH_BITS);
+}
+
+
+/* encode the remainder of a length (beyond 15) as a sequence of bytes */
+static size_t lz4block_putLength(uint8_t * dst, size_t len)
+{
+   size_t n = 0;
+   while (len >= 255)
+   {
+      dst[n++] = 255;
+      len -= 255;
+   }
+   dst[n++] = (uint8_t)len;
+   return n;
+}
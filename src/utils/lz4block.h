@@ -0,0 +1,46 @@
+//-----------------------------------------------------------------------------
+/*!
+   \file
+   \brief LZ4 block compression
+
+   Fast LZ (byte oriented) compression. The compressed data is in LZ4 "block format"
+   (a sequence of literal runs and back references). Blocks are independent of each other.
+   Block size is limited to LZ4BLOCK_INPUT_MAX (back reference offsets are 16 bits).
+*/
+//-----------------------------------------------------------------------------
+#ifndef LZ4BLOCK_H_
+#define LZ4BLOCK_H_
+
+/* -- Includes ------------------------------------------------------------ */
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* -- Defines ------------------------------------------------------------- */
+#define LZ4BLOCK_INPUT_MAX       (65535)
+#define LZ4BLOCK_BOUND(len)      ((len) + ((len) / 255) + 16) /* worst case size of compressed data */
+
+
+/* -- Types --------------------------------------------------------------- */
+
+/* -- Global Variables ---------------------------------------------------- */
+
+/* -- Function Prototypes ------------------------------------------------- */
+/* returns size of compressed data. 0, if it doesn't fit into dst (or src is too big) */
+size_t lz4blockCompress(const uint8_t * src, size_t srcLen, uint8_t * dst, size_t dstCapacity);
+/* returns size of decompressed data. -1, if src is invalid or doesn't fit into dst */
+long lz4blockDecompress(const uint8_t * src, size_t srcLen, uint8_t * dst, size_t dstCapacity);
+
+
+/* -- Implementation ------------------------------------------------------ */
+
+
+
+#ifdef __cplusplus
+} /* end of extern "C" */
+#endif
+
+#endif
@@ -0,0 +1,63 @@
+//---------------------------------------------------------------------------------------------------------------------
+/*!
+   \file
+   \brief Memory mapped (read-only) file
+
+   The file is mapped through a sliding window. So even "huge" files can be accessed on systems with a
+   small (32-bit) address space. Slices returned by map() point directly into the page cache. No copy is made.
+   If the file is truncated while it is open, the size shrinks accordingly (checked on each map()). So no page
+   beyond the end of file is accessed (which would raise SIGBUS), unless it is truncated while a slice is in use.
+*/
+//---------------------------------------------------------------------------------------------------------------------
+#ifndef MAPFILE_H
+#define MAPFILE_H
+
+/* -- Includes ------------------------------------------------------------ */
+#include <stddef.h>
+#include <string>
+
+
+/* -- Defines ------------------------------------------------------------- */
+#define MAPFILE_WINDOW_SIZE   (1024 * 1024) //size of the mapping window (in bytes)
+
+
+/* -- Types --------------------------------------------------------------- */
+
+/* -- Global Variables ---------------------------------------------------- */
+
+/* -- Function Prototypes ------------------------------------------------- */
+
+
+/* -- Implementation ------------------------------------------------------ */
+
+class MappedFile
+{
+public:
+   MappedFile();
+   ~MappedFile();
+
+   bool open(const std::string& path);
+   void close();
+   bool isOpen() const;
+   size_t getSize() const;
+
+   //get a pointer to the file content at "offset". on input "len" is the number of requested bytes.
+   //on output "len" is the number of bytes available at the returned pointer (may be less then requested).
+   //returns NULL on error or if offset is beyond end of file (the file may have been truncated, see getSize)
+   const unsigned char * map(size_t offset, size_t * len);
+
+private:
+   MappedFile(const MappedFile&); //not copyable
+   MappedFile& operator=(const MappedFile&);
+   void unmap();
+
+   int fd;
+   size_t size;
+   unsigned char * window;
+   size_t windowOffset;
+   size_t windowLength;
+};
+
+
+
+#endif
@@ -0,0 +1,158 @@
+//-----------------------------------------------------------------------------
+/*!
+   \file
+   \brief Memory mapped (read-only) file
+*/
+//-----------------------------------------------------------------------------
+
+/* -- Includes ------------------------------------------------------------ */
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "mapfile.h"
+
+
+/* -- Defines ------------------------------------------------------------- */
+using namespace std;
+
+
+/* -- Types --------------------------------------------------------------- */
+
+/* -- (Module) Global Variables ------------------------------------------- */
+
+/* -- Module Global Function Prototypes ----------------------------------- */
+
+/* -- Implementation ------------------------------------------------------ */
+
+
+
+MappedFile::MappedFile()
+{
+   fd = -1;
+   size = 0;
+   window = NULL;
+   windowOffset = 0;
+   windowLength = 0;
+}
+
+
+MappedFile::~MappedFile()
+{
+   close();
+}
+
+
+//open file for (mapped) reading. only regular files can be mapped!
+bool MappedFile::open(const string& path)
+{
+   struct stat fileStat;
+
+   close(); //close a previously opened file (if any)
+   fd = ::open(path.c_str(), O_RDONLY);
+   if (fd < 0)
+   {
+      return false;
+   }
+   if ((fstat(fd, &fileStat) != 0) || !S_ISREG(fileStat.st_mode))
+   {
+      close();
+      return false;
+   }
+   size = fileStat.st_size;
+   posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL); //let the kernel do aggressive read-ahead
+   return true;
+}
+
+
+void MappedFile::close()
+{
+   unmap();
+   if (fd >= 0)
+   {
+      ::close(fd);
+      fd = -1;
+   }
+   size = 0;
+}
+
+
+bool MappedFile::isOpen() const
+{
+   return (fd >= 0);
+}
+
+
+size_t MappedFile::getSize() const
+{
+   return size;
+}
+
+
+const unsigned char * MappedFile::map(size_t offset, size_t * len)
+{
+   struct stat fileStat;
+
+   //the file may have been truncated (by someone else) in the meantime. accessing a mapped page beyond its end
+   //raises SIGBUS. so check the size before each access, and never map beyond the current end
+   if ((fd < 0) || (fstat(fd, &fileStat) != 0))
+   {
+      *len = 0;
+      return NULL;
+   }
+   if ((size_t)fileStat.st_size < size)
+   {
+      size = fileStat.st_size;
+   }
+   if (offset >= size)
+   {
+      *len = 0;
+      return NULL;
+   }
+
+   //slide window, if offset is outside the current one
+   if ((window == NULL) || (offset < windowOffset) || (offset >= (windowOffset + windowLength)))
+   {
+      const size_t pageSize = sysconf(_SC_PAGESIZE);
+      unmap();
+      windowOffset = offset - (offset % pageSize); //mapping must start at a page boundary
+      windowLength = size - windowOffset;
+      if (windowLength > MAPFILE_WINDOW_SIZE)
+      {
+         windowLength = MAPFILE_WINDOW_SIZE;
+      }
+      void * mem = mmap(NULL, windowLength, PROT_READ, MAP_SHARED, fd, windowOffset);
+      if (mem == MAP_FAILED)
+      {
+         windowLength = 0;
+         *len = 0;
+         return NULL;
+      }
+      window = (unsigned char *)mem;
+      madvise(window, windowLength, MADV_SEQUENTIAL); //pages are read ahead, and dropped after use
+   }
+
+   //limit to the end of the window (and to the end of a truncated file)
+   size_t available = (windowOffset + windowLength) - offset;
+   if (available > (size - offset))
+   {
+      available = size - offset;
+   }
+   if (*len > available)
+   {
+      *len = available;
+   }
+   return &window[offset - windowOffset];
+}
+
+
+void MappedFile::unmap()
+{
+   if (window != NULL)
+   {
+      munmap(window, windowLength);
+      window = NULL;
+   }
+   windowOffset = 0;
+   windowLength = 0;
+}
@@ -0,0 +1,94 @@
+//---------------------------------------------------------------------------------------------------------------------
+/*!
+   \file
+   \brief Read-ahead file
+
+   The file is read sequentially by a dedicated reader thread into a bounded ring of large (page aligned) blocks,
+   ahead of the caller. The caller only takes blocks, that are ready. So the caller isn't blocked by slow storage
+   (USB sticks, network file systems), as long as the reader keeps up with it.
+
+   Reading starts at the offset of the first access. An access before the blocks in the ring (or beyond the
+   block being read) restarts the reader at that offset. Blocks before the offset of an access are released.
+   The reader thread is started on first open, and kept for further files (e.g. the files of a bundle).
+   Each block read can be signaled on an eventfd (see setNotifyFd). So an event loop can wait for it, instead of
+   polling isReady.
+*/
+//---------------------------------------------------------------------------------------------------------------------
+#ifndef READAHEAD_H
+#define READAHEAD_H
+
+/* -- Includes ------------------------------------------------------------ */
+#include <stddef.h>
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+
+/* -- Defines ------------------------------------------------------------- */
+#define READAHEAD_BLOCK_SIZE        (64 * 1024)          //size of one block of the ring (in bytes)
+#define READAHEAD_BLOCK_COUNT       (4)                  //number of blocks in the ring
+
+
+/* -- Types --------------------------------------------------------------- */
+
+/* -- Global Variables ---------------------------------------------------- */
+
+/* -- Function Prototypes ------------------------------------------------- */
+
+
+/* -- Implementation ------------------------------------------------------ */
+
+class ReadAheadFile
+{
+public:
+   ReadAheadFile();
+   ~ReadAheadFile();
+
+   bool open(const std::string& path);
+   void close();
+   bool isOpen() const;
+   size_t getSize() const;
+
+   //check if the data at "offset" is available. so map() doesn't block. starts reading at "offset" (if not yet done).
+   //also true on read error or if offset is beyond end of file (map returns NULL then)
+   bool isReady(size_t offset);
+
+   //get a pointer to the file content at "offset". on input "len" is the number of requested bytes.
+   //on output "len" is the number of bytes available at the returned pointer (may be less then requested).
+   //blocks, until the data was read. returns NULL on error or if offset is beyond end of file.
+   //the pointer is valid until the next call of map, isReady or close
+   const unsigned char * map(size_t offset, size_t * len);
+
+   void setNotifyFd(int fd); //eventfd to be signaled, when a block was read (or failed to be read). -1: none
+
+private:
+   ReadAheadFile(const ReadAheadFile&); //not copyable
+   ReadAheadFile& operator=(const ReadAheadFile&);
+   bool seek(size_t offset); //release blocks before offset. restart reader, if needed. true if offset is within the ring
+   void reader(); //reader thread
+
+   int fd;
+   int notifyFd;
+   size_t size;
+   std::vector<unsigned char *> blocks;
+   std::vector<size_t> blockOffset;
+   std::vector<size_t> blockLength;
+   unsigned int head;      //next block to be read by the reader thread
+   unsigned int tail;      //oldest block in the ring (used by the caller)
+   unsigned int count;     //number of blocks, that were read
+   size_t readOffset;      //next offset to be read by the reader thread
+   unsigned long generation; //incremented on restart. a block read for an older generation is dropped
+   bool reading;           //reader thread is reading a block (the fd is in use)
+   bool error;
+   bool aborting;
+   std::thread thread;
+   std::mutex ringMutex;
+   std::condition_variable blockReady;
+   std::condition_variable blockNeeded;
+};
+
+
+
+#endif
@@ -0,0 +1,286 @@
+//-----------------------------------------------------------------------------
+/*!
+   \file
+   \brief Read-ahead file
+*/
+//-----------------------------------------------------------------------------
+
+/* -- Includes ------------------------------------------------------------ */
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "readahead.h"
+
+
+/* -- Defines ------------------------------------------------------------- */
+using namespace std;
+
+
+/* -- Types --------------------------------------------------------------- */
+
+/* -- (Module) Global Variables ------------------------------------------- */
+
+/* -- Module Global Function Prototypes ----------------------------------- */
+
+/* -- Implementation ------------------------------------------------------ */
+
+
+
+ReadAheadFile::ReadAheadFile()
+{
+   fd = -1;
+   notifyFd = -1;
+   size = 0;
+   head = 0;
+   tail = 0;
+   count = 0;
+   readOffset = 0;
+   generation = 0;
+   reading = false;
+   error = false;
+   aborting = false;
+}
+
+
+ReadAheadFile::~ReadAheadFile()
+{
+   close();
+   {
+      lock_guard<mutex> lock(ringMutex);
+      aborting = true;
+      blockNeeded.notify_one();
+   }
+   if (thread.joinable())
+   {
+      thread.join();
+   }
+   for (size_t i = 0; i < blocks.size(); ++i)
+   {
+      free(blocks[i]);
+   }
+}
+
+
+//open file for reading. only regular files can be read ahead!
+//the reader thread starts reading at offset 0 (see isReady)
+bool ReadAheadFile::open(const string& path)
+{
+   struct stat fileStat;
+
+   close(); //close a previously opened file (if any)
+
+   //allocate the ring (only once). blocks are page aligned
+   while (blocks.size() < READAHEAD_BLOCK_COUNT)
+   {
+      void * block = NULL;
+      if (posix_memalign(&block, sysconf(_SC_PAGESIZE), READAHEAD_BLOCK_SIZE) != 0)
+      {
+         return false;
+      }
+      blocks.push_back((unsigned char *)block);
+      blockOffset.push_back(0);
+      blockLength.push_back(0);
+   }
+
+   const int file = ::open(path.c_str(), O_RDONLY);
+   if (file < 0)
+   {
+      return false;
+   }
+   if ((fstat(file, &fileStat) != 0) || !S_ISREG(fileStat.st_mode))
+   {
+      ::close(file);
+      return false;
+   }
+   posix_fadvise(file, 0, 0, POSIX_FADV_SEQUENTIAL); //let the kernel do aggressive read-ahead as well
+
+   lock_guard<mutex> lock(ringMutex);
+   fd = file;
+   size = fileStat.st_size;
+   head = tail;
+   count = 0;
+   readOffset = 0;
+   error = false;
+   ++generation;
+   if (!thread.joinable())
+   {
+      thread = std::thread(&ReadAheadFile::reader, this);
+   }
+   blockNeeded.notify_one();
+   return true;
+}
+
+
+//stop reading (wait for a pending read of the reader thread) and close the file
+void ReadAheadFile::close()
+{
+   unique_lock<mutex> lock(ringMutex);
+   ++generation;
+   count = 0;
+   head = tail;
+   while (reading)
+   {
+      blockReady.wait(lock);
+   }
+   if (fd >= 0)
+   {
+      ::close(fd);
+      fd = -1;
+   }
+   size = 0;
+   readOffset = 0;
+}
+
+
+bool ReadAheadFile::isOpen() const
+{
+   return (fd >= 0);
+}
+
+
+size_t ReadAheadFile::getSize() const
+{
+   return size;
+}
+
+
+bool ReadAheadFile::isReady(size_t offset)
+{
+   lock_guard<mutex> lock(ringMutex);
+   return (fd < 0) || (offset >= size) || seek(offset) || error;
+}
+
+
+const unsigned char * ReadAheadFile::map(size_t offset, size_t * len)
+{
+   unique_lock<mutex> lock(ringMutex);
+   if ((fd < 0) || (offset >= size))
+   {
+      *len = 0;
+      return NULL;
+   }
+
+   //wait for the block at offset
+   while (!seek(offset) && !error)
+   {
+      blockReady.wait(lock);
+   }
+   if (count == 0) //read error
+   {
+      *len = 0;
+      return NULL;
+   }
+
+   //limit to the end of the block
+   const size_t available = (blockOffset[tail] + blockLength[tail]) - offset;
+   if (*len > available)
+   {
+      *len = available;
+   }
+   return &blocks[tail][offset - blockOffset[tail]];
+}
+
+
+void ReadAheadFile::setNotifyFd(int fd)
+{
+   lock_guard<mutex> lock(ringMutex);
+   notifyFd = fd;
+}
+
+
+//to be called with locked ring
+bool ReadAheadFile::seek(size_t offset)
+{
+   //release blocks before offset
+   while ((count > 0) && (offset >= (blockOffset[tail] + blockLength[tail])))
+   {
+      tail = (tail + 1) % READAHEAD_BLOCK_COUNT;
+      --count;
+      blockNeeded.notify_one();
+   }
+   if ((count > 0) && (offset >= blockOffset[tail]))
+   {
+      return true; //offset is within the oldest block
+   }
+
+   //restart reader at offset, unless it is about to read it
+   if ((count > 0) || (offset != readOffset))
+   {
+      ++generation;
+      count = 0;
+      head = tail;
+      readOffset = offset;
+      error = false;
+      blockNeeded.notify_one();
+   }
+   return false;
+}
+
+
+void ReadAheadFile::reader()
+{
+   unique_lock<mutex> lock(ringMutex);
+   while (true)
+   {
+      //wait for a free block (and something to read)
+      while (!aborting && ((fd < 0) || error || (readOffset >= size) || (count == READAHEAD_BLOCK_COUNT)))
+      {
+         blockNeeded.wait(lock);
+      }
+      if (aborting)
+      {
+         break;
+      }
+
+      //read block "head". the block is owned by the reader until count is incremented
+      const unsigned long readGeneration = generation;
+      const unsigned int idx = head;
+      const size_t offset = readOffset;
+      size_t len = size - offset;
+      if (len > READAHEAD_BLOCK_SIZE)
+      {
+         len = READAHEAD_BLOCK_SIZE;
+      }
+      size_t done = 0;
+      bool failed = false;
+      reading = true;
+      lock.unlock();
+      while ((done < len) && !failed)
+      {
+         ssize_t n = pread(fd, &blocks[idx][done], len - done, offset + done);
+         if (n < 0)
+         {
+            failed = (errno != EINTR);
+            continue;
+         }
+         failed = (n == 0); //file was truncated
+         done += n;
+      }
+      lock.lock();
+      reading = false;
+      if (readGeneration == generation) //no restart (or close) in between
+      {
+         if (failed)
+         {
+            error = true;
+         }
+         else
+         {
+            blockOffset[idx] = offset;
+            blockLength[idx] = len;
+            head = (head + 1) % READAHEAD_BLOCK_COUNT;
+            ++count;
+            readOffset += len;
+         }
+         if (notifyFd >= 0)
+         {
+            const uint64_t increment = 1;
+            ::write(notifyFd, &increment, sizeof(increment));
+         }
+      }
+      blockReady.notify_all();
+   }
+}
@@ -0,0 +1,135 @@
+//---------------------------------------------------------------------------------------------------------------------
+/*!
+   \file
+   \brief Lock-free single-producer/single-consumer ring of frames
+
+   Frames are pushed by one thread (e.g. the receive callback of a slay2 channel) and taken by another one (e.g. the
+   task of a file transfer client), without any lock. Each frame is stored contiguously, with its length in front
+   and a zero termination behind (like a received slay2 frame). A frame, that doesn't fit before the end of the
+   ring, is stored at its start (a wrap marker tells the consumer to skip the rest). Empty frames aren't stored.
+
+   The write position (head) is only changed by the producer, the read position (tail) only by the consumer.
+   Both are byte counters, that just increase. The producer publishes a frame by storing head (release), after
+   the frame was written. The consumer releases a frame by storing tail (release), after it was processed.
+*/
+//---------------------------------------------------------------------------------------------------------------------
+#ifndef SPSCRING_H
+#define SPSCRING_H
+
+/* -- Includes ------------------------------------------------------------ */
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <atomic>
+
+
+/* -- Defines ------------------------------------------------------------- */
+#define SPSCRING_ALIGN        (sizeof(uint32_t)) //frames are aligned to their length field
+#define SPSCRING_WRAP         (0xFFFFFFFFu)      //length of the wrap marker
+#define SPSCRING_CACHE_LINE   (64)               //size of a cache line (in bytes)
+
+
+/* -- Types --------------------------------------------------------------- */
+
+/* -- Global Variables ---------------------------------------------------- */
+
+/* -- Function Prototypes ------------------------------------------------- */
+
+
+/* -- Implementation ------------------------------------------------------ */
+
+template <size_t SIZE>
+class SpscFrameRing
+{
+public:
+   SpscFrameRing()
+   {
+      head.store(0);
+      tail.store(0);
+   }
+
+   //producer: append a frame. returns false, if there isn't enough space (the frame is dropped). an empty frame
+   //is rejected: it couldn't be told from an empty ring (see top)
+   bool push(const unsigned char * data, unsigned int len)
+   {
+      if (len == 0)
+      {
+         return false;
+      }
+      const size_t h = head.load(std::memory_order_relaxed);
+      const size_t t = tail.load(std::memory_order_acquire);
+      const size_t need = getFrameSize(len);
+      size_t offset = h % CAPACITY;
+      const size_t skip = (need > (CAPACITY - offset)) ? (CAPACITY - offset) : 0; //rest of the ring, if the frame doesn't fit
+      if ((need + skip) > (CAPACITY - (h - t)))
+      {
+         return false;
+      }
+      if (skip != 0)
+      {
+         const uint32_t marker = SPSCRING_WRAP;
+         memcpy(&buffer[offset], &marker, sizeof(marker));
+         offset = 0;
+      }
+      const uint32_t length = len;
+      memcpy(&buffer[offset], &length, sizeof(length));
+      memcpy(&buffer[offset + sizeof(length)], data, len);
+      buffer[offset + sizeof(length) + len] = 0; //zero terminate
+      head.store(h + skip + need, std::memory_order_release);
+      return true;
+   }
+
+   //check for frames (consumer or producer)
+   bool isEmpty() const
+   {
+      return tail.load(std::memory_order_acquire) == head.load(std::memory_order_acquire);
+   }
+
+   //consumer: get the oldest frame (zero terminated). returns its length, 0 if the ring is empty.
+   //the frame stays valid until pop
+   unsigned int top(unsigned char ** data)
+   {
+      size_t t = tail.load(std::memory_order_relaxed);
+      if (t == head.load(std::memory_order_acquire))
+      {
+         return 0;
+      }
+      uint32_t length;
+      memcpy(&length, &buffer[t % CAPACITY], sizeof(length));
+      if (length == SPSCRING_WRAP) //frame is at the start of the ring (published together with the marker)
+      {
+         t += CAPACITY - (t % CAPACITY);
+         tail.store(t, std::memory_order_release);
+         memcpy(&length, &buffer[0], sizeof(length));
+      }
+      *data = &buffer[(t % CAPACITY) + sizeof(length)];
+      return length;
+   }
+
+   //consumer: drop the oldest frame (returned by top)
+   void pop()
+   {
+      const size_t t = tail.load(std::memory_order_relaxed);
+      uint32_t length;
+      memcpy(&length, &buffer[t % CAPACITY], sizeof(length));
+      tail.store(t + getFrameSize(length), std::memory_order_release);
+   }
+
+private:
+   static const size_t CAPACITY = ((SIZE + SPSCRING_ALIGN - 1) / SPSCRING_ALIGN) * SPSCRING_ALIGN;
+
+   //length field, data and zero termination. aligned
+   static size_t getFrameSize(size_t len)
+   {
+      return ((sizeof(uint32_t) + len + 1 + SPSCRING_ALIGN - 1) / SPSCRING_ALIGN) * SPSCRING_ALIGN;
+   }
+
+   alignas(SPSCRING_ALIGN) unsigned char buffer[CAPACITY];
+   std::atomic<size_t> head;     //written by the producer
+   char padding[SPSCRING_CACHE_LINE]; //head and tail on different cache lines
+   std::atomic<size_t> tail;     //written by the consumer
+};
+
+
+
+#endif
@@ -0,0 +1,103 @@
+//---------------------------------------------------------------------------------------------------------------------
+/*!
+   \file
+   \brief Write-behind file
+
+   Data written to the file is collected in a bounded ring of large (page aligned) blocks. A dedicated
+   writer thread drains the ring into the file. So the caller isn't blocked by slow storage (SD cards,
+   USB sticks), as long as there are free blocks in the ring.
+
+   Durability modes:
+   - NONE: data is handed over to the OS. No sync at all.
+   - FSYNC_AT_END: the file is synced once, when all data was written.
+   - FSYNC_PERIODIC: like FSYNC_AT_END, but additionally synced every WRITEBEHIND_SYNC_PERIOD bytes.
+
+   Completion of finish can be signaled on an eventfd (see setNotifyFd). So an event loop can wait for it, instead
+   of polling isFinished.
+*/
+//---------------------------------------------------------------------------------------------------------------------
+#ifndef WRITEBEHIND_H
+#define WRITEBEHIND_H
+
+/* -- Includes ------------------------------------------------------------ */
+#include <stddef.h>
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+
+/* -- Defines ------------------------------------------------------------- */
+#define WRITEBEHIND_BLOCK_SIZE      (64 * 1024)          //size of one block of the ring (in bytes)
+#define WRITEBEHIND_BLOCK_COUNT     (8)                  //number of blocks in the ring
+#define WRITEBEHIND_SYNC_PERIOD     (4 * 1024 * 1024)    //sync period for FSYNC_PERIODIC mode (in bytes)
+
+
+/* -- Types --------------------------------------------------------------- */
+
+/* -- Global Variables ---------------------------------------------------- */
+
+/* -- Function Prototypes ------------------------------------------------- */
+
+
+/* -- Implementation ------------------------------------------------------ */
+
+class WriteBehindFile
+{
+public:
+   typedef enum
+   {
+      DURABILITY_NONE = 0,
+      DURABILITY_FSYNC_AT_END,
+      DURABILITY_FSYNC_PERIODIC
+   } Durability;
+
+   WriteBehindFile();
+   ~WriteBehindFile();
+
+   bool open(const std::string& path, Durability durability = DURABILITY_NONE, size_t offset = 0);
+   bool isOpen() const;
+   void write(const unsigned char * data, size_t len); //blocks, if there is no free block in the ring
+
+   //write without copying: get the free part of the current block (at least one byte), to be filled by the caller.
+   //then hand over the filled bytes by commit. full blocks are written (page aligned) by the writer thread.
+   //returns NULL, if aborted
+   unsigned char * getBuffer(size_t * len);
+   void commit(size_t len); //blocks, if there is no free block in the ring
+   void finish(); //no more data. flush remaining data and sync according to durability mode
+   bool isFinished(bool * ok); //check if finish has completed. "ok" is false, if any write/sync failed
+   bool wait(); //block until finish has completed. returns false, if any write/sync failed
+   void close(); //to be called, after finish has completed
+   void abort(); //discard pending data and close file
+   void setNotifyFd(int fd); //eventfd to be signaled, when finish has completed (-1: none)
+
+private:
+   WriteBehindFile(const WriteBehindFile&); //not copyable
+   WriteBehindFile& operator=(const WriteBehindFile&);
+   void writer(); //writer thread
+   void handOver(std::unique_lock<std::mutex>& lock); //pass the full block at head to the writer thread
+   void stop();
+
+   int fd;
+   int notifyFd;
+   Durability durability;
+   std::vector<unsigned char *> blocks;
+   std::vector<size_t> blockLength;
+   unsigned int head;      //block currently filled by the caller
+   unsigned int tail;      //next block to be written by the writer thread
+   unsigned int count;     //number of blocks, ready to be written
+   bool finishing;
+   bool finished;
+   bool aborting;
+   bool error;
+   std::thread thread;
+   std::mutex ringMutex;
+   std::condition_variable dataAvailable;
+   std::condition_variable spaceAvailable;
+   std::condition_variable finishedCondition;
+};
+
+
+
+#endif
@@ -0,0 +1,308 @@
+//-----------------------------------------------------------------------------
+/*!
+   \file
+   \brief Write-behind file
+*/
+//-----------------------------------------------------------------------------
+
+/* -- Includes ------------------------------------------------------------ */
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "writebehind.h"
+
+
+/* -- Defines ------------------------------------------------------------- */
+using namespace std;
+
+
+/* -- Types --------------------------------------------------------------- */
+
+/* -- (Module) Global Variables ------------------------------------------- */
+
+/* -- Module Global Function Prototypes ----------------------------------- */
+
+/* -- Implementation ------------------------------------------------------ */
+
+
+
+WriteBehindFile::WriteBehindFile()
+{
+   fd = -1;
+   notifyFd = -1;
+   durability = DURABILITY_NONE;
+   head = 0;
+   tail = 0;
+   count = 0;
+   finishing = false;
+   finished = false;
+   aborting = false;
+   error = false;
+}
+
+
+WriteBehindFile::~WriteBehindFile()
+{
+   abort();
+   for (size_t i = 0; i < blocks.size(); ++i)
+   {
+      free(blocks[i]);
+   }
+}
+
+
+//open file for writing. start the writer thread.
+//the file is truncated to "offset". writing starts at that offset (use 0 to overwrite the whole file)
+bool WriteBehindFile::open(const string& path, Durability durability, size_t offset)
+{
+   abort(); //close a previously opened file (if any)
+
+   //allocate the ring (only once). blocks are page aligned
+   while (blocks.size() < WRITEBEHIND_BLOCK_COUNT)
+   {
+      void * block = NULL;
+      if (posix_memalign(&block, sysconf(_SC_PAGESIZE), WRITEBEHIND_BLOCK_SIZE) != 0)
+      {
+         return false;
+      }
+      blocks.push_back((unsigned char *)block);
+      blockLength.push_back(0);
+   }
+
+   fd = ::open(path.c_str(), O_WRONLY | O_CREAT | ((offset == 0) ? O_TRUNC : 0), 0666);
+   if (fd < 0)
+   {
+      return false;
+   }
+   if ((offset > 0) && ((ftruncate(fd, offset) != 0) || (lseek(fd, offset, SEEK_SET) == (off_t)-1)))
+   {
+      ::close(fd);
+      fd = -1;
+      return false;
+   }
+   this->durability = durability;
+   head = 0;
+   tail = 0;
+   count = 0;
+   blockLength[head] = 0;
+   finishing = false;
+   finished = false;
+   aborting = false;
+   error = false;
+   thread = std::thread(&WriteBehindFile::writer, this);
+   return true;
+}
+
+
+bool WriteBehindFile::isOpen() const
+{
+   return (fd >= 0);
+}
+
+
+//copy data into the ring. hand over full blocks to the writer thread
+void WriteBehindFile::write(const unsigned char * data, size_t len)
+{
+   unique_lock<mutex> lock(ringMutex);
+   while ((len > 0) && !aborting)
+   {
+      //copy as much as fits into the current block
+      size_t n = WRITEBEHIND_BLOCK_SIZE - blockLength[head];
+      if (n > len)
+      {
+         n = len;
+      }
+      lock.unlock(); //the block at "head" is owned by the caller. no need to lock while copying
+      memcpy(&blocks[head][blockLength[head]], data, n);
+      lock.lock();
+      blockLength[head] += n;
+      data += n;
+      len -= n;
+
+      //block full? -> pass to writer thread
+      if (blockLength[head] == WRITEBEHIND_BLOCK_SIZE)
+      {
+         handOver(lock);
+      }
+   }
+}
+
+
+//the block at "head" is owned by the caller, so it may be filled without lock
+unsigned char * WriteBehindFile::getBuffer(size_t * len)
+{
+   lock_guard<mutex> lock(ringMutex);
+   if (aborting)
+   {
+      *len = 0;
+      return NULL;
+   }
+   *len = WRITEBEHIND_BLOCK_SIZE - blockLength[head]; //a full block was handed over already
+   return &blocks[head][blockLength[head]];
+}
+
+
+void WriteBehindFile::commit(size_t len)
+{
+   unique_lock<mutex> lock(ringMutex);
+   if (aborting)
+   {
+      return;
+   }
+   blockLength[head] += len;
+   if (blockLength[head] == WRITEBEHIND_BLOCK_SIZE)
+   {
+      handOver(lock);
+   }
+}
+
+
+void WriteBehindFile::handOver(unique_lock<mutex>& lock)
+{
+   head = (head + 1) % WRITEBEHIND_BLOCK_COUNT;
+   ++count;
+   dataAvailable.notify_one();
+   //wait for the next block to become free
+   while ((count == WRITEBEHIND_BLOCK_COUNT) && !aborting)
+   {
+      spaceAvailable.wait(lock);
+   }
+   blockLength[head] = 0;
+}
+
+
+void WriteBehindFile::finish()
+{
+   lock_guard<mutex> lock(ringMutex);
+   if (blockLength[head] > 0) //hand over the partially filled block. the ring can't be full here (see "write")
+   {
+      head = (head + 1) % WRITEBEHIND_BLOCK_COUNT;
+      ++count;
+   }
+   finishing = true;
+   dataAvailable.notify_one();
+}
+
+
+bool WriteBehindFile::isFinished(bool * ok)
+{
+   lock_guard<mutex> lock(ringMutex);
+   *ok = !error;
+   return finished;
+}
+
+
+bool WriteBehindFile::wait()
+{
+   unique_lock<mutex> lock(ringMutex);
+   while (!finished && thread.joinable())
+   {
+      finishedCondition.wait(lock);
+   }
+   return !error;
+}
+
+
+void WriteBehindFile::close()
+{
+   stop();
+}
+
+
+void WriteBehindFile::abort()
+{
+   {
+      lock_guard<mutex> lock(ringMutex);
+      aborting = true;
+      dataAvailable.notify_one();
+      spaceAvailable.notify_one();
+   }
+   stop();
+}
+
+
+void WriteBehindFile::setNotifyFd(int fd)
+{
+   lock_guard<mutex> lock(ringMutex);
+   notifyFd = fd;
+}
+
+
+void WriteBehindFile::stop()
+{
+   if (thread.joinable())
+   {
+      thread.join();
+   }
+   if (fd >= 0)
+   {
+      ::close(fd);
+      fd = -1;
+   }
+}
+
+
+void WriteBehindFile::writer()
+{
+   size_t unsynced = 0;
+   bool failed = false; //owned by the writer thread. "error" is updated under lock
+   unique_lock<mutex> lock(ringMutex);
+   while (true)
+   {
+      //wait for a block to write
+      while ((count == 0) && !finishing && !aborting)
+      {
+         dataAvailable.wait(lock);
+      }
+      if (aborting || (count == 0)) //aborted, or finished and all data written
+      {
+         break;
+      }
+
+      //write block "tail". the block is owned by the writer until count is decremented
+      const unsigned char * data = blocks[tail];
+      size_t len = blockLength[tail];
+      lock.unlock();
+      unsynced += len;
+      while ((len > 0) && !failed) //on failure, keep on draining the ring, so the caller isn't blocked forever
+      {
+         ssize_t written = ::write(fd, data, len);
+         if (written < 0)
+         {
+            failed = (errno != EINTR);
+            continue;
+         }
+         data += written;
+         len -= written;
+      }
+      if (!failed && (durability == DURABILITY_FSYNC_PERIODIC) && (unsynced >= WRITEBEHIND_SYNC_PERIOD))
+      {
+         failed = (fdatasync(fd) != 0);
+         unsynced = 0;
+      }
+      lock.lock();
+      error = error || failed;
+      tail = (tail + 1) % WRITEBEHIND_BLOCK_COUNT;
+      --count;
+      spaceAvailable.notify_one();
+   }
+
+   //make data durable
+   if (!aborting && !error && (durability != DURABILITY_NONE))
+   {
+      lock.unlock();
+      failed = (fsync(fd) != 0);
+      lock.lock();
+      error = error || failed;
+   }
+   finished = true;
+   finishedCondition.notify_all();
+   if (notifyFd >= 0)
+   {
+      const uint64_t increment = 1;
+      ::write(notifyFd, &increment, sizeof(increment));
+   }
+}
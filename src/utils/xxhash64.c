@@ -0,0 +1,127 @@
+//-----------------------------------------------------------------------------
+/*!
+   \file
+   \brief xxHash64 - fast (non-cryptographic) 64-bit hash
+
+   Implementation of the xxHash64 algorithm (https://github.com/Cyan4973/xxHash).
+*/
+//-----------------------------------------------------------------------------
+
+/* -- Includes ------------------------------------------------------------ */
+#include "xxhash64.h"
+
+
+/* -- Defines ------------------------------------------------------------- */
+#define PRIME64_1    (0x9E3779B185EBCA87ull)
+#define PRIME64_2    (0xC2B2AE3D27D4EB4Full)
+#define PRIME64_3    (0x165667B19E3779F9ull)
+#define PRIME64_4    (0x85EBCA77C2B2AE63ull)
+#define PRIME64_5    (0x27D4EB2F165667C5ull)
+
+#define ROTL64(x, r) (((x) << (r)) | ((x) >> (64 - (r))))
+
+
+/* -- Types --------------------------------------------------------------- */
+
+
+/* -- Module Global Function Prototypes ----------------------------------- */
+static uint64_t read64(const unsigned char * p);
+static uint32_t read32(const unsigned char * p);
+static uint64_t round64(uint64_t acc, uint64_t input);
+static uint64_t merge64(uint64_t acc, uint64_t val);
+
+
+/* -- Module Global Variables --------------------------------------------- */
+
+
+/* -- Implementation ------------------------------------------------------ */
+
+//read little endian
+static uint64_t read64(const unsigned char * p)
+{
+   return (uint64_t)read32(p) | ((uint64_t)read32(p + 4) << 32);
+}
+
+static uint32_t read32(const unsigned char * p)
+{
+   return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+
+static uint64_t round64(uint64_t acc, uint64_t input)
+{
+   acc += input * PRIME64_2;
+   acc = ROTL64(acc, 31);
+   return acc * PRIME64_1;
+}
+
+
+static uint64_t merge64(uint64_t acc, uint64_t val)
+{
+   acc ^= round64(0, val);
+   return (acc * PRIME64_1) + PRIME64_4;
+}
+
+
+
+uint64_t xxhash64(const void * data, size_t len, uint64_t seed)
+{
+   const unsigned char * p = (const unsigned char *)data;
+   const unsigned char * const end = p + len;
+   uint64_t h;
+
+   if (len >= 32)
+   {
+      const unsigned char * const limit = end - 32;
+      uint64_t v1 = seed + PRIME64_1 + PRIME64_2;
+      uint64_t v2 = seed + PRIME64_2;
+      uint64_t v3 = seed;
+      uint64_t v4 = seed - PRIME64_1;
+      do
+      {
+         v1 = round64(v1, read64(p));
+         v2 = round64(v2, read64(p + 8));
+         v3 = round64(v3, read64(p + 16));
+         v4 = round64(v4, read64(p + 24));
+         p += 32;
+      } while (p <= limit);
+      h = ROTL64(v1, 1) + ROTL64(v2, 7) + ROTL64(v3, 12) + ROTL64(v4, 18);
+      h = merge64(h, v1);
+      h = merge64(h, v2);
+      h = merge64(h, v3);
+      h = merge64(h, v4);
+   }
+   else
+   {
+      h = seed + PRIME64_5;
+   }
+   h += (uint64_t)len;
+
+   //process remaining bytes
+   while ((p + 8) <= end)
+   {
+      h ^= round64(0, read64(p));
+      h = (ROTL64(h, 27) * PRIME64_1) + PRIME64_4;
+      p += 8;
+   }
+   if ((p + 4) <= end)
+   {
+      h ^= (uint64_t)read32(p) * PRIME64_1;
+      h = (ROTL64(h, 23) * PRIME64_2) + PRIME64_3;
+      p += 4;
+   }
+   while (p < end)
+   {
+      h ^= (uint64_t)(*p) * PRIME64_5;
+      h = ROTL64(h, 11) * PRIME64_1;
+      ++p;
+   }
+
+   //avalanche
+   h ^= h >> 33;
+   h *= PRIME64_2;
+   h ^= h >> 29;
+   h *= PRIME64_3;
+   h ^= h >> 32;
+   return h;
+}
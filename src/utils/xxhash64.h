@@ -0,0 +1,36 @@
+//-----------------------------------------------------------------------------
+/*!
+   \file
+   \brief xxHash64 - fast (non-cryptographic) 64-bit hash
+*/
+//-----------------------------------------------------------------------------
+#ifndef XXHASH64_H_
+#define XXHASH64_H_
+
+/* -- Includes ------------------------------------------------------------ */
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* -- Defines ------------------------------------------------------------- */
+
+/* -- Types --------------------------------------------------------------- */
+
+/* -- Global Variables ---------------------------------------------------- */
+
+/* -- Function Prototypes ------------------------------------------------- */
+uint64_t xxhash64(const void * data, size_t len, uint64_t seed);
+
+
+/* -- Implementation ------------------------------------------------------ */
+
+
+
+#ifdef __cplusplus
+} /* end of extern "C" */
+#endif
+
+#endif
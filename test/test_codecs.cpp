@@ -0,0 +1,622 @@
+//-----------------------------------------------------------------------------
+/*!
+   \file
+   \brief Round trip tests of the codecs
+
+   Encodes data with the compression, delta, bundle and listing codecs and decodes it again. The decoders are fed in
+   pieces of different sizes (down to single bytes). Covers the edge cases: empty input, incompressible data, blocks
+   of exactly the boundary size, names of the maximal length, corrupt input. The frame ring is tested with frames,
+   that wrap around its end, and with a producer and a consumer thread.
+
+   Usage: ./fx_test
+   Returns 0, if all checks passed.
+*/
+//-----------------------------------------------------------------------------
+
+/* -- Includes ------------------------------------------------------------ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <thread>
+#include <vector>
+#include "file_xfer.h"
+#include "file_xfer_compress.h"
+#include "file_xfer_delta.h"
+#include "file_xfer_bundle.h"
+#include "file_xfer_list.h"
+#include "spscring.h"
+
+
+/* -- Defines ------------------------------------------------------------- */
+using namespace std;
+
+#define CHECK(cond)     check((cond), #cond, __FILE__, __LINE__)
+
+
+/* -- Types --------------------------------------------------------------- */
+
+//basis and output of a delta
+class DeltaCollector : public FileXferDeltaTarget
+{
+public:
+   DeltaCollector(const vector<unsigned char>& basis) : basis(basis) { }
+   size_t readBasis(size_t offset, unsigned char * buffer, size_t len)
+   {
+      if (offset >= basis.size())
+      {
+         return 0;
+      }
+      if (len > (basis.size() - offset))
+      {
+         len = basis.size() - offset;
+      }
+      memcpy(buffer, &basis[offset], len);
+      return len;
+   }
+   void writeTarget(const unsigned char * data, size_t len)
+   {
+      output.insert(output.end(), data, data + len);
+   }
+
+   const vector<unsigned char>& basis;
+   vector<unsigned char> output;
+};
+
+
+//collects the content of a bundle
+class BundleCollector : public FileXferBundleTarget
+{
+public:
+   bool beginFile(const string& name, unsigned long long size, unsigned long long mtime)
+   {
+      FileXferStat entry = { 'f', name, size, mtime };
+      entries.push_back(entry);
+      data.push_back(vector<unsigned char>());
+      return true;
+   }
+   void writeFile(const unsigned char * data, size_t len)
+   {
+      this->data.back().insert(this->data.back().end(), data, data + len);
+   }
+   void endFile()
+   {
+      ++ended;
+   }
+   void createDirectory(const string& name)
+   {
+      FileXferStat entry = { 'd', name, 0, 0 };
+      entries.push_back(entry);
+      data.push_back(vector<unsigned char>());
+   }
+   bool canBeginFile()
+   {
+      return (entries.size() < limit);
+   }
+
+   vector<FileXferStat> entries;
+   vector<vector<unsigned char> > data;
+   unsigned int ended = 0;
+   size_t limit = (size_t)-1; //the reader is paused before the entry beyond this number
+};
+
+
+/* -- (Module) Global Variables ------------------------------------------- */
+static unsigned int failures = 0;
+static const size_t pieceSizes[] = { 1, 7, 1000, (size_t)-1 }; //sizes of the pieces fed to the decoders
+
+
+/* -- Module Global Function Prototypes ----------------------------------- */
+
+/* -- Implementation ------------------------------------------------------ */
+
+static void check(bool ok, const char * cond, const char * file, int line)
+{
+   if (!ok)
+   {
+      printf("%s:%d: check failed: %s\n", file, line, cond);
+      ++failures;
+   }
+}
+
+
+static vector<unsigned char> makeText(size_t len)
+{
+   vector<unsigned char> data;
+   for (unsigned int line = 0; data.size() < len; ++line)
+   {
+      char buffer[64];
+      const int n = snprintf(buffer, sizeof(buffer), "line %u of a compressible text file\n", line);
+      data.insert(data.end(), buffer, buffer + n);
+   }
+   data.resize(len);
+   return data;
+}
+
+
+static vector<unsigned char> makeRandom(size_t len)
+{
+   vector<unsigned char> data(len);
+   unsigned long long x = 88172645463325252ULL; //xorshift
+   for (size_t idx = 0; idx < len; ++idx)
+   {
+      x ^= x << 13;
+      x ^= x >> 7;
+      x ^= x << 17;
+      data[idx] = (unsigned char)(x >> 24);
+   }
+   return data;
+}
+
+
+//encode "data" (in one call), decode it in pieces of "piece" bytes. returns the decoded data
+static vector<unsigned char> roundTripCompress(const vector<unsigned char>& data, size_t piece, FileXferCompressStat * stat)
+{
+   FileXferEncoder encoder;
+   FileXferDecoder decoder;
+   encoder.reset();
+   decoder.reset();
+   encoder.encode(data.data(), data.size());
+   for (size_t offset = 0; offset < encoder.output.size(); offset += piece)
+   {
+      const size_t n = (piece < (encoder.output.size() - offset)) ? piece : (encoder.output.size() - offset);
+      CHECK(decoder.feed(&encoder.output[offset], n));
+   }
+   *stat = encoder.stat;
+   return decoder.output;
+}
+
+
+static void testCompress()
+{
+   const size_t sizes[] = { 0, 1, FILE_XFER_COMPRESS_BLOCK_SIZE - 1, FILE_XFER_COMPRESS_BLOCK_SIZE,
+                            FILE_XFER_COMPRESS_BLOCK_SIZE + 1, 5 * FILE_XFER_COMPRESS_BLOCK_SIZE };
+   for (unsigned int s = 0; s < (sizeof(sizes) / sizeof(sizes[0])); ++s)
+   {
+      for (unsigned int p = 0; p < (sizeof(pieceSizes) / sizeof(pieceSizes[0])); ++p)
+      {
+         FileXferCompressStat stat;
+         const vector<unsigned char> text = makeText(sizes[s]);
+         CHECK(roundTripCompress(text, pieceSizes[p], &stat) == text);
+         CHECK(stat.originalBytes == sizes[s]);
+         CHECK((stat.compressedBlocks + stat.storedBlocks) == ((sizes[s] + FILE_XFER_COMPRESS_BLOCK_SIZE - 1) / FILE_XFER_COMPRESS_BLOCK_SIZE));
+         if (sizes[s] >= FILE_XFER_COMPRESS_BLOCK_SIZE)
+         {
+            CHECK(stat.encodedBytes < stat.originalBytes); //text is compressed
+         }
+
+         const vector<unsigned char> random = makeRandom(sizes[s]);
+         CHECK(roundTripCompress(random, pieceSizes[p], &stat) == random);
+         CHECK(stat.compressedBlocks == 0); //incompressible data is stored
+      }
+   }
+
+   //a block of exactly the block size is encoded as one block
+   FileXferEncoder encoder;
+   const vector<unsigned char> block = makeRandom(FILE_XFER_COMPRESS_BLOCK_SIZE);
+   encoder.reset();
+   encoder.encode(block.data(), block.size());
+   CHECK(encoder.output.size() == (3 + block.size()));
+   CHECK(encoder.output[0] == FILE_XFER_COMPRESS_STORED);
+
+   //invalid data is rejected
+   FileXferDecoder decoder;
+   const unsigned char invalid[] = { 'X', 1, 0, 0 };
+   decoder.reset();
+   CHECK(!decoder.feed(invalid, sizeof(invalid)));
+}
+
+
+//build the signatures of "basis" and the delta of "file" against them (in pieces of "piece" bytes)
+static vector<unsigned char> makeDelta(const vector<unsigned char>& basis, const vector<unsigned char>& file,
+                                       unsigned int blockSize, size_t piece)
+{
+   FileXferSignatureBuilder signatures;
+   FileXferDeltaGenerator generator;
+   signatures.reset(blockSize);
+   for (size_t offset = 0; offset < basis.size(); offset += piece)
+   {
+      signatures.feed(&basis[offset], (piece < (basis.size() - offset)) ? piece : (basis.size() - offset));
+   }
+   generator.reset(blockSize, basis.size() / blockSize);
+   size_t offset = 0;
+   while ((offset < signatures.output.size()) && !generator.hasAllSignatures())
+   {
+      const size_t n = (piece < (signatures.output.size() - offset)) ? piece : (signatures.output.size() - offset);
+      offset += generator.addSignatures(&signatures.output[offset], n);
+   }
+   CHECK(generator.hasAllSignatures());
+   for (offset = 0; offset < file.size(); offset += piece)
+   {
+      generator.feed(&file[offset], (piece < (file.size() - offset)) ? piece : (file.size() - offset));
+   }
+   generator.finish();
+   return generator.output;
+}
+
+
+static int feedDelta(FileXferDeltaApplier& applier, const vector<unsigned char>& delta, size_t piece)
+{
+   int result = 0;
+   for (size_t offset = 0; (offset < delta.size()) && (result == 0); offset += piece)
+   {
+      const size_t n = (piece < (delta.size() - offset)) ? piece : (delta.size() - offset);
+      result = applier.feed(&delta[offset], n);
+   }
+   return result;
+}
+
+
+static void putVarint(vector<unsigned char>& out, unsigned long long value)
+{
+   unsigned char buffer[FILE_XFER_VARINT_MAX_LEN];
+   out.insert(out.end(), buffer, buffer + fileXferEncodeVarint(buffer, value));
+}
+
+
+static void testDelta()
+{
+   const vector<unsigned char> basis = makeText(300000);
+   const unsigned int blockSize = FileXferDelta::getBlockSize(basis.size());
+
+   //new version: a block changed, bytes inserted (so the following blocks are found at unaligned offsets),
+   //the tail of the basis removed and random data appended
+   vector<unsigned char> file = basis;
+   file[3 * blockSize + 5] ^= 0xFF;
+   const vector<unsigned char> inserted = makeRandom(77);
+   file.insert(file.begin() + 10 * blockSize + 3, inserted.begin(), inserted.end());
+   file.resize(file.size() - 5000);
+   const vector<unsigned char> appended = makeRandom(2 * FILE_XFER_DELTA_LITERAL_MAX + 1);
+   file.insert(file.end(), appended.begin(), appended.end());
+
+   const vector<unsigned char> empty;
+   const vector<unsigned char> * files[] = { &file, &basis, &empty };
+   for (unsigned int f = 0; f < (sizeof(files) / sizeof(files[0])); ++f)
+   {
+      for (unsigned int p = 0; p < (sizeof(pieceSizes) / sizeof(pieceSizes[0])); ++p)
+      {
+         const vector<unsigned char> delta = makeDelta(basis, *files[f], blockSize, pieceSizes[p]);
+         FileXferDeltaApplier applier;
+         DeltaCollector target(basis);
+         applier.reset(blockSize, &target);
+         CHECK(feedDelta(applier, delta, pieceSizes[p]) == 1);
+         CHECK(target.output == *files[f]);
+         if (files[f] != &empty)
+         {
+            CHECK(delta.size() < (files[f]->size() / 4)); //most of the file is sent as block references
+         }
+      }
+   }
+
+   //no basis at all: the file is sent as literal data
+   for (unsigned int p = 0; p < (sizeof(pieceSizes) / sizeof(pieceSizes[0])); ++p)
+   {
+      const vector<unsigned char> delta = makeDelta(empty, file, blockSize, pieceSizes[p]);
+      FileXferDeltaApplier applier;
+      DeltaCollector target(empty);
+      applier.reset(blockSize, &target);
+      CHECK(feedDelta(applier, delta, pieceSizes[p]) == 1);
+      CHECK(target.output == file);
+   }
+
+   //corrupt deltas are rejected: blocks beyond the basis, a block index that overflows the offset,
+   //an unknown operation, a wrong CRC and a header that never ends
+   vector<unsigned char> corrupt[5];
+   corrupt[0].push_back(FILE_XFER_DELTA_OP_BLOCK);
+   putVarint(corrupt[0], basis.size() / blockSize - 1);
+   putVarint(corrupt[0], 2);
+   corrupt[1].push_back(FILE_XFER_DELTA_OP_BLOCK);
+   putVarint(corrupt[1], ~0ULL / blockSize + 1); //multiplied by the block size, it wraps around to a small offset
+   putVarint(corrupt[1], 1);
+   corrupt[2].push_back('X');
+   corrupt[3] = makeDelta(basis, file, blockSize, (size_t)-1);
+   corrupt[3][corrupt[3].size() - 1] ^= 0x01;
+   corrupt[4].push_back(FILE_XFER_DELTA_OP_BLOCK);
+   corrupt[4].insert(corrupt[4].end(), 2 * FILE_XFER_VARINT_MAX_LEN + 1, 0x80);
+   for (unsigned int idx = 0; idx < (sizeof(corrupt) / sizeof(corrupt[0])); ++idx)
+   {
+      FileXferDeltaApplier applier;
+      DeltaCollector target(basis);
+      applier.reset(blockSize, &target);
+      CHECK(feedDelta(applier, corrupt[idx], 1) == -1);
+      CHECK((idx != 1) || target.output.empty()); //the block at the wrapped offset isn't copied
+   }
+}
+
+
+static int feedBundle(FileXferBundleReader& reader, const vector<unsigned char>& bundle, size_t piece)
+{
+   int result = 0;
+   for (size_t offset = 0; (offset < bundle.size()) && (result == 0); offset += piece)
+   {
+      const size_t n = (piece < (bundle.size() - offset)) ? piece : (bundle.size() - offset);
+      result = reader.feed(&bundle[offset], n);
+   }
+   return result;
+}
+
+
+static void testBundle()
+{
+   const string longName(FILE_XFER_BUNDLE_NAME_MAX, 'n');
+   const vector<unsigned char> content[] = { vector<unsigned char>(), makeRandom(1), makeText(100000) };
+   const string names[] = { "empty", longName, "text.txt" };
+
+   for (unsigned int p = 0; p < (sizeof(pieceSizes) / sizeof(pieceSizes[0])); ++p)
+   {
+      //empty bundle
+      FileXferBundleWriter writer;
+      FileXferBundleReader reader;
+      BundleCollector empty;
+      writer.reset();
+      writer.finish();
+      reader.reset(&empty);
+      CHECK(feedBundle(reader, writer.output, pieceSizes[p]) == 1);
+      CHECK(empty.entries.empty());
+
+      //files, including an empty one and one of the max. name length
+      BundleCollector files;
+      writer.reset();
+      for (unsigned int idx = 0; idx < 3; ++idx)
+      {
+         writer.addFile(names[idx], content[idx].size(), 1000000000ULL + idx);
+         writer.output.insert(writer.output.end(), content[idx].begin(), content[idx].end());
+      }
+      writer.finish();
+      reader.reset(&files);
+      CHECK(feedBundle(reader, writer.output, pieceSizes[p]) == 1);
+      CHECK(files.entries.size() == 3);
+      CHECK(files.ended == 3);
+      for (unsigned int idx = 0; (idx < 3) && (idx < files.entries.size()); ++idx)
+      {
+         CHECK(files.entries[idx].name == names[idx]);
+         CHECK(files.entries[idx].size == content[idx].size());
+         CHECK(files.entries[idx].mtime == (1000000000ULL + idx));
+         CHECK(files.data[idx] == content[idx]);
+      }
+
+      //paused before each file, until it is resumed. the data fed meanwhile is held
+      BundleCollector paused;
+      paused.limit = 0;
+      reader.reset(&paused);
+      CHECK(feedBundle(reader, writer.output, pieceSizes[p]) == 0);
+      CHECK(reader.isPaused() && paused.entries.empty());
+      int result = 0;
+      while (reader.isPaused() && (result == 0))
+      {
+         const size_t count = paused.entries.size();
+         paused.limit = count + 1;
+         result = reader.resume();
+         CHECK(paused.entries.size() == (count + 1));
+      }
+      CHECK(result == 1);
+      CHECK(paused.data.size() == 3);
+      for (unsigned int idx = 0; (idx < 3) && (idx < paused.data.size()); ++idx)
+      {
+         CHECK(paused.data[idx] == content[idx]);
+      }
+
+      //tree
+      BundleCollector tree;
+      writer.reset();
+      writer.addDirectory("dir");
+      writer.addFile("dir/file", content[2].size(), 0);
+      writer.output.insert(writer.output.end(), content[2].begin(), content[2].end());
+      writer.finish();
+      reader.reset(&tree, true);
+      CHECK(feedBundle(reader, writer.output, pieceSizes[p]) == 1);
+      CHECK((tree.entries.size() == 2) && (tree.entries[0].type == 'd') && (tree.entries[1].name == "dir/file"));
+      CHECK((tree.data.size() == 2) && (tree.data[1] == content[2]));
+   }
+
+   //names, that are too long or escape the tree, are rejected
+   FileXferBundleWriter writer;
+   FileXferBundleReader reader;
+   BundleCollector rejected;
+   writer.reset();
+   writer.addFile(longName + "n", 0, 0);
+   writer.finish();
+   reader.reset(&rejected);
+   CHECK(feedBundle(reader, writer.output, 1) == -1);
+   writer.reset();
+   writer.addFile("../file", 0, 0);
+   writer.finish();
+   reader.reset(&rejected, true);
+   CHECK(feedBundle(reader, writer.output, 1) == -1);
+   writer.reset();
+   writer.addDirectory("dir");
+   writer.finish();
+   reader.reset(&rejected, false); //no directories in a flat bundle
+   CHECK(feedBundle(reader, writer.output, 1) == -1);
+   CHECK(rejected.entries.empty());
+}
+
+
+static bool sameEntries(const vector<FileXferStat>& a, const vector<FileXferStat>& b)
+{
+   if (a.size() != b.size())
+   {
+      return false;
+   }
+   for (size_t idx = 0; idx < a.size(); ++idx)
+   {
+      if ((a[idx].type != b[idx].type) || (a[idx].name != b[idx].name) || (a[idx].size != b[idx].size) ||
+          (a[idx].mtime != b[idx].mtime))
+      {
+         return false;
+      }
+   }
+   return true;
+}
+
+
+static int feedListing(FileXferListReader& reader, const vector<unsigned char>& listing, size_t piece, bool binary)
+{
+   int result = 0;
+   for (size_t offset = 0; (offset < listing.size()) && (result == 0); offset += piece)
+   {
+      const size_t n = (piece < (listing.size() - offset)) ? piece : (listing.size() - offset);
+      result = binary ? reader.feed(&listing[offset], n) : reader.feedText(&listing[offset], n);
+   }
+   return result;
+}
+
+
+static void testListing()
+{
+   vector<FileXferStat> entries;
+   const FileXferStat dir = { 'd', "dir", 0, 0 };
+   const FileXferStat file = { 'f', "dir.txt", 123456789ULL, 1500000000ULL };
+   const FileXferStat emptyFile = { 'f', "empty", 0, 1500000001ULL };
+   entries.push_back(dir);
+   entries.push_back(file);
+   entries.push_back(emptyFile);
+
+   for (unsigned int binary = 0; binary < 2; ++binary)
+   {
+      //text names are limited by the entry size, binary ones by FILE_XFER_LIST_NAME_MAX
+      const FileXferStat longFile = { 'f', string(binary ? FILE_XFER_LIST_NAME_MAX : 255, 'x'), 1, 1500000002ULL };
+      vector<FileXferStat> all = entries;
+      all.push_back(longFile);
+
+      for (unsigned int p = 0; p < (sizeof(pieceSizes) / sizeof(pieceSizes[0])); ++p)
+      {
+         FileXferListing listing;
+         FileXferListReader reader;
+
+         //empty listing
+         vector<unsigned char> output;
+         FileXferListing::addCurrent(output, "/", binary);
+         output.push_back(FILE_XFER_LIST_END);
+         reader.reset();
+         CHECK(feedListing(reader, output, pieceSizes[p], binary) == 1);
+         CHECK((reader.current == "/") && reader.entries.empty());
+
+         //entries (front coded in binary format)
+         output.clear();
+         FileXferListing::addCurrent(output, "some/dir/", binary);
+         listing.format(output, all, binary);
+         output.push_back(FILE_XFER_LIST_END);
+         reader.reset();
+         CHECK(feedListing(reader, output, pieceSizes[p], binary) == 1);
+         CHECK(reader.current == "some/dir/");
+         CHECK(sameEntries(reader.entries, all));
+      }
+   }
+
+   //removed entries of a listing of changes
+   FileXferListWriter writer;
+   FileXferListReader reader;
+   vector<unsigned char> output;
+   writer.reset();
+   FileXferListWriter::addCurrent(output, "/");
+   writer.addFile(output, "a", 1, 1, 1);
+   writer.addRemoved(output, "ab", 2);
+   output.push_back(FILE_XFER_LIST_END);
+   reader.reset();
+   CHECK(feedListing(reader, output, 1, true) == 1);
+   CHECK((reader.entries.size() == 2) && (reader.entries[1].type == 'r') && (reader.entries[1].name == "ab"));
+}
+
+
+static void testRing()
+{
+   SpscFrameRing<256> ring;
+   unsigned char * frame;
+   unsigned char data[256];
+   for (unsigned int idx = 0; idx < sizeof(data); ++idx)
+   {
+      data[idx] = (unsigned char)idx;
+   }
+
+   CHECK(ring.isEmpty());
+   CHECK(ring.top(&frame) == 0);
+   CHECK(!ring.push(data, 256)); //never fits (length field and termination)
+   CHECK(!ring.push(data, 0)); //empty frame is rejected
+   CHECK(ring.isEmpty());
+
+   //frames of growing size wrap around the end of the ring
+   for (unsigned int len = 1; len < 120; len += 13)
+   {
+      CHECK(ring.push(data, len));
+      CHECK(ring.push(data, 3));
+      CHECK(ring.top(&frame) == len);
+      CHECK((memcmp(frame, data, len) == 0) && (frame[len] == 0));
+      ring.pop();
+      CHECK(ring.top(&frame) == 3);
+      CHECK(memcmp(frame, data, 3) == 0);
+      ring.pop();
+      CHECK(ring.isEmpty());
+   }
+
+   //full ring (frames of 16 bytes, including length field and termination)
+   SpscFrameRing<256> full;
+   unsigned int pushed = 0;
+   while (full.push(data, 11))
+   {
+      ++pushed;
+   }
+   CHECK(pushed == (256 / 16));
+   CHECK(full.top(&frame) == 11);
+   full.pop();
+   CHECK(full.push(data, 11)); //space of one frame
+   CHECK(!full.push(data, 11));
+
+   //producer and consumer thread. each frame holds its sequence number
+   SpscFrameRing<4096> * shared = new SpscFrameRing<4096>;
+   const unsigned int count = 200000;
+   std::thread producer([shared, count]()
+   {
+      unsigned char buffer[64] = { 0 };
+      for (unsigned int seq = 0; seq < count; )
+      {
+         memcpy(buffer, &seq, sizeof(seq));
+         if (shared->push(buffer, sizeof(seq) + (seq % 60)))
+         {
+            ++seq;
+         }
+         else
+         {
+            std::this_thread::yield(); //full
+         }
+      }
+   });
+   unsigned int expected = 0;
+   bool inOrder = true;
+   while (expected < count)
+   {
+      const unsigned int len = shared->top(&frame);
+      if (len == 0)
+      {
+         std::this_thread::yield(); //empty
+         continue;
+      }
+      unsigned int seq;
+      memcpy(&seq, frame, sizeof(seq));
+      inOrder = inOrder && (seq == expected) && (len == (sizeof(seq) + (seq % 60)));
+      shared->pop();
+      ++expected;
+   }
+   producer.join();
+   CHECK(inOrder);
+   CHECK(shared->isEmpty());
+   delete shared;
+}
+
+
+
+int main()
+{
+   testCompress();
+   testDelta();
+   testBundle();
+   testListing();
+   testRing();
+   if (failures > 0)
+   {
+      printf("%u checks failed!\n", failures);
+      return 1;
+   }
+   printf("All checks passed.\n");
+   return 0;
+}